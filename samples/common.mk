@@ -15,7 +15,10 @@ CFLAGS = -O2
 ifeq ($(CC), gcc)
 	CFLAGS += -std=gnu99 -pthread
 endif
-LIBS += -lgpuvm -lOpenCL
+LIBS += -lgpuvm
+ifneq ($(NO_OPENCL), y)
+	LIBS += -lOpenCL
+endif
 ifeq ($(OSNAME), Darwin)
   INCLUDE_DIRS += -I/system/library/frameworks/opencl.framework/headers
 endif
@@ -0,0 +1,94 @@
+/** copy microbenchmark; measures the bandwidth of host-to-device and
+		device-to-host copies of a large array on a simulated device with
+		unlimited bandwidth, so that the speed of the host copy engine is
+		measured. Run with "serial" as the first argument to compare with plain
+		memcpy() in a single thread, and with the array size in MB as the
+		second */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../../src/gpuvm.h"
+
+// macros to check for errors
+#define CHECK(x) \
+	{\
+	int res = x;\
+	if(res != 0) {\
+	printf(#x "\n");\
+	printf("%d\n", res);\
+	exit(-1);\
+	}\
+	}
+
+#define CHECK_NULL(x) \
+	if(x == NULL) {\
+	printf(#x "\n");\
+	exit(-1);\
+	}
+
+#define DEFAULT_SIZE_MB 256
+#define NRUNS 8
+
+/** gets the current time, in seconds */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+	int serial = argc > 1 && !strcmp(argv[1], "serial");
+	size_t nbytes = (size_t)(argc > 2 ? atoi(argv[2]) : DEFAULT_SIZE_MB) << 20;
+
+	// a single simulated device with no latency and unlimited bandwidth
+	gpuvm_sim_params_t params = {0, 0, 0, 0, 0, 0, 0, 0};
+	void *devs[1] = {&params};
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_BEFORE_INIT));
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_AFTER_INIT));
+	CHECK(gpuvm_init(1, devs, GPUVM_SIM | GPUVM_STAT |
+									 (serial ? GPUVM_SERIAL_COPY : 0)));
+
+	// allocate and link the array; the device buffer is host memory
+	char *ha = (char*)malloc(nbytes), *da = (char*)malloc(nbytes);
+	CHECK_NULL(ha);
+	CHECK_NULL(da);
+	memset(ha, 1, nbytes);
+	memset(da, 0, nbytes);
+	CHECK(gpuvm_link(ha, nbytes, 0, da, GPUVM_SIM | GPUVM_ON_HOST));
+
+	printf("copying %zu MB, %s\n", nbytes >> 20, serial ? "serial" : "parallel");
+	double h2d_time = 0, d2h_time = 0;
+	unsigned irun;
+	for(irun = 0; irun < NRUNS; irun++) {
+		// copy to device
+		double start = now();
+		CHECK(gpuvm_kernel_begin(ha, 0, GPUVM_READ_WRITE));
+		h2d_time += now() - start;
+		da[irun] = 2;
+		CHECK(gpuvm_kernel_end(ha, 0));
+
+		// copy back to host on the first access
+		start = now();
+		ha[0]++;
+		d2h_time += now() - start;
+		if(ha[irun] != 2 && irun) {
+			printf("check: FAILED\n");
+			exit(-1);
+		}
+	}  // for(irun)
+
+	// print bandwidth
+	double host_copy_time = 0;
+	CHECK(gpuvm_stat(GPUVM_STAT_HOST_COPY_TIME, &host_copy_time));
+	printf("host-to-device: %.2lf GB/s\n", NRUNS * nbytes / h2d_time * 1e-9);
+	printf("device-to-host: %.2lf GB/s\n", NRUNS * nbytes / d2h_time * 1e-9);
+	printf("host copy time: %lf s\n", host_copy_time);
+
+	CHECK(gpuvm_unlink(ha, 0));
+	free(da);
+	free(ha);
+	return 0;
+}  // end of main()
@@ -0,0 +1,73 @@
+/** minimal reference backend, loaded by GPUVM at run time with GPUVM_PLUGIN;
+		its devices keep buffers in host memory, and can copy between each other
+		directly. It implements the required entries, allocation (GPUVM_CAP_ALLOC)
+		and peer copies (GPUVM_CAP_PEER), and counts the bytes copied between
+		devices in sample_peer_nbytes, so that the caller can check that peer
+		copies have been used */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../../src/gpuvm-backend.h"
+
+/** number of devices */
+static unsigned ndevs = 0;
+
+/** bytes copied between devices so far */
+volatile size_t sample_peer_nbytes = 0;
+
+static int sample_init(unsigned n, void **params) {
+	ndevs = n;
+	return 0;
+}
+
+static int sample_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	memcpy((char*)tgt + devoff, src, nbytes);
+	return 0;
+}
+
+static int sample_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	memcpy(tgt, (char*)src + devoff, nbytes);
+	return 0;
+}
+
+static int sample_mem_alloc(unsigned idev, size_t nbytes, void **pbuf) {
+	*pbuf = malloc(nbytes);
+	return *pbuf ? 0 : GPUVM_EDEVALLOC;
+}
+
+static int sample_mem_free(unsigned idev, void *buf) {
+	free(buf);
+	return 0;
+}
+
+static int sample_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes) {
+	if(tgt_idev >= ndevs || src_idev >= ndevs)
+		return GPUVM_EARG;
+	memcpy((char*)tgt + tgtoff, (char*)src + srcoff, nbytes);
+	__sync_fetch_and_add(&sample_peer_nbytes, nbytes);
+	return 0;
+}
+
+/** the backend; entries not advertised with capability bits are left 0 */
+static const gpuvm_backend_t sample_backend = {
+	.abi_version = GPUVM_BACKEND_ABI_VERSION,
+	.caps = GPUVM_CAP_ALLOC | GPUVM_CAP_PEER,
+	.init = sample_init,
+	.memcpy_h2d = sample_memcpy_h2d,
+	.memcpy_d2h = sample_memcpy_d2h,
+	.mem_alloc = sample_mem_alloc,
+	.mem_free = sample_mem_free,
+	.memcpy_peer = sample_memcpy_peer
+};
+
+/** the entry point looked up by GPUVM, see GPUVM_BACKEND_ENTRY */
+const gpuvm_backend_t *gpuvm_backend_entry(unsigned abi_version) {
+	if(abi_version != GPUVM_BACKEND_ABI_VERSION)
+		return 0;
+	return &sample_backend;
+}
@@ -0,0 +1,92 @@
+/** run-time backend sample; loads the reference backend from
+		backend/backend.c with GPUVM_PLUGIN, modifies an array on its device 0
+		and reads it on device 1, which gets the data from device 0 with a peer
+		copy rather than through host. Usage:
+		plugin-backend [path to the backend library] */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../../src/gpuvm.h"
+#include "../../../src/gpuvm-backend.h"
+
+// macros to check for errors
+#define CHECK(x) \
+	{\
+	int res = x;\
+	if(res != 0) {\
+	printf(#x "\n");\
+	printf("%d\n", res);\
+	exit(-1);\
+	}\
+	}
+
+#define CHECK_NULL(x) \
+	if(x == NULL) {\
+	printf(#x "\n");\
+	exit(-1);\
+	}
+
+#define N (1024 * 1024)
+#define SZ (N * sizeof(int))
+
+/** the default path to the backend library, relative to the sample
+		directory */
+#define BACKEND_PATH "../bin/libgpuvm-sample-backend.so"
+
+int main(int argc, char** argv) {
+	const char *path = argc > 1 ? argv[1] : BACKEND_PATH;
+
+	// both devices come from the same library; the backend takes no parameters
+	gpuvm_plugin_params_t params = {path, 0};
+	void *devs[2] = {&params, &params};
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_BEFORE_INIT));
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_AFTER_INIT));
+	CHECK(gpuvm_init(2, devs, GPUVM_PLUGIN | GPUVM_STAT));
+
+	// the library is already loaded, so this only gets its handle, to read the
+	// counter of peer copies
+	void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	CHECK_NULL(lib);
+	volatile size_t *peer_nbytes = 
+		(volatile size_t*)dlsym(lib, "sample_peer_nbytes");
+	CHECK_NULL(peer_nbytes);
+
+	int *ha = (int*)malloc(SZ);
+	CHECK_NULL(ha);
+	for(int i = 0; i < N; i++)
+		ha[i] = i;
+	// the backend allocates device buffers
+	CHECK(gpuvm_link_alloc(ha, SZ, 0, GPUVM_PLUGIN | GPUVM_ON_HOST));
+	CHECK(gpuvm_link_alloc(ha, SZ, 1, GPUVM_PLUGIN | GPUVM_ON_HOST));
+
+	// "kernel" on device 0 doubles the array
+	CHECK(gpuvm_kernel_begin(ha, 0, GPUVM_READ_WRITE));
+	int *d0 = (int*)gpuvm_xlate(ha, 0);
+	for(int i = 0; i < N; i++)
+		d0[i] *= 2;
+	CHECK(gpuvm_kernel_end(ha, 0));
+
+	// "kernel" on device 1 reads it; the data are now only on device 0
+	unsigned long long pagefaults = 0;
+	CHECK(gpuvm_kernel_begin(ha, 1, GPUVM_READ_ONLY));
+	CHECK(gpuvm_stat(GPUVM_STAT_PAGEFAULTS, &pagefaults));
+	int *d1 = (int*)gpuvm_xlate(ha, 1);
+	for(int i = 0; i < N; i++) {
+		if(d1[i] != 2 * i) {
+			printf("check: FAILED\n");
+			printf("d1[%d] != %d: %d\n", i, 2 * i, d1[i]);
+			exit(-1);
+		}
+	}
+	CHECK(gpuvm_kernel_end(ha, 1));
+	printf("check: PASSED\n");
+	printf("bytes copied between devices: %zu\n", *peer_nbytes);
+	printf("number of pagefaults: %lld\n", pagefaults);
+
+	CHECK(gpuvm_unlink(ha, 0));
+	CHECK(gpuvm_unlink(ha, 1));
+	free(ha);
+	return 0;
+}  // end of main()
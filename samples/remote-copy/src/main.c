@@ -0,0 +1,93 @@
+/** remote device sample; round-trips an array through a remote device served
+		by samples/remote-server, and prints the bandwidth of the transfers.
+		Start the server first, e.g. "remote-server unix:/tmp/gpuvm.sock", and
+		pass its address as the first argument, and the array size in MB as the
+		second */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../../../src/gpuvm.h"
+
+// macros to check for errors
+#define CHECK(x) \
+	{\
+	int res = x;\
+	if(res != 0) {\
+	printf(#x "\n");\
+	printf("%d\n", res);\
+	exit(-1);\
+	}\
+	}
+
+#define CHECK_NULL(x) \
+	if(x == NULL) {\
+	printf(#x "\n");\
+	exit(-1);\
+	}
+
+#define DEFAULT_ADDRESS "unix:/tmp/gpuvm.sock"
+#define DEFAULT_SIZE_MB 64
+#define NRUNS 4
+
+/** gets the current time, in seconds */
+double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char** argv) {
+	const char *address = argc > 1 ? argv[1] : DEFAULT_ADDRESS;
+	size_t nbytes = (size_t)(argc > 2 ? atoi(argv[2]) : DEFAULT_SIZE_MB) << 20;
+	size_t n = nbytes / sizeof(int);
+
+	// a single device, number 0 on the server
+	gpuvm_remote_params_t params = {address, 0};
+	void *devs[1] = {&params};
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_BEFORE_INIT));
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_AFTER_INIT));
+	CHECK(gpuvm_init(1, devs, GPUVM_REMOTE | GPUVM_STAT));
+
+	// the device buffer lives on the server, so let GPUVM allocate it
+	int *ha = (int*)malloc(nbytes);
+	CHECK_NULL(ha);
+	for(size_t i = 0; i < n; i++)
+		ha[i] = i;
+	CHECK(gpuvm_link_alloc(ha, nbytes, 0, GPUVM_REMOTE | GPUVM_ON_HOST));
+
+	printf("round-tripping %zu MB through %s\n", nbytes >> 20, address);
+	double h2d_time = 0, d2h_time = 0;
+	unsigned irun;
+	for(irun = 0; irun < NRUNS; irun++) {
+		// copy to device; the "kernel" is assumed to write the whole array
+		double start = now();
+		CHECK(gpuvm_kernel_begin(ha, 0, GPUVM_READ_WRITE));
+		h2d_time += now() - start;
+		CHECK(gpuvm_kernel_end(ha, 0));
+
+		// copy back to host on the first access, and check the data
+		start = now();
+		volatile int first = ha[0];
+		d2h_time += now() - start;
+		(void)first;
+		for(size_t i = 0; i < n; i++) {
+			if(ha[i] != (int)(i + irun)) {
+				printf("check: FAILED at %zu\n", i);
+				exit(-1);
+			}
+			ha[i]++;
+		}
+	}  // for(irun)
+	printf("check: OK\n");
+
+	// print bandwidth
+	printf("host-to-device: %.2lf GB/s\n", NRUNS * nbytes / h2d_time * 1e-9);
+	printf("device-to-host: %.2lf GB/s\n", NRUNS * nbytes / d2h_time * 1e-9);
+
+	CHECK(gpuvm_unlink(ha, 0));
+	free(ha);
+	return 0;
+}  // end of main()
@@ -0,0 +1,287 @@
+/** stand-in remote device server; serves GPUVM remote devices (see
+		src/remote-proto.h) with buffers kept in its own memory, so that remote
+		devices can be used without any GPU. Usage:
+		remote-server unix:<path> | tcp:<port> */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../../../src/gpuvm.h"
+#include "../../../src/remote-proto.h"
+
+/** a device buffer */
+typedef struct {
+	/** the data, or 0 if the slot is free */
+	char *data;
+	/** the size of the buffer */
+	size_t nbytes;
+} buffer_t;
+
+/** buffers, shared by all connections; the handle of a buffer is its index
+		plus one */
+buffer_t *buffers = 0;
+size_t nbuffers = 0;
+pthread_mutex_t buffers_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/** receives exactly nbytes, returns 0 if successful */
+int recv_all(int fd, void *data, size_t nbytes) {
+	char *p = (char*)data;
+	while(nbytes) {
+		ssize_t n = recv(fd, p, nbytes, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		p += n;
+		nbytes -= n;
+	}
+	return 0;
+}
+
+/** sends exactly nbytes, returns 0 if successful */
+int send_all(int fd, const void *data, size_t nbytes) {
+	const char *p = (const char*)data;
+	while(nbytes) {
+		ssize_t n = send(fd, p, nbytes, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return -1;
+		p += n;
+		nbytes -= n;
+	}
+	return 0;
+}
+
+/** allocates a buffer, returns its handle or 0 if not successful */
+uint64_t buffer_alloc(size_t nbytes) {
+	char *data = (char*)malloc(nbytes ? nbytes : 1);
+	if(!data)
+		return 0;
+	pthread_mutex_lock(&buffers_mutex);
+	size_t ibuf;
+	for(ibuf = 0; ibuf < nbuffers && buffers[ibuf].data; ibuf++);
+	if(ibuf == nbuffers) {
+		buffer_t *new_buffers =
+			(buffer_t*)realloc(buffers, (nbuffers * 2 + 16) * sizeof(buffer_t));
+		if(!new_buffers) {
+			pthread_mutex_unlock(&buffers_mutex);
+			free(data);
+			return 0;
+		}
+		buffers = new_buffers;
+		memset(buffers + nbuffers, 0, (nbuffers + 16) * sizeof(buffer_t));
+		nbuffers = nbuffers * 2 + 16;
+	}
+	buffers[ibuf].data = data;
+	buffers[ibuf].nbytes = nbytes;
+	pthread_mutex_unlock(&buffers_mutex);
+	return ibuf + 1;
+}
+
+/** frees a buffer, returns 0 if successful */
+int buffer_free(uint64_t handle) {
+	pthread_mutex_lock(&buffers_mutex);
+	if(!handle || handle > nbuffers || !buffers[handle - 1].data) {
+		pthread_mutex_unlock(&buffers_mutex);
+		return -1;
+	}
+	free(buffers[handle - 1].data);
+	buffers[handle - 1].data = 0;
+	pthread_mutex_unlock(&buffers_mutex);
+	return 0;
+}
+
+/** gets the data of the buffer range, or 0 if the range is invalid */
+char *buffer_range(uint64_t handle, uint64_t devoff, uint64_t nbytes) {
+	char *data = 0;
+	pthread_mutex_lock(&buffers_mutex);
+	if(handle && handle <= nbuffers && buffers[handle - 1].data &&
+		 devoff <= buffers[handle - 1].nbytes &&
+		 nbytes <= buffers[handle - 1].nbytes - devoff)
+		data = buffers[handle - 1].data + devoff;
+	pthread_mutex_unlock(&buffers_mutex);
+	return data;
+}
+
+/** receives the hello request, together with the shared memory segment if
+		the client passes one; returns 0 if successful */
+int recv_hello(int fd, remote_req_t *req, int *shm_fd) {
+	struct iovec iov;
+	iov.iov_base = req;
+	iov.iov_len = sizeof(*req);
+	char control[CMSG_SPACE(sizeof(int))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	*shm_fd = -1;
+	ssize_t n = recvmsg(fd, &msg, 0);
+	if(n <= 0)
+		return -1;
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+		memcpy(shm_fd, CMSG_DATA(cmsg), sizeof(int));
+	// the rest of the request, if any
+	return recv_all(fd, (char*)req + n, sizeof(*req) - n);
+}
+
+/** serves a single connection */
+void *serve(void *arg) {
+	int fd = (int)(intptr_t)arg;
+	remote_req_t req;
+	remote_resp_t resp;
+	int shm_fd;
+	char *shm = 0;
+	size_t shm_size = 0;
+	if(recv_hello(fd, &req, &shm_fd) || req.op != REMOTE_OP_HELLO) {
+		close(fd);
+		return 0;
+	}
+	memset(&resp, 0, sizeof(resp));
+	if(req.buf != REMOTE_VERSION) {
+		resp.status = GPUVM_EAPI;
+	} else if(shm_fd >= 0 && req.nbytes) {
+		void *p = mmap(0, req.nbytes, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd,
+									 0);
+		if(p != MAP_FAILED) {
+			shm = (char*)p;
+			shm_size = req.nbytes;
+			resp.value = 1;
+		}
+	}
+	if(shm_fd >= 0)
+		close(shm_fd);
+	if(send_all(fd, &resp, sizeof(resp)) || resp.status) {
+		close(fd);
+		return 0;
+	}
+
+	// scratch space for payloads of failed writes
+	char scratch[4096];
+	while(!recv_all(fd, &req, sizeof(req))) {
+		memset(&resp, 0, sizeof(resp));
+		int use_shm = req.flags & REMOTE_FLAG_SHM;
+		if(use_shm && (!shm || req.shmoff > shm_size ||
+									 req.nbytes > shm_size - req.shmoff))
+			resp.status = GPUVM_EARG;
+		char *data = 0;
+		switch(req.op) {
+		case REMOTE_OP_ALLOC:
+			resp.value = buffer_alloc(req.nbytes);
+			if(!resp.value)
+				resp.status = GPUVM_EDEVALLOC;
+			break;
+		case REMOTE_OP_FREE:
+			if(buffer_free(req.buf))
+				resp.status = GPUVM_EARG;
+			break;
+		case REMOTE_OP_WRITE:
+			data = buffer_range(req.buf, req.devoff, req.nbytes);
+			if(!data)
+				resp.status = GPUVM_EARG;
+			if(use_shm) {
+				if(!resp.status)
+					memcpy(data, shm + req.shmoff, req.nbytes);
+			} else if(!resp.status) {
+				if(recv_all(fd, data, req.nbytes))
+					goto done;
+			} else {
+				// drop the payload
+				uint64_t left = req.nbytes;
+				while(left) {
+					size_t n = left < sizeof(scratch) ? left : sizeof(scratch);
+					if(recv_all(fd, scratch, n))
+						goto done;
+					left -= n;
+				}
+			}
+			break;
+		case REMOTE_OP_READ:
+			data = buffer_range(req.buf, req.devoff, req.nbytes);
+			if(!data)
+				resp.status = GPUVM_EARG;
+			if(!resp.status && use_shm)
+				memcpy(shm + req.shmoff, data, req.nbytes);
+			break;
+		default:
+			resp.status = GPUVM_EARG;
+			break;
+		}
+		if(send_all(fd, &resp, sizeof(resp)))
+			break;
+		if(req.op == REMOTE_OP_READ && !resp.status && !use_shm &&
+			 send_all(fd, data, req.nbytes))
+			break;
+	}
+ done:
+	if(shm)
+		munmap(shm, shm_size);
+	close(fd);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	if(argc < 2 || (strncmp(argv[1], "unix:", 5) && strncmp(argv[1], "tcp:", 4))) {
+		fprintf(stderr, "usage: %s unix:<path> | tcp:<port>\n", argv[0]);
+		return -1;
+	}
+	int lfd;
+	if(!strncmp(argv[1], "unix:", 5)) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, argv[1] + 5, sizeof(addr.sun_path) - 1);
+		unlink(addr.sun_path);
+		lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr))) {
+			perror("bind");
+			return -1;
+		}
+	} else {
+		struct sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(INADDR_ANY);
+		addr.sin_port = htons(atoi(argv[1] + 4));
+		int one = 1;
+		lfd = socket(AF_INET, SOCK_STREAM, 0);
+		if(lfd >= 0)
+			setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(lfd < 0 || bind(lfd, (struct sockaddr*)&addr, sizeof(addr))) {
+			perror("bind");
+			return -1;
+		}
+	}
+	if(listen(lfd, 16)) {
+		perror("listen");
+		return -1;
+	}
+	printf("serving on %s\n", argv[1]);
+	fflush(stdout);
+	while(1) {
+		int fd = accept(lfd, 0, 0);
+		if(fd < 0) {
+			if(errno == EINTR)
+				continue;
+			perror("accept");
+			return -1;
+		}
+		pthread_t thread;
+		if(pthread_create(&thread, 0, serve, (void*)(intptr_t)fd))
+			close(fd);
+		else
+			pthread_detach(thread);
+	}
+	return 0;
+}  // end of main()
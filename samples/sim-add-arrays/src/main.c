@@ -0,0 +1,130 @@
+/** simulated device sample; adding two arrays on a simulated device, which
+		requires neither GPU nor OpenCL runtime, and printing transfer statistics */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../../../src/gpuvm.h"
+
+// macros to check for errors
+#define CHECK(x) \
+	{\
+	int res = x;\
+	if(res != 0) {\
+	printf(#x "\n");\
+	printf("%d\n", res);\
+	exit(-1);\
+	}\
+	}
+
+#define CHECK_NULL(x) \
+	if(x == NULL) {\
+	printf(#x "\n");\
+	exit(-1);\
+	}
+
+#define N (1024 * 13 + 64)
+#define SZ (N * sizeof(int))
+#define NRUNS 4
+
+/** adds arrays on simulated device; the "kernel" runs on host, but uses only
+		device buffers obtained with gpuvm_xlate() */
+void add_arrays_on_device(int *c, int *a, int *b, int n) {
+	CHECK(gpuvm_kernel_begin(a, 0, GPUVM_READ_ONLY));
+	CHECK(gpuvm_kernel_begin(b, 0, GPUVM_READ_ONLY));
+	CHECK(gpuvm_kernel_begin(c, 0, GPUVM_READ_WRITE));
+
+	int *dc = (int*)gpuvm_xlate(c, 0);
+	int *da = (int*)gpuvm_xlate(a, 0);
+	int *db = (int*)gpuvm_xlate(b, 0);
+	
+	// run "kernel"
+	for(int i = 0; i < n; i++)
+		dc[i] = da[i] + db[i];
+
+	// on kernel end
+	CHECK(gpuvm_kernel_end(a, 0));
+	CHECK(gpuvm_kernel_end(b, 0));
+	CHECK(gpuvm_kernel_end(c, 0));
+}
+
+int main(int argc, char** argv) {
+	
+	// initialize GPUVM with a single device with default parameters
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_BEFORE_INIT));
+	CHECK(gpuvm_pre_init(GPUVM_THREADS_AFTER_INIT));
+	CHECK(gpuvm_init(1, 0, GPUVM_SIM | GPUVM_STAT | GPUVM_WRITER_SIG_BLOCK));
+
+	// allocate host data
+	int *ha = 0, *hb = 0, *hc = 0, *hg = 0;
+	ha = (int*)malloc(SZ);
+	hb = (int*)malloc(SZ);
+	hc = (int*)malloc(SZ);
+	hg = (int*)malloc(SZ);
+	CHECK_NULL(ha);
+	CHECK_NULL(hb);
+	CHECK_NULL(hc);
+	CHECK_NULL(hg);
+	for(int i = 0; i < N; i++) {
+		ha[i] = i;
+		hb[i] = i + 1;
+	}
+
+	// allocate device data, which is host memory for simulated devices
+	int *da = (int*)malloc(SZ), *db = (int*)malloc(SZ), *dc = (int*)malloc(SZ);
+	CHECK_NULL(da);
+	CHECK_NULL(db);
+	CHECK_NULL(dc);
+
+	// link host buffers to device buffers
+	CHECK(gpuvm_link(ha, SZ, 0, da, GPUVM_SIM | GPUVM_ON_HOST));
+	CHECK(gpuvm_link(hb, SZ, 0, db, GPUVM_SIM | GPUVM_ON_HOST));
+	CHECK(gpuvm_link(hc, SZ, 0, dc, GPUVM_SIM | GPUVM_ON_HOST));
+
+	printf("adding arrays\n");
+	unsigned irun;
+	for(irun = 0; irun < NRUNS; irun++) {
+		// do work on device
+		add_arrays_on_device(hc, ha, hb, N);
+
+		// evaluate "gold" result
+		for(int i = 0; i < N; i++)
+			hg[i] = ha[i] + hb[i];
+
+		// check result
+		for(int i = 0; i < N; i++) {
+			if(hg[i] != hc[i]) {
+				printf("check: FAILED\n");
+				printf("hg[%d] != hc[%d]: %d != %d\n", i, i, hg[i], hc[i]);
+				exit(-1);
+			}
+		}
+		printf("check: PASSED\n");
+	}  // for(irun)
+
+	// print statistics
+	unsigned long long pagefaults = 0;
+	double copy_time = 0, host_copy_time = 0;
+	CHECK(gpuvm_stat(GPUVM_STAT_PAGEFAULTS, &pagefaults));
+	CHECK(gpuvm_stat(GPUVM_STAT_COPY_TIME, &copy_time));
+	CHECK(gpuvm_stat(GPUVM_STAT_HOST_COPY_TIME, &host_copy_time));
+	printf("number of pagefaults: %lld\n", pagefaults);
+	printf("device copy time: %lf s\n", copy_time);
+	printf("host copy time: %lf s\n", host_copy_time);
+
+	// unlink
+	CHECK(gpuvm_unlink(ha, 0));
+	CHECK(gpuvm_unlink(hb, 0));
+	CHECK(gpuvm_unlink(hc, 0));
+
+	// free memory
+	free(da);
+	free(db);
+	free(dc);
+	free(ha);
+	free(hb);
+	free(hc);
+	free(hg);
+
+	return 0;
+}  // end of main()
@@ -0,0 +1,307 @@
+/** @file conv.c implementation of element conversion during transfer */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "conv.h"
+#include "devapi.h"
+#include "gpuvm.h"
+#include "util.h"
+
+/** size of the staging buffer in which the elements are converted, in bytes */
+#define CONV_STAGING_SIZE (256 * 1024)
+
+/** maximum number of staging buffers kept for reuse */
+#define CONV_NSTAGING 8
+
+/** number of element types, including the unused 0 */
+#define CONV_NTYPES (GPUVM_TYPE_DOUBLE + 1)
+
+/** converts n elements from one type to another
+		@param dst the first destination element
+		@param dst_stride the distance between destination elements, in bytes
+		@param src the first source element
+		@param src_stride the distance between source elements, in bytes
+		@param n the number of elements to convert
+ */
+typedef void (*conv_func_t)
+(char *dst, size_t dst_stride, const char *src, size_t src_stride, size_t n);
+
+/** defines a function converting elements of type stype to dtype. Dense and
+		aligned elements are converted with a plain loop over typed pointers,
+		which the compiler vectorizes; others, e.g. fields of host records, are
+		loaded and stored one by one */
+#define CONV_FUNC(name, stype, dtype)																		\
+	static void conv_##name																								\
+	(char *dst, size_t dst_stride, const char *src, size_t src_stride,		\
+	 size_t n) {																													\
+		size_t i;																														\
+		if(dst_stride == sizeof(dtype) && src_stride == sizeof(stype) &&		\
+			 (uintptr_t)dst % sizeof(dtype) == 0 &&														\
+			 (uintptr_t)src % sizeof(stype) == 0) {														\
+			dtype *restrict d = (dtype*)dst;																	\
+			const stype *restrict s = (const stype*)src;											\
+			for(i = 0; i < n; i++)																						\
+				d[i] = (dtype)s[i];																							\
+			return;																														\
+		}																																		\
+		for(i = 0; i < n; i++) {																						\
+			stype s;																													\
+			dtype d;																													\
+			memcpy(&s, src + i * src_stride, sizeof(s));											\
+			d = (dtype)s;																											\
+			memcpy(dst + i * dst_stride, &d, sizeof(d));											\
+		}																																		\
+	}
+
+/** defines functions converting elements of type stype to all types */
+#define CONV_FUNCS_FROM(sname, stype)						\
+	CONV_FUNC(sname##_int16, stype, int16_t)			\
+	CONV_FUNC(sname##_int32, stype, int32_t)			\
+	CONV_FUNC(sname##_int64, stype, int64_t)			\
+	CONV_FUNC(sname##_float, stype, float)				\
+	CONV_FUNC(sname##_double, stype, double)
+
+CONV_FUNCS_FROM(int16, int16_t)
+CONV_FUNCS_FROM(int32, int32_t)
+CONV_FUNCS_FROM(int64, int64_t)
+CONV_FUNCS_FROM(float, float)
+CONV_FUNCS_FROM(double, double)
+
+/** the row of conversion functions from a type to all types */
+#define CONV_FUNCS_ROW(sname)																						\
+	{0, conv_##sname##_int16, conv_##sname##_int32, conv_##sname##_int64,	\
+			conv_##sname##_float, conv_##sname##_double}
+
+/** conversion functions, indexed by source and destination types */
+static const conv_func_t conv_funcs_g[CONV_NTYPES][CONV_NTYPES] = {
+	{0, 0, 0, 0, 0, 0},
+	CONV_FUNCS_ROW(int16),
+	CONV_FUNCS_ROW(int32),
+	CONV_FUNCS_ROW(int64),
+	CONV_FUNCS_ROW(float),
+	CONV_FUNCS_ROW(double)
+};
+
+/** sizes of the element types */
+/** staging buffers not in use, kept for the next copies; an empty slot is 0.
+		The buffers are mapped separately from host arrays, so that converting
+		never faults on them */
+static char *volatile conv_staging_g[CONV_NSTAGING];
+
+static const size_t conv_sizes_g[CONV_NTYPES] = {
+	0, sizeof(int16_t), sizeof(int32_t), sizeof(int64_t), sizeof(float),
+	sizeof(double)
+};
+
+int conv_init(conv_t *conv, const gpuvm_conv_t *desc, size_t nbytes) {
+	if(desc->host_type <= 0 || desc->host_type >= CONV_NTYPES ||
+		 desc->dev_type <= 0 || desc->dev_type >= CONV_NTYPES) {
+		fprintf(stderr, "conv_init: invalid element type\n");
+		return GPUVM_EARG;
+	}
+	conv->host_type = desc->host_type;
+	conv->dev_type = desc->dev_type;
+	conv->host_size = conv_sizes_g[desc->host_type];
+	conv->dev_size = conv_sizes_g[desc->dev_type];
+	conv->record_size = desc->record_size ? desc->record_size : conv->host_size;
+	conv->nfields = desc->nfields ? desc->nfields : 1;
+	if(conv->nfields > GPUVM_CONV_MAX_FIELDS) {
+		fprintf(stderr, "conv_init: too many fields\n");
+		return GPUVM_EARG;
+	}
+	if(!nbytes || nbytes % conv->record_size) {
+		fprintf(stderr, "conv_init: invalid array size\n");
+		return GPUVM_EARG;
+	}
+	conv->nrecords = nbytes / conv->record_size;
+	unsigned ifield;
+	memset(conv->field_offsets, 0, sizeof(conv->field_offsets));
+	for(ifield = 0; ifield < conv->nfields; ifield++) {
+		if(desc->nfields)
+			conv->field_offsets[ifield] = desc->field_offsets[ifield];
+		if(conv->field_offsets[ifield] + conv->host_size > conv->record_size) {
+			fprintf(stderr, "conv_init: field is outside the record\n");
+			return GPUVM_EARG;
+		}
+	}
+	conv->soa = desc->soa && conv->nfields > 1;
+	return 0;
+}  // conv_init
+
+int conv_equal(const conv_t *a, const conv_t *b) {
+	return a->host_type == b->host_type && a->dev_type == b->dev_type &&
+		a->record_size == b->record_size && a->nrecords == b->nrecords &&
+		a->nfields == b->nfields && a->soa == b->soa &&
+		!memcmp(a->field_offsets, b->field_offsets, sizeof(a->field_offsets));
+}  // conv_equal
+
+size_t conv_dev_nbytes(const conv_t *conv) {
+	return conv->nrecords * conv->nfields * conv->dev_size;
+}  // conv_dev_nbytes
+
+/** gets the position of a field of a chunk of records in the staging buffer,
+		which holds the chunk as it is laid out on device
+		@param conv the conversion
+		@param ifield the field
+		@param nrecords the number of records in the chunk
+		@param stride [out] the distance between the elements of the field, in
+		bytes
+		@returns the offset of the first element of the field
+ */
+static size_t conv_staging_field
+(const conv_t *conv, unsigned ifield, size_t nrecords, size_t *stride) {
+	if(conv->soa) {
+		*stride = conv->dev_size;
+		return ifield * nrecords * conv->dev_size;
+	}
+	*stride = conv->nfields * conv->dev_size;
+	return ifield * conv->dev_size;
+}  // conv_staging_field
+
+/** writes back the bytes of a host element lying in a range, if the element
+		intersects the range
+		@param conv the conversion
+		@param dst the host element
+		@param src the device element
+		@param lo the start of the range
+		@param hi the end of the range
+ */
+static void conv_readback_partial
+(const conv_t *conv, char *dst, const char *src, char *lo, char *hi) {
+	char elem[sizeof(double)];
+	if(dst + conv->host_size <= lo || dst >= hi)
+		return;
+	conv_funcs_g[conv->dev_type][conv->host_type](elem, 0, src, 0, 1);
+	char *start = dst > lo ? dst : lo;
+	char *end = dst + conv->host_size < hi ? dst + conv->host_size : hi;
+	memcpy(start, elem + (start - dst), end - start);
+}  // conv_readback_partial
+
+/** converts a chunk of records from the staging buffer into a host range;
+		the elements only partially inside the range are written partially
+		@param conv the conversion
+		@param hostptr the start of the host array
+		@param staging the staging buffer
+		@param r0 the first record of the chunk
+		@param r1 the end of the chunk
+		@param range the host range
+ */
+static void conv_readback_chunk
+(const conv_t *conv, char *hostptr, const char *staging, size_t r0, size_t r1,
+ const memrange_t *range) {
+	size_t rs = conv->record_size, hs = conv->host_size;
+	size_t lo = (char*)range->ptr - hostptr, hi = lo + range->nbytes;
+	conv_func_t func = conv_funcs_g[conv->dev_type][conv->host_type];
+	unsigned ifield;
+	for(ifield = 0; ifield < conv->nfields; ifield++) {
+		size_t off = conv->field_offsets[ifield], stride;
+		const char *src = staging + conv_staging_field(conv, ifield, r1 - r0,
+																									 &stride);
+		// records [a, b) have the field wholly inside the range
+		size_t a = lo > off ? (lo - off + rs - 1) / rs : 0;
+		size_t b = hi >= off + hs ? (hi - off - hs) / rs + 1 : 0;
+		size_t ia = a > r0 ? a : r0, ib = b < r1 ? b : r1;
+		if(ia < ib)
+			func(hostptr + ia * rs + off, rs, src + (ia - r0) * stride, stride,
+					 ib - ia);
+		// at most one element straddles each end of the range, a - 1 and b
+		if(b < a)
+			b = a;
+		if(a > r0 && a <= r1)
+			conv_readback_partial(conv, hostptr + (a - 1) * rs + off,
+														src + (a - 1 - r0) * stride, hostptr + lo,
+														hostptr + hi);
+		if(b >= r0 && b < r1)
+			conv_readback_partial(conv, hostptr + b * rs + off,
+														src + (b - r0) * stride, hostptr + lo,
+														hostptr + hi);
+	}
+}  // conv_readback_chunk
+
+/** gets a staging buffer of ::CONV_STAGING_SIZE bytes, either a kept one or a
+		newly mapped one; copies may be made by several threads at once, so each
+		takes a buffer of its own
+		@returns the buffer, or 0 if it can't be allocated
+ */
+static char *conv_staging_get(void) {
+	unsigned istaging;
+	for(istaging = 0; istaging < CONV_NSTAGING; istaging++) {
+		char *staging = __sync_lock_test_and_set(&conv_staging_g[istaging], 0);
+		if(staging)
+			return staging;
+	}
+	void *staging = mmap(0, CONV_STAGING_SIZE, PROT_READ | PROT_WRITE, 
+											 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return staging == MAP_FAILED ? 0 : (char*)staging;
+}  // conv_staging_get
+
+/** returns a staging buffer for reuse, or unmaps it if enough are kept
+		@param staging the buffer got with conv_staging_get()
+ */
+static void conv_staging_put(char *staging) {
+	unsigned istaging;
+	for(istaging = 0; istaging < CONV_NSTAGING; istaging++)
+		if(__sync_bool_compare_and_swap(&conv_staging_g[istaging], 0, staging))
+			return;
+	munmap(staging, CONV_STAGING_SIZE);
+}  // conv_staging_put
+
+int conv_copy
+(const conv_t *conv, void *hostptr, unsigned idev, void *buf, size_t devoff,
+ const memrange_t *range, int to_device) {
+	size_t rs = conv->record_size, ds = conv->dev_size;
+	size_t lo = (char*)range->ptr - (char*)hostptr, hi = lo + range->nbytes;
+	if(!range->nbytes)
+		return 0;
+	// records intersecting the range
+	size_t r0 = lo / rs, r1 = (hi + rs - 1) / rs;
+	if(r1 > conv->nrecords)
+		r1 = conv->nrecords;
+	size_t chunk_nrecords = CONV_STAGING_SIZE / (conv->nfields * ds);
+	if(chunk_nrecords > r1 - r0)
+		chunk_nrecords = r1 - r0;
+	char *staging = conv_staging_get();
+	if(!staging) {
+		fprintf(stderr, "conv_copy: can\'t allocate staging buffer\n");
+		return GPUVM_ERROR;
+	}
+
+	int err = 0;
+	size_t c0;
+	for(c0 = r0; c0 < r1 && !err; c0 += chunk_nrecords) {
+		size_t c1 = c0 + chunk_nrecords < r1 ? c0 + chunk_nrecords : r1;
+		size_t n = c1 - c0;
+		// the chunk on device, as a single range or one range per field
+		devcopy_t copies[GPUVM_CONV_MAX_FIELDS];
+		unsigned ncopies = conv->soa ? conv->nfields : 1, icopy;
+		for(icopy = 0; icopy < ncopies; icopy++) {
+			copies[icopy].hostptr = staging + icopy * n * ds;
+			if(conv->soa) {
+				copies[icopy].nbytes = n * ds;
+				copies[icopy].devoff = devoff + (icopy * conv->nrecords + c0) * ds;
+			} else {
+				copies[icopy].nbytes = n * conv->nfields * ds;
+				copies[icopy].devoff = devoff + c0 * conv->nfields * ds;
+			}
+		}
+		if(to_device) {
+			// elements partially inside the range are uploaded whole
+			conv_func_t func = conv_funcs_g[conv->host_type][conv->dev_type];
+			unsigned ifield;
+			for(ifield = 0; ifield < conv->nfields; ifield++) {
+				size_t stride, pos = conv_staging_field(conv, ifield, n, &stride);
+				func(staging + pos, stride,
+						 (char*)hostptr + c0 * rs + conv->field_offsets[ifield], rs, n);
+			}
+			err = memcpy_h2d_n(devapi_g, idev, buf, copies, ncopies);
+		} else {
+			if(!(err = memcpy_d2h_n(devapi_g, idev, buf, copies, ncopies)))
+				conv_readback_chunk(conv, (char*)hostptr, staging, c0, c1, range);
+		}
+	}
+	conv_staging_put(staging);
+	return err;
+}  // conv_copy
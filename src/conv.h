@@ -0,0 +1,78 @@
+#ifndef GPUVM_CONV_H_
+#define GPUVM_CONV_H_
+
+/** @file conv.h
+		this file contains definition of conv_t, which describes how the elements
+		of a host array are converted on their way to and from device. The host
+		array consists of records, from each of which one or more fields are
+		taken; each field is converted from host to device element type. On
+		device, fields are stored either as separate arrays, one after another
+		(SoA), or record after record, with the fields of each record packed
+		together. The data are converted while staged in a buffer of limited size,
+		so no full-size converted copy is ever kept on host
+ */
+
+#include "gpuvm.h"
+#include "util.h"
+
+typedef struct conv_struct {
+	/** host element type, one of GPUVM_TYPE_* */
+	int host_type;
+	/** device element type, one of GPUVM_TYPE_* */
+	int dev_type;
+	/** size of a host element, in bytes */
+	size_t host_size;
+	/** size of a device element, in bytes */
+	size_t dev_size;
+	/** size of a host record, in bytes */
+	size_t record_size;
+	/** number of records in the array */
+	size_t nrecords;
+	/** number of fields taken from each record */
+	unsigned nfields;
+	/** offsets of the fields in a host record */
+	size_t field_offsets[GPUVM_CONV_MAX_FIELDS];
+	/** nonzero if each field is stored on device as a separate array, and 0 if
+			the fields of each record are stored together */
+	int soa;
+} conv_t;
+
+/** initializes the conversion from its public description, checking it
+		@param conv the conversion to initialize
+		@param desc the public description of the conversion
+		@param nbytes the size of the host array, in bytes
+		@returns 0 if successful and ::GPUVM_EARG if the description is invalid
+ */
+int conv_init(conv_t *conv, const gpuvm_conv_t *desc, size_t nbytes);
+
+/** checks whether two conversions are the same
+		@param a the first conversion
+		@param b the second conversion
+		@returns nonzero if they are and 0 if not
+ */
+int conv_equal(const conv_t *a, const conv_t *b);
+
+/** gets the size of the converted array on device
+		@param conv the conversion
+		@returns the size in bytes
+ */
+size_t conv_dev_nbytes(const conv_t *conv);
+
+/** copies the elements of the array lying in a host range between host and
+		device, converting them. On upload, elements only partially inside the
+		range are uploaded whole; on readback, only their bytes inside the range
+		are written
+		@param conv the conversion
+		@param hostptr the start of the host array
+		@param idev the device
+		@param buf the device buffer
+		@param devoff the offset of the converted array in the device buffer
+		@param range the host range, inside the array
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+int conv_copy
+(const conv_t *conv, void *hostptr, unsigned idev, void *buf, size_t devoff,
+ const memrange_t *range, int to_device);
+
+#endif
@@ -1,15 +1,53 @@
-/** @file cuda-api.c CUDA-based API for host-device interaction */
+/** @file cuda-api.c CUDA-based API for host-device interaction. Each device
+		gets its own stream, so that copies do not wait for unrelated kernels or
+		copies on other streams, and a pair of pinned staging buffers, through which
+		the data are copied asynchronously in chunks. As copies are issued to
+		device-bound streams, the current CUDA device never needs to be changed on
+		the copy path */
 
 #ifdef CUDA_ENABLED
 
 #include <cuda.h>
 #include <cuda_runtime_api.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "devapi.h"
 #include "gpuvm.h"
+#include "hcopy.h"
+#include "stat.h"
 #include "util.h"
 
+/** number of pinned staging buffers per device */
+#define CUDA_NSTAGING 2
+
+/** size of a single pinned staging buffer, in bytes */
+#define CUDA_STAGING_SIZE (1024 * 1024)
+
+/** per-device CUDA data */
+typedef struct {
+	/** the stream on which all copies for the device are performed */
+	cudaStream_t stream;
+	/** events recorded before and after the copy, used both for timing and for
+			waiting for the copy to complete */
+	cudaEvent_t start_ev, end_ev;
+	/** pinned staging buffers */
+	void *staging[CUDA_NSTAGING];
+	/** events indicating that the respective staging buffer is no longer used
+			by the device */
+	cudaEvent_t staging_ev[CUDA_NSTAGING];
+	/** mutex protecting the staging buffers, as copies to the same device can be
+			requested from several threads at once */
+	pthread_mutex_t mutex;
+} cuda_dev_t;
+
+/** CUDA devapi structure */
+devapi_t cuda_devapi_g;
+
+/** CUDA per-device data, one for each device */
+cuda_dev_t *cuda_devs_g = 0;
+
 /** a CUDA function for device-to-host copy
 		@param idev GPUVM device number
 		@param tgt target pointer, that is, host pointer
@@ -32,55 +70,387 @@ static int cuda_memcpy_d2h
 static int cuda_memcpy_h2d
 (unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
 
-int cuda_devapi_init() {
-		// fill in devapi_g structure
-	devapi_g = (devapi_t*)smalloc(sizeof(devapi_t));
-	if(!devapi_g)		
-		return GPUVM_ESALLOC;
-	devapi_g->memcpy_d2h = cuda_memcpy_d2h;
-	devapi_g->memcpy_h2d = cuda_memcpy_h2d;
-	return 0;
-}  // cuda_devapi_init()
+/** a CUDA function for batched device-to-host copy
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies);
 
-// TODO: avoid always getting/setting CUDA device, find another way
-static int cuda_memcpy_d2h
-(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+/** a CUDA function for batched host-to-device copy
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies);
+
+/** a CUDA function for batched host-to-device copy of rectangular blocks,
+		with cudaMemcpy2DAsync() and cudaMemcpy3DAsync()
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects);
+
+/** a CUDA function for batched device-to-host copy of rectangular blocks,
+		with cudaMemcpy2DAsync() and cudaMemcpy3DAsync()
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects);
+
+/** a CUDA function for device buffer allocation
+		@param idev GPUVM device number
+		@param nbytes the size of the buffer
+		@param pbuf [out] *pbuf is the allocated device pointer if successful
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_mem_alloc(unsigned idev, size_t nbytes, void **pbuf);
+
+/** a CUDA function for freeing a device buffer
+		@param idev GPUVM device number
+		@param buf the device pointer to free
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_mem_free(unsigned idev, void *buf);
+
+/** a CUDA function for copying between buffers of two devices, with
+		cudaMemcpyPeerAsync() on the stream of the target device
+		@param tgt_idev GPUVM number of the target device
+		@param tgt target device pointer
+		@param tgtoff offset in target buffer
+		@param src_idev GPUVM number of the source device
+		@param src source device pointer
+		@param srcoff offset in source buffer
+		@param nbytes how many bytes to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes);
+
+/** a CUDA function for filling a device buffer range, with cudaMemsetAsync()
+		on the device stream
+		@param idev GPUVM device number
+		@param buf the device pointer
+		@param devoff offset of the range in the buffer
+		@param nbytes the size of the range
+		@param value the value of each byte
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value);
+
+/** creates per-device CUDA data for a single device
+		@param idev GPUVM device number, the same as CUDA device number
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_dev_init(unsigned idev) {
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	memset(dev, 0, sizeof(cuda_dev_t));
+	// streams and events are bound to the device current at their creation
 	int prev_device;
 	cudaGetDevice(&prev_device);
 	cudaSetDevice((int)idev);
-	
-	cudaError_t err = cudaMemcpy
-		(tgt, (char*)src + devoff, nbytes, cudaMemcpyDeviceToHost);
+	cudaError_t err = cudaStreamCreateWithFlags(&dev->stream, cudaStreamNonBlocking);
 	if(!err)
-		err = cudaDeviceSynchronize();
-
+		err = cudaEventCreate(&dev->start_ev);
+	if(!err)
+		err = cudaEventCreate(&dev->end_ev);
+	unsigned istaging;
+	for(istaging = 0; istaging < CUDA_NSTAGING && !err; istaging++) {
+		err = cudaMallocHost(&dev->staging[istaging], CUDA_STAGING_SIZE);
+		if(!err)
+			err = cudaEventCreateWithFlags
+				(&dev->staging_ev[istaging], cudaEventDisableTiming);
+	}
 	cudaSetDevice(prev_device);
+	if(err != cudaSuccess) {
+		fprintf(stderr, "cuda_dev_init: can\'t create CUDA resources for device %d\n",
+						idev);
+		return err == cudaErrorMemoryAllocation ? GPUVM_EDEVALLOC : GPUVM_ERROR;
+	}
+	if(pthread_mutex_init(&dev->mutex, 0)) {
+		fprintf(stderr, "cuda_dev_init: can\'t init mutex\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // cuda_dev_init
 
+int cuda_devapi_init() {
+	// fill in devapi_g structure
+	devapi_g = &cuda_devapi_g;
+	devapi_g->memcpy_d2h = cuda_memcpy_d2h;
+	devapi_g->memcpy_h2d = cuda_memcpy_h2d;
+	devapi_g->memcpy_d2h_n = cuda_memcpy_d2h_n;
+	devapi_g->memcpy_h2d_n = cuda_memcpy_h2d_n;
+	devapi_g->memcpy_d2h_rect = cuda_memcpy_d2h_rect;
+	devapi_g->memcpy_h2d_rect = cuda_memcpy_h2d_rect;
+	devapi_g->mem_alloc = cuda_mem_alloc;
+	devapi_g->mem_free = cuda_mem_free;
+	devapi_g->memcpy_peer = cuda_memcpy_peer;
+	devapi_g->mem_fill = cuda_mem_fill;
+
+	// initialize per-device data
+	cuda_devs_g = (cuda_dev_t*)smalloc(ndevs_g * sizeof(cuda_dev_t));
+	if(!cuda_devs_g)
+		return GPUVM_ESALLOC;
+	unsigned idev;
+	int err;
+	for(idev = 0; idev < ndevs_g; idev++)
+		if(err = cuda_dev_init(idev))
+			return err;
+	return 0;
+}  // cuda_devapi_init()
+
+/** waits for the copies issued to the device stream since the start event, and
+		collects statistics for them
+		@param dev the device on which the copies have been issued
+		@param err the error of issuing the copies
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_wait_copies(cuda_dev_t *dev, cudaError_t err) {
+	if(!err)
+		err = cudaEventRecord(dev->end_ev, dev->stream);
+	// only wait for the copies' own event, not for the whole device
+	if(!err)
+		err = cudaEventSynchronize(dev->end_ev);
 	if(err != cudaSuccess) {
-		fprintf(stderr, "cuda_memcpy_d2h: can\'t copy data\n");
-		return -1;
+		fprintf(stderr, "cuda_wait_copies: can\'t copy data\n");
+		return err == cudaErrorMemoryAllocation ? GPUVM_EDEVALLOC : GPUVM_ERROR;
+	}
+	// do statistics collection
+	if(stat_enabled()) {
+		float time_ms;
+		if(cudaEventElapsedTime(&time_ms, dev->start_ev, dev->end_ev)) {
+			fprintf(stderr, "cuda_wait_copies: can\'t get copy time\n");
+			return GPUVM_ERROR;
+		}
+		return stat_acc_double(GPUVM_STAT_COPY_TIME, time_ms * 1e-3);
 	}
 	return 0;
+}  // cuda_wait_copies
+
+static int cuda_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies) {
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	pthread_mutex_lock(&dev->mutex);
+	cudaError_t err = cudaEventRecord(dev->start_ev, dev->stream);
+	unsigned icopy, istaging = 0;
+	for(icopy = 0; icopy < ncopies && !err; icopy++) {
+		const devcopy_t *copy = &copies[icopy];
+		size_t off;
+		for(off = 0; off < copy->nbytes && !err; off += CUDA_STAGING_SIZE) {
+			size_t nbytes = copy->nbytes - off;
+			if(nbytes > CUDA_STAGING_SIZE)
+				nbytes = CUDA_STAGING_SIZE;
+			// wait until the device is done with the staging buffer, fill it and
+			// copy it asynchronously, while the next buffer is being filled
+			if(err = cudaEventSynchronize(dev->staging_ev[istaging]))
+				break;
+			hcopy(dev->staging[istaging], (char*)copy->hostptr + off, nbytes);
+			(err = cudaMemcpyAsync
+			 ((char*)tgt + copy->devoff + off, dev->staging[istaging], nbytes,
+				cudaMemcpyHostToDevice, dev->stream)) ||
+				(err = cudaEventRecord(dev->staging_ev[istaging], dev->stream));
+			istaging = (istaging + 1) % CUDA_NSTAGING;
+		}
+	}
+	int res = cuda_wait_copies(dev, err);
+	pthread_mutex_unlock(&dev->mutex);
+	return res;
+}  // cuda_memcpy_h2d_n
+
+static int cuda_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies) {
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	pthread_mutex_lock(&dev->mutex);
+	cudaError_t err = cudaEventRecord(dev->start_ev, dev->stream);
+	// chunk whose data are in the other staging buffer and are yet to be copied
+	// out to host
+	void *pending_ptr = 0;
+	size_t pending_nbytes = 0;
+	unsigned icopy, istaging = 0;
+	for(icopy = 0; icopy <= ncopies && !err; icopy++) {
+		const devcopy_t *copy = icopy < ncopies ? &copies[icopy] : 0;
+		size_t off;
+		for(off = 0; !err && (copy ? off < copy->nbytes : off == 0);
+				off += CUDA_STAGING_SIZE) {
+			size_t nbytes = 0;
+			if(copy) {
+				// copy the next chunk into the staging buffer asynchronously
+				nbytes = copy->nbytes - off;
+				if(nbytes > CUDA_STAGING_SIZE)
+					nbytes = CUDA_STAGING_SIZE;
+				(err = cudaMemcpyAsync
+				 (dev->staging[istaging], (char*)src + copy->devoff + off, nbytes,
+					cudaMemcpyDeviceToHost, dev->stream)) ||
+					(err = cudaEventRecord(dev->staging_ev[istaging], dev->stream));
+			}
+			// meanwhile, copy out the previous chunk
+			unsigned iprev = (istaging + CUDA_NSTAGING - 1) % CUDA_NSTAGING;
+			if(!err && pending_ptr) {
+				if(!(err = cudaEventSynchronize(dev->staging_ev[iprev])))
+					hcopy(pending_ptr, dev->staging[iprev], pending_nbytes);
+			}
+			pending_ptr = copy ? (char*)copy->hostptr + off : 0;
+			pending_nbytes = nbytes;
+			istaging = (istaging + 1) % CUDA_NSTAGING;
+			if(!copy)
+				break;
+		}
+	}
+	int res = cuda_wait_copies(dev, err);
+	pthread_mutex_unlock(&dev->mutex);
+	return res;
+}  // cuda_memcpy_d2h_n
+
+/** copies rectangular blocks in either direction directly between host memory
+		and device, without staging, as a single copy command for each block
+		@param idev GPUVM device number
+		@param buf the device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int cuda_memcpy_rect
+(unsigned idev, void *buf, const devrect_t *rects, unsigned nrects, 
+ int to_device) {
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	pthread_mutex_lock(&dev->mutex);
+	cudaError_t err = cudaEventRecord(dev->start_ev, dev->stream);
+	unsigned irect;
+	for(irect = 0; irect < nrects && !err; irect++) {
+		const devrect_t *rect = &rects[irect];
+		char *devptr = (char*)buf + rect->devoff;
+		if(rect->depth == 1) {
+			err = to_device ?
+				cudaMemcpy2DAsync
+				(devptr, rect->dev_row_pitch, rect->hostptr, rect->host_row_pitch,
+				 rect->width, rect->height, cudaMemcpyHostToDevice, dev->stream) :
+				cudaMemcpy2DAsync
+				(rect->hostptr, rect->host_row_pitch, devptr, rect->dev_row_pitch,
+				 rect->width, rect->height, cudaMemcpyDeviceToHost, dev->stream);
+			continue;
+		}
+		struct cudaPitchedPtr host_pitched = {
+			rect->hostptr, rect->host_row_pitch, rect->width, 
+			rect->host_slice_pitch / rect->host_row_pitch
+		};
+		struct cudaPitchedPtr dev_pitched = {
+			devptr, rect->dev_row_pitch, rect->width, 
+			rect->dev_slice_pitch / rect->dev_row_pitch
+		};
+		struct cudaMemcpy3DParms parms;
+		memset(&parms, 0, sizeof(parms));
+		parms.srcPtr = to_device ? host_pitched : dev_pitched;
+		parms.dstPtr = to_device ? dev_pitched : host_pitched;
+		parms.extent.width = rect->width;
+		parms.extent.height = rect->height;
+		parms.extent.depth = rect->depth;
+		parms.kind = to_device ? cudaMemcpyHostToDevice : cudaMemcpyDeviceToHost;
+		err = cudaMemcpy3DAsync(&parms, dev->stream);
+	}
+	int res = cuda_wait_copies(dev, err);
+	pthread_mutex_unlock(&dev->mutex);
+	return res;
+}  // cuda_memcpy_rect
+
+static int cuda_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects) {
+	return cuda_memcpy_rect(idev, tgt, rects, nrects, 1);
+}  // cuda_memcpy_h2d_rect
+
+static int cuda_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects) {
+	return cuda_memcpy_rect(idev, src, rects, nrects, 0);
+}  // cuda_memcpy_d2h_rect
+
+static int cuda_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {tgt, nbytes, devoff};
+	return cuda_memcpy_d2h_n(idev, src, &copy, 1);
 }  // cuda_memcpy_d2h
 
 static int cuda_memcpy_h2d
 (unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {src, nbytes, devoff};
+	return cuda_memcpy_h2d_n(idev, tgt, &copy, 1);
+}  // cuda_memcpy_h2d
+
+static int cuda_mem_alloc(unsigned idev, size_t nbytes, void **pbuf) {
+	// allocation is done on the current device, so switch to the requested one
+	// for the time of the call
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	pthread_mutex_lock(&dev->mutex);
 	int prev_device;
 	cudaGetDevice(&prev_device);
 	cudaSetDevice((int)idev);
-	
-	cudaError_t err = cudaMemcpy
-		((char*)tgt + devoff, src, nbytes, cudaMemcpyHostToDevice);
-	if(!err)
-		err = cudaDeviceSynchronize();
-
+	cudaError_t err = cudaMalloc(pbuf, nbytes);
 	cudaSetDevice(prev_device);
+	pthread_mutex_unlock(&dev->mutex);
+	if(err != cudaSuccess) {
+		if(err == cudaErrorMemoryAllocation)
+			return GPUVM_EDEVALLOC;
+		fprintf(stderr, "cuda_mem_alloc: can\'t allocate device memory\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // cuda_mem_alloc
+
+static int cuda_mem_free(unsigned idev, void *buf) {
+	if(cudaFree(buf) != cudaSuccess) {
+		fprintf(stderr, "cuda_mem_free: can\'t free device memory\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // cuda_mem_free
+
+static int cuda_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes) {
+	cuda_dev_t *dev = &cuda_devs_g[tgt_idev];
+	pthread_mutex_lock(&dev->mutex);
+	cudaError_t err = cudaEventRecord(dev->start_ev, dev->stream);
+	if(!err)
+		err = cudaMemcpyPeerAsync((char*)tgt + tgtoff, (int)tgt_idev, 
+															(char*)src + srcoff, (int)src_idev, nbytes, 
+															dev->stream);
+	int res = cuda_wait_copies(dev, err);
+	pthread_mutex_unlock(&dev->mutex);
+	return res;
+}  // cuda_memcpy_peer
 
+static int cuda_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value) {
+	cuda_dev_t *dev = &cuda_devs_g[idev];
+	pthread_mutex_lock(&dev->mutex);
+	cudaError_t err = cudaMemsetAsync((char*)buf + devoff, value, nbytes, 
+																		dev->stream);
+	if(!err)
+		err = cudaEventRecord(dev->end_ev, dev->stream);
+	if(!err)
+		err = cudaEventSynchronize(dev->end_ev);
+	pthread_mutex_unlock(&dev->mutex);
 	if(err != cudaSuccess) {
-		fprintf(stderr, "cuda_memcpy_h2d: can\'t copy data\n");
-		return -1;
+		fprintf(stderr, "cuda_mem_fill: can't fill device memory\n");
+		return GPUVM_ERROR;
 	}
 	return 0;
-}  // cuda_memcpy_h2d
+}  // cuda_mem_fill
 
 #endif
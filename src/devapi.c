@@ -1,5 +1,5 @@
-/** @file devapi.c implementation of device interaction API, either CUDA or
-		OpenCL 
+/** @file devapi.c implementation of device interaction API, CUDA,
+		OpenCL or simulated device 
 */
 
 #include <signal.h>
@@ -9,14 +9,51 @@
 #include "devapi.h"
 #include "gpuvm.h"
 #include "opencl-api.h"
+#include "plugin-api.h"
+#include "remote-api.h"
+#include "sim-api.h"
 #include "stat.h"
 #include "util.h"
+#include "xsched.h"
+
+/** maximum number of rows copied as a single batch when a device copies
+		rectangular blocks row by row */
+#define DEVAPI_ROW_BATCH 64
+
+/** maximum number of asynchronous copies in flight when a device copies a
+		batch of ranges one by one */
+#define DEVAPI_ASYNC_WINDOW 16
 
 devapi_t *devapi_g;
 
 /** a helper signal mask to (un)block during writer lock */
 sigset_t devapi_block_sig_g;
 
+/** sets the capabilities of the API from its entries; a capability is set
+		only if all of its entries are available
+		@param devapi the API
+ */
+static void devapi_set_caps(devapi_t *devapi) {
+	unsigned caps = 0;
+	if(devapi->memcpy_h2d_n && devapi->memcpy_d2h_n)
+		caps |= GPUVM_CAP_COPY_N;
+	if(devapi->memcpy_h2d_rect && devapi->memcpy_d2h_rect)
+		caps |= GPUVM_CAP_COPY_RECT;
+	if(devapi->mem_alloc && devapi->mem_free)
+		caps |= GPUVM_CAP_ALLOC;
+	if(devapi->host_unified && devapi->mem_wrap && devapi->mem_unwrap && 
+		 devapi->mem_map && devapi->mem_unmap)
+		caps |= GPUVM_CAP_MAP;
+	if(devapi->memcpy_h2d_async && devapi->memcpy_d2h_async && 
+		 devapi->event_wait)
+		caps |= GPUVM_CAP_ASYNC;
+	if(devapi->memcpy_peer)
+		caps |= GPUVM_CAP_PEER;
+	if(devapi->mem_fill)
+		caps |= GPUVM_CAP_FILL;
+	devapi->caps = caps;
+}  // devapi_set_caps
+
 int devapi_init(int flags) {
 	sigemptyset(&devapi_block_sig_g);
 	//sigaddset(&devapi_block_sig_g, SIG_MONOGC_SUSPEND);
@@ -25,65 +62,376 @@ int devapi_init(int flags) {
 #endif
 
 	flags &= GPUVM_API;
-	if(flags != GPUVM_CUDA && flags != GPUVM_OPENCL) {
+	if(flags != GPUVM_CUDA && flags != GPUVM_OPENCL && flags != GPUVM_SIM &&
+		 flags != GPUVM_REMOTE && flags != GPUVM_PLUGIN) {
 		fprintf(stderr, "devapi_init: invalid flags\n");
 		return GPUVM_EARG;
 	}
+	int err = 0;
 	if(flags == GPUVM_OPENCL) {
 #ifdef OPENCL_ENABLED
-		return ocl_devapi_init();
+		err = ocl_devapi_init();
 #else
 		fprintf(stderr, "devapi_init: OpenCL is not supported "
 						"in this libgpuvm build\n");
 		return GPUVM_EAPI;
 #endif
-	}
-	if(flags == GPUVM_CUDA) {
+	} else if(flags == GPUVM_CUDA) {
 #ifdef CUDA_ENABLED
-		return cuda_devapi_init();
+		err = cuda_devapi_init();
 #else
 		fprintf(stderr, "devapi_init: CUDA is not supported "
 						"in this libgpuvm build\n");
 		return GPUVM_EAPI;		
 #endif
+	} else if(flags == GPUVM_SIM) {
+		err = sim_devapi_init();
+	} else if(flags == GPUVM_REMOTE) {
+		err = remote_devapi_init();
+	} else if(flags == GPUVM_PLUGIN) {
+		err = plugin_devapi_init();
 	}
+	if(err)
+		return err;
+	devapi_set_caps(devapi_g);
+	return 0;
 }  // devapi_init
 
+/** copies a contiguous range in either direction through the transfer
+		scheduler; background copies are split into chunks, each admitted
+		separately
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf device buffer
+		@param hostptr host pointer
+		@param nbytes how many bytes to copy
+		@param devoff offset in device buffer
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int devapi_copy
+(devapi_t *devapi, unsigned idev, void *buf, void *hostptr, size_t nbytes, 
+ size_t devoff, int to_device) {
+	int xclass = xsched_class(to_device);
+	size_t chunk = xsched_chunk(xclass, to_device), offset = 0;
+	int err = 0;
+	do {
+		size_t chunk_nbytes = nbytes - offset < chunk ? nbytes - offset : chunk;
+		xsched_ticket_t ticket;
+		xsched_begin(&ticket, xclass, to_device);
+		sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+
+		char *chunk_ptr = (char*)hostptr + offset;
+		err = to_device ?
+			devapi->memcpy_h2d(idev, buf, chunk_ptr, chunk_nbytes, devoff + offset) :
+			devapi->memcpy_d2h(idev, chunk_ptr, buf, chunk_nbytes, devoff + offset);
+
+		double time = xsched_end(&ticket, chunk_nbytes);
+		sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+		if(stat_enabled())
+			stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, time);
+		offset += chunk_nbytes;
+	} while(offset < nbytes && !err);
+	return err;
+}  // devapi_copy
+
 int memcpy_h2d
 (devapi_t *devapi, unsigned idev, void *tgt, void *src, size_t nbytes, 
  size_t devoff) {
-	// time API call
-	rtime_t start_time, end_time;
-	if(stat_enabled()) 
-		start_time = rtime_get();
+	return devapi_copy(devapi, idev, tgt, src, nbytes, devoff, 1);
+}  // memcpy_h2d
+
+int memcpy_d2h
+(devapi_t *devapi, unsigned idev, void *tgt, void *src, size_t nbytes, 
+ size_t devoff) {
+	return devapi_copy(devapi, idev, src, tgt, nbytes, devoff, 0);
+}  // memcpy_d2h
+
+/** copies a batch of ranges in either direction one by one, with
+		asynchronous copies, so that a copy is issued while the previous ones are
+		still in progress; must be called with signals blocked
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf device buffer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int devapi_copy_async_n
+(devapi_t *devapi, unsigned idev, void *buf, const devcopy_t *copies, 
+ unsigned ncopies, int to_device) {
+	void *events[DEVAPI_ASYNC_WINDOW];
+	unsigned icopy = 0;
+	int err = 0;
+	while(icopy < ncopies && !err) {
+		// issue a window of copies, then wait for all of them
+		unsigned nevents = 0, ievent;
+		for(; icopy < ncopies && nevents < DEVAPI_ASYNC_WINDOW && !err; icopy++) {
+			const devcopy_t *copy = &copies[icopy];
+			err = to_device ?
+				devapi->memcpy_h2d_async(idev, buf, copy->hostptr, copy->nbytes, 
+																 copy->devoff, &events[nevents]) :
+				devapi->memcpy_d2h_async(idev, copy->hostptr, buf, copy->nbytes, 
+																 copy->devoff, &events[nevents]);
+			if(!err)
+				nevents++;
+		}
+		for(ievent = 0; ievent < nevents; ievent++) {
+			int wait_err = devapi->event_wait(idev, events[ievent]);
+			if(!err)
+				err = wait_err;
+		}
+	}
+	return err;
+}  // devapi_copy_async_n
+
+/** copies a batch of ranges in either direction with the fastest way
+		available on the device: a batched copy, asynchronous copies or
+		synchronous copies one by one; must be called with signals blocked
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf device buffer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int devapi_copy_n
+(devapi_t *devapi, unsigned idev, void *buf, const devcopy_t *copies, 
+ unsigned ncopies, int to_device) {
+	if(devapi->caps & GPUVM_CAP_COPY_N) {
+		return to_device ? devapi->memcpy_h2d_n(idev, buf, copies, ncopies) :
+			devapi->memcpy_d2h_n(idev, buf, copies, ncopies);
+	}
+	if(ncopies > 1 && (devapi->caps & GPUVM_CAP_ASYNC))
+		return devapi_copy_async_n(devapi, idev, buf, copies, ncopies, to_device);
+	unsigned icopy;
+	int err = 0;
+	for(icopy = 0; icopy < ncopies && !err; icopy++) {
+		const devcopy_t *copy = &copies[icopy];
+		err = to_device ?
+			devapi->memcpy_h2d(idev, buf, copy->hostptr, copy->nbytes, copy->devoff) :
+			devapi->memcpy_d2h(idev, copy->hostptr, buf, copy->nbytes, copy->devoff);
+	}
+	return err;
+}  // devapi_copy_n
+
+int memcpy_h2d_n
+(devapi_t *devapi, unsigned idev, void *tgt, const devcopy_t *copies, 
+ unsigned ncopies) {
+	if(ncopies == 1)
+		return memcpy_h2d(devapi, idev, tgt, copies->hostptr, copies->nbytes, 
+											copies->devoff);
+	xsched_ticket_t ticket;
+	xsched_begin(&ticket, xsched_class(1), 1);
 	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
 
-	int err = devapi->memcpy_h2d(idev, tgt, src, nbytes, devoff);
+	int err = devapi_copy_n(devapi, idev, tgt, copies, ncopies, 1);
 
+	double time = xsched_end(&ticket, 0);
 	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
-	if(stat_enabled()) {
-		end_time = rtime_get();
-		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, rtime_diff(&start_time, &end_time));
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, time);
+	return err;
+}  // memcpy_h2d_n
+
+int memcpy_d2h_n
+(devapi_t *devapi, unsigned idev, void *src, const devcopy_t *copies, 
+ unsigned ncopies) {
+	if(ncopies == 1)
+		return memcpy_d2h(devapi, idev, copies->hostptr, src, copies->nbytes, 
+											copies->devoff);
+	xsched_ticket_t ticket;
+	xsched_begin(&ticket, xsched_class(0), 0);
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+
+	int err = devapi_copy_n(devapi, idev, src, copies, ncopies, 0);
+
+	double time = xsched_end(&ticket, 0);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, time);
+	return err;
+}  // memcpy_d2h_n
+
+/** copies rectangular blocks row by row, for devices which can't copy them
+		directly; must be called with signals blocked
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf device buffer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int devapi_copy_rect_rows
+(devapi_t *devapi, unsigned idev, void *buf, const devrect_t *rects, 
+ unsigned nrects, int to_device) {
+	devcopy_t copies[DEVAPI_ROW_BATCH];
+	unsigned irect, ncopies = 0;
+	int err = 0;
+	for(irect = 0; irect < nrects && !err; irect++) {
+		const devrect_t *rect = &rects[irect];
+		size_t z, y;
+		for(z = 0; z < rect->depth && !err; z++)
+			for(y = 0; y < rect->height && !err; y++) {
+				devcopy_t *copy = &copies[ncopies++];
+				copy->hostptr = (char*)rect->hostptr + z * rect->host_slice_pitch + 
+					y * rect->host_row_pitch;
+				copy->nbytes = rect->width;
+				copy->devoff = rect->devoff + z * rect->dev_slice_pitch + 
+					y * rect->dev_row_pitch;
+				if(ncopies == DEVAPI_ROW_BATCH) {
+					err = devapi_copy_n(devapi, idev, buf, copies, ncopies, to_device);
+					ncopies = 0;
+				}
+			}
 	}
+	if(!err && ncopies)
+		err = devapi_copy_n(devapi, idev, buf, copies, ncopies, to_device);
 	return err;
-}  // memcpy_h2d
+}  // devapi_copy_rect_rows
 
-int memcpy_d2h
-(devapi_t *devapi, unsigned idev, void *tgt, void *src, size_t nbytes, 
- size_t devoff) {
-	// time API call
-	rtime_t start_time, end_time;
-	if(stat_enabled()) 
-		start_time = rtime_get();
+int memcpy_h2d_rect
+(devapi_t *devapi, unsigned idev, void *tgt, const devrect_t *rects, 
+ unsigned nrects) {
+	xsched_ticket_t ticket;
+	xsched_begin(&ticket, xsched_class(1), 1);
 	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
 
-	int err = devapi->memcpy_d2h(idev, tgt, src, nbytes, devoff);
-	
+	int err;
+	if(devapi->caps & GPUVM_CAP_COPY_RECT)
+		err = devapi->memcpy_h2d_rect(idev, tgt, rects, nrects);
+	else
+		err = devapi_copy_rect_rows(devapi, idev, tgt, rects, nrects, 1);
+
+	double time = xsched_end(&ticket, 0);
 	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, time);
+	return err;
+}  // memcpy_h2d_rect
+
+int memcpy_d2h_rect
+(devapi_t *devapi, unsigned idev, void *src, const devrect_t *rects, 
+ unsigned nrects) {
+	xsched_ticket_t ticket;
+	xsched_begin(&ticket, xsched_class(0), 0);
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+
+	int err;
+	if(devapi->caps & GPUVM_CAP_COPY_RECT)
+		err = devapi->memcpy_d2h_rect(idev, src, rects, nrects);
+	else
+		err = devapi_copy_rect_rows(devapi, idev, src, rects, nrects, 0);
 
-	if(stat_enabled()) {
-		end_time = rtime_get();
-		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, rtime_diff(&start_time, &end_time));
+	double time = xsched_end(&ticket, 0);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_HOST_COPY_TIME, time);
+	return err;
+}  // memcpy_d2h_rect
+
+int mem_alloc(devapi_t *devapi, unsigned idev, size_t nbytes, void **pbuf) {
+	*pbuf = 0;
+	if(!(devapi->caps & GPUVM_CAP_ALLOC)) {
+		fprintf(stderr, "mem_alloc: device allocation not supported by the API\n");
+		return GPUVM_EAPI;
 	}
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_alloc(idev, nbytes, pbuf);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
 	return err;
-}  // memcpy_d2h
+}  // mem_alloc
+
+int mem_free(devapi_t *devapi, unsigned idev, void *buf) {
+	if(!(devapi->caps & GPUVM_CAP_ALLOC))
+		return GPUVM_EAPI;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_free(idev, buf);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_free
+
+int host_unified(devapi_t *devapi, unsigned idev) {
+	if(!(devapi->caps & GPUVM_CAP_MAP))
+		return 0;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int res = devapi->host_unified(idev);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return res;
+}  // host_unified
+
+int mem_wrap
+(devapi_t *devapi, unsigned idev, void *hostptr, size_t nbytes, void **pbuf) {
+	*pbuf = 0;
+	if(!(devapi->caps & GPUVM_CAP_MAP)) {
+		fprintf(stderr, "mem_wrap: host memory buffers not supported by the API\n");
+		return GPUVM_EAPI;
+	}
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_wrap(idev, hostptr, nbytes, pbuf);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_wrap
+
+int mem_unwrap(devapi_t *devapi, unsigned idev, void *buf) {
+	if(!(devapi->caps & GPUVM_CAP_MAP))
+		return GPUVM_EAPI;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_unwrap(idev, buf);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_unwrap
+
+int mem_map
+(devapi_t *devapi, unsigned idev, void *buf, void *hostptr, size_t nbytes) {
+	if(!(devapi->caps & GPUVM_CAP_MAP))
+		return GPUVM_EAPI;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_map(idev, buf, hostptr, nbytes);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_map
+
+int mem_unmap(devapi_t *devapi, unsigned idev, void *buf, void *hostptr) {
+	if(!(devapi->caps & GPUVM_CAP_MAP))
+		return GPUVM_EAPI;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_unmap(idev, buf, hostptr);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_unmap
+
+int memcpy_peer
+(devapi_t *devapi, unsigned tgt_idev, void *tgt, size_t tgtoff, 
+ unsigned src_idev, void *src, size_t srcoff, size_t nbytes) {
+	if(!(devapi->caps & GPUVM_CAP_PEER))
+		return GPUVM_EAPI;
+	// copies between devices take the link to device
+	xsched_ticket_t ticket;
+	xsched_begin(&ticket, xsched_class(1), 1);
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+
+	int err = devapi->memcpy_peer
+		(tgt_idev, tgt, tgtoff, src_idev, src, srcoff, nbytes);
+
+	double time = xsched_end(&ticket, 0);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	// no host memory is involved, so the copy counts as a device copy only
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_COPY_TIME, time);
+	return err;
+}  // memcpy_peer
+
+int mem_fill
+(devapi_t *devapi, unsigned idev, void *buf, size_t devoff, size_t nbytes, 
+ int value) {
+	if(!(devapi->caps & GPUVM_CAP_FILL))
+		return GPUVM_EAPI;
+	sigprocmask(SIG_BLOCK, &devapi_block_sig_g, 0);
+	int err = devapi->mem_fill(idev, buf, devoff, nbytes, value);
+	sigprocmask(SIG_UNBLOCK, &devapi_block_sig_g, 0);
+	return err;
+}  // mem_fill
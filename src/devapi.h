@@ -2,14 +2,30 @@
 #define GPUVM_DEVAPI_H_
 
 /** @file devapi.h
-		API for interaction with device, either CUDA or OpenCL
+		API for interaction with device, CUDA, OpenCL or simulated device
 */
 
-/** describes an abstract API for interaction with device, such as CUDA or
-		OpenCL. As everywhere in libgpuvm, functions accept arguments, first of
+#include "gpuvm-backend.h"
+
+/** describes an abstract API for interaction with device, such as CUDA,
+		OpenCL or simulated device. As everywhere in libgpuvm, functions accept arguments, first of
 		which is the device number, and then go other arguments. All functions
 		return error code */
+
+/** a single range copied between a host array and a device buffer as part of
+		a batched copy */
+typedef gpuvm_backend_copy_t devcopy_t;
+
+/** a rectangular (2D or 3D) block copied between strided host memory and a
+		device buffer as part of a batched copy */
+typedef gpuvm_backend_rect_t devrect_t;
+
 typedef struct devapi_struct {
+
+	/** capabilities of the API, a combination of GPUVM_CAP_*, telling which
+			optional entries are available; set by devapi_init() from the entries
+			which are not 0 */
+	unsigned caps;
 	
 	/** copies data synchronously from host to device; also updates device-related
 			time counters if provided by device
@@ -33,6 +49,180 @@ typedef struct devapi_struct {
 	 */
 	int (*memcpy_d2h)(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
 
+	/** copies several ranges synchronously from host to the same device buffer,
+			waiting only once for all of them to complete; may be 0 if not supported
+			by device, in which case memcpy_h2d is called for each range
+			@param idev GPUVM device number
+			@param tgt target pointer, that is, device pointer
+			@param copies ranges to copy
+			@param ncopies number of ranges to copy
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_h2d_n)
+	(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies);
+
+	/** copies several ranges synchronously from the same device buffer to host,
+			waiting only once for all of them to complete; may be 0 if not supported
+			by device, in which case memcpy_d2h is called for each range
+			@param idev GPUVM device number
+			@param src source pointer, that is, device pointer
+			@param copies ranges to copy
+			@param ncopies number of ranges to copy
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_d2h_n)
+	(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies);
+
+	/** copies several rectangular blocks synchronously from strided host memory
+			to the same device buffer, waiting only once for all of them to
+			complete; may be 0 if not supported by device, in which case each row of
+			each block is copied as a separate range with memcpy_h2d_n
+			@param idev GPUVM device number
+			@param tgt target pointer, that is, device pointer
+			@param rects blocks to copy
+			@param nrects number of blocks to copy
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_h2d_rect)
+	(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects);
+
+	/** copies several rectangular blocks synchronously from the same device
+			buffer to strided host memory, waiting only once for all of them to
+			complete; may be 0 if not supported by device, in which case each row of
+			each block is copied as a separate range with memcpy_d2h_n
+			@param idev GPUVM device number
+			@param src source pointer, that is, device pointer
+			@param rects blocks to copy
+			@param nrects number of blocks to copy
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_d2h_rect)
+	(unsigned idev, void *src, const devrect_t *rects, unsigned nrects);
+
+	/** allocates a buffer on device; may be 0 if the device does not support
+			allocation by GPUVM
+			@param idev GPUVM device number
+			@param nbytes the size of the buffer
+			@param pbuf [out] *pbuf is the allocated buffer if successful
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_alloc)(unsigned idev, size_t nbytes, void **pbuf);
+
+	/** frees a buffer previously allocated with mem_alloc
+			@param idev GPUVM device number
+			@param buf the buffer to free
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_free)(unsigned idev, void *buf);
+
+	/** checks whether the device shares memory with host, e.g. is a CPU or an
+			integrated GPU; may be 0, in which case the device is assumed not to
+			@param idev GPUVM device number
+			@returns nonzero if the device shares memory with host and 0 if not
+	 */
+	int (*host_unified)(unsigned idev);
+
+	/** creates a device buffer which uses host memory as its storage, so that
+			no copies are needed; the data are accessible to host only while the
+			buffer is mapped. May be 0 if not supported by device
+			@param idev GPUVM device number
+			@param hostptr the host memory to use
+			@param nbytes the size of the host memory
+			@param pbuf [out] *pbuf is the created buffer if successful
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_wrap)(unsigned idev, void *hostptr, size_t nbytes, void **pbuf);
+
+	/** releases a buffer created with mem_wrap; the buffer must not be mapped
+			@param idev GPUVM device number
+			@param buf the buffer to release
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_unwrap)(unsigned idev, void *buf);
+
+	/** maps a buffer created with mem_wrap for host access, and waits until its
+			data are accessible at its host memory
+			@param idev GPUVM device number
+			@param buf the buffer to map
+			@param hostptr the host memory of the buffer
+			@param nbytes the size of the buffer
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_map)(unsigned idev, void *buf, void *hostptr, size_t nbytes);
+
+	/** unmaps a buffer mapped with mem_map, so that it can be used by device
+			@param idev GPUVM device number
+			@param buf the buffer to unmap
+			@param hostptr the host memory of the buffer
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_unmap)(unsigned idev, void *buf, void *hostptr);
+
+	/** starts a copy from host to device, without waiting for it to complete;
+			may be 0 if not supported by device, and then so must be
+			memcpy_d2h_async and event_wait
+			@param idev GPUVM device number
+			@param tgt target pointer, that is, device pointer
+			@param src source pointer, that is, host pointer
+			@param nbytes how many bytes to copy
+			@param devoff offset in device buffer
+			@param pevent [out] *pevent is the event of the copy if successful, to
+			be passed to event_wait
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_h2d_async)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+	 void **pevent);
+
+	/** starts a copy from device to host, without waiting for it to complete
+			@param idev GPUVM device number
+			@param tgt target pointer, that is, host pointer
+			@param src source pointer, that is, device pointer
+			@param nbytes how many bytes to copy
+			@param devoff offset in device buffer
+			@param pevent [out] *pevent is the event of the copy if successful, to
+			be passed to event_wait
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*memcpy_d2h_async)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+	 void **pevent);
+
+	/** waits for an asynchronous copy to complete, and releases its event
+			@param idev GPUVM device number
+			@param event the event of the copy
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*event_wait)(unsigned idev, void *event);
+
+	/** copies data synchronously between buffers of two devices; may be 0 if
+			not supported by devices
+			@param tgt_idev GPUVM number of the target device
+			@param tgt target buffer
+			@param tgtoff offset in target buffer
+			@param src_idev GPUVM number of the source device
+			@param src source buffer
+			@param srcoff offset in source buffer
+			@param nbytes how many bytes to copy
+			@returns 0 if successful and a negative error code if not, in
+			particular ::GPUVM_EAPI if the devices can't copy directly
+	 */
+	int (*memcpy_peer)
+	(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+	 size_t srcoff, size_t nbytes);
+
+	/** fills a range of a device buffer with a byte value, without copying
+			from host; may be 0 if not supported by device
+			@param idev GPUVM device number
+			@param buf the device buffer
+			@param devoff offset of the range in the buffer
+			@param nbytes the size of the range
+			@param value the value of each byte
+			@returns 0 if successful and a negative error code if not
+	 */
+	int (*mem_fill)
+	(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value);
+
 } devapi_t;
 
 /** global devapi variable pointer */
@@ -68,4 +258,158 @@ int memcpy_h2d
  */
 int memcpy_d2h
 (devapi_t *devapi, unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+
+/** a wrapper function for batched host-to-device copy of several ranges into
+		the same device buffer; uses devapi->memcpy_h2d_n if available, and
+		devapi->memcpy_h2d for each range if not
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+int memcpy_h2d_n
+(devapi_t *devapi, unsigned idev, void *tgt, const devcopy_t *copies, 
+ unsigned ncopies);
+
+/** a wrapper function for batched device-to-host copy of several ranges from
+		the same device buffer; uses devapi->memcpy_d2h_n if available, and
+		devapi->memcpy_d2h for each range if not
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+int memcpy_d2h_n
+(devapi_t *devapi, unsigned idev, void *src, const devcopy_t *copies, 
+ unsigned ncopies);
+
+/** a wrapper function for batched host-to-device copy of several rectangular
+		blocks into the same device buffer; uses devapi->memcpy_h2d_rect if
+		available, and copies the rows of the blocks as ranges if not
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+int memcpy_h2d_rect
+(devapi_t *devapi, unsigned idev, void *tgt, const devrect_t *rects, 
+ unsigned nrects);
+
+/** a wrapper function for batched device-to-host copy of several rectangular
+		blocks from the same device buffer; uses devapi->memcpy_d2h_rect if
+		available, and copies the rows of the blocks as ranges if not
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+int memcpy_d2h_rect
+(devapi_t *devapi, unsigned idev, void *src, const devrect_t *rects, 
+ unsigned nrects);
+
+/** a wrapper function for device buffer allocation
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param nbytes the size of the buffer
+		@param pbuf [out] *pbuf is the allocated buffer if successful
+		@returns 0 if successful and a negative error code if not, in particular
+		::GPUVM_EAPI if the device does not support allocation by GPUVM
+ */
+int mem_alloc(devapi_t *devapi, unsigned idev, size_t nbytes, void **pbuf);
+
+/** a wrapper function for freeing a device buffer
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf the buffer to free
+		@returns 0 if successful and a negative error code if not
+ */
+int mem_free(devapi_t *devapi, unsigned idev, void *buf);
+
+/** a wrapper function checking whether the device shares memory with host
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@returns nonzero if it does and 0 if it does not or if the API can't tell
+ */
+int host_unified(devapi_t *devapi, unsigned idev);
+
+/** a wrapper function for creating a device buffer over host memory
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param hostptr the host memory to use
+		@param nbytes the size of the host memory
+		@param pbuf [out] *pbuf is the created buffer if successful
+		@returns 0 if successful and a negative error code if not, in particular
+		::GPUVM_EAPI if not supported by the API
+ */
+int mem_wrap
+(devapi_t *devapi, unsigned idev, void *hostptr, size_t nbytes, void **pbuf);
+
+/** a wrapper function for releasing a buffer created over host memory
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf the buffer to release
+		@returns 0 if successful and a negative error code if not
+ */
+int mem_unwrap(devapi_t *devapi, unsigned idev, void *buf);
+
+/** a wrapper function for mapping a buffer created over host memory for host
+		access
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf the buffer to map
+		@param hostptr the host memory of the buffer
+		@param nbytes the size of the buffer
+		@returns 0 if successful and a negative error code if not
+ */
+int mem_map
+(devapi_t *devapi, unsigned idev, void *buf, void *hostptr, size_t nbytes);
+
+/** a wrapper function for unmapping a buffer created over host memory, for
+		device access
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf the buffer to unmap
+		@param hostptr the host memory of the buffer
+		@returns 0 if successful and a negative error code if not
+ */
+int mem_unmap(devapi_t *devapi, unsigned idev, void *buf, void *hostptr);
+
+/** a wrapper function for a copy between buffers of two devices
+		@param devapi API used to interact with devices
+		@param tgt_idev GPUVM number of the target device
+		@param tgt target buffer
+		@param tgtoff offset in target buffer
+		@param src_idev GPUVM number of the source device
+		@param src source buffer
+		@param srcoff offset in source buffer
+		@param nbytes how many bytes to copy
+		@returns 0 if successful and a negative error code if not, in particular
+		::GPUVM_EAPI if the devices can't copy directly, in which case the data
+		must be copied through host
+ */
+int memcpy_peer
+(devapi_t *devapi, unsigned tgt_idev, void *tgt, size_t tgtoff, 
+ unsigned src_idev, void *src, size_t srcoff, size_t nbytes);
+
+/** a wrapper function for filling a range of a device buffer with a byte value
+		@param devapi API used to interact with device
+		@param idev GPUVM device number
+		@param buf the device buffer
+		@param devoff offset of the range in the buffer
+		@param nbytes the size of the range
+		@param value the value of each byte
+		@returns 0 if successful and a negative error code if not, in particular
+		::GPUVM_EAPI if not supported by the API
+ */
+int mem_fill
+(devapi_t *devapi, unsigned idev, void *buf, size_t devoff, size_t nbytes, 
+ int value);
 #endif
@@ -0,0 +1,168 @@
+/** @file devmem.c implementation of device memory allocated by GPUVM */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "devapi.h"
+#include "devmem.h"
+#include "gpuvm.h"
+#include "util.h"
+
+/** number of bits in a word of the free block mask */
+#define DEVMEM_MASK_BITS (sizeof(unsigned long) * 8)
+
+/** number of words in the free block mask */
+#define DEVMEM_MASK_WORDS \
+	(DEVMEM_SLAB_SIZE / (1 << DEVMEM_MIN_CLASS_SHIFT) / DEVMEM_MASK_BITS)
+
+/** a slab, i.e. a single device buffer divided into blocks of equal size */
+typedef struct devmem_slab_struct {
+	/** the device buffer */
+	void *buf;
+	/** total number of blocks in the slab */
+	unsigned nblocks;
+	/** number of free blocks in the slab */
+	unsigned nfree;
+	/** free block mask; a set bit indicates a free block */
+	unsigned long free_mask[DEVMEM_MASK_WORDS];
+	/** next slab of the same size class */
+	struct devmem_slab_struct *next;
+} devmem_slab_t;
+
+/** a per-device arena */
+typedef struct {
+	/** slabs of each size class */
+	devmem_slab_t *slabs[DEVMEM_NCLASSES];
+} devmem_arena_t;
+
+/** arenas, one per device */
+static devmem_arena_t *devmem_arenas_g = 0;
+
+/** mutex protecting the arenas */
+static pthread_mutex_t devmem_mutex_g = PTHREAD_MUTEX_INITIALIZER;
+
+int devmem_init(void) {
+	devmem_arenas_g = (devmem_arena_t*)smalloc(ndevs_g * sizeof(devmem_arena_t));
+	if(!devmem_arenas_g)
+		return GPUVM_ESALLOC;
+	memset(devmem_arenas_g, 0, ndevs_g * sizeof(devmem_arena_t));
+	return 0;
+}  // devmem_init
+
+/** gets the size class of an array 
+		@param nbytes the size of the array
+		@returns the size class, or DEVMEM_NCLASSES if the array is too large to
+		be placed into a slab
+ */
+static unsigned devmem_class(size_t nbytes) {
+	unsigned iclass;
+	for(iclass = 0; iclass < DEVMEM_NCLASSES; iclass++)
+		if(nbytes <= (size_t)1 << (iclass + DEVMEM_MIN_CLASS_SHIFT))
+			return iclass;
+	return DEVMEM_NCLASSES;
+}  // devmem_class
+
+/** allocates a new slab and adds it to the arena
+		@param idev the device for which to allocate the slab
+		@param iclass the size class of the slab
+		@returns the new slab if successful and 0 if not
+ */
+static devmem_slab_t *devmem_slab_alloc(unsigned idev, unsigned iclass) {
+	devmem_slab_t *slab = (devmem_slab_t*)smalloc(sizeof(devmem_slab_t));
+	if(!slab)
+		return 0;
+	memset(slab, 0, sizeof(devmem_slab_t));
+	if(mem_alloc(devapi_g, idev, DEVMEM_SLAB_SIZE, &slab->buf)) {
+		sfree(slab);
+		return 0;
+	}
+	slab->nblocks = DEVMEM_SLAB_SIZE >> (iclass + DEVMEM_MIN_CLASS_SHIFT);
+	slab->nfree = slab->nblocks;
+	unsigned iblock;
+	for(iblock = 0; iblock < slab->nblocks; iblock++)
+		slab->free_mask[iblock / DEVMEM_MASK_BITS] |= 1ul << iblock % DEVMEM_MASK_BITS;
+	devmem_arena_t *arena = &devmem_arenas_g[idev];
+	slab->next = arena->slabs[iclass];
+	arena->slabs[iclass] = slab;
+	return slab;
+}  // devmem_slab_alloc
+
+/** allocates device memory; the arenas must be locked
+		@see devmem_alloc()
+ */
+static int devmem_alloc_locked
+(unsigned idev, size_t nbytes, void **pbuf, size_t *pdevoff) {
+	*pbuf = 0;
+	*pdevoff = 0;
+	unsigned iclass = devmem_class(nbytes);
+	if(iclass == DEVMEM_NCLASSES)
+		return mem_alloc(devapi_g, idev, nbytes, pbuf);
+
+	// find a slab with a free block, or allocate a new one
+	devmem_slab_t *slab;
+	for(slab = devmem_arenas_g[idev].slabs[iclass]; slab; slab = slab->next)
+		if(slab->nfree)
+			break;
+	if(!slab && !(slab = devmem_slab_alloc(idev, iclass)))
+		return GPUVM_EDEVALLOC;
+
+	// take the first free block
+	unsigned iword;
+	for(iword = 0; !slab->free_mask[iword]; iword++);
+	unsigned ibit = __builtin_ctzl(slab->free_mask[iword]);
+	slab->free_mask[iword] &= ~(1ul << ibit);
+	slab->nfree--;
+	*pbuf = slab->buf;
+	*pdevoff = (size_t)(iword * DEVMEM_MASK_BITS + ibit) << 
+		(iclass + DEVMEM_MIN_CLASS_SHIFT);
+	return 0;
+}  // devmem_alloc_locked
+
+/** frees device memory; the arenas must be locked
+		@see devmem_free()
+ */
+static int devmem_free_locked
+(unsigned idev, size_t nbytes, void *buf, size_t devoff) {
+	unsigned iclass = devmem_class(nbytes);
+	if(iclass == DEVMEM_NCLASSES)
+		return mem_free(devapi_g, idev, buf);
+
+	devmem_slab_t **pslab;
+	for(pslab = &devmem_arenas_g[idev].slabs[iclass]; *pslab; 
+			pslab = &(*pslab)->next)
+		if((*pslab)->buf == buf)
+			break;
+	devmem_slab_t *slab = *pslab;
+	if(!slab) {
+		fprintf(stderr, "devmem_free: buffer not allocated by GPUVM\n");
+		return GPUVM_EARG;
+	}
+	unsigned iblock = devoff >> (iclass + DEVMEM_MIN_CLASS_SHIFT);
+	slab->free_mask[iblock / DEVMEM_MASK_BITS] |= 1ul << iblock % DEVMEM_MASK_BITS;
+	slab->nfree++;
+
+	// release an empty slab, unless it is the only one of its class
+	if(slab->nfree == slab->nblocks && 
+		 (slab != devmem_arenas_g[idev].slabs[iclass] || slab->next)) {
+		*pslab = slab->next;
+		int err = mem_free(devapi_g, idev, slab->buf);
+		sfree(slab);
+		return err;
+	}
+	return 0;
+}  // devmem_free_locked
+
+int devmem_alloc(unsigned idev, size_t nbytes, void **pbuf, size_t *pdevoff) {
+	pthread_mutex_lock(&devmem_mutex_g);
+	int err = devmem_alloc_locked(idev, nbytes, pbuf, pdevoff);
+	pthread_mutex_unlock(&devmem_mutex_g);
+	return err;
+}  // devmem_alloc
+
+int devmem_free(unsigned idev, size_t nbytes, void *buf, size_t devoff) {
+	pthread_mutex_lock(&devmem_mutex_g);
+	int err = devmem_free_locked(idev, nbytes, buf, devoff);
+	pthread_mutex_unlock(&devmem_mutex_g);
+	return err;
+}  // devmem_free
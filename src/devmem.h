@@ -0,0 +1,49 @@
+#ifndef GPUVM_DEVMEM_H_
+#define GPUVM_DEVMEM_H_
+
+/** @file devmem.h 
+		interface to device memory allocated by GPUVM itself. Small arrays are
+		packed into large shared device buffers (slabs), each of which is divided
+		into blocks of a single size class; large arrays get device buffers of their
+		own. All functions are thread-safe
+ */
+
+#include <stddef.h>
+
+/** log2 of the smallest size class, in bytes */
+#define DEVMEM_MIN_CLASS_SHIFT 8
+
+/** log2 of the largest size class, in bytes; larger arrays are allocated
+		separately */
+#define DEVMEM_MAX_CLASS_SHIFT 16
+
+/** number of size classes */
+#define DEVMEM_NCLASSES (DEVMEM_MAX_CLASS_SHIFT - DEVMEM_MIN_CLASS_SHIFT + 1)
+
+/** size of a single slab, in bytes */
+#define DEVMEM_SLAB_SIZE (1024 * 1024)
+
+/** initializes per-device arenas
+		@returns 0 if successful and a negative error code if not
+ */
+int devmem_init(void);
+
+/** allocates device memory for an array
+		@param idev the device on which to allocate memory
+		@param nbytes the size of the array
+		@param pbuf [out] *pbuf is the device buffer containing the array
+		@param pdevoff [out] *pdevoff is the offset of the array in the buffer
+		@returns 0 if successful and a negative error code if not
+ */
+int devmem_alloc(unsigned idev, size_t nbytes, void **pbuf, size_t *pdevoff);
+
+/** frees device memory previously allocated with devmem_alloc()
+		@param idev the device on which the memory has been allocated
+		@param nbytes the size of the array, the same as passed to devmem_alloc()
+		@param buf the device buffer
+		@param devoff the offset of the array in the device buffer
+		@returns 0 if successful and a negative error code if not
+ */
+int devmem_free(unsigned idev, size_t nbytes, void *buf, size_t devoff);
+
+#endif
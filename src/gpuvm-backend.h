@@ -0,0 +1,186 @@
+/** @file gpuvm-backend.h interface of device backends loaded by GPUVM at run
+		time from a shared library, see ::GPUVM_PLUGIN. The library must export
+		a function named #GPUVM_BACKEND_ENTRY, of type ::gpuvm_backend_entry_t,
+		which returns the description of the backend. The backend advertises
+		optional features with capability bits; entries for features it does not
+		advertise are ignored, and GPUVM falls back to slower ways of doing the
+		same, e.g. to one synchronous copy per range if neither batched nor
+		asynchronous copies are available. As everywhere in libgpuvm, functions
+		accept the device number as their first argument, and return 0 if
+		successful and a negative GPUVM error code if not */
+
+#ifndef _GPUVM_BACKEND_H_
+#define _GPUVM_BACKEND_H_
+
+#include <stddef.h>
+
+#include "gpuvm.h"
+
+/** the version of the backend interface described by this header; it is
+		incremented on any incompatible change */
+#define GPUVM_BACKEND_ABI_VERSION 1
+
+/** the name of the function exported by a backend library */
+#define GPUVM_BACKEND_ENTRY "gpuvm_backend_entry"
+
+/** capabilities of a backend, each enabling a group of optional entries */
+enum {
+	/** memcpy_h2d_n and memcpy_d2h_n, batched copies of several ranges */
+	GPUVM_CAP_COPY_N = 0x1,
+	/** memcpy_h2d_rect and memcpy_d2h_rect, copies of rectangular blocks */
+	GPUVM_CAP_COPY_RECT = 0x2,
+	/** mem_alloc and mem_free, allocation of device buffers by GPUVM */
+	GPUVM_CAP_ALLOC = 0x4,
+	/** host_unified, mem_wrap, mem_unwrap, mem_map and mem_unmap, device
+			buffers over host memory */
+	GPUVM_CAP_MAP = 0x8,
+	/** memcpy_h2d_async, memcpy_d2h_async and event_wait, copies which can be
+			issued before the previous ones complete */
+	GPUVM_CAP_ASYNC = 0x10,
+	/** memcpy_peer, direct copies between buffers of two devices */
+	GPUVM_CAP_PEER = 0x20,
+	/** mem_fill, filling a device buffer range without a copy from host */
+	GPUVM_CAP_FILL = 0x40,
+	/** all capabilities */
+	GPUVM_CAP_ALL = 0x7f
+};
+
+/** parameters of a device of a backend loaded at run time; with
+		::GPUVM_PLUGIN, a pointer to such structure must be passed to gpuvm_init()
+		for each device, and all devices must use the same library */
+typedef struct {
+	/** path to the backend library, as accepted by dlopen() */
+	const char *path;
+	/** parameters of the device, passed to the backend as is */
+	void *params;
+} gpuvm_plugin_params_t;
+
+/** a single range copied between a host array and a device buffer as part of
+		a batched copy */
+typedef struct {
+	/** host pointer */
+	void *hostptr;
+	/** how many bytes to copy */
+	size_t nbytes;
+	/** offset in device buffer */
+	size_t devoff;
+} gpuvm_backend_copy_t;
+
+/** a rectangular (2D or 3D) block copied between strided host memory and a
+		device buffer as part of a batched copy; pitches are in bytes, and the
+		block is width bytes by height rows by depth slices */
+typedef struct {
+	/** host pointer to the first byte of the block */
+	void *hostptr;
+	/** offset of the first byte of the block in device buffer */
+	size_t devoff;
+	/** width of the block in bytes */
+	size_t width;
+	/** height of the block in rows */
+	size_t height;
+	/** depth of the block in slices */
+	size_t depth;
+	/** distance between consecutive rows on host */
+	size_t host_row_pitch;
+	/** distance between consecutive slices on host; a multiple of
+			host_row_pitch */
+	size_t host_slice_pitch;
+	/** distance between consecutive rows on device */
+	size_t dev_row_pitch;
+	/** distance between consecutive slices on device; a multiple of
+			dev_row_pitch */
+	size_t dev_slice_pitch;
+} gpuvm_backend_rect_t;
+
+/** a backend; device buffers are opaque to GPUVM, and are either passed to
+		it by the application or allocated with mem_alloc. All copies are done
+		with signals blocked, and may be requested from several threads at once */
+typedef struct {
+	/** the version of the interface, must be ::GPUVM_BACKEND_ABI_VERSION */
+	unsigned abi_version;
+	/** capabilities, a combination of GPUVM_CAP_* */
+	unsigned caps;
+
+	/** initializes the backend; required
+			@param ndevs the number of devices
+			@param params parameters of each device, the params fields of
+			::gpuvm_plugin_params_t
+	 */
+	int (*init)(unsigned ndevs, void **params);
+
+	/** copies data synchronously from host to device; required */
+	int (*memcpy_h2d)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+	/** copies data synchronously from device to host; required */
+	int (*memcpy_d2h)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+
+	/** copies several ranges synchronously into the same device buffer */
+	int (*memcpy_h2d_n)
+	(unsigned idev, void *tgt, const gpuvm_backend_copy_t *copies,
+	 unsigned ncopies);
+	/** copies several ranges synchronously from the same device buffer */
+	int (*memcpy_d2h_n)
+	(unsigned idev, void *src, const gpuvm_backend_copy_t *copies,
+	 unsigned ncopies);
+
+	/** copies rectangular blocks synchronously into the same device buffer */
+	int (*memcpy_h2d_rect)
+	(unsigned idev, void *tgt, const gpuvm_backend_rect_t *rects,
+	 unsigned nrects);
+	/** copies rectangular blocks synchronously from the same device buffer */
+	int (*memcpy_d2h_rect)
+	(unsigned idev, void *src, const gpuvm_backend_rect_t *rects,
+	 unsigned nrects);
+
+	/** allocates a device buffer */
+	int (*mem_alloc)(unsigned idev, size_t nbytes, void **pbuf);
+	/** frees a buffer allocated with mem_alloc */
+	int (*mem_free)(unsigned idev, void *buf);
+
+	/** returns nonzero if the device shares memory with host, and 0 if not */
+	int (*host_unified)(unsigned idev);
+	/** creates a device buffer using host memory as its storage */
+	int (*mem_wrap)(unsigned idev, void *hostptr, size_t nbytes, void **pbuf);
+	/** releases a buffer created with mem_wrap */
+	int (*mem_unwrap)(unsigned idev, void *buf);
+	/** maps a buffer created with mem_wrap for host access */
+	int (*mem_map)(unsigned idev, void *buf, void *hostptr, size_t nbytes);
+	/** unmaps a buffer mapped with mem_map, for device access */
+	int (*mem_unmap)(unsigned idev, void *buf, void *hostptr);
+
+	/** starts a copy from host to device; the host memory must not be changed
+			until the copy completes. *pevent is set to an event passed to
+			event_wait; copies to the same device complete in order */
+	int (*memcpy_h2d_async)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff,
+	 void **pevent);
+	/** starts a copy from device to host; the host memory must not be accessed
+			until the copy completes */
+	int (*memcpy_d2h_async)
+	(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff,
+	 void **pevent);
+	/** waits for an asynchronous copy to complete and releases its event; each
+			event must be waited for exactly once, even if an earlier wait fails */
+	int (*event_wait)(unsigned idev, void *event);
+
+	/** copies data synchronously between buffers of two devices; may return
+			::GPUVM_EAPI for a pair of devices which can't copy directly */
+	int (*memcpy_peer)
+	(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+	 size_t srcoff, size_t nbytes);
+
+	/** sets nbytes bytes of the device buffer, starting at devoff, to value */
+	int (*mem_fill)
+	(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value);
+} gpuvm_backend_t;
+
+/** the function exported by a backend library
+		@param abi_version the version of the interface GPUVM expects,
+		::GPUVM_BACKEND_ABI_VERSION
+		@returns the backend, valid until the process exits, or 0 if the library
+		does not support this version of the interface
+ */
+typedef const gpuvm_backend_t *(*gpuvm_backend_entry_t)(unsigned abi_version);
+
+#endif
@@ -4,15 +4,26 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "conv.h"
 #include "devapi.h"
+#include "devmem.h"
 #include "gpuvm.h"
 #include "handler.h"
+#include "hcopy.h"
 #include "host-array.h"
 #include "link.h"
+#include "prefetch.h"
+#include "rect.h"
+#include "residency.h"
 #include "stat.h"
+#include "stream.h"
 #include "subreg.h"
 #include "tsem.h"
 #include "util.h"
+#include "wback.h"
+#include "wthreads.h"
+#include "xsched.h"
+#include "zcopy.h"
 
 unsigned ndevs_g = 0;
 void **devs_g = 0;
@@ -88,7 +99,9 @@ int gpuvm_init(unsigned ndevs, void **devs, int flags) {
 		return GPUVM_EARG;
 	}
 	if(flags & ~(GPUVM_API | GPUVM_STAT | GPUVM_WRITER_SIG_BLOCK | 
-							 GPUVM_UNLINK_NO_SYNC_BACK) || !(flags & GPUVM_API)) {
+							 GPUVM_UNLINK_NO_SYNC_BACK | GPUVM_WRITE_BACK | 
+							 GPUVM_SERIAL_COPY) || 
+		 !(flags & GPUVM_API)) {
 		fprintf(stderr, "gpuvm_init: invalid flags\n");
 		return GPUVM_EARG;
 	}
@@ -111,7 +124,7 @@ int gpuvm_init(unsigned ndevs, void **devs, int flags) {
 	if(!devs_g)
 		return GPUVM_ESALLOC;
 
-	if(flags & GPUVM_OPENCL) {
+	if(flags & (GPUVM_OPENCL | GPUVM_REMOTE | GPUVM_PLUGIN)) {
 		if(!devs) {
 			fprintf(stderr, "gpuvm_init: null pointer to devices not allowed\n");
 			return GPUVM_ENULL;
@@ -120,61 +133,72 @@ int gpuvm_init(unsigned ndevs, void **devs, int flags) {
 	} else if(flags & GPUVM_CUDA) {
 		// ignore devs, just zero out devs_g
 		memset(devs_g, 0, ndevs * sizeof(void*));
+	} else if(flags & GPUVM_SIM) {
+		// device parameters are optional
+		if(devs)
+			memcpy(devs_g, devs, ndevs * sizeof(void*));
+		else
+			memset(devs_g, 0, ndevs * sizeof(void*));
 	}
 
 	// continue with initialization
 	(err = sync_init()) || 
+		(err = xsched_init()) ||
 		(err = devapi_init(flags)) ||
+		(err = devmem_init()) ||
+		(err = residency_init()) ||
 		(err = handler_init()) || 
 		(err = stat_init(flags)) || 
 		(err = tsem_init()) || 
-		(err = wthreads_init());
+		(err = wthreads_init()) ||
+		(err = hcopy_init(flags));
 	if(err)
 		return err;
 	
 	return 0;
 }  // gpuvm_init
 
-int gpuvm_link(void *hostptr, size_t nbytes, unsigned idev, void *devbuf, int
-flags) {
-	//fprintf(stderr, "linking\n");
-	// check arguments
-	if(!hostptr) {
-		fprintf(stderr, "gpuvm_link: hostptr is NULL\n");
-		return GPUVM_ENULL;
-	}
-	if(nbytes == 0) {
-		fprintf(stderr, "gpuvm_link: nbytes is zero\n");
-		return GPUVM_EARG;
-	}
-	if(idev >= ndevs_g) {
-		fprintf(stderr, "gpuvm_link: invalid device number\n");
-		return GPUVM_EARG;
-	}
-	if((flags & ~GPUVM_API) != GPUVM_ON_HOST && 
-		 (flags & ~GPUVM_API) != GPUVM_ON_DEVICE) {
-		fprintf(stderr, "gpuvm_link: invalid flags\n");
-		return GPUVM_EARG;
-	}
-	if(!devbuf) {
-		fprintf(stderr, "gpuvm_link: device buffer cannot be null\n");
-		return GPUVM_ENULL;
-	}
-
+/** links a host array with a device buffer; called after the arguments have
+		been checked
+		@param hostptr the host array to link
+		@param nbytes the size of the host array
+		@param idev the device on which to link the array
+		@param devbuf the device buffer, ignored if alloc is nonzero
+		@param alloc nonzero if the device memory is to be allocated by GPUVM
+		@param rect layout of a strided array, or 0 for an ordinary array
+		@param conv conversion of the array elements, or 0 if copied as is
+		@param flags link flags, see gpuvm_link()
+		@returns 0 if successful and a negative error code if not
+ */
+static int gpuvm_link_buf(void *hostptr, size_t nbytes, unsigned idev, 
+													void *devbuf, int alloc, const rect_t *rect, 
+													const conv_t *conv, int flags) {
 	// lock writer data structure
 	if(lock_writer())
 		return GPUVM_ERROR;
 
 	// find an array intersecting specified range
 	host_array_t *host_array = 0;
-	if(host_array_find(&host_array, hostptr, nbytes)) {
+	if(host_array_find(&host_array, hostptr, nbytes, rect)) {
 		//fprintf(stderr, "gpuvm_link: intersecting range already registered with GPUVM\n");
 		//fprintf(stderr, "ptr=%p, nbytes=%zd, rangeptr=%p, rangenbytes=%zd\n", 
 		//				hostptr, nbytes, host_array->range.ptr, host_array->range.nbytes);
 		unlock_writer();
 		return GPUVM_ERANGE;
 	}
+	if(stream_find(hostptr, nbytes) || zcopy_find(hostptr, nbytes)) {
+		unlock_writer();
+		return GPUVM_ERANGE;
+	}
 	//fprintf(stderr, "host array search finished\n");
+	if(host_array && 
+		 (!host_array->rect != !rect || !host_array->conv != !conv ||
+			(rect && memcmp(host_array->rect, rect, sizeof(rect_t))) ||
+			(conv && !conv_equal(host_array->conv, conv)))) {
+		// links of the same array on different devices must have the same layout
+		unlock_writer();
+		return GPUVM_ERANGE;
+	}
 	if(host_array) {
 		if(host_array->links[idev]) {
 			//fprintf(stderr, "gpuvm_link: link on specified device already exists\n");
@@ -189,14 +213,28 @@ flags) {
 		}
 	}
 
+	// allocate device memory if requested; if there is not enough, data on host
+	// can wait for memory until the first kernel which uses them
+	size_t devoff = 0;
+	int err = 0;
+	if(alloc && (err = devmem_alloc(idev, nbytes, &devbuf, &devoff))) {
+		if(err != GPUVM_EDEVALLOC || (flags & GPUVM_ON_DEVICE)) {
+			unlock_writer();
+			return err;
+		}
+		devbuf = 0;
+		err = 0;
+	}
+
 	// allocate an array if not found
 	host_array_t *new_host_array = 0;
-	int err = 0;
 	if(!host_array) {
-		err = host_array_alloc(&new_host_array, hostptr, nbytes, 
+		err = host_array_alloc(&new_host_array, hostptr, nbytes, rect, conv,
 													 flags & GPUVM_ON_DEVICE ? idev : -1);
 		//fprintf(stderr, "new host array allocated\n");
 		if(err) { 
+			if(alloc && devbuf)
+				devmem_free(idev, nbytes, devbuf, devoff);
 			unlock_writer();
 			return err;
 		}
@@ -207,20 +245,263 @@ flags) {
 
 	// create a link with an array (and assign it into the array)
 	link_t *link = 0;
-	err = link_alloc(&link, devbuf, idev, host_array);
+	err = link_alloc(&link, devbuf, devoff, idev, host_array);
 	//fprintf(stderr, "new link allocated\n");
 	if(err) {
+		if(alloc && devbuf)
+			devmem_free(idev, nbytes, devbuf, devoff);
 		host_array_free(new_host_array);
 		unlock_writer();
 		return err;
 	}
+	link->allocated = alloc != 0;
+	if(alloc)
+		residency_add(link);
 
 	if(unlock_writer())
 		return GPUVM_ERROR;
 	//fprintf(stderr, "hostptr %p registered with libgpuvm\n", hostptr);
 	return 0;
+}  // gpuvm_link_buf
+
+/** links a host array in zero-copy mode with a device which shares memory
+		with host; called after the arguments have been checked
+		@param hostptr the host array to link
+		@param nbytes the size of the host array
+		@param idev the device on which to link the array
+		@returns 0 if successful and a negative error code if not
+ */
+static int gpuvm_link_zcopy(void *hostptr, size_t nbytes, unsigned idev) {
+	if(lock_writer())
+		return GPUVM_ERROR;
+
+	// a zero-copy array may not intersect any other linked array, including
+	// another zero-copy link of the same array
+	host_array_t *host_array = 0;
+	if(host_array_find(&host_array, hostptr, nbytes, 0) || host_array || 
+		 stream_find(hostptr, nbytes) || zcopy_find(hostptr, nbytes)) {
+		unlock_writer();
+		return GPUVM_ERANGE;
+	}
+
+	zcopy_t *zcopy;
+	int err;
+	if(err = zcopy_alloc(&zcopy, hostptr, nbytes, idev)) {
+		unlock_writer();
+		return err;
+	}
+
+	if(unlock_writer())
+		return GPUVM_ERROR;
+	return 0;
+}  // gpuvm_link_zcopy
+
+int gpuvm_link(void *hostptr, size_t nbytes, unsigned idev, void *devbuf, int
+flags) {
+	//fprintf(stderr, "linking\n");
+	// check arguments
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_link: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(nbytes == 0) {
+		fprintf(stderr, "gpuvm_link: nbytes is zero\n");
+		return GPUVM_EARG;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_link: invalid device number\n");
+		return GPUVM_EARG;
+	}
+	if((flags & ~GPUVM_API) != GPUVM_ON_HOST && 
+		 (flags & ~GPUVM_API) != GPUVM_ON_DEVICE) {
+		fprintf(stderr, "gpuvm_link: invalid flags\n");
+		return GPUVM_EARG;
+	}
+	if(!devbuf) {
+		fprintf(stderr, "gpuvm_link: device buffer cannot be null\n");
+		return GPUVM_ENULL;
+	}
+	return gpuvm_link_buf(hostptr, nbytes, idev, devbuf, 0, 0, 0, flags);
 }  // gpuvm_link
 
+int gpuvm_link_alloc(void *hostptr, size_t nbytes, unsigned idev, int flags) {
+	// check arguments
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_link_alloc: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(nbytes == 0) {
+		fprintf(stderr, "gpuvm_link_alloc: nbytes is zero\n");
+		return GPUVM_EARG;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_link_alloc: invalid device number\n");
+		return GPUVM_EARG;
+	}
+	int zero_copy = flags & GPUVM_ZERO_COPY;
+	flags &= ~GPUVM_ZERO_COPY;
+	if((flags & ~GPUVM_API) != GPUVM_ON_HOST && 
+		 (flags & ~GPUVM_API) != GPUVM_ON_DEVICE) {
+		fprintf(stderr, "gpuvm_link_alloc: invalid flags\n");
+		return GPUVM_EARG;
+	}
+	if(zero_copy && host_unified(devapi_g, idev))
+		return gpuvm_link_zcopy(hostptr, nbytes, idev);
+	return gpuvm_link_buf(hostptr, nbytes, idev, 0, 1, 0, 0, flags);
+}  // gpuvm_link_alloc
+
+int gpuvm_link_rect(void *hostptr, const gpuvm_rect_t *rect, unsigned idev, 
+										void *devbuf, int flags) {
+	// check arguments
+	if(!hostptr || !rect) {
+		fprintf(stderr, "gpuvm_link_rect: hostptr or rect is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(!rect->region[0] || !rect->region[1] || !rect->region[2]) {
+		fprintf(stderr, "gpuvm_link_rect: tile is empty\n");
+		return GPUVM_EARG;
+	}
+	rect_t layout;
+	layout.width = rect->region[0];
+	layout.height = rect->region[1];
+	layout.depth = rect->region[2];
+	layout.row_pitch = rect->row_pitch ? rect->row_pitch : layout.width;
+	layout.slice_pitch = rect->slice_pitch ? rect->slice_pitch :
+		layout.row_pitch * layout.height;
+	if(layout.row_pitch < layout.width || 
+		 layout.slice_pitch < layout.row_pitch * layout.height ||
+		 layout.slice_pitch % layout.row_pitch) {
+		fprintf(stderr, "gpuvm_link_rect: invalid pitches\n");
+		return GPUVM_EARG;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_link_rect: invalid device number\n");
+		return GPUVM_EARG;
+	}
+	if((flags & ~GPUVM_API) != GPUVM_ON_HOST && 
+		 (flags & ~GPUVM_API) != GPUVM_ON_DEVICE) {
+		fprintf(stderr, "gpuvm_link_rect: invalid flags\n");
+		return GPUVM_EARG;
+	}
+	if(!devbuf) {
+		fprintf(stderr, "gpuvm_link_rect: device buffer cannot be null\n");
+		return GPUVM_ENULL;
+	}
+	// the array starts at the first byte of the tile
+	char *tileptr = (char*)hostptr + rect->origin[2] * layout.slice_pitch + 
+		rect->origin[1] * layout.row_pitch + rect->origin[0];
+	return gpuvm_link_buf(tileptr, rect_span(&layout), idev, devbuf, 0, &layout,
+												0, flags);
+}  // gpuvm_link_rect
+
+int gpuvm_link_conv(void *hostptr, size_t nbytes, const gpuvm_conv_t *conv, 
+										unsigned idev, void *devbuf, int flags) {
+	// check arguments
+	if(!hostptr || !conv) {
+		fprintf(stderr, "gpuvm_link_conv: hostptr or conv is NULL\n");
+		return GPUVM_ENULL;
+	}
+	conv_t layout;
+	int err;
+	if(err = conv_init(&layout, conv, nbytes))
+		return err;
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_link_conv: invalid device number\n");
+		return GPUVM_EARG;
+	}
+	if((flags & ~GPUVM_API) != GPUVM_ON_HOST && 
+		 (flags & ~GPUVM_API) != GPUVM_ON_DEVICE) {
+		fprintf(stderr, "gpuvm_link_conv: invalid flags\n");
+		return GPUVM_EARG;
+	}
+	if(!devbuf) {
+		fprintf(stderr, "gpuvm_link_conv: device buffer cannot be null\n");
+		return GPUVM_ENULL;
+	}
+	return gpuvm_link_buf(hostptr, nbytes, idev, devbuf, 0, 0, &layout, flags);
+}  // gpuvm_link_conv
+
+int gpuvm_link_stream(void *hostptr, size_t nbytes, unsigned idev, void *devbuf,
+											size_t tile_nbytes, unsigned ntiles, int flags) {
+	// check arguments
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_link_stream: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(nbytes == 0 || tile_nbytes == 0) {
+		fprintf(stderr, "gpuvm_link_stream: nbytes or tile_nbytes is zero\n");
+		return GPUVM_EARG;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_link_stream: invalid device number\n");
+		return GPUVM_EARG;
+	}
+	if(ntiles == 0 || ntiles > MAX_STREAM_TILES) {
+		fprintf(stderr, "gpuvm_link_stream: invalid number of tiles\n");
+		return GPUVM_EARG;
+	}
+	int usage = flags & ~GPUVM_API;
+	if(usage != GPUVM_READ_ONLY && usage != GPUVM_WRITE_ONLY && 
+		 usage != GPUVM_READ_WRITE) {
+		fprintf(stderr, "gpuvm_link_stream: invalid flags\n");
+		return GPUVM_EARG;
+	}
+	if(!devbuf) {
+		fprintf(stderr, "gpuvm_link_stream: device buffer cannot be null\n");
+		return GPUVM_ENULL;
+	}
+
+	if(lock_writer())
+		return GPUVM_ERROR;
+
+	// a streamed array may not intersect any other linked or streamed array
+	host_array_t *host_array = 0;
+	if(host_array_find(&host_array, hostptr, nbytes, 0) || host_array || 
+		 stream_find(hostptr, nbytes) || zcopy_find(hostptr, nbytes)) {
+		unlock_writer();
+		return GPUVM_ERANGE;
+	}
+
+	stream_t *stream;
+	int err;
+	if(err = stream_alloc(&stream, hostptr, nbytes, idev, devbuf, tile_nbytes, 
+												ntiles, usage)) {
+		unlock_writer();
+		return err;
+	}
+
+	if(unlock_writer())
+		return GPUVM_ERROR;
+	return 0;
+}  // gpuvm_link_stream
+
+int gpuvm_stream_next(void *hostptr, unsigned idev, size_t *offset, 
+											size_t *nbytes, size_t *devoff) {
+	// check arguments
+	if(!hostptr || !offset || !nbytes || !devoff) {
+		fprintf(stderr, "gpuvm_stream_next: null pointer argument\n");
+		return GPUVM_ENULL;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_stream_next: invalid device number\n");
+		return GPUVM_EARG;
+	}
+
+	if(lock_reader())
+		return GPUVM_ERROR;
+	stream_t *stream = stream_find(hostptr, 0);
+	if(!stream || stream->idev != idev) {
+		fprintf(stderr, "gpuvm_stream_next: hostptr %p is not streamed on "
+						"device %d\n", hostptr, idev);
+		unlock_reader();
+		return GPUVM_EHOSTPTR;
+	}
+	int res = stream_next(stream, offset, nbytes, devoff);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	return res;
+}  // gpuvm_stream_next
+
 /** pre-unlinks the host array by synchronizing it back to host and unprotecting
 		it 
 		@param hostptr the address of the host array to be synchronized and
@@ -242,10 +523,8 @@ static int gpuvm_pre_unlink(void *hostptr) {
 	// tap into the beginning of each array subregion, to cause readback if
 	// mprotected 
 	unsigned isubreg;
-	int err;
-	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
-		err += *(char*)host_array->subregs[isubreg]->range.ptr;
-	}
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
+		*(volatile char*)host_array_subreg(host_array, isubreg)->range.ptr;
 	
 	unlock_reader();
 	return 0;
@@ -260,7 +539,38 @@ int gpuvm_unlink(void *hostptr, unsigned idev) {
 	}
 	if(!hostptr)
 		return 0;
+
+	// streamed and zero-copy arrays are not monitored, so no sync back is needed
+	if(lock_writer())
+		return GPUVM_ERROR;
+	stream_t *stream = stream_find(hostptr, 0);
+	if(stream) {
+		int err = stream->idev == idev ? stream_free(stream) : 0;
+		if(unlock_writer())
+			return GPUVM_ERROR;
+		return err;
+	}
+	zcopy_t *zcopy = zcopy_find(hostptr, 0);
+	if(zcopy) {
+		int err = zcopy->idev == idev ? zcopy_free(zcopy) : 0;
+		if(unlock_writer())
+			return GPUVM_ERROR;
+		return err;
+	}
+	if(unlock_writer())
+		return GPUVM_ERROR;
 	
+	// finish prefetches and write-backs which may still use the array
+	wthreads_wait_prefetches();
+	wthreads_wait_write_backs();
+	if(lock_reader())
+		return GPUVM_ERROR;
+	host_array_t *prefetch_array = host_array_find_by_ptr(hostptr);
+	if(prefetch_array && prefetch_array->links[idev])
+		prefetch_finish(prefetch_array->links[idev], 0);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+
 	//fprintf(stderr, "pre-unlinking\n");
 	if(stat_unlink_sync_back()) {
 		// make array to be synced to host and unprotected
@@ -280,6 +590,10 @@ int gpuvm_unlink(void *hostptr, unsigned idev) {
 	}
 
 	//fprintf(stderr, "removing link\n");
+	// a prefetch may have been started by another thread in the meantime; with
+	// the writer lock held, none can be half-started
+	if(host_array->links[idev])
+		prefetch_finish(host_array->links[idev], 0);
 	int err;
 	if(err = host_array_remove_link(host_array, idev)) {
 		unlock_writer();
@@ -300,10 +614,16 @@ int gpuvm_unlink(void *hostptr, unsigned idev) {
 }  // gpuvm_unlink
 
 void *gpuvm_xlate(void *hostptr, unsigned idev) {
+	size_t devoff;
+	return gpuvm_xlate_offset(hostptr, idev, &devoff);
+}  // gpuvm_xlate
+
+void *gpuvm_xlate_offset(void *hostptr, unsigned idev, size_t *devoff) {
 	//fprintf(stderr, "xlating\n");
 	// check arguments
-	if(!hostptr || idev >= ndevs_g)
+	if(!hostptr || idev >= ndevs_g || !devoff)
 		return 0;
+	*devoff = 0;
 	
 	// lock for reading
 	if(lock_reader())
@@ -312,46 +632,260 @@ void *gpuvm_xlate(void *hostptr, unsigned idev) {
 	// find host array and device buffer
 	void *dev_buffer = 0;
 	host_array_t *host_array = host_array_find_by_ptr(hostptr);
-	if(host_array && host_array->links[idev])
+	if(host_array && host_array->links[idev]) {
 		dev_buffer = host_array->links[idev]->buf;
+		*devoff = host_array->links[idev]->devoff;
+	}
+	if(!host_array) {
+		stream_t *stream = stream_find(hostptr, 0);
+		zcopy_t *zcopy = stream ? 0 : zcopy_find(hostptr, 0);
+		if(stream && stream->idev == idev)
+			dev_buffer = stream->devbuf;
+		else if(zcopy && zcopy->idev == idev)
+			dev_buffer = zcopy->buf;
+	}
 	
 	// unlock and return
 	if(unlock_reader())
 		return 0;
 	return dev_buffer;
-}  // gpuvm_xlate
+}  // gpuvm_xlate_offset
 
-int gpuvm_kernel_begin(void *hostptr, unsigned idev, int flags) {
+int gpuvm_prefetch(void *hostptr, unsigned idev) {
+	// check arguments
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_prefetch: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(idev >= ndevs_g) {
+		fprintf(stderr, "gpuvm_prefetch: invalid device number\n");
+		return GPUVM_EARG;
+	}
+
+	if(lock_reader())
+		return GPUVM_ERROR;
+	host_array_t *host_array = host_array_find_by_ptr(hostptr);
+	zcopy_t *zcopy = host_array ? 0 : zcopy_find(hostptr, 0);
+	if(zcopy && zcopy->idev == idev) {
+		// zero-copy arrays are never copied, so there is nothing to prefetch
+		return unlock_reader() ? GPUVM_ERROR : 0;
+	}
+	if(!host_array || !host_array->links[idev]) {
+		fprintf(stderr, "gpuvm_prefetch: hostptr %p is not linked on device %d\n",
+						hostptr, idev);
+		unlock_reader();
+		return GPUVM_EHOSTPTR;
+	}
+	if(!host_array_same_layout(host_array)) {
+		// strided and converted arrays are copied only by gpuvm_kernel_begin()
+		return unlock_reader() ? GPUVM_ERROR : 0;
+	}
+	int err = prefetch_start(host_array->links[idev]);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	return err;
+}  // gpuvm_prefetch
+
+int gpuvm_prefetch_host(void *hostptr) {
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_prefetch_host: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+
+	if(lock_reader())
+		return GPUVM_ERROR;
+	host_array_t *host_array = host_array_find_by_ptr(hostptr);
+	if(!host_array && zcopy_find(hostptr, 0))
+		return unlock_reader() ? GPUVM_ERROR : 0;
+	if(!host_array) {
+		fprintf(stderr, "gpuvm_prefetch_host: hostptr %p is not registered with "
+						"GPUVM\n", hostptr);
+		unlock_reader();
+		return GPUVM_EHOSTPTR;
+	}
+	int err = prefetch_host_start(host_array);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	return err;
+}  // gpuvm_prefetch_host
+
+int gpuvm_advise(void *hostptr, int advice, int idev) {
+	// check arguments
+	if(!hostptr) {
+		fprintf(stderr, "gpuvm_advise: hostptr is NULL\n");
+		return GPUVM_ENULL;
+	}
+	if(advice == GPUVM_ADVISE_PREFERRED_LOCATION && 
+		 idev != GPUVM_LOCATION_HOST && (idev < 0 || idev >= (int)ndevs_g)) {
+		fprintf(stderr, "gpuvm_advise: invalid location\n");
+		return GPUVM_EARG;
+	}
+
+	if(lock_reader())
+		return GPUVM_ERROR;
+	host_array_t *host_array = host_array_find_by_ptr(hostptr);
+	if(!host_array) {
+		fprintf(stderr, "gpuvm_advise: hostptr %p is not registered with GPUVM\n",
+						hostptr);
+		unlock_reader();
+		return GPUVM_EHOSTPTR;
+	}
+	int err = host_array_advise(host_array, advice, idev);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	return err;
+}  // gpuvm_advise
+
+/** checks that the range lies inside the array containing hostptr. Must be
+		called with the global lock held
+		@param name the name of the API function, for error messages
+		@param hostptr the host pointer
+		@param range the range
+		@returns 0 if the range is valid and a negative error code if not
+ */
+static int gpuvm_check_range
+(const char *name, void *hostptr, const memrange_t *range) {
+	host_array_t *host_array = host_array_find_by_ptr(hostptr);
+	if(!host_array) {
+		fprintf(stderr, "%s: hostptr %p is not registed with GPUVM\n", name, 
+						hostptr);
+		return GPUVM_EHOSTPTR;
+	}
+	if(!memrange_is_inside(&host_array->range, range)) {
+		fprintf(stderr, "%s: range is outside the array\n", name);
+		return GPUVM_EARG;
+	}
+	if(!host_array_same_layout(host_array)) {
+		fprintf(stderr, "%s: ranges of strided or converted arrays are not "
+						"supported\n", name);
+		return GPUVM_EARG;
+	}
+	return 0;
+}  // gpuvm_check_range
+
+/** starts or ends a kernel on a zero-copy array, if hostptr belongs to one.
+		The whole array is made available to the kernel even if it uses only a
+		range of it. Must be called with the reader lock held
+		@param name the name of the API function, for error messages
+		@param hostptr the host pointer
+		@param offset the offset of the range used by the kernel from hostptr
+		@param nbytes the size of the range used by the kernel, or 0 if the kernel
+		uses the whole array
+		@param idev the device
+		@param begin nonzero if the kernel begins and 0 if it ends
+		@returns 0 if successful, 1 if hostptr does not belong to a zero-copy array
+		and a negative error code in case of an error
+ */
+static int gpuvm_kernel_zcopy
+(const char *name, void *hostptr, size_t offset, size_t nbytes, unsigned idev,
+ int begin) {
+	zcopy_t *zcopy = zcopy_find(hostptr, 0);
+	if(!zcopy)
+		return 1;
+	if(zcopy->idev != idev) {
+		fprintf(stderr, "%s: no link for array on device\n", name);
+		return GPUVM_ENOLINK;
+	}
+	memrange_t range = {(char*)hostptr + offset, nbytes};
+	if(nbytes && !memrange_is_inside(&zcopy->range, &range)) {
+		fprintf(stderr, "%s: range is outside the array\n", name);
+		return GPUVM_EARG;
+	}
+	return begin ? zcopy_kernel_begin(zcopy) : zcopy_kernel_end(zcopy);
+}  // gpuvm_kernel_zcopy
+
+/** common implementation of gpuvm_kernel_begin() and
+		gpuvm_kernel_begin_range()
+		@param name the name of the API function, for error messages
+		@param hostptr the host pointer
+		@param offset the offset of the range used by the kernel from hostptr
+		@param nbytes the size of the range used by the kernel, or 0 if the kernel
+		uses the whole array
+		@param idev the device
+		@param flags the usage flags
+		@returns 0 if successful and a negative error code if not
+ */
+static int gpuvm_kernel_begin_in
+(const char *name, void *hostptr, size_t offset, size_t nbytes, unsigned idev, 
+ int flags) {
 	//fprintf(stderr, "beginning kernel\n");
 	// check arguments
 	if(!hostptr) {
-		fprintf(stderr, "gpuvm_kernel_begin: hostptr is NULL\n");
+		fprintf(stderr, "%s: hostptr is NULL\n", name);
 		return GPUVM_ENULL;
 	}
 	if(idev >= ndevs_g) {
-		fprintf(stderr, "gpuvm_kernel_begin: invalid device number\n");
+		fprintf(stderr, "%s: invalid device number\n", name);
 		return GPUVM_EARG;		
 	}
-	if(flags != GPUVM_READ_WRITE && flags != GPUVM_READ_ONLY) {
-		fprintf(stderr, "gpuvm_kernel_begin: invalid flags\n");
+	if(flags != GPUVM_READ_WRITE && flags != GPUVM_READ_ONLY && 
+		 flags != GPUVM_WRITE_ONLY) {
+		fprintf(stderr, "%s: invalid flags\n", name);
 		return GPUVM_EARG;
 	}
 
+	// a zero-copy array only needs to be unmapped from host
+	int err;
+	if(lock_reader())
+		return GPUVM_ERROR;
+	err = gpuvm_kernel_zcopy(name, hostptr, offset, nbytes, idev, 1);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	if(err != 1)
+		return err;
+
+	memrange_t range = {(char*)hostptr + offset, nbytes};
+	if(nbytes) {
+		// give the range subregions of its own, so that its actuality is tracked
+		// separately from the rest of the array
+		if(lock_writer())
+			return GPUVM_ERROR;
+		if(!(err = gpuvm_check_range(name, hostptr, &range)))
+			err = host_array_split(host_array_find_by_ptr(hostptr), &range);
+		if(unlock_writer())
+			return GPUVM_ERROR;
+		if(err)
+			return err;
+	}
+
 	if(lock_reader())
 		return GPUVM_ERROR;
 
 	// find host array
 	host_array_t *host_array = host_array_find_by_ptr(hostptr);
 	if(!host_array) {
-		fprintf(stderr, "gpuvm_kernel_begin: hostptr %p is not registed with "
-						"GPUVM\n", hostptr);
+		fprintf(stderr, "%s: hostptr %p is not registed with GPUVM\n", name, 
+						hostptr);
 		unlock_reader();
 		return GPUVM_EHOSTPTR;
 	}
 	
-	// copy data to device if needed
-	int err;
-	if(err = host_array_sync_to_device(host_array, idev, flags)) {
+	link_t *link = host_array->links[idev];
+	if(!link) {
+		fprintf(stderr, "%s: no link for array on device\n", name);
+		unlock_reader();
+		return GPUVM_ENOLINK;
+	}
+
+	// make sure the array has device memory, and copy data to device if needed;
+	// if device memory is exhausted, evict arrays which have not been used for
+	// the longest time
+	const memrange_t *prange = nbytes ? &range : 0;
+	if(err = residency_begin(link)) {
+		unlock_reader();
+		return err;
+	}
+	// take over what has been prefetched to device
+	prefetch_finish(link, 1);
+	if(!(err = host_array_pre_sync_to_device(host_array, idev, flags, prange))) {
+		wback_upload_begin();
+		do {
+			err = host_array_copy_to_device(host_array, idev, prange);
+		} while(err == GPUVM_EDEVALLOC && !residency_evict(idev));
+		wback_upload_end();
+	}
+	if(err) {
+		residency_end(link);
 		unlock_reader();
 		return err;
 	}
@@ -360,19 +894,106 @@ int gpuvm_kernel_begin(void *hostptr, unsigned idev, int flags) {
 		return GPUVM_ERROR;
 
 	return 0;
+}  // gpuvm_kernel_begin_in
+
+int gpuvm_kernel_begin(void *hostptr, unsigned idev, int flags) {
+	return gpuvm_kernel_begin_in("gpuvm_kernel_begin", hostptr, 0, 0, idev, flags);
 }  // gpuvm_kernel_begin
 
-int gpuvm_kernel_end(void *hostptr, unsigned idev) {
+int gpuvm_kernel_begin_range
+(void *hostptr, size_t offset, size_t nbytes, unsigned idev, int flags) {
+	if(!nbytes) {
+		fprintf(stderr, "gpuvm_kernel_begin_range: range is empty\n");
+		return GPUVM_EARG;
+	}
+	return gpuvm_kernel_begin_in
+		("gpuvm_kernel_begin_range", hostptr, offset, nbytes, idev, flags);
+}  // gpuvm_kernel_begin_range
+
+/** gets the ranges written by a kernel, and splits the array so that they
+		consist of whole subregions. Must be called with the writer lock held
+		@param name the name of the API function, for error messages
+		@param hostptr the host pointer
+		@param host_array the array containing hostptr
+		@param written the ranges written, with offsets from hostptr
+		@param nwritten the number of ranges written
+		@param pranges [out] *pranges is the ranges written, to be freed with
+		sfree(), or 0 if the array can't be split, in which case it must be handled
+		as written as a whole
+		@param pnranges [out] *pnranges is the number of ranges written
+		@returns 0 if successful and a negative error code if not
+ */
+static int gpuvm_split_written
+(const char *name, void *hostptr, host_array_t *host_array, 
+ const gpuvm_range_t *written, unsigned nwritten, memrange_t **pranges, 
+ unsigned *pnranges) {
+	*pranges = 0;
+	*pnranges = 0;
+	memrange_t *ranges = (memrange_t*)smalloc
+		((nwritten ? nwritten : 1) * sizeof(memrange_t));
+	if(!ranges)
+		return GPUVM_ESALLOC;
+	unsigned iwritten, nranges = 0;
+	int err;
+	for(iwritten = 0; iwritten < nwritten; iwritten++) {
+		if(!written[iwritten].nbytes)
+			continue;
+		memrange_t *range = &ranges[nranges];
+		range->ptr = (char*)hostptr + written[iwritten].offset;
+		range->nbytes = written[iwritten].nbytes;
+		if(err = gpuvm_check_range(name, hostptr, range)) {
+			sfree(ranges);
+			return err;
+		}
+		nranges++;
+	}
+	for(iwritten = 0; iwritten < nranges; iwritten++)
+		if(host_array_split(host_array, &ranges[iwritten])) {
+			// e.g. the array shares pages with another one
+			sfree(ranges);
+			return 0;
+		}
+	*pranges = ranges;
+	*pnranges = nranges;
+	return 0;
+}  // gpuvm_split_written
+
+/** common implementation of gpuvm_kernel_end(), gpuvm_kernel_end_range() and
+		gpuvm_kernel_end_written()
+		@param name the name of the API function, for error messages
+		@param hostptr the host pointer
+		@param offset the offset of the range used by the kernel from hostptr
+		@param nbytes the size of the range used by the kernel, or 0 if the kernel
+		used the whole array
+		@param idev the device
+		@param written the ranges written by the kernel, with offsets from hostptr,
+		or 0 if it may have written everything it used
+		@param nwritten the number of ranges written
+		@returns 0 if successful and a negative error code if not
+ */
+static int gpuvm_kernel_end_in
+(const char *name, void *hostptr, size_t offset, size_t nbytes, unsigned idev,
+ const gpuvm_range_t *written, unsigned nwritten) {
 	//fprintf(stderr, "ending kernel\n");
 	// check arguments
 	if(!hostptr) {
-		fprintf(stderr, "gpuvm_kernel_end: hostptr is NULL");
+		fprintf(stderr, "%s: hostptr is NULL\n", name);
 		return GPUVM_ENULL;
 	}
 	if(idev >= ndevs_g) {
-		fprintf(stderr, "gpuvm_kernel_end: invalid device number");
+		fprintf(stderr, "%s: invalid device number\n", name);
 		return GPUVM_EARG;
 	}
+
+	// a zero-copy array only needs to be mapped back for host
+	int err;
+	if(lock_reader())
+		return GPUVM_ERROR;
+	err = gpuvm_kernel_zcopy(name, hostptr, offset, nbytes, idev, 0);
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	if(err != 1)
+		return err;
 	
 	// lock for writer
 	if(lock_writer())
@@ -381,21 +1002,92 @@ int gpuvm_kernel_end(void *hostptr, unsigned idev) {
 	// find host array
 	host_array_t *host_array = host_array_find_by_ptr(hostptr);
 	if(!host_array) {
-		fprintf(stderr, "gpuvm_kernel_begin: hostptr is not registed with GPUVM\n");
+		fprintf(stderr, "%s: hostptr is not registed with GPUVM\n", name);
 		unlock_writer();
 		return GPUVM_EHOSTPTR;
 	}
+	memrange_t range = {(char*)hostptr + offset, nbytes};
+	if(nbytes && (err = gpuvm_check_range(name, hostptr, &range))) {
+		unlock_writer();
+		return err;
+	}
+
+	memrange_t *written_ranges = 0;
+	unsigned nwritten_ranges = 0;
+	if(written && (err = gpuvm_split_written
+								 (name, hostptr, host_array, written, nwritten, &written_ranges,
+									&nwritten_ranges))) {
+		unlock_writer();
+		return err;
+	}
 
 	// set up memory protection and update actuality info
-	int err;
-	if(err = host_array_after_kernel(host_array, idev)) {
+	err = host_array_after_kernel(host_array, idev, nbytes ? &range : 0, 
+																written_ranges, nwritten_ranges);
+	if(written_ranges)
+		sfree(written_ranges);
+	if(err) {
 		unlock_writer();
 		return err;
 	}
+	int write_back = host_array_needs_write_back(host_array);
+	int read_mostly = host_array->advice & ADVICE_READ_MOSTLY;
+	if(!write_back) {
+		residency_end(host_array->links[idev]);
+		// bring the data written back to host while it is busy elsewhere
+		wback_array(host_array);
+	}
 
 	// lock for writer
 	if(unlock_writer())
 		return GPUVM_ERROR;
+
+	if(write_back || read_mostly) {
+		// bring data back to host through pagefaults, which requires the reader
+		// lock; the link stays in use until the data are back
+		if(lock_reader())
+			return GPUVM_ERROR;
+		host_array = host_array_find_by_ptr(hostptr);
+		if(write_back && host_array && host_array->links[idev]) {
+			err = host_array_write_back(host_array, idev);
+			residency_end(host_array->links[idev]);
+		}
+		// read-mostly data are copied from host to the other devices in the
+		// background, and the copies are used by their next kernels
+		if(!err && read_mostly && host_array)
+			err = prefetch_replicate(host_array, idev);
+		if(unlock_reader())
+			return GPUVM_ERROR;
+	}
 	//fprintf(stderr, "kernel ended\n");
-	return 0;
+	return err;
+} // gpuvm_kernel_end_in
+
+int gpuvm_kernel_end(void *hostptr, unsigned idev) {
+	return gpuvm_kernel_end_in("gpuvm_kernel_end", hostptr, 0, 0, idev, 0, 0);
 } // gpuvm_kernel_end
+
+int gpuvm_kernel_end_range
+(void *hostptr, size_t offset, size_t nbytes, unsigned idev) {
+	if(!nbytes) {
+		fprintf(stderr, "gpuvm_kernel_end_range: range is empty\n");
+		return GPUVM_EARG;
+	}
+	return gpuvm_kernel_end_in
+		("gpuvm_kernel_end_range", hostptr, offset, nbytes, idev, 0, 0);
+} // gpuvm_kernel_end_range
+
+int gpuvm_kernel_end_written
+(void *hostptr, unsigned idev, const gpuvm_range_t *written, unsigned nwritten) {
+	// stands for no ranges written, as a null pointer means everything written
+	static const gpuvm_range_t none = {0, 0};
+	if(!written) {
+		if(nwritten) {
+			fprintf(stderr, "gpuvm_kernel_end_written: written is NULL\n");
+			return GPUVM_ENULL;
+		}
+		written = &none;
+	}
+	return gpuvm_kernel_end_in
+		("gpuvm_kernel_end_written", hostptr, 0, 0, idev, written, nwritten);
+} // gpuvm_kernel_end_written
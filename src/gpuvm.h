@@ -11,6 +11,12 @@
 /** indicates that all devices must be unlinked */
 #define GPUVM_ALL_DEVICES ~0
 
+/** location of the host, for use with ::GPUVM_ADVISE_PREFERRED_LOCATION */
+#define GPUVM_LOCATION_HOST -1
+
+/** maximum number of fields taken from a host record by a conversion */
+#define GPUVM_CONV_MAX_FIELDS 8
+
 /** flags specifying device type, data placement, array usage etc. Constants of this type must be used directly  */
 enum {
 	/** no flags */
@@ -19,8 +25,16 @@ enum {
 	GPUVM_OPENCL = 0x1,
 	/** CUDA device */
 	GPUVM_CUDA = 0x2,
-	/** GPUVM_CUDA or GPUVM_OPENCL */
-	GPUVM_API = GPUVM_CUDA | GPUVM_OPENCL,
+	/** simulated device, with device buffers in host memory */
+	GPUVM_SIM = 0x800,
+	/** remote device, served by a separate process over a socket */
+	GPUVM_REMOTE = 0x8000,
+	/** device of a backend loaded at run time from a shared library, see
+			gpuvm-backend.h */
+	GPUVM_PLUGIN = 0x10000,
+	/** GPUVM_CUDA, GPUVM_OPENCL, GPUVM_SIM, GPUVM_REMOTE or GPUVM_PLUGIN */
+	GPUVM_API = GPUVM_CUDA | GPUVM_OPENCL | GPUVM_SIM | GPUVM_REMOTE | 
+	GPUVM_PLUGIN,
 	/** data in the array being linked reside on host */
 	GPUVM_ON_HOST = 0x4,
 	/** data in the array being linked reside on device */
@@ -43,7 +57,16 @@ enum {
 	 this is required to work correctly with mono GC */
 	GPUVM_WRITER_SIG_BLOCK = 0x200,
 	/** do not sync data back to host prior to unlinking */
-	GPUVM_UNLINK_NO_SYNC_BACK = 0x400
+	GPUVM_UNLINK_NO_SYNC_BACK = 0x400,
+	/** link the array without copies if the device shares memory with host */
+	GPUVM_ZERO_COPY = 0x1000,
+	/** bring data written by kernels back to host in the background after
+			gpuvm_kernel_end(), rather than on the first host access */
+	GPUVM_WRITE_BACK = 0x2000,
+	/** do the copies performed by the CPU, e.g. for simulated devices, with a
+			plain memcpy() in the calling thread, rather than in parallel with
+			non-temporal stores */
+	GPUVM_SERIAL_COPY = 0x4000
 };
 
 /** constants specifying different types of errors */
@@ -81,6 +104,47 @@ enum {
 	GPUVM_EAPI = -13
 };
 
+/** hints on the use of an array, passed to gpuvm_advise() */
+enum {
+	/** the array is mostly read, both on host and on devices; after a kernel
+			writes the array, its data are eagerly written back to host, so that the
+			host and the device copies stay valid and host reads cause no pagefaults,
+			and are then prefetched to the other devices which hold the array, so
+			that it stays replicated there. Devices the array has been evicted from
+			get their copy at their next kernel */
+	GPUVM_ADVISE_READ_MOSTLY = 1,
+	/** removes ::GPUVM_ADVISE_READ_MOSTLY hint */
+	GPUVM_ADVISE_UNSET_READ_MOSTLY = 2,
+	/** the array preferably resides on the specified location, either a device
+			or ::GPUVM_LOCATION_HOST. Arrays preferring a device are evicted from it
+			last; arrays preferring host are evicted first, and are written back to
+			host eagerly after a kernel writes them */
+	GPUVM_ADVISE_PREFERRED_LOCATION = 3,
+	/** removes ::GPUVM_ADVISE_PREFERRED_LOCATION hint */
+	GPUVM_ADVISE_UNSET_PREFERRED_LOCATION = 4,
+	/** the array is modified neither on host nor on devices; it is copied to
+			each device once, and its host memory is never protected. Kernels using
+			the array always use it as ::GPUVM_READ_ONLY */
+	GPUVM_ADVISE_IMMUTABLE = 5,
+	/** removes ::GPUVM_ADVISE_IMMUTABLE hint; device copies of the array are
+			discarded, so that the array may be modified on host again */
+	GPUVM_ADVISE_UNSET_IMMUTABLE = 6
+};
+
+/** element types of arrays converted during transfer, see gpuvm_link_conv() */
+enum {
+	/** 16-bit signed integer */
+	GPUVM_TYPE_INT16 = 1,
+	/** 32-bit signed integer */
+	GPUVM_TYPE_INT32 = 2,
+	/** 64-bit signed integer */
+	GPUVM_TYPE_INT64 = 3,
+	/** single-precision floating point */
+	GPUVM_TYPE_FLOAT = 4,
+	/** double-precision floating point */
+	GPUVM_TYPE_DOUBLE = 5
+};
+
 /** possible values, including counters and parameters, which can be obtained using
 		gpuvm_stat() call. The types for the respective counters are specified as well
 */
@@ -89,7 +153,8 @@ enum {
 	GPUVM_STAT_ENABLED = 1,
 	/** number of devices, unsigned */
 	GPUVM_STAT_NDEVS = 2,
-	/** total copying time (measured by OpenCL) in seconds, double */
+	/** total copying time (measured by OpenCL) in seconds, double; copies
+			between devices are counted here only */
 	GPUVM_STAT_COPY_TIME = 3,
 	/** total number of pagefaults, unsigned long long */
 	GPUVM_STAT_PAGEFAULTS = 4,
@@ -98,9 +163,127 @@ enum {
 	GPUVM_STAT_HOST_COPY_TIME = 5,
 	/** pagefault handling time, without time spent in data copying; fairly good
 		approximation of pagefault overhead */
-	GPUVM_STAT_PAGEFAULT_TIME = 6
+	GPUVM_STAT_PAGEFAULT_TIME = 6,
+	/** total number of arrays evicted from device memory to make room for
+			others, unsigned long long */
+	GPUVM_STAT_EVICTIONS = 7,
+	/** total number of bytes not copied between host and devices because
+			arrays were used as ::GPUVM_WRITE_ONLY, unsigned long long */
+	GPUVM_STAT_WRITE_ONLY_BYTES = 8,
+	/** total number of bytes brought back to host by background write-back,
+			unsigned long long */
+	GPUVM_STAT_WRITE_BACK_BYTES = 9,
+	/** total number of bytes of all-zero blocks sent to devices as fills
+			rather than copied, unsigned long long */
+	GPUVM_STAT_ZERO_FILL_BYTES = 10,
+	/** total time copies have waited for copies of higher priority, e.g.
+			background copies for pagefault readbacks, in seconds, double */
+	GPUVM_STAT_XFER_WAIT_TIME = 11,
+	/** number of bytes of GPUVM metadata currently allocated, rounded up to
+			allocator size classes, unsigned long long */
+	GPUVM_STAT_META_USED_BYTES = 12,
+	/** number of bytes of memory held by the GPUVM metadata allocator; the
+			fraction of it not used by ::GPUVM_STAT_META_USED_BYTES measures
+			fragmentation, unsigned long long */
+	GPUVM_STAT_META_HELD_BYTES = 13,
+	/** number of host arrays currently linked, unsigned long long */
+	GPUVM_STAT_ARRAYS = 14,
+	/** average number of bytes of GPUVM metadata per linked host array, i.e.
+			::GPUVM_STAT_META_USED_BYTES divided by ::GPUVM_STAT_ARRAYS, or 0 if no
+			arrays are linked, double */
+	GPUVM_STAT_META_BYTES_PER_ARRAY = 15
 };
 
+/** parameters of a simulated (::GPUVM_SIM) device. Device buffers of a simulated
+		device are ordinary host memory, and each copy in either direction takes 
+		latency + nbytes / bandwidth seconds, which is also reported as device copy
+		time */
+typedef struct {
+	/** latency of a host-to-device copy, in seconds */
+	double h2d_latency;
+	/** bandwidth of host-to-device copies, in bytes per second; 0 means that
+			bandwidth is unlimited */
+	double h2d_bandwidth;
+	/** latency of a device-to-host copy, in seconds */
+	double d2h_latency;
+	/** bandwidth of device-to-host copies, in bytes per second; 0 means that
+			bandwidth is unlimited */
+	double d2h_bandwidth;
+	/** maximum number of host-to-device copies performed at the same time; other
+			copies wait for their turn; 0 means no limit */
+	unsigned max_h2d_copies;
+	/** maximum number of device-to-host copies performed at the same time; other
+			copies wait for their turn; 0 means no limit */
+	unsigned max_d2h_copies;
+	/** amount of memory of the device available for allocation by GPUVM, in
+			bytes; 0 means no limit */
+	size_t mem_size;
+	/** nonzero if the device shares memory with host, in which case links with
+			::GPUVM_ZERO_COPY use host memory directly */
+	int unified_memory;
+} gpuvm_sim_params_t;
+
+/** parameters of a remote device; with ::GPUVM_REMOTE, a pointer to such
+		structure must be passed to gpuvm_init() for each device. Buffers of
+		remote devices are handles valid only on the device server, and can only
+		be allocated by GPUVM, e.g. with gpuvm_link_alloc() */
+typedef struct {
+	/** address of the device server, either "unix:<path>" or
+			"tcp:<host>:<port>"; over a Unix socket, data are passed through shared
+			memory */
+	const char *address;
+	/** number of the device on the server */
+	unsigned idev;
+} gpuvm_remote_params_t;
+
+/** describes a 2D or 3D tile of a larger host matrix, linked with 
+		gpuvm_link_rect(); the conventions are those of clEnqueueReadBufferRect() */
+typedef struct {
+	/** offset of the tile from the start of the matrix: in bytes within a row,
+			in rows and in slices */
+	size_t origin[3];
+	/** size of the tile: width in bytes, height in rows and depth in slices; all
+			must be nonzero */
+	size_t region[3];
+	/** distance between the starts of consecutive rows of the matrix, in bytes;
+			0 means region[0] */
+	size_t row_pitch;
+	/** distance between the starts of consecutive slices of the matrix, in
+			bytes, which must be a multiple of row_pitch; 0 means row_pitch *
+			region[1] */
+	size_t slice_pitch;
+} gpuvm_rect_t;
+
+/** describes how a host array is converted on its way to and from device,
+		with gpuvm_link_conv() */
+typedef struct {
+	/** type of the host elements, one of GPUVM_TYPE_* */
+	int host_type;
+	/** type of the device elements, one of GPUVM_TYPE_* */
+	int dev_type;
+	/** size of a host record, in bytes; 0 means the size of host_type, i.e. the
+			host array is an array of elements */
+	size_t record_size;
+	/** number of fields taken from each record, at most
+			::GPUVM_CONV_MAX_FIELDS; 0 means 1 */
+	unsigned nfields;
+	/** offsets of the fields in the record, in bytes */
+	size_t field_offsets[GPUVM_CONV_MAX_FIELDS];
+	/** nonzero if each field is stored on device as a separate array, one
+			after another (SoA), and 0 if the fields of each record are stored on
+			device together, record after record */
+	int soa;
+} gpuvm_conv_t;
+
+/** a byte range of an array, e.g. one written by a kernel, see
+		gpuvm_kernel_end_written() */
+typedef struct {
+	/** offset of the range, in bytes from the host pointer passed along */
+	size_t offset;
+	/** size of the range, in bytes */
+	size_t nbytes;
+} gpuvm_range_t;
+
 /** 
 		must be called before and after initialization of OpenCL runtime. The threads which
 		belong to OpenCL runtime will be recorded, and not touched during thread 
@@ -130,11 +313,16 @@ int gpuvm_library_exists();
 		initializes GPUVM library, must be called once per process 
 		@param ndevs number of devices to be used in the library
 		@param devs devices to be used in the library. For OpenCL, each pointer must specify a
-		device queue. 
+		device queue. For simulated devices, each pointer must point to
+		::gpuvm_sim_params_t describing the device, or be null to use the default
+		parameters; devs itself may also be null. For remote devices, each pointer
+		must point to ::gpuvm_remote_params_t. For devices of a backend library,
+		each pointer must point to ::gpuvm_plugin_params_t from gpuvm-backend.h
 		@param flags indicate device type and possibly usage strategy. Currently must include
-		::GPUVM_OPENCL or ::GPUVM_CUDA (if compiled with CUDA support), and a
-		combination of optional ::GPUVM_STAT, ::GPUVM_WRITER_SIG_BLOCK
-		and ::GPUVM_UNLINK_NO_SYNC_BACK.
+		::GPUVM_OPENCL, ::GPUVM_CUDA (if compiled with CUDA support), ::GPUVM_SIM,
+		::GPUVM_REMOTE or ::GPUVM_PLUGIN, and a combination of optional ::GPUVM_STAT,
+		::GPUVM_WRITER_SIG_BLOCK, ::GPUVM_UNLINK_NO_SYNC_BACK, ::GPUVM_WRITE_BACK
+		and ::GPUVM_SERIAL_COPY.
 		Note that if ::GPUVM_STAT is specified for OpenCL devices, the underlying
 		OpenCL queue must have profiling enabled, or OpenCL-related errors will occur during
 		further operation
@@ -153,7 +341,8 @@ int gpuvm_init(unsigned ndevs, void **devs, int flags);
 		@param idev device number with which a link is created. Only one link may be created
 		for a single device
 		@param devbuf device-side buffer being linked to host-side array. May be NULL if
-		nbytes == 0
+		nbytes == 0. For simulated devices, this is a block of host memory of at least
+		nbytes bytes, e.g. allocated with malloc()
 		@param flags indicating device type and initial data placement. Currently,
 		must include obligatory ::GPUVM_OPENCL, and one of ::GPUVM_ON_HOST or
 		::GPUVM_ON_DEVICE, to indicate initial data placement (on host or on device,
@@ -164,11 +353,143 @@ int gpuvm_init(unsigned ndevs, void **devs, int flags);
 __attribute__((visibility("default")))
 int gpuvm_link(void *hostptr, size_t nbytes, unsigned idev, void *devbuf, int flags);
 
+/** 
+		links a host array with device memory allocated by GPUVM itself, rather than
+		with a buffer provided by the caller. Small arrays are packed into large
+		shared device buffers, so that many small arrays do not require many device
+		allocations; therefore, the array may start at a nonzero offset in its
+		device buffer, which can be obtained with gpuvm_xlate_offset(). The device
+		memory is freed when the array is unlinked. Device memory of such arrays may
+		be oversubscribed: if it is exhausted, arrays not used by a running kernel
+		are evicted from device in least-recently-used order, and re-materialized
+		on the next gpuvm_kernel_begin(). An array linked ::GPUVM_ON_HOST when device
+		memory is exhausted gets its memory at its first gpuvm_kernel_begin(); the
+		device buffer of an evicted array, as returned by gpuvm_xlate(), is null.
+
+		If ::GPUVM_ZERO_COPY is specified and the device shares memory with host
+		(e.g. a CPU device, or an OpenCL device reporting
+		CL_DEVICE_HOST_UNIFIED_MEMORY), the device buffer is created over the host
+		array itself. Such an array is never copied or protected; it is
+		unmapped from host between gpuvm_kernel_begin() and gpuvm_kernel_end(), and
+		host must not access it during that time. A zero-copy array can be linked
+		on a single device only. If the device does not share memory with host,
+		::GPUVM_ZERO_COPY is ignored
+		@param hostptr the host array to link
+		@param nbytes the size of the host array
+		@param idev the device on which to allocate memory and create the link
+		@param flags the same as for gpuvm_link(), optionally combined with
+		::GPUVM_ZERO_COPY
+		@returns 0 if successful and error code if not, in particular
+		::GPUVM_EDEVALLOC if device memory cannot be allocated
+ */
+__attribute__((visibility("default")))
+int gpuvm_link_alloc(void *hostptr, size_t nbytes, unsigned idev, int flags);
+
+/** 
+		links a tile of a host matrix with a device buffer holding only the tile,
+		densely packed: row after row, with a row pitch of region[0] bytes, and
+		slice after slice, with a slice pitch of region[0] * region[1] bytes. Only
+		the pages the tile occupies are protected, and only the bytes of the tile
+		are copied, with rectangular copies (clEnqueueReadBufferRect() and
+		clEnqueueWriteBufferRect() for OpenCL, cudaMemcpy2D() and cudaMemcpy3D()
+		for CUDA). Host accesses to the matrix outside the tile but on the same
+		pages are still handled as accesses to the tile. Rows less than a page
+		apart are tracked together as a single run, as a contiguous array is, so
+		a host write anywhere in a run, including between its rows, makes the
+		whole run stale on devices. After linking, the tile is referred to by the
+		address of its first byte, i.e. hostptr + origin[2] * slice_pitch +
+		origin[1] * row_pitch + origin[0], in all other calls, e.g.
+		gpuvm_kernel_begin() or gpuvm_unlink(). The runs of the tile may not
+		intersect other linked arrays; other tiles of the same matrix can be
+		linked as long as they have no bytes in the runs of each other. A tile
+		can't be used by
+		gpuvm_kernel_begin_range(), and is neither prefetched to device nor written
+		back in the background
+		@param hostptr the start of the host matrix
+		@param rect the tile of the matrix to link
+		@param idev the device with which to link the tile
+		@param devbuf the device buffer, of at least region[0] * region[1] *
+		region[2] bytes
+		@param flags the same as for gpuvm_link()
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_link_rect(void *hostptr, const gpuvm_rect_t *rect, unsigned idev, 
+										void *devbuf, int flags);
+
+/** 
+		links a host array with a device buffer holding its data converted as
+		described by conv: each field of each host record is converted from the
+		host to the device element type, as if by a C cast, and the fields are
+		laid out on device either as separate arrays or packed record after
+		record. The conversion is done on the way to and from device, in a staging
+		buffer of limited size, so that no converted copy of the whole array is
+		kept on host, and only the converted fields cross the bus. Note that
+		narrowing conversions lose precision, and so does a readback of data
+		written by a kernel. A converted array can't be used by
+		gpuvm_kernel_begin_range(), and is neither prefetched to device nor written
+		back in the background
+		@param hostptr the host array to link
+		@param nbytes the size of the host array, a multiple of the record size
+		@param conv the conversion
+		@param idev the device with which to link the array
+		@param devbuf the device buffer, of at least nbytes / record_size *
+		nfields times the size of the device element type
+		@param flags the same as for gpuvm_link()
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_link_conv(void *hostptr, size_t nbytes, const gpuvm_conv_t *conv, 
+										unsigned idev, void *devbuf, int flags);
+
+/** 
+		links a host array, which may be larger than device memory, with a smaller
+		device window buffer in streaming mode. The array is processed in tiles of
+		tile_nbytes bytes, which occupy ntiles consecutive slots of the window. The
+		tiles are made available on device one by one with gpuvm_stream_next();
+		while the kernel works on one tile, the next one is uploaded and the
+		previous one is read back in the background. Unlike arrays linked with
+		gpuvm_link(), a streamed array is not protected, and the host must not
+		access it between the first call to gpuvm_stream_next() and the end of the
+		pass
+		@param hostptr the host array to be streamed
+		@param nbytes the size of the host array
+		@param idev the device on which the array is streamed
+		@param devbuf device window buffer, of at least tile_nbytes * ntiles bytes
+		@param tile_nbytes the size of a single tile, which must be nonzero
+		@param ntiles the number of tiles in the window, at least 2 for transfers
+		to overlap with kernels, and at most 8
+		@param flags device type (see gpuvm_link()) and usage of the tiles by the
+		kernel, one of ::GPUVM_READ_ONLY, ::GPUVM_WRITE_ONLY or ::GPUVM_READ_WRITE
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_link_stream(void *hostptr, size_t nbytes, unsigned idev, void *devbuf,
+											size_t tile_nbytes, unsigned ntiles, int flags);
+
+/** 
+		advances a stream to the next tile. The kernel using the current tile, if
+		any, must have finished. The current tile is read back to host, if the
+		kernel writes it, and the next tile is made available on device
+		@param hostptr the host array linked with gpuvm_link_stream()
+		@param idev the device on which the array is streamed
+		@param [out] offset offset of the tile in the host array, in bytes
+		@param [out] nbytes the size of the tile, in bytes
+		@param [out] devoff offset of the tile in the device window buffer, in bytes
+		@returns 1 if the next tile is available on device, 0 if all tiles of the
+		array have been processed and are back on host, and error code in case of an
+		error. After 0 is returned, the next call starts a new pass over the array
+ */
+__attribute__((visibility("default")))
+int gpuvm_stream_next(void *hostptr, unsigned idev, size_t *offset, 
+											size_t *nbytes, size_t *devoff);
+
 /** 
 		unlinks an array which was previously linked, on a single device. If the array is
 		not linked on the specified device, nothing is done and 0 is returned. If the
 		specified device is the last on which the host array is linked, then the host array is
-		removed from monitoring by GPUVM
+		removed from monitoring by GPUVM. Streamed arrays are unlinked after all their
+		pending transfers finish
 		@param hostptr a pointer previously linked with gpuvm_link
 		@param idev the device on which to unlink the buffer
 		@returns 0 if successful and error code if not
@@ -183,11 +504,67 @@ int gpuvm_unlink(void *hostptr, unsigned idev);
 		@param idev the device for which to translate the host pointer
 		@returns the device pointer if successful and 0 if not, e.g. if hostptr is
 		not registered on host, or there is no link for a specific device, or idev
-		is not a valid device number. In any case, no error messages are generated
+		is not a valid device number. For a streamed array, the device window buffer
+		is returned. In any case, no error messages are generated
  */
 __attribute__((visibility("default")))
 void *gpuvm_xlate(void *hostptr, unsigned idev);
 
+/** 
+		translates a host pointer into a device buffer and the offset of the array
+		in it. The offset is nonzero only for arrays linked with gpuvm_link_alloc(),
+		which may share device buffers; it must be passed to the kernel along with
+		the buffer, or, for CUDA and simulated devices, added to the device pointer
+		@param hostptr a pointer on host
+		@param idev the device for which to translate the host pointer
+		@param [out] devoff the offset of the array in the device buffer
+		@returns the device buffer, the same as gpuvm_xlate(), if successful and 0
+		if not
+ */
+__attribute__((visibility("default")))
+void *gpuvm_xlate_offset(void *hostptr, unsigned idev, size_t *devoff);
+
+/** 
+		starts copying the array to device in the background, so that a later
+		gpuvm_kernel_begin() on the same device only has to wait for the copy to
+		complete, rather than perform it. Parts of the array written on host after
+		the prefetch has started are copied again by gpuvm_kernel_begin(). If a
+		prefetch for the array is already in progress, nothing is done
+		@param hostptr a pointer previously linked to a device buffer
+		@param idev the device to which to prefetch the array
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_prefetch(void *hostptr, unsigned idev);
+
+/** 
+		starts bringing the data of the array which are actual only on device back
+		to host in the background, so that a later host access does not have to
+		wait for a pagefault to be handled. The data are written back without
+		stopping other threads and remain shared with devices, so only a host
+		write takes a (cheap) pagefault; arrays which can't be written back this
+		way are unprotected through the pagefault handling path. The call returns
+		without waiting for the data
+		@param hostptr a pointer previously linked to a device buffer
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_prefetch_host(void *hostptr);
+
+/** 
+		gives a hint on how the array is going to be used, similar to
+		cudaMemAdvise(). Hints apply to the whole array and all its links, and
+		remain in effect until removed or until the array is unlinked from all
+		devices
+		@param hostptr a pointer previously linked to a device buffer
+		@param advice the hint, one of GPUVM_ADVISE_* constants
+		@param idev the location for ::GPUVM_ADVISE_PREFERRED_LOCATION, either a
+		device number or ::GPUVM_LOCATION_HOST; ignored for other hints
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_advise(void *hostptr, int advice, int idev);
+
 /** 
 		indicates that the device array corresponding to host array is about to be used in a
 		kernel, so make its state on device actual
@@ -195,7 +572,9 @@ void *gpuvm_xlate(void *hostptr, unsigned idev);
 		in a kernel
 		@param idev number of device on which a kernel is about to be launched
 		@param flags flags indicating possible buffer usage on device. Currently, must be
-		::GPUVM_READ_WRITE or ::GPUVM_READ_ONLY
+		::GPUVM_READ_WRITE, ::GPUVM_READ_ONLY or ::GPUVM_WRITE_ONLY. With
+		::GPUVM_WRITE_ONLY, the kernel must overwrite the whole array (or the whole
+		range, for gpuvm_kernel_begin_range()), as its data are not copied to device
 		@returns 0 if successful and error code if not
  */
 __attribute__((visibility("default")))
@@ -211,6 +590,58 @@ int gpuvm_kernel_begin(void *hostptr, unsigned idev, int flags);
 __attribute__((visibility("default")))
 int gpuvm_kernel_end(void *hostptr, unsigned idev);
 
+/** 
+		same as gpuvm_kernel_begin(), but for a kernel which uses only a part of the
+		array. Only the part is made actual on device, and it is tracked separately
+		from the rest of the array at page granularity, so that disjoint parts of
+		the same array can be used on different devices without invalidating each
+		other
+		@param hostptr a pointer previously linked to device buffer
+		@param offset the offset of the part used by the kernel, in bytes from hostptr
+		@param nbytes the size of the part used by the kernel, in bytes; the part
+		must lie inside the array
+		@param idev the device on which the kernel runs
+		@param flags the usage flags, as for gpuvm_kernel_begin()
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_kernel_begin_range
+(void *hostptr, size_t offset, size_t nbytes, unsigned idev, int flags);
+
+/** 
+		same as gpuvm_kernel_end(), but for a kernel started with
+		gpuvm_kernel_begin_range(); the range must be the same as the one passed
+		to gpuvm_kernel_begin_range()
+		@param hostptr a pointer previously linked to device buffer
+		@param offset the offset of the part used by the kernel, in bytes from hostptr
+		@param nbytes the size of the part used by the kernel, in bytes
+		@param idev device on which a kernel has recently finished
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_kernel_end_range(void *hostptr, size_t offset, size_t nbytes, unsigned idev);
+
+/** 
+		same as gpuvm_kernel_end(), but for a kernel which has written only the
+		given ranges of the array. Only the pages of these ranges are left actual
+		on device only and protected from host access; the rest of the array is
+		handled as if the kernel has only read it, so that its host copy stays
+		valid and is not copied back. The array is tracked at page granularity
+		from then on, as with gpuvm_kernel_begin_range(). The kernel must have been
+		started with gpuvm_kernel_begin(), and must not have written anything
+		outside the ranges
+		@param hostptr a pointer previously linked to device buffer
+		@param idev device on which a kernel has recently finished
+		@param written the ranges written by the kernel, with offsets from hostptr;
+		may be null if nwritten is 0
+		@param nwritten the number of ranges; 0 means that the kernel has written
+		nothing
+		@returns 0 if successful and error code if not
+ */
+__attribute__((visibility("default")))
+int gpuvm_kernel_end_written
+(void *hostptr, unsigned idev, const gpuvm_range_t *written, unsigned nwritten);
+
 /** 
 		gets the value of a certain GPUVM counter or parameter
 		@param parameter the parameter; currently available parameters are ::GPUVM_STAT_NDEVS,
@@ -0,0 +1,269 @@
+/** @file hcopy.c implementation of the host copy engine */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HCOPY_X86
+#endif
+
+#include "gpuvm.h"
+#include "hcopy.h"
+#include "semaph.h"
+#include "util.h"
+
+/** maximum number of threads copying together, including the calling one */
+#define HCOPY_MAX_THREADS 8
+
+/** minimum size of a copy done with non-temporal stores; smaller copies are
+		likely to be used soon, and are better left in cache */
+#define HCOPY_NT_MIN (1024 * 1024)
+
+/** minimum number of bytes copied by each thread of a parallel copy */
+#define HCOPY_CHUNK_MIN (1024 * 1024)
+
+/** alignment of destination for non-temporal stores, a cache line */
+#define HCOPY_ALIGN 64
+
+/** a function copying host memory */
+typedef void (*hcopy_func_t)(void *dst, const void *src, size_t nbytes);
+
+/** a worker thread of the copy engine */
+typedef struct {
+	/** the thread */
+	thread_t thread;
+	/** semaphore posted when the worker has a chunk to copy */
+	semaph_t start_sem;
+	/** the destination of the chunk */
+	char *dst;
+	/** the source of the chunk */
+	const char *src;
+	/** the size of the chunk */
+	size_t nbytes;
+	/** nonzero if the worker must quit */
+	volatile int quit;
+} hcopy_worker_t;
+
+/** the workers */
+static hcopy_worker_t hcopy_workers_g[HCOPY_MAX_THREADS - 1];
+
+/** the number of workers */
+static unsigned hcopy_nworkers_g = 0;
+
+/** mutex held while the workers are busy with a copy */
+static pthread_mutex_t hcopy_mutex_g = PTHREAD_MUTEX_INITIALIZER;
+
+/** semaphore posted by a worker when it has copied its chunk */
+static semaph_t hcopy_done_sem_g;
+
+/** semaphore posted by a worker when it has started */
+static semaph_t hcopy_init_sem_g;
+
+/** copy with non-temporal stores for this CPU, or 0 if there is none */
+static hcopy_func_t hcopy_nt_g = 0;
+
+#ifdef HCOPY_X86
+
+/** defines a copy with non-temporal stores; the destination is aligned to a
+		cache line, and then each cache line is loaded and stored with the body,
+		which uses the src and dst pointers. The stores are fenced, as they are
+		weakly ordered */
+#define HCOPY_NT_FUNC(name, isa, body)																	\
+	__attribute__((target(isa)))																						\
+	static void hcopy_nt_##name(void *dst, const void *src, size_t nbytes) {	\
+		size_t head = -(uintptr_t)dst % HCOPY_ALIGN;												\
+		if(head > nbytes)																										\
+			head = nbytes;																										\
+		memcpy(dst, src, head);																							\
+		char *d = (char*)dst + head;																				\
+		const char *s = (const char*)src + head;														\
+		char *end = d + (nbytes - head) / HCOPY_ALIGN * HCOPY_ALIGN;				\
+		for(; d < end; d += HCOPY_ALIGN, s += HCOPY_ALIGN) {								\
+			body;																															\
+		}																																		\
+		_mm_sfence();																												\
+		memcpy(d, s, (char*)dst + nbytes - d);															\
+	}
+
+HCOPY_NT_FUNC(sse2, "sse2", {
+		__m128i x0 = _mm_loadu_si128((const __m128i*)s);
+		__m128i x1 = _mm_loadu_si128((const __m128i*)(s + 16));
+		__m128i x2 = _mm_loadu_si128((const __m128i*)(s + 32));
+		__m128i x3 = _mm_loadu_si128((const __m128i*)(s + 48));
+		_mm_stream_si128((__m128i*)d, x0);
+		_mm_stream_si128((__m128i*)(d + 16), x1);
+		_mm_stream_si128((__m128i*)(d + 32), x2);
+		_mm_stream_si128((__m128i*)(d + 48), x3);
+	})
+
+HCOPY_NT_FUNC(avx2, "avx2", {
+		__m256i y0 = _mm256_loadu_si256((const __m256i*)s);
+		__m256i y1 = _mm256_loadu_si256((const __m256i*)(s + 32));
+		_mm256_stream_si256((__m256i*)d, y0);
+		_mm256_stream_si256((__m256i*)(d + 32), y1);
+	})
+
+HCOPY_NT_FUNC(avx512, "avx512f", {
+		__m512i z0 = _mm512_loadu_si512((const void*)s);
+		_mm512_stream_si512((void*)d, z0);
+	})
+
+#endif
+
+/** picks the copy with non-temporal stores for this CPU
+		@returns the copy function, or 0 if there is none
+ */
+static hcopy_func_t hcopy_select_nt(void) {
+#ifdef HCOPY_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f"))
+		return hcopy_nt_avx512;
+	if(__builtin_cpu_supports("avx2"))
+		return hcopy_nt_avx2;
+	if(__builtin_cpu_supports("sse2"))
+		return hcopy_nt_sse2;
+#endif
+	return 0;
+}  // hcopy_select_nt
+
+/** copies a chunk by the current thread alone
+		@param dst the destination
+		@param src the source
+		@param nbytes the number of bytes to copy
+ */
+static void hcopy_chunk(void *dst, const void *src, size_t nbytes) {
+	if(hcopy_nt_g && nbytes >= HCOPY_NT_MIN)
+		hcopy_nt_g(dst, src, nbytes);
+	else
+		memcpy(dst, src, nbytes);
+}  // hcopy_chunk
+
+/** thread routine of a copy engine worker */
+static void *hcopy_thread(void *arg) {
+	hcopy_worker_t *worker = (hcopy_worker_t*)arg;
+	worker->thread = self_thread();
+	if(semaph_post(&hcopy_init_sem_g)) {
+		fprintf(stderr, "hcopy_thread: can\'t post init semaphore\n");
+		return 0;
+	}
+	while(1) {
+		if(semaph_wait(&worker->start_sem) || worker->quit)
+			return 0;
+		hcopy_chunk(worker->dst, worker->src, worker->nbytes);
+		semaph_post(&hcopy_done_sem_g);
+	}
+}  // hcopy_thread
+
+/** quits the worker threads */
+static void hcopy_quit(void) {
+	unsigned iworker;
+	for(iworker = 0; iworker < hcopy_nworkers_g; iworker++) {
+		hcopy_workers_g[iworker].quit = 1;
+		semaph_post(&hcopy_workers_g[iworker].start_sem);
+	}
+}  // hcopy_quit
+
+/** stops the workers started so far, waits for them to quit and frees their
+		semaphores, when initialization fails
+		@param pthreads the workers started so far, hcopy_nworkers_g of them
+ */
+static void hcopy_unwind(const pthread_t *pthreads) {
+	unsigned iworker;
+	hcopy_quit();
+	for(iworker = 0; iworker < hcopy_nworkers_g; iworker++) {
+		pthread_join(pthreads[iworker], 0);
+		semaph_destroy(&hcopy_workers_g[iworker].start_sem);
+	}
+	hcopy_nworkers_g = 0;
+	semaph_destroy(&hcopy_init_sem_g);
+	semaph_destroy(&hcopy_done_sem_g);
+}  // hcopy_unwind
+
+int hcopy_init(int flags) {
+	if(flags & GPUVM_SERIAL_COPY)
+		return 0;
+	hcopy_nt_g = hcopy_select_nt();
+
+	// one thread per core, up to the limit, counting the calling thread
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned nworkers = ncpus > 1 ? ncpus - 1 : 0;
+	if(nworkers > HCOPY_MAX_THREADS - 1)
+		nworkers = HCOPY_MAX_THREADS - 1;
+	if(nworkers > MAX_NTHREADS - immune_nthreads_g)
+		nworkers = MAX_NTHREADS - immune_nthreads_g;
+	if(!nworkers)
+		return 0;
+	if(semaph_init(&hcopy_done_sem_g, 0))
+		return GPUVM_ERROR;
+	if(semaph_init(&hcopy_init_sem_g, 0)) {
+		semaph_destroy(&hcopy_done_sem_g);
+		return GPUVM_ERROR;
+	}
+	pthread_t pthreads[HCOPY_MAX_THREADS - 1];
+	unsigned iworker;
+	for(iworker = 0; iworker < nworkers; iworker++) {
+		hcopy_worker_t *worker = &hcopy_workers_g[iworker];
+		worker->quit = 0;
+		if(semaph_init(&worker->start_sem, 0))
+			break;
+		if(pthread_create(&pthreads[iworker], 0, hcopy_thread, worker)) {
+			semaph_destroy(&worker->start_sem);
+			break;
+		}
+		hcopy_nworkers_g++;
+	}
+	if(hcopy_nworkers_g < nworkers) {
+		fprintf(stderr, "hcopy_init: can\'t start worker thread\n");
+		hcopy_unwind(pthreads);
+		return GPUVM_ERROR;
+	}
+	for(iworker = 0; iworker < hcopy_nworkers_g; iworker++)
+		semaph_wait(&hcopy_init_sem_g);
+	if(atexit(hcopy_quit)) {
+		fprintf(stderr, "hcopy_init: can\'t finish initialization\n");
+		hcopy_unwind(pthreads);
+		return GPUVM_ERROR;
+	}
+	semaph_destroy(&hcopy_init_sem_g);
+	// the workers run until exit
+	for(iworker = 0; iworker < hcopy_nworkers_g; iworker++)
+		pthread_detach(pthreads[iworker]);
+	// workers copy while other threads are stopped
+	for(iworker = 0; iworker < hcopy_nworkers_g; iworker++)
+		immune_threads_g[immune_nthreads_g++] = hcopy_workers_g[iworker].thread;
+	return 0;
+}  // hcopy_init
+
+void hcopy(void *dst, const void *src, size_t nbytes) {
+	unsigned nthreads = nbytes / HCOPY_CHUNK_MIN;
+	if(nthreads > hcopy_nworkers_g + 1)
+		nthreads = hcopy_nworkers_g + 1;
+	if(nthreads <= 1 || pthread_mutex_trylock(&hcopy_mutex_g)) {
+		// too small, or the workers are busy
+		hcopy_chunk(dst, src, nbytes);
+		return;
+	}
+	// each thread gets a contiguous run of whole pages, so that it streams
+	// through memory on its own; the calling thread copies the first chunk
+	size_t chunk = (nbytes / nthreads + GPUVM_PAGE_SIZE - 1) / GPUVM_PAGE_SIZE *
+		GPUVM_PAGE_SIZE;
+	unsigned ithread;
+	for(ithread = 1; ithread < nthreads && ithread * chunk < nbytes; ithread++) {
+		hcopy_worker_t *worker = &hcopy_workers_g[ithread - 1];
+		size_t offset = ithread * chunk;
+		worker->dst = (char*)dst + offset;
+		worker->src = (const char*)src + offset;
+		worker->nbytes = nbytes - offset < chunk ? nbytes - offset : chunk;
+		semaph_post(&worker->start_sem);
+	}
+	nthreads = ithread;
+	hcopy_chunk(dst, src, chunk);
+	for(ithread = 1; ithread < nthreads; ithread++)
+		semaph_wait(&hcopy_done_sem_g);
+	pthread_mutex_unlock(&hcopy_mutex_g);
+}  // hcopy
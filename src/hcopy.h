@@ -0,0 +1,32 @@
+#ifndef GPUVM_HCOPY_H_
+#define GPUVM_HCOPY_H_
+
+/** @file hcopy.h
+		interface to the host copy engine, which performs the copies done by the
+		CPU on behalf of devices, i.e. simulated device copies and copies through
+		pinned staging buffers. Large copies are split into page-aligned chunks,
+		each copied by a separate thread of a small worker pool, with
+		non-temporal stores if the CPU supports them, so that the data copied do
+		not evict the last-level cache
+ */
+
+#include <stddef.h>
+
+/** initializes the copy engine, detecting CPU features and starting worker
+		threads; the workers are added to the immune threads
+		@param flags the flags passed to gpuvm_init(); with ::GPUVM_SERIAL_COPY,
+		no workers are started, and all copies are done with memcpy()
+		@returns 0 if successful and a negative error code if not
+ */
+int hcopy_init(int flags);
+
+/** copies host memory; a drop-in replacement for memcpy() which uses the
+		worker pool for large copies. If the pool is busy with another copy, the
+		copy is done by the calling thread alone
+		@param dst the destination
+		@param src the source
+		@param nbytes the number of bytes to copy
+ */
+void hcopy(void *dst, const void *src, size_t nbytes);
+
+#endif
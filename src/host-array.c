@@ -4,12 +4,17 @@
 #include <stddef.h>
 #include <string.h>
 
+#include "conv.h"
+#include "devapi.h"
 #include "gpuvm.h"
 #include "host-array.h"
 #include "link.h"
+#include "rect.h"
 #include "region.h"
+#include "stat.h"
 #include "subreg.h"
 #include "util.h"
+#include "zfill.h"
 
 /** splits the range passed into 1-3 subranges based on page boundaries:
 		if a range lies inside a single page, it is returned
@@ -75,49 +80,105 @@ static unsigned split_range(memrange_t subranges[MAX_SUBREGS], const memrange_t*
 	return nsubranges;
 }  // split_range
 
-int host_array_alloc(host_array_t **p, void *hostptr, size_t nbytes, int idev) {
+/** number of host arrays allocated */
+static size_t nhost_arrays_g = 0;
+
+/** gets the subranges of the next part of the array, which is the whole
+		array for an ordinary array, and the next run of rows for a strided array
+		@param range the range of the array
+		@param rect the layout of a strided array, or 0 for an ordinary array
+		@param irow [in,out] the part with which to start, 0 for the first one;
+		set to the next part
+		@param subranges [out] the subranges of the part
+		@returns the number of subranges of the part, or 0 if there are no more
+		parts
+ */
+static unsigned host_array_next_subranges
+(const memrange_t *range, const rect_t *rect, size_t *irow, 
+ memrange_t subranges[MAX_SUBREGS]) {
+	memrange_t run;
+	if(!rect) {
+		if((*irow)++)
+			return 0;
+		return split_range(subranges, range);
+	}
+	if(!rect_next_run(rect, range->ptr, irow, &run))
+		return 0;
+	return split_range(subranges, &run);
+}  // host_array_next_subranges
+
+int host_array_alloc(host_array_t **p, void *hostptr, size_t nbytes, 
+										 const rect_t *rect, const conv_t *conv, int idev) {
 	*p = 0;
-	host_array_t *new_host_array = (host_array_t*)smalloc(sizeof(host_array_t));
+	// generate subranges, first only to count them
+	memrange_t range = {hostptr, nbytes};
+	memrange_t subranges[MAX_SUBREGS];
+	unsigned nsubregs = 0, nsubranges;
+	size_t irow = 0;
+	while(nsubranges = host_array_next_subranges(&range, rect, &irow, subranges))
+		nsubregs += nsubranges;
+
+	// the array, its links and its subregions are allocated together
+	host_array_t *new_host_array = (host_array_t*)smalloc
+		(sizeof(host_array_t) + ndevs_g * sizeof(link_t*) + 
+		 nsubregs * sizeof(subreg_t));
 	//fprintf(stderr, "memory for host array allocated\n");
 	if(!new_host_array)
 		return GPUVM_ESALLOC;	
-	memset(new_host_array, 0, sizeof(host_array_t));
+	memset(new_host_array, 0, sizeof(host_array_t) + ndevs_g * sizeof(link_t*));
 	
-	new_host_array->range.ptr = hostptr;
-	new_host_array->range.nbytes = nbytes;
-	new_host_array->links = (link_t**)smalloc(ndevs_g * sizeof(link_t));
-	//fprintf(stderr, "memory for host array links allocated\n");
-	if(!new_host_array->links) {
-		sfree(new_host_array);
-		return GPUVM_ESALLOC;
+	new_host_array->preferred_location = NO_PREFERRED_LOCATION;
+	new_host_array->range = range;
+	if(rect) {
+		new_host_array->rect = (rect_t*)smalloc(sizeof(rect_t));
+		if(!new_host_array->rect) {
+			sfree(new_host_array);
+			return GPUVM_ESALLOC;
+		}
+		*new_host_array->rect = *rect;
+	}
+	if(conv) {
+		new_host_array->conv = (conv_t*)smalloc(sizeof(conv_t));
+		if(!new_host_array->conv) {
+			sfree(new_host_array->rect);
+			sfree(new_host_array);
+			return GPUVM_ESALLOC;
+		}
+		*new_host_array->conv = *conv;
 	}
-	memset(new_host_array->links, 0, ndevs_g * sizeof(link_t));
-	
-	// generate subranges
-	memrange_t subranges[MAX_SUBREGS];
-	unsigned nsubregs = split_range(subranges, &new_host_array->range);
-	unsigned isubreg;
 	new_host_array->nsubregs = nsubregs;
 	
-	// allocate subregions
-	int err;
-	for(isubreg = 0; isubreg < nsubregs; isubreg++) {
-		err = subreg_alloc(new_host_array->subregs + isubreg, 
-											 subranges[isubreg].ptr, subranges[isubreg].nbytes, idev);
-		//fprintf(stderr, "subregion allocated\n");
-		if(err) {
-			// free previously allocated subregions
-			unsigned jsubreg;
-			for(jsubreg = 0; jsubreg < isubreg; jsubreg++)
-				subreg_free(new_host_array->subregs[jsubreg]);
-			sfree(new_host_array->links);
-			return err;
+	// initialize subregions
+	int err = 0;
+	unsigned isubreg = 0, isubrange;
+	irow = 0;
+	while(!err && (nsubranges = host_array_next_subranges
+								 (&range, rect, &irow, subranges))) {
+		for(isubrange = 0; isubrange < nsubranges; isubrange++) {
+			subreg_t *subreg = host_array_subreg(new_host_array, isubreg);
+			err = subreg_init(subreg, subranges[isubrange].ptr, 
+												subranges[isubrange].nbytes, idev);
+			//fprintf(stderr, "subregion allocated\n");
+			if(err)
+				break;
+			subreg->host_array = new_host_array;
+			isubreg++;
 		}
-		new_host_array->subregs[isubreg]->host_array = new_host_array;
-	}  // for(isubreg)
+	}
+	if(err) {
+		// free previously initialized subregions
+		unsigned jsubreg;
+		for(jsubreg = 0; jsubreg < isubreg; jsubreg++)
+			subreg_free(host_array_subreg(new_host_array, jsubreg));
+		sfree(new_host_array->conv);
+		sfree(new_host_array->rect);
+		sfree(new_host_array);
+		return err;
+	}
 
 	//fprintf(stderr, "subregions allocated\n");
 
+	nhost_arrays_g++;
 	*p = new_host_array;
 	return 0;
 }  // host_array_alloc
@@ -130,29 +191,51 @@ void host_array_free(host_array_t *host_array) {
 	unsigned ilink;
 	for(ilink = 0; ilink < ndevs_g; ilink++)
 		link_free(host_array->links[ilink]);
-	sfree(host_array->links);
 	// free subregions
 	//fprintf(stderr, "freeing subregions\n");
 	unsigned isubreg;
 	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
-		subreg_free(host_array->subregs[isubreg]);
+		subreg_free(host_array_subreg(host_array, isubreg));
+	sfree(host_array->subregs);
 	// free memory
+	sfree(host_array->conv);
+	sfree(host_array->rect);
 	sfree(host_array);
+	nhost_arrays_g--;
 	//fprintf(stderr, "freed host array\n");
 	//fprintf(stderr, "host array deallocated\n");
 }  // host_array_free
 
-int host_array_find(host_array_t **p, void *hostptr, size_t nbytes) {
+subreg_t *host_array_subreg(const host_array_t *host_array, unsigned isubreg) {
+	if(host_array->subregs)
+		return host_array->subregs[isubreg];
+	return (subreg_t*)(host_array->links + ndevs_g) + isubreg;
+}  // host_array_subreg
+
+size_t host_array_count(void) {
+	return nhost_arrays_g;
+}  // host_array_count
+
+int host_array_find(host_array_t **p, void *hostptr, size_t nbytes, 
+										const rect_t *rect) {
 	*p = 0;
-	// find subregion
-	subreg_t *subreg = region_find_region_subreg_in_range(hostptr, nbytes);
+	// find subregion; for a strided range, only its runs of rows are searched,
+	// so that other data in between, e.g. other tiles, don't count
+	subreg_t *subreg = 0;
+	if(rect) {
+		memrange_t run;
+		size_t irow = 0;
+		while(!subreg && rect_next_run(rect, hostptr, &irow, &run))
+			subreg = region_find_region_subreg_in_range(run.ptr, run.nbytes);
+	} else
+		subreg = region_find_region_subreg_in_range(hostptr, nbytes);
 	/*region_t *region = region_find_region(hostptr);
 	if(!region) {
 		// try finding any intersecting region
 		region = region_find_region_in_range(hostptr, nbytes);
 		if(region) {
 			// return just any array found, not necessarily intersecting the range
-			*p = region->subreg_list->subreg->host_array;
+			*p = region->subregs->host_array;
 			return 1;
 		} else 
 			return 0;
@@ -179,22 +262,298 @@ host_array_t *host_array_find_by_ptr(void *hostptr) {
 	return subreg->host_array;
 }
 
-int host_array_sync_to_device(host_array_t *host_array, unsigned idev, int flags) {
+/** splits the subregion of the array containing the address, if the address is
+		strictly inside it
+		@param host_array the array
+		@param ptr the address at which to split, page-aligned
+		@returns 0 if successful and a negative error code if not
+ */
+static int host_array_split_at(host_array_t *host_array, void *ptr) {
+	unsigned isubreg;
+	subreg_t *subreg = 0;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg = host_array_subreg(host_array, isubreg);
+		if(memrange_pos_ptr(&subreg->range, ptr) == MR_CMP_INT)
+			break;
+	}
+	if(isubreg == host_array->nsubregs || subreg->range.ptr == ptr || 
+		 host_array->nsubregs >= MAX_SPLIT_SUBREGS)
+		return 0;
+	subreg_t **new_subregs = (subreg_t**)smalloc
+		((host_array->nsubregs + 1) * sizeof(subreg_t*));
+	if(!new_subregs)
+		return GPUVM_ESALLOC;
+	subreg_t *new_subreg;
+	int err;
+	if(err = subreg_split(subreg, ptr, &new_subreg)) {
+		sfree(new_subregs);
+		return err;
+	}
+	new_subreg->host_array = host_array;
+	unsigned jsubreg;
+	for(jsubreg = 0; jsubreg <= isubreg; jsubreg++)
+		new_subregs[jsubreg] = host_array_subreg(host_array, jsubreg);
+	new_subregs[isubreg + 1] = new_subreg;
+	for(jsubreg = isubreg + 1; jsubreg < host_array->nsubregs; jsubreg++)
+		new_subregs[jsubreg + 1] = host_array_subreg(host_array, jsubreg);
+	sfree(host_array->subregs);
+	host_array->subregs = new_subregs;
+	host_array->nsubregs++;
+	return 0;
+}  // host_array_split_at
+
+int host_array_split(host_array_t *host_array, const memrange_t *range) {
+	ptrdiff_t start = (char*)range->ptr - (char*)0;
+	ptrdiff_t end = start + range->nbytes;
+	int err;
+	start = start / GPUVM_PAGE_SIZE * GPUVM_PAGE_SIZE;
+	end = (end + GPUVM_PAGE_SIZE - 1) / GPUVM_PAGE_SIZE * GPUVM_PAGE_SIZE;
+	if(err = host_array_split_at(host_array, (char*)0 + start))
+		return err;
+	return host_array_split_at(host_array, (char*)0 + end);
+}  // host_array_split
+
+int host_array_same_layout(const host_array_t *host_array) {
+	return !host_array->rect && !host_array->conv;
+}  // host_array_same_layout
+
+int host_array_link_copy
+(const host_array_t *host_array, const link_t *link, const memrange_t *range,
+ int to_device) {
+	if(host_array->conv)
+		return conv_copy(host_array->conv, host_array->range.ptr, link->idev, 
+										 link->buf, link->devoff, range, to_device);
+	if(host_array->rect)
+		return rect_copy(host_array->rect, host_array->range.ptr, link->idev, 
+										 link->buf, link->devoff, range, to_device);
+	size_t devoff = link->devoff + 
+		((char*)range->ptr - (char*)host_array->range.ptr);
+	return to_device ?
+		zfill_memcpy_h2d(link->idev, link->buf, range->ptr, range->nbytes, devoff) :
+		memcpy_d2h(devapi_g, link->idev, range->ptr, link->buf, range->nbytes, 
+							 devoff);
+}  // host_array_link_copy
+
+/** checks whether the subregion is used by a kernel working on a range
+		@param subreg the subregion to check
+		@param range the range used by the kernel, or 0 for the whole array
+		@returns nonzero if the subregion intersects the range and 0 if not
+ */
+static int subreg_in_range(const subreg_t *subreg, const memrange_t *range) {
+	if(!range)
+		return 1;
+	memrange_cmp_t cmp = memrange_cmp(&subreg->range, range);
+	return cmp != MR_CMP_LT && cmp != MR_CMP_GT;
+}  // subreg_in_range
+
+int host_array_pre_sync_to_device
+(host_array_t *host_array, unsigned idev, int flags, const memrange_t *range) {
 	if(!host_array->links[idev]) {
-		fprintf(stderr, "host_array_sync_to_device: no link for array on device\n");
+		fprintf(stderr, "host_array_pre_sync_to_device: no link for array on device\n");
+		return GPUVM_ENOLINK;
+	}
+	unsigned isubreg;
+	int err;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(!subreg_in_range(subreg, range))
+			continue;
+		// a subregion only partly inside the range keeps data outside it, which
+		// must be uploaded as well
+		int subreg_flags = flags;
+		if((flags & GPUVM_READ_WRITE) == GPUVM_WRITE_ONLY && range && 
+			 !memrange_is_inside(range, &subreg->range))
+			subreg_flags = flags | GPUVM_READ_WRITE;
+		if(err = subreg_pre_sync_to_device(subreg, idev, subreg_flags))
+			return err;
+	}
+	return 0;
+}  // host_array_pre_sync_to_device
+
+int host_array_copy_to_device
+(host_array_t *host_array, unsigned idev, const memrange_t *range) {
+	link_t *link = host_array->links[idev];
+	if(!link || !link->buf) {
+		fprintf(stderr, "host_array_copy_to_device: no device buffer for array\n");
 		return GPUVM_ENOLINK;
 	}
+	unsigned isubreg, istart;
+	int err;
+	// subregions of an array are adjacent both on host and on device, so copy
+	// each run of subregions not actual on device with a single command; for a
+	// strided array, the gaps between subregions are not copied
+	for(isubreg = istart = 0; isubreg <= host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = isubreg < host_array->nsubregs ? 
+			host_array_subreg(host_array, isubreg) : 0;
+		if(subreg && subreg_in_range(subreg, range) && 
+			 !subreg_is_actual_on_device(subreg, idev)) {
+			if((subreg->state & SUBREG_USAGE) != GPUVM_WRITE_ONLY)
+				continue;
+			// the kernel overwrites the subregion, so there is nothing to copy, nor
+			// to read back from another device; the host copy becomes stale at the
+			// end of the kernel
+			if(stat_enabled())
+				stat_acc_ull(GPUVM_STAT_WRITE_ONLY_BYTES, 
+										 subreg->range.nbytes * 
+										 (subreg->state & SUBREG_ACTUAL_HOST ? 1 : 2));
+			subreg_mark_synced_to_device(subreg, idev);
+		}
+		if(isubreg > istart) {
+			subreg_t *first = host_array_subreg(host_array, istart), 
+				*last = host_array_subreg(host_array, isubreg - 1);
+			memrange_t run;
+			run.ptr = first->range.ptr;
+			run.nbytes = (char*)last->range.ptr + last->range.nbytes - (char*)run.ptr;
+			if(err = host_array_link_copy(host_array, link, &run, 1))
+				return err;
+			unsigned jsubreg;
+			for(jsubreg = istart; jsubreg < isubreg; jsubreg++)
+				subreg_mark_synced_to_device(host_array_subreg(host_array, jsubreg), idev);
+		}
+		istart = isubreg + 1;
+	}
+	return 0;
+}  // host_array_copy_to_device
+
+/** checks whether the only actual copy of the subregion is on the device
+		@param subreg the subregion
+		@param idev the device, or a negative value for any device
+		@returns nonzero if the subregion is not actual on host, and, if idev is
+		not negative, is actual on idev only, and 0 otherwise
+ */
+static int subreg_only_on_device(const subreg_t *subreg, int idev) {
+	if(subreg->state & SUBREG_ACTUAL_HOST)
+		return 0;
+	return idev < 0 || subreg->actual_mask == 1ull << idev;
+}  // subreg_only_on_device
+
+/** taps into the subregions of the array whose only actual copy is on device,
+		to bring them back to host through pagefault handling
+		@param host_array the array to bring back to host
+		@param idev the device whose subregions to bring back, or a negative value
+		to bring back all subregions not actual on host
+ */
+static void host_array_tap(const host_array_t *host_array, int idev) {
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(subreg_only_on_device(subreg, idev))
+			*(volatile char*)subreg->range.ptr;
+	}
+}  // host_array_tap
+
+int host_array_evict(host_array_t *host_array, unsigned idev) {
+	unsigned isubreg;
+	// data also actual on other devices needn't go back to host
+	host_array_tap(host_array, idev);
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(subreg_only_on_device(subreg, idev)) {
+			fprintf(stderr, "host_array_evict: can\'t bring data back to host\n");
+			return GPUVM_ERROR;
+		}
+		subreg_drop_device(subreg, idev);
+	}
+	return 0;
+}  // host_array_evict
+
+int host_array_advise(host_array_t *host_array, int advice, int idev) {
 	unsigned isubreg;
 	int err;
+	switch(advice) {
+	case GPUVM_ADVISE_READ_MOSTLY:
+		host_array->advice |= ADVICE_READ_MOSTLY;
+		break;
+	case GPUVM_ADVISE_UNSET_READ_MOSTLY:
+		host_array->advice &= ~ADVICE_READ_MOSTLY;
+		break;
+	case GPUVM_ADVISE_PREFERRED_LOCATION:
+		host_array->preferred_location = idev;
+		break;
+	case GPUVM_ADVISE_UNSET_PREFERRED_LOCATION:
+		host_array->preferred_location = NO_PREFERRED_LOCATION;
+		break;
+	case GPUVM_ADVISE_IMMUTABLE:
+		// host data must be actual before protection is abandoned
+		host_array_tap(host_array, -1);
+		for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
+			if(!(host_array_subreg(host_array, isubreg)->state & 
+					 SUBREG_ACTUAL_HOST)) {
+				fprintf(stderr, "host_array_advise: can't bring data back to host\n");
+				return GPUVM_ERROR;
+			}
+		host_array->advice |= ADVICE_IMMUTABLE;
+		break;
+	case GPUVM_ADVISE_UNSET_IMMUTABLE:
+		if(!(host_array->advice & ADVICE_IMMUTABLE))
+			break;
+		// host writes are not tracked for an immutable array, so its device copies
+		// can't be trusted any more
+		host_array->advice &= ~ADVICE_IMMUTABLE;
+		for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
+			if(err = subreg_sync_to_host(host_array_subreg(host_array, isubreg)))
+				return err;
+		break;
+	default:
+		fprintf(stderr, "host_array_advise: invalid advice\n");
+		return GPUVM_EARG;
+	}
+	return 0;
+}  // host_array_advise
+
+int host_array_needs_write_back(const host_array_t *host_array) {
+	if(!(host_array->advice & ADVICE_READ_MOSTLY) && 
+		 host_array->preferred_location != GPUVM_LOCATION_HOST)
+		return 0;
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
+		if(!(host_array_subreg(host_array, isubreg)->state & SUBREG_ACTUAL_HOST))
+			return 1;
+	return 0;
+}  // host_array_needs_write_back
+
+int host_array_write_back(host_array_t *host_array, unsigned idev) {
+	unsigned isubreg;
+	int err;
+	host_array_tap(host_array, -1);
 	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
-		err = subreg_sync_to_device(host_array->subregs[isubreg], idev, flags);
-		if(err)
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(!(subreg->state & SUBREG_ACTUAL_HOST)) {
+			fprintf(stderr, "host_array_write_back: can't bring data back to host\n");
+			return GPUVM_ERROR;
+		}
+		// readback leaves the data shared with the device, and the region
+		// write-protected; the protection is set here as well in case the data
+		// have already been on host
+		if(subreg_usage_count(subreg))
+			continue;
+		if(err = region_protect_after(subreg->region, GPUVM_READ_ONLY))
 			return err;
 	}
 	return 0;
-}  // host_array_sync_to_device
+}  // host_array_write_back
+
+/** checks whether the subregion has been written by a kernel
+		@param subreg the subregion to check
+		@param written the ranges written by the kernel, or 0 if it may have
+		written everything it used
+		@param nwritten the number of ranges written
+		@returns nonzero if the subregion intersects any of the ranges and 0 if not
+ */
+static int subreg_is_written
+(const subreg_t *subreg, const memrange_t *written, unsigned nwritten) {
+	if(!written)
+		return 1;
+	unsigned iwritten;
+	for(iwritten = 0; iwritten < nwritten; iwritten++)
+		if(subreg_in_range(subreg, &written[iwritten]))
+			return 1;
+	return 0;
+}  // subreg_is_written
 
-int host_array_after_kernel(host_array_t *host_array, unsigned idev) {
+int host_array_after_kernel
+(host_array_t *host_array, unsigned idev, const memrange_t *range, 
+ const memrange_t *written, unsigned nwritten) {
 	if(!host_array->links[idev]) {
 		fprintf(stderr, "host_array_after_kernel: no link for array on device\n");
 		return GPUVM_ENOLINK;
@@ -202,13 +561,26 @@ int host_array_after_kernel(host_array_t *host_array, unsigned idev) {
 	unsigned isubreg;
 	int err;
 	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
-		if(err = subreg_after_kernel(host_array->subregs[isubreg], idev))
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(!subreg_in_range(subreg, range))
+			continue;
+		if(err = subreg_after_kernel
+			 (subreg, idev, subreg_is_written(subreg, written, nwritten)))
 			return err;
 	}
 	return 0;
 }  // host_array_after_kernel
 
 int host_array_remove_link(host_array_t *host_array, unsigned idev) {
+	// copies on the device become invalid, even if shared; data not synced back
+	// from the device are left as they are
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		if(subreg->state & SUBREG_ACTUAL_HOST || 
+			 subreg->actual_mask & ~(1ull << idev))
+			subreg_drop_device(subreg, idev);
+	}
 	link_t **plink = &host_array->links[idev];
 	//fprintf(stderr, "freeing link\n");
 	link_free(*plink);
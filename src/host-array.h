@@ -4,26 +4,59 @@
 /** @file host-array.h
 		this file contains definition for the host_array_t structure, which corresponds to a
 		single host array, and holds data on that array as well as pointers to links and
-		subregions associated with array
+		subregions associated with array. A host array is allocated as a single block,
+		together with its links and its initial subregions, as there may be millions of
+		small arrays
  */
 
 #include "util.h"
 
 #define MAX_SUBREGS 3
+/** maximum number of subregions of an array after host_array_split(); splits
+		are never merged back, so ranges used after this many are tracked with the
+		subregions they intersect */
+#define MAX_SPLIT_SUBREGS 64
 
+/** host array advice flag: the array is mostly read */
+#define ADVICE_READ_MOSTLY 0x1
+/** host array advice flag: the array is never modified */
+#define ADVICE_IMMUTABLE 0x2
+
+/** the array has no preferred location */
+#define NO_PREFERRED_LOCATION -2
+
+struct conv_struct;
 struct link_struct;
+struct rect_struct;
 struct subreg_struct;
 
 typedef struct host_array_struct {
 	/** memory range corresponding to the array */
 	memrange_t range;
-	/** links associated with the host array, one for each device */
-	struct link_struct **links;
-	/** total number of subregions associated with array, no more than MAX_SUBREGS */
+	/** subregions associated with the array, sorted by address, once they have
+			been split with host_array_split(); 0 while the array has only the
+			subregions allocated inline with it. Use host_array_subreg() to get a
+			subregion */
+	struct subreg_struct **subregs;
+	/** layout of a strided array, i.e. a tile of a larger host matrix, or 0 for
+			an ordinary array; the subregions of a strided array cover only the runs
+			of its rows, and may have gaps between them */
+	struct rect_struct *rect;
+	/** conversion of the array elements on their way to and from device, or 0
+			if the array is copied as is */
+	struct conv_struct *conv;
+	/** total number of subregions associated with array; no more than MAX_SUBREGS
+			for each run of an ordinary or strided array initially, but up to
+			MAX_SPLIT_SUBREGS after subregions are split with host_array_split() */
 	unsigned nsubregs;
-	/** subregions associated with the array; only first nsubregs point to actual
-	subregions, others are null */
-	struct subreg_struct *subregs[MAX_SUBREGS];
+	/** combination of ADVICE_* flags given with gpuvm_advise() */
+	short advice;
+	/** preferred location of the array, a device number, ::GPUVM_LOCATION_HOST
+			or ::NO_PREFERRED_LOCATION */
+	short preferred_location;
+	/** links associated with the host array, one for each device, followed by
+			the subregions allocated inline with the array */
+	struct link_struct *links[];
 } host_array_t;
 
 /** allocates the host array, under assumption that no such array exists. Subregions are
@@ -31,24 +64,48 @@ typedef struct host_array_struct {
 		@param p [out] *p points to allocated array if successful and is 0 if not
 		@param hostptr pointer to the start of the host array
 		@param nbytes size of the host array in bytes
+		@param rect layout of a strided array, copied into the array, or 0 for an
+		ordinary array; for a strided array, hostptr is the first byte of the tile
+		and nbytes is the size of the range it spans
+		@param conv conversion of the array elements, copied into the array, or 0
+		if the array is copied as is
 		@param idev the device on which the array is located, or a negative value if
 		initially on host
 		@returns 0 if successful and negative error code if not
  */
-int host_array_alloc(host_array_t **p, void *hostptr, size_t nbytes, int idev);
+int host_array_alloc(host_array_t **p, void *hostptr, size_t nbytes, 
+										 const struct rect_struct *rect, 
+										 const struct conv_struct *conv, int idev);
 
 /** frees a previously allocated host array 
 		@param host_array host array to free
  */
 void host_array_free(host_array_t *host_array);
 
+/** gets a subregion of the array
+		@param host_array the array
+		@param isubreg the number of the subregion, less than the number of
+		subregions of the array
+		@returns the subregion
+ */
+struct subreg_struct *host_array_subreg
+(const host_array_t *host_array, unsigned isubreg);
+
+/** gets the number of host arrays currently allocated
+		@returns the number of host arrays
+ */
+size_t host_array_count(void);
+
 /** finds an array which either equals or intersects the specified range
 		@param p [out] *p contains pointer to array if found and 0 if not
 		@param hostptr start of memory range
 		@param nbytes the size of memory range; may be 0 if searching for pointer only
+		@param rect the layout of a strided range, of which only the runs of rows
+		are searched, or 0 to search the whole range
 		@returns 0 if either no array if found or the array found is the same as the host
 		range, and 1 if the array found is not the same as the host range */
-int host_array_find(host_array_t **p, void *hostptr, size_t nbytes);
+int host_array_find(host_array_t **p, void *hostptr, size_t nbytes, 
+										const struct rect_struct *rect);
 
 /** finds a host array which contains the given address
 		@param hostptr the address
@@ -56,21 +113,115 @@ int host_array_find(host_array_t **p, void *hostptr, size_t nbytes);
  */
 host_array_t *host_array_find_by_ptr(void *hostptr);
 
-/** synchronizes the array (if necessary) so that it is actual on the specified device
-		@param the array to synchronize
-		@param idev the device on which to make the array synchronous
-		@param flags usage flags, either ::GPUVM_READ_WRITE or ::GPUVM_READ_ONLY
+/** splits the subregions of the array so that the range, extended to page
+		boundaries, consists of whole subregions, and its actuality can be tracked
+		separately from the rest of the array. The array is left as it is once it
+		has ::MAX_SPLIT_SUBREGS subregions, so that repeated ranges don't fragment it
+		without bound. Must be called with the global writer lock held
+		@param host_array the array whose subregions to split
+		@param range the range inside the array
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_split(host_array_t *host_array, const memrange_t *range);
+
+/** checks whether the array is laid out on device as on host, i.e. is neither
+		strided nor converted, so that any its range can be copied to the same
+		offset on device
+		@param host_array the array to check
+		@returns nonzero if it is and 0 if not
+ */
+int host_array_same_layout(const host_array_t *host_array);
+
+/** copies the data of the array lying in a host range between host and the
+		device of the link; for a strided array, only the bytes of the tile rows
+		are copied, with rectangular copies, and for a converted array, the
+		elements are converted during copying
+		@param host_array the array
+		@param link the link of the array
+		@param range the host range, inside the array
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_link_copy
+(const host_array_t *host_array, const struct link_struct *link, 
+ const memrange_t *range, int to_device);
+
+/** prepares the array for synchronization to the specified device; this
+		updates usage info and brings data to host if they are actual on another
+		device only
+		@param host_array the array to prepare
+		@param idev the device on which to make the array actual
+		@param flags usage flags, ::GPUVM_READ_WRITE, ::GPUVM_READ_ONLY or
+		::GPUVM_WRITE_ONLY; subregions only partly inside a write-only range are
+		used read-write, so that their data outside the range are uploaded
+		@param range the range of the array used on device, or 0 for the whole
+		array; only subregions intersecting it are affected
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_pre_sync_to_device
+(host_array_t *host_array, unsigned idev, int flags, const memrange_t *range);
+
+/** copies the parts of the array which are not actual on the device to it;
+		must be preceded by host_array_pre_sync_to_device(), and may be repeated if
+		it fails, e.g. due to lack of device memory
+		@param host_array the array to copy
+		@param idev the device on which to make the array actual
+		@param range the range of the array to copy, or 0 for the whole array
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_copy_to_device
+(host_array_t *host_array, unsigned idev, const memrange_t *range);
+
+/** brings the data of the array which are actual only on the device back to
+		host, and marks the array as not actual on the device, so that the device
+		memory can be freed. Must be called with the global reader lock held
+		@param host_array the array to evict
+		@param idev the device from which to evict the array
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_evict(host_array_t *host_array, unsigned idev);
+
+/** applies a hint on the array usage
+		@param host_array the array to which the hint applies
+		@param advice the hint, one of GPUVM_ADVISE_* constants
+		@param idev the location for ::GPUVM_ADVISE_PREFERRED_LOCATION
+		@returns 0 if successful and a negative error code if not
+ */
+int host_array_advise(host_array_t *host_array, int advice, int idev);
+
+/** checks whether the array must be written back to host eagerly after a
+		kernel, i.e. it is read-mostly or prefers host, and has data actual only on
+		a device
+		@param host_array the array to check
+		@returns nonzero if it must and 0 if not
+ */
+int host_array_needs_write_back(const host_array_t *host_array);
+
+/** brings the data of the array actual only on the device back to host,
+		keeping the device copy valid as well; host memory is left write-protected,
+		so that a host write invalidates the device copy. Must be called with the
+		global reader lock held
+		@param host_array the array to write back
+		@param idev the device on which the array has been used
 		@returns 0 if successful and a negative error code if not
  */
-int host_array_sync_to_device(host_array_t *host_array, unsigned idev, int flags);
+int host_array_write_back(host_array_t *host_array, unsigned idev);
 
 /** performs necessary actions after device counterpart of the array has been used in the
 		kernel (for both reading and writing). This includes marking array as not-actual on
 		host and setting up memory protection
 		@param host_array the array which was used on device
 		@param idev the device on which the array was used
+		@param range the range of the array used on device, or 0 for the whole
+		array
+		@param written the ranges written by the kernel, or 0 if it may have
+		written everything it used; subregions not intersecting any of them are
+		handled as only read by the kernel
+		@param nwritten the number of ranges written
  */
-int host_array_after_kernel(host_array_t *host_array, unsigned idev);
+int host_array_after_kernel
+(host_array_t *host_array, unsigned idev, const memrange_t *range, 
+ const memrange_t *written, unsigned nwritten);
 
 /** removes the host array link on the specified device. The link removed is freed
 		@param host_array the host array for which to remove the link
@@ -1,13 +1,21 @@
+#include "devmem.h"
 #include "gpuvm.h"
 #include "host-array.h"
 #include "link.h"
+#include "residency.h"
 #include "util.h"
 
-int link_alloc(link_t **p, void *buf, unsigned idev, host_array_t *host_array) {
+int link_alloc(link_t **p, void *buf, size_t devoff, unsigned idev, 
+							 host_array_t *host_array) {
 	if(!(*p = (link_t*)smalloc(sizeof(link_t)))) 
 		return GPUVM_ESALLOC;
 	link_t *link = *p;
 	link->buf = buf;
+	link->devoff = devoff;
+	link->allocated = 0;
+	link->nkernels = 0;
+	link->lru_prev = link->lru_next = 0;
+	link->prefetch = 0;
 	link->idev = idev;
 	link->host_array = host_array;
 	host_array->links[idev] = link;
@@ -17,5 +25,11 @@ int link_alloc(link_t **p, void *buf, unsigned idev, host_array_t *host_array) {
 void link_free(link_t *link) {
 	if(!link)
 		return;
+	if(link->allocated) {
+		residency_remove(link);
+		if(link->buf)
+			devmem_free(link->idev, link->host_array->range.nbytes, link->buf, 
+									link->devoff);
+	}
 	sfree(link);
 }
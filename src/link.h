@@ -5,27 +5,49 @@
 		this file defines link, which "links" host array to a buffer on a specific device
 */
 
+#include <stddef.h>
+
 struct host_array_struct;
+struct prefetch_struct;
 
 typedef struct link_struct {
 	/** device buffer */
 	void *buf;
-	/** device for this link */
-	unsigned idev;
+	/** offset of the array in the device buffer; nonzero for small arrays
+			packed into a shared buffer allocated by GPUVM */
+	size_t devoff;
+	/** previous and next links in the per-device LRU list of links allocated by
+			GPUVM, most recently used first */
+	struct link_struct *lru_prev, *lru_next;
+	/** prefetch of the array to the device in progress, or 0 if none; it is
+			installed and taken with atomic operations, as prefetches are started and
+			finished with only the reader lock held */
+	struct prefetch_struct *prefetch;
 	/** host array corresponding to the link */
 	struct host_array_struct *host_array;
+	/** device for this link */
+	unsigned idev;
+	/** number of kernels currently using the link; a link in use is never
+			evicted */
+	unsigned nkernels : 31;
+	/** nonzero if the device memory has been allocated by GPUVM, and must be
+			freed together with the link */
+	unsigned allocated : 1;
 } link_t;
 
 /** allocates a new link, and assigns it into the array
 		@param p [out] - *p points to allocated link if successful and is 0 if not
 		@param buf device buffer
+		@param devoff offset of the array in the device buffer
 		@param idev device number for which the link is created
 		@param host_array host array associated with the link, or 0 if none
 		@returns 0 if successful and negative error code if not
  */
-int link_alloc(link_t **p, void *buf, unsigned idev, struct host_array_struct *host_array);
+int link_alloc(link_t **p, void *buf, size_t devoff, unsigned idev, 
+							 struct host_array_struct *host_array);
 
-/** frees a previously allocated link 
+/** frees a previously allocated link, together with device memory if it has
+		been allocated by GPUVM
 		@param link the link to be freed
  */
 void link_free(link_t *link);
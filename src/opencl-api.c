@@ -22,6 +22,10 @@
 
 #define MAX_DEVICE_NAME_LENGTH 256
 
+/** maximum number of copy commands enqueued before waiting for them in a
+		batched copy */
+#define MAX_COPY_BATCH 32
+
 /** OpenCL devapi structure */
 devapi_t ocl_devapi_g;
 
@@ -52,6 +56,110 @@ int ocl_memcpy_d2h
 static int ocl_memcpy_h2d
 (unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
 
+/** an OpenCL function for batched host-to-device copy
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies);
+
+/** an OpenCL function for batched device-to-host copy
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param copies ranges to copy
+		@param ncopies number of ranges to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies);
+
+/** an OpenCL function for batched host-to-device copy of rectangular blocks,
+		with clEnqueueWriteBufferRect()
+		@param idev GPUVM device number
+		@param tgt target pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects);
+
+/** an OpenCL function for batched device-to-host copy of rectangular blocks,
+		with clEnqueueReadBufferRect()
+		@param idev GPUVM device number
+		@param src source pointer, that is, device pointer
+		@param rects blocks to copy
+		@param nrects number of blocks to copy
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects);
+
+/** an OpenCL function for device buffer allocation; the buffer is created in
+		the context of the device's command queue
+		@param idev GPUVM device number
+		@param nbytes the size of the buffer
+		@param pbuf [out] *pbuf is the allocated buffer (cl_mem) if successful
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_mem_alloc(unsigned idev, size_t nbytes, void **pbuf);
+
+/** an OpenCL function for freeing a device buffer
+		@param idev GPUVM device number
+		@param buf the buffer (cl_mem) to free
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_mem_free(unsigned idev, void *buf);
+
+/** checks whether the device shares memory with host, i.e. is a CPU device or
+		reports CL_DEVICE_HOST_UNIFIED_MEMORY */
+static int ocl_host_unified(unsigned idev);
+
+/** creates a buffer with CL_MEM_USE_HOST_PTR over the host memory */
+static int ocl_mem_wrap(unsigned idev, void *hostptr, size_t nbytes, void **pbuf);
+
+/** releases a buffer created over host memory */
+static int ocl_mem_unwrap(unsigned idev, void *buf);
+
+/** maps a buffer created over host memory for reading and writing, blocking
+		until the mapping completes; fails if the runtime maps the buffer at an
+		address other than its host memory */
+static int ocl_mem_map(unsigned idev, void *buf, void *hostptr, size_t nbytes);
+
+/** unmaps a buffer created over host memory and waits for the unmapping */
+static int ocl_mem_unmap(unsigned idev, void *buf, void *hostptr);
+
+/** enqueues a host-to-device copy without waiting for it; the event is the
+		OpenCL event of the copy */
+static int ocl_memcpy_h2d_async
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+ void **pevent);
+
+/** enqueues a device-to-host copy without waiting for it */
+static int ocl_memcpy_d2h_async
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+ void **pevent);
+
+/** waits for an enqueued copy, collects statistics for it and releases its
+		event */
+static int ocl_event_wait(unsigned idev, void *event);
+
+/** copies between buffers of two devices with clEnqueueCopyBuffer(); this is
+		possible only if their queues share a context */
+static int ocl_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes);
+
+#ifdef CL_VERSION_1_2
+/** fills a buffer range with clEnqueueFillBuffer(), available since OpenCL
+		1.2 */
+static int ocl_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value);
+#endif
+
 int ocl_devapi_init(void) {
 	// fill in devapi_g structure
 	//devapi_g = (devapi_t*)smalloc(sizeof(devapi_t));
@@ -60,6 +168,24 @@ int ocl_devapi_init(void) {
 	devapi_g = &ocl_devapi_g;
 	devapi_g->memcpy_d2h = ocl_memcpy_d2h;
 	devapi_g->memcpy_h2d = ocl_memcpy_h2d;
+	devapi_g->memcpy_d2h_n = ocl_memcpy_d2h_n;
+	devapi_g->memcpy_h2d_n = ocl_memcpy_h2d_n;
+	devapi_g->memcpy_d2h_rect = ocl_memcpy_d2h_rect;
+	devapi_g->memcpy_h2d_rect = ocl_memcpy_h2d_rect;
+	devapi_g->mem_alloc = ocl_mem_alloc;
+	devapi_g->mem_free = ocl_mem_free;
+	devapi_g->host_unified = ocl_host_unified;
+	devapi_g->mem_wrap = ocl_mem_wrap;
+	devapi_g->mem_unwrap = ocl_mem_unwrap;
+	devapi_g->mem_map = ocl_mem_map;
+	devapi_g->mem_unmap = ocl_mem_unmap;
+	devapi_g->memcpy_h2d_async = ocl_memcpy_h2d_async;
+	devapi_g->memcpy_d2h_async = ocl_memcpy_d2h_async;
+	devapi_g->event_wait = ocl_event_wait;
+	devapi_g->memcpy_peer = ocl_memcpy_peer;
+#ifdef CL_VERSION_1_2
+	devapi_g->mem_fill = ocl_mem_fill;
+#endif
 
 	// do AMD hack if needed
 	return ocl_amd_hack_init();
@@ -221,4 +347,326 @@ static int ocl_memcpy_h2d(unsigned idev, void *tgt, void *src, size_t nbytes,
 	}	
 }  // ocl_memcpy_h2d()
 
+/** waits for a batch of enqueued copy commands, collects statistics for them
+		and releases their events
+		@param evs events of the enqueued commands
+		@param nevs number of commands enqueued
+		@param cl_err error code returned by the first failed enqueue, or
+		CL_SUCCESS if all commands were enqueued successfully
+		@returns 0 if successful and a negative error code if not
+ */
+static int ocl_wait_copies(cl_event *evs, unsigned nevs, int cl_err) {
+	int err = 0;
+	unsigned iev;
+	if(nevs)
+		clWaitForEvents(nevs, evs);
+	if(cl_err != CL_SUCCESS) {
+		if(cl_err == CL_MEM_OBJECT_ALLOCATION_FAILURE || 
+			 cl_err == CL_OUT_OF_RESOURCES || cl_err == CL_OUT_OF_HOST_MEMORY) {
+			err = GPUVM_EDEVALLOC;
+		} else {
+			fprintf(stderr, "ocl_wait_copies: can\'t copy buffer data\n");
+			err = GPUVM_ERROR;
+		}
+	}
+	for(iev = 0; iev < nevs; iev++) {
+		// do statistics collection
+		if(!err && stat_enabled()) {
+			double time;
+			(err = ocl_time(&time, evs[iev])) || 
+				(err = stat_acc_double(GPUVM_STAT_COPY_TIME, time));
+		}
+		clReleaseEvent(evs[iev]);
+	}
+	return err;
+}  // ocl_wait_copies
+
+static int ocl_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_mem buffer = (cl_mem)tgt;
+	cl_event evs[MAX_COPY_BATCH];
+	unsigned icopy, nevs = 0;
+	int err = 0;
+	for(icopy = 0; icopy < ncopies && !err; icopy++) {
+		int cl_err = clEnqueueWriteBuffer
+			(queue, buffer, CL_FALSE, copies[icopy].devoff, copies[icopy].nbytes,
+			 copies[icopy].hostptr, 0, 0, &evs[nevs]);
+		if(cl_err == CL_SUCCESS)
+			nevs++;
+		if(cl_err != CL_SUCCESS || nevs == MAX_COPY_BATCH || icopy == ncopies - 1) {
+			err = ocl_wait_copies(evs, nevs, cl_err);
+			nevs = 0;
+		}
+	}
+	return err;
+}  // ocl_memcpy_h2d_n
+
+static int ocl_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_mem buffer = (cl_mem)src;
+	cl_event evs[MAX_COPY_BATCH];
+	unsigned icopy, nevs = 0;
+	int err = 0;
+	for(icopy = 0; icopy < ncopies && !err; icopy++) {
+		int cl_err = clEnqueueReadBuffer
+			(queue, buffer, CL_FALSE, copies[icopy].devoff, copies[icopy].nbytes,
+			 copies[icopy].hostptr, 0, 0, &evs[nevs]);
+		if(cl_err == CL_SUCCESS)
+			nevs++;
+		if(cl_err != CL_SUCCESS || nevs == MAX_COPY_BATCH || icopy == ncopies - 1) {
+			err = ocl_wait_copies(evs, nevs, cl_err);
+			nevs = 0;
+		}
+	}
+	return err;
+}  // ocl_memcpy_d2h_n
+
+static int ocl_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_mem buffer = (cl_mem)tgt;
+	cl_event evs[MAX_COPY_BATCH];
+	unsigned irect, nevs = 0;
+	int err = 0;
+	for(irect = 0; irect < nrects && !err; irect++) {
+		const devrect_t *rect = &rects[irect];
+		size_t buffer_origin[3] = {rect->devoff, 0, 0}, host_origin[3] = {0, 0, 0};
+		size_t region[3] = {rect->width, rect->height, rect->depth};
+		int cl_err = clEnqueueWriteBufferRect
+			(queue, buffer, CL_FALSE, buffer_origin, host_origin, region, 
+			 rect->dev_row_pitch, rect->dev_slice_pitch, rect->host_row_pitch, 
+			 rect->host_slice_pitch, rect->hostptr, 0, 0, &evs[nevs]);
+		if(cl_err == CL_SUCCESS)
+			nevs++;
+		if(cl_err != CL_SUCCESS || nevs == MAX_COPY_BATCH || irect == nrects - 1) {
+			err = ocl_wait_copies(evs, nevs, cl_err);
+			nevs = 0;
+		}
+	}
+	return err;
+}  // ocl_memcpy_h2d_rect
+
+static int ocl_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_mem buffer = (cl_mem)src;
+	cl_event evs[MAX_COPY_BATCH];
+	unsigned irect, nevs = 0;
+	int err = 0;
+	for(irect = 0; irect < nrects && !err; irect++) {
+		const devrect_t *rect = &rects[irect];
+		size_t buffer_origin[3] = {rect->devoff, 0, 0}, host_origin[3] = {0, 0, 0};
+		size_t region[3] = {rect->width, rect->height, rect->depth};
+		int cl_err = clEnqueueReadBufferRect
+			(queue, buffer, CL_FALSE, buffer_origin, host_origin, region, 
+			 rect->dev_row_pitch, rect->dev_slice_pitch, rect->host_row_pitch, 
+			 rect->host_slice_pitch, rect->hostptr, 0, 0, &evs[nevs]);
+		if(cl_err == CL_SUCCESS)
+			nevs++;
+		if(cl_err != CL_SUCCESS || nevs == MAX_COPY_BATCH || irect == nrects - 1) {
+			err = ocl_wait_copies(evs, nevs, cl_err);
+			nevs = 0;
+		}
+	}
+	return err;
+}  // ocl_memcpy_d2h_rect
+
+static int ocl_mem_alloc(unsigned idev, size_t nbytes, void **pbuf) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_context context;
+	if(clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), 
+													 &context, 0) != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_alloc: can\'t get queue context\n");
+		return GPUVM_ERROR;
+	}
+	cl_int cl_err;
+	cl_mem buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, nbytes, 0, &cl_err);
+	if(cl_err != CL_SUCCESS) {
+		if(cl_err == CL_MEM_OBJECT_ALLOCATION_FAILURE || 
+			 cl_err == CL_OUT_OF_RESOURCES || cl_err == CL_OUT_OF_HOST_MEMORY ||
+			 cl_err == CL_INVALID_BUFFER_SIZE)
+			return GPUVM_EDEVALLOC;
+		fprintf(stderr, "ocl_mem_alloc: can\'t create buffer\n");
+		return GPUVM_ERROR;
+	}
+	*pbuf = buffer;
+	return 0;
+}  // ocl_mem_alloc
+
+static int ocl_mem_free(unsigned idev, void *buf) {
+	if(clReleaseMemObject((cl_mem)buf) != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_free: can\'t release buffer\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // ocl_mem_free
+
+static int ocl_host_unified(unsigned idev) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_device_id dev;
+	if(clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(cl_device_id),
+													 &dev, 0) != CL_SUCCESS)
+		return 0;
+	cl_device_type type;
+	if(clGetDeviceInfo(dev, CL_DEVICE_TYPE, sizeof(type), &type, 0) == CL_SUCCESS
+		 && (type & CL_DEVICE_TYPE_CPU))
+		return 1;
+	cl_bool unified;
+	if(clGetDeviceInfo(dev, CL_DEVICE_HOST_UNIFIED_MEMORY, sizeof(unified), 
+										 &unified, 0) == CL_SUCCESS && unified)
+		return 1;
+	return 0;
+}  // ocl_host_unified
+
+static int ocl_mem_wrap
+(unsigned idev, void *hostptr, size_t nbytes, void **pbuf) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_context context;
+	if(clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), 
+													 &context, 0) != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_wrap: can't get queue context\n");
+		return GPUVM_ERROR;
+	}
+	cl_int cl_err;
+	cl_mem buffer = clCreateBuffer
+		(context, CL_MEM_READ_WRITE | CL_MEM_USE_HOST_PTR, nbytes, hostptr, &cl_err);
+	if(cl_err != CL_SUCCESS) {
+		if(cl_err == CL_MEM_OBJECT_ALLOCATION_FAILURE || 
+			 cl_err == CL_OUT_OF_RESOURCES || cl_err == CL_OUT_OF_HOST_MEMORY)
+			return GPUVM_EDEVALLOC;
+		fprintf(stderr, "ocl_mem_wrap: can't create buffer\n");
+		return GPUVM_ERROR;
+	}
+	*pbuf = buffer;
+	return 0;
+}  // ocl_mem_wrap
+
+static int ocl_mem_unwrap(unsigned idev, void *buf) {
+	if(clReleaseMemObject((cl_mem)buf) != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_unwrap: can't release buffer\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // ocl_mem_unwrap
+
+static int ocl_mem_map(unsigned idev, void *buf, void *hostptr, size_t nbytes) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_int cl_err;
+	void *ptr = clEnqueueMapBuffer
+		(queue, (cl_mem)buf, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE, 0, nbytes, 0, 0, 0,
+		 &cl_err);
+	if(cl_err != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_map: can't map buffer\n");
+		return GPUVM_ERROR;
+	}
+	if(ptr != hostptr) {
+		// the runtime keeps its own copy of the data, which can't be used
+		fprintf(stderr, "ocl_mem_map: buffer not mapped at its host memory\n");
+		ocl_mem_unmap(idev, buf, ptr);
+		return GPUVM_EAPI;
+	}
+	return 0;
+}  // ocl_mem_map
+
+static int ocl_mem_unmap(unsigned idev, void *buf, void *hostptr) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_event ev;
+	if(clEnqueueUnmapMemObject(queue, (cl_mem)buf, hostptr, 0, 0, &ev) 
+		 != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_unmap: can't unmap buffer\n");
+		return GPUVM_ERROR;
+	}
+	int cl_err = clWaitForEvents(1, &ev);
+	clReleaseEvent(ev);
+	if(cl_err != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_unmap: can't wait for unmapping\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // ocl_mem_unmap
+
+static int ocl_memcpy_h2d_async
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+ void **pevent) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_event ev = 0;
+	int cl_err = clEnqueueWriteBuffer(queue, (cl_mem)tgt, CL_FALSE, devoff, nbytes,
+																		src, 0, 0, &ev);
+	if(cl_err != CL_SUCCESS)
+		return ocl_wait_copies(0, 0, cl_err);
+	// make sure the copy starts before it is waited for
+	clFlush(queue);
+	*pevent = ev;
+	return 0;
+}  // ocl_memcpy_h2d_async
+
+static int ocl_memcpy_d2h_async
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff, 
+ void **pevent) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_event ev = 0;
+	int cl_err = clEnqueueReadBuffer(queue, (cl_mem)src, CL_FALSE, devoff, nbytes,
+																	 tgt, 0, 0, &ev);
+	if(cl_err != CL_SUCCESS)
+		return ocl_wait_copies(0, 0, cl_err);
+	clFlush(queue);
+	*pevent = ev;
+	return 0;
+}  // ocl_memcpy_d2h_async
+
+static int ocl_event_wait(unsigned idev, void *event) {
+	cl_event ev = (cl_event)event;
+	return ocl_wait_copies(&ev, 1, CL_SUCCESS);
+}  // ocl_event_wait
+
+/** gets the context of a device's queue
+		@param idev GPUVM device number
+		@returns the context, or 0 if it can't be obtained
+ */
+static cl_context ocl_queue_context(unsigned idev) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	cl_context context;
+	if(clGetCommandQueueInfo(queue, CL_QUEUE_CONTEXT, sizeof(cl_context), 
+													 &context, 0) != CL_SUCCESS)
+		return 0;
+	return context;
+}  // ocl_queue_context
+
+static int ocl_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes) {
+	cl_context context = ocl_queue_context(tgt_idev);
+	if(!context || context != ocl_queue_context(src_idev))
+		return GPUVM_EAPI;
+	cl_command_queue queue = (cl_command_queue)devs_g[tgt_idev];
+	cl_event ev = 0;
+	int cl_err = clEnqueueCopyBuffer(queue, (cl_mem)src, (cl_mem)tgt, srcoff, 
+																	 tgtoff, nbytes, 0, 0, &ev);
+	return ocl_wait_copies(&ev, cl_err == CL_SUCCESS ? 1 : 0, cl_err);
+}  // ocl_memcpy_peer
+
+#ifdef CL_VERSION_1_2
+static int ocl_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value) {
+	cl_command_queue queue = (cl_command_queue)devs_g[idev];
+	unsigned char pattern = (unsigned char)value;
+	cl_event ev = 0;
+	int cl_err = clEnqueueFillBuffer(queue, (cl_mem)buf, &pattern, 
+																	 sizeof(pattern), devoff, nbytes, 0, 0, &ev);
+	if(cl_err != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_fill: can't fill buffer\n");
+		return GPUVM_ERROR;
+	}
+	cl_err = clWaitForEvents(1, &ev);
+	clReleaseEvent(ev);
+	if(cl_err != CL_SUCCESS) {
+		fprintf(stderr, "ocl_mem_fill: can't wait for filling\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // ocl_mem_fill
+#endif
+
 #endif // OPENCL_ENABLED
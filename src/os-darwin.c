@@ -142,6 +142,22 @@ void cont_other_threads(void) {
 	// all other threads have been resumed
 }
 
+int write_protected(void *dst, const void *src, size_t nbytes) {
+	// Mach VM writes honour page protection
+	fprintf(stderr, "write_protected: not supported on Darwin\n");
+	return GPUVM_ERROR;
+}  // write_protected
+
+int untouched_pages(unsigned char *untouched, void *ptr, size_t npages) {
+	// no pagemap on Darwin; callers fall back to reading the pages
+	return GPUVM_ERROR;
+}  // untouched_pages
+
+int range_is_private_anon(void *ptr, size_t nbytes) {
+	// no /proc/self/maps on Darwin
+	return 0;
+}  // range_is_private_anon
+
 // semaphore utilities, from semaph.h
 int semaph_init(semaph_t *sem, int value) {
 	kern_return_t err = semaphore_create(mach_task_self(), sem, 0, value);
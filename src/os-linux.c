@@ -10,6 +10,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <semaphore.h>
+#include <stdint.h>
 #include <signal.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -62,6 +63,10 @@ pid_t my_pid_g;
 //int first_time_g = 1;
 /** last modification time for /proc/self/task */
 struct timespec task_mtim_g = {0, 0};
+/** file descriptor of /proc/self/mem, or -1 if not open yet */
+int self_mem_fd_g = -1;
+/** file descriptor of /proc/self/pagemap, or -1 if not open yet */
+int self_pagemap_fd_g = -1;
 
 /** getdents() linux syscall */
 static int getdents(int fd, void *buf, unsigned count) {
@@ -285,6 +290,168 @@ void cont_other_threads(void) {
 	// stopped threads have been resumed
 }  // cont_other_threads
 
+int write_protected(void *dst, const void *src, size_t nbytes) {
+	if(self_mem_fd_g < 0) {
+		int fd = open("/proc/self/mem", O_RDWR);
+		if(fd < 0) {
+			fprintf(stderr, "write_protected: can\'t open /proc/self/mem\n");
+			return GPUVM_ERROR;
+		}
+		if(!__sync_bool_compare_and_swap(&self_mem_fd_g, -1, fd))
+			close(fd);
+	}
+	// writes through /proc/self/mem ignore page protection
+	while(nbytes) {
+		ssize_t nwritten = pwrite(self_mem_fd_g, src, nbytes, (off_t)dst);
+		if(nwritten <= 0) {
+			if(nwritten < 0 && errno == EINTR)
+				continue;
+			fprintf(stderr, "write_protected: can\'t write to /proc/self/mem\n");
+			return GPUVM_ERROR;
+		}
+		dst = (char*)dst + nwritten;
+		src = (const char*)src + nwritten;
+		nbytes -= nwritten;
+	}
+	return 0;
+}  // write_protected
+
+// pagemap entry bits, see Documentation/admin-guide/mm/pagemap.rst
+#define PAGEMAP_PRESENT (1ull << 63)
+#define PAGEMAP_SWAPPED (1ull << 62)
+
+// number of pagemap entries read at once
+#define PAGEMAP_BATCH 512
+
+// size of the buffer for reading /proc/self/maps, enough for a line with the
+// longest path
+#define MAPS_BUFFER_SIZE 8192
+
+/** parses a hexadecimal or decimal number at *pp, and advances *pp past it */
+static unsigned long long parse_ull(const char **pp, int base) {
+	unsigned long long value = 0;
+	const char *p = *pp;
+	while(1) {
+		int digit;
+		if(*p >= '0' && *p <= '9')
+			digit = *p - '0';
+		else if(base == 16 && *p >= 'a' && *p <= 'f')
+			digit = *p - 'a' + 10;
+		else
+			break;
+		value = value * base + digit;
+		p++;
+	}
+	*pp = p;
+	return value;
+}  // parse_ull
+
+/** checks a line of /proc/self/maps against the range
+		@param line the line, without the newline
+		@param pcur [in,out] the start of the part of the range not yet checked;
+		advanced to the end of the mapping if it is private anonymous and covers
+		*pcur
+		@param end the end of the range
+		@returns 1 if the whole range has been checked, -1 if the range is not
+		covered by private anonymous mappings, and 0 if more lines are needed
+ */
+static int maps_check_line
+(const char *line, unsigned long long *pcur, unsigned long long end) {
+	const char *p = line;
+	unsigned long long start = parse_ull(&p, 16);
+	p++;
+	unsigned long long stop = parse_ull(&p, 16);
+	if(stop <= *pcur)
+		return 0;
+	if(start > *pcur)
+		return -1;
+	// perms, offset, device, inode, path
+	const char *perms = p + 1;
+	if(strlen(perms) < 4 || perms[3] != 'p')
+		return -1;
+	p = perms + 4;
+	unsigned ifield;
+	for(ifield = 0; ifield < 2; ifield++) {
+		while(*p == ' ')
+			p++;
+		while(*p && *p != ' ')
+			p++;
+	}
+	while(*p == ' ')
+		p++;
+	if(parse_ull(&p, 10) != 0)
+		return -1;
+	while(*p == ' ')
+		p++;
+	if(*p && strcmp(p, "[heap]") && strcmp(p, "[stack]"))
+		return -1;
+	*pcur = stop;
+	return stop >= end ? 1 : 0;
+}  // maps_check_line
+
+int range_is_private_anon(void *ptr, size_t nbytes) {
+	int fd = open("/proc/self/maps", O_RDONLY);
+	if(fd < 0)
+		return 0;
+	char buf[MAPS_BUFFER_SIZE];
+	size_t filled = 0;
+	unsigned long long cur = (uintptr_t)ptr, end = cur + nbytes;
+	int res = 0;
+	while(!res) {
+		ssize_t nread = read(fd, buf + filled, sizeof(buf) - 1 - filled);
+		if(nread < 0 && errno == EINTR)
+			continue;
+		if(nread <= 0)
+			break;
+		filled += nread;
+		buf[filled] = 0;
+		// check each complete line
+		char *line = buf, *nl;
+		while(!res && (nl = strchr(line, '\n'))) {
+			*nl = 0;
+			res = maps_check_line(line, &cur, end);
+			line = nl + 1;
+		}
+		if(line == buf && filled == sizeof(buf) - 1)
+			break;
+		filled -= line - buf;
+		memmove(buf, line, filled);
+	}
+	close(fd);
+	return res > 0;
+}  // range_is_private_anon
+
+int untouched_pages(unsigned char *untouched, void *ptr, size_t npages) {
+	if(self_pagemap_fd_g < 0) {
+		int fd = open("/proc/self/pagemap", O_RDONLY);
+		if(fd < 0)
+			return GPUVM_ERROR;
+		if(!__sync_bool_compare_and_swap(&self_pagemap_fd_g, -1, fd))
+			close(fd);
+	}
+	// a page neither present nor swapped out has never been touched
+	unsigned long long entries[PAGEMAP_BATCH];
+	size_t ipage = 0;
+	while(ipage < npages) {
+		size_t nentries = npages - ipage < PAGEMAP_BATCH ? 
+			npages - ipage : PAGEMAP_BATCH;
+		off_t off = ((uintptr_t)ptr / GPUVM_PAGE_SIZE + ipage) * sizeof(entries[0]);
+		ssize_t nread = pread(self_pagemap_fd_g, entries, 
+													nentries * sizeof(entries[0]), off);
+		if(nread < 0 && errno == EINTR)
+			continue;
+		if(nread < (ssize_t)sizeof(entries[0]))
+			return GPUVM_ERROR;
+		nentries = nread / sizeof(entries[0]);
+		size_t ientry;
+		for(ientry = 0; ientry < nentries; ientry++)
+			untouched[ipage + ientry] = 
+				!(entries[ientry] & (PAGEMAP_PRESENT | PAGEMAP_SWAPPED));
+		ipage += nentries;
+	}
+	return 0;
+}  // untouched_pages
+
 // semaphore utilities, from semaph.h
 int semaph_init(semaph_t *sem, int value) {
 	int err = sem_init(sem, 0, value);
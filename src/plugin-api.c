@@ -0,0 +1,124 @@
+/** @file plugin-api.c implementation of devices of a backend loaded at run
+		time from a shared library. The entries of the backend are used directly
+		as those of the device API, except those whose capabilities the backend
+		does not advertise */
+
+#include <dlfcn.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "plugin-api.h"
+#include "util.h"
+
+/** plugin devapi structure */
+devapi_t plugin_devapi_g;
+
+/** the backend */
+const gpuvm_backend_t *plugin_backend_g = 0;
+
+/** loads the backend library and gets its backend
+		@param path the path to the library
+		@returns the backend, or 0 if it can't be loaded
+ */
+static const gpuvm_backend_t *plugin_load(const char *path) {
+	// the library stays loaded until the process exits
+	void *lib = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if(!lib) {
+		fprintf(stderr, "plugin_load: can\'t load %s: %s\n", path, dlerror());
+		return 0;
+	}
+	gpuvm_backend_entry_t entry = 
+		(gpuvm_backend_entry_t)dlsym(lib, GPUVM_BACKEND_ENTRY);
+	if(!entry) {
+		fprintf(stderr, "plugin_load: %s does not export " GPUVM_BACKEND_ENTRY 
+						"\n", path);
+		dlclose(lib);
+		return 0;
+	}
+	const gpuvm_backend_t *backend = entry(GPUVM_BACKEND_ABI_VERSION);
+	if(!backend || backend->abi_version != GPUVM_BACKEND_ABI_VERSION) {
+		fprintf(stderr, "plugin_load: %s does not support backend interface "
+						"version %d\n", path, GPUVM_BACKEND_ABI_VERSION);
+		dlclose(lib);
+		return 0;
+	}
+	if(!backend->init || !backend->memcpy_h2d || !backend->memcpy_d2h) {
+		fprintf(stderr, "plugin_load: %s lacks required entries\n", path);
+		dlclose(lib);
+		return 0;
+	}
+	return backend;
+}  // plugin_load
+
+int plugin_devapi_init(void) {
+	// all devices must come from the same library
+	unsigned idev;
+	const char *path = 0;
+	for(idev = 0; idev < ndevs_g; idev++) {
+		const gpuvm_plugin_params_t *params = 
+			(const gpuvm_plugin_params_t*)devs_g[idev];
+		if(!params || !params->path) {
+			fprintf(stderr, "plugin_devapi_init: no library for device %d\n", idev);
+			return GPUVM_ENULL;
+		}
+		if(path && strcmp(path, params->path)) {
+			fprintf(stderr, "plugin_devapi_init: devices use different libraries\n");
+			return GPUVM_EARG;
+		}
+		path = params->path;
+	}
+	plugin_backend_g = plugin_load(path);
+	if(!plugin_backend_g)
+		return GPUVM_EAPI;
+	const gpuvm_backend_t *backend = plugin_backend_g;
+
+	// fill in devapi_g structure, only with the entries advertised
+	devapi_g = &plugin_devapi_g;
+	memset(devapi_g, 0, sizeof(devapi_t));
+	devapi_g->memcpy_h2d = backend->memcpy_h2d;
+	devapi_g->memcpy_d2h = backend->memcpy_d2h;
+	if(backend->caps & GPUVM_CAP_COPY_N) {
+		devapi_g->memcpy_h2d_n = backend->memcpy_h2d_n;
+		devapi_g->memcpy_d2h_n = backend->memcpy_d2h_n;
+	}
+	if(backend->caps & GPUVM_CAP_COPY_RECT) {
+		devapi_g->memcpy_h2d_rect = backend->memcpy_h2d_rect;
+		devapi_g->memcpy_d2h_rect = backend->memcpy_d2h_rect;
+	}
+	if(backend->caps & GPUVM_CAP_ALLOC) {
+		devapi_g->mem_alloc = backend->mem_alloc;
+		devapi_g->mem_free = backend->mem_free;
+	}
+	if(backend->caps & GPUVM_CAP_MAP) {
+		devapi_g->host_unified = backend->host_unified;
+		devapi_g->mem_wrap = backend->mem_wrap;
+		devapi_g->mem_unwrap = backend->mem_unwrap;
+		devapi_g->mem_map = backend->mem_map;
+		devapi_g->mem_unmap = backend->mem_unmap;
+	}
+	if(backend->caps & GPUVM_CAP_ASYNC) {
+		devapi_g->memcpy_h2d_async = backend->memcpy_h2d_async;
+		devapi_g->memcpy_d2h_async = backend->memcpy_d2h_async;
+		devapi_g->event_wait = backend->event_wait;
+	}
+	if(backend->caps & GPUVM_CAP_PEER)
+		devapi_g->memcpy_peer = backend->memcpy_peer;
+	if(backend->caps & GPUVM_CAP_FILL)
+		devapi_g->mem_fill = backend->mem_fill;
+
+	// initialize the backend with the parameters of its devices
+	void **params = (void**)smalloc(ndevs_g * sizeof(void*));
+	if(!params)
+		return GPUVM_ESALLOC;
+	for(idev = 0; idev < ndevs_g; idev++)
+		params[idev] = ((gpuvm_plugin_params_t*)devs_g[idev])->params;
+	int err = backend->init(ndevs_g, params);
+	sfree(params);
+	if(err) {
+		fprintf(stderr, "plugin_devapi_init: can\'t initialize backend %s\n", path);
+		return err;
+	}
+	return 0;
+}  // plugin_devapi_init
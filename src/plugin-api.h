@@ -0,0 +1,15 @@
+#ifndef GPUVM_PLUGIN_API_H_
+#define GPUVM_PLUGIN_API_H_
+
+/** @file plugin-api.h 
+		functions used by GPUVM to interact with devices of a backend loaded at
+		run time from a shared library, see gpuvm-backend.h
+ */
+
+/** initializes the API of a backend library, loading the library and
+		initializing the backend
+		@returns 0 if successful and a negative error code if not
+ */
+int plugin_devapi_init(void);
+
+#endif
@@ -0,0 +1,149 @@
+/** @file prefetch.c implementation of prefetching */
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "gpuvm.h"
+#include "host-array.h"
+#include "link.h"
+#include "prefetch.h"
+#include "region.h"
+#include "residency.h"
+#include "subreg.h"
+#include "util.h"
+#include "wback.h"
+#include "wthreads.h"
+
+/** value of link->prefetch while a prefetch is being started; it claims the
+		link, so that only one thread marks and transfers its subregions */
+#define PREFETCH_STARTING ((prefetch_t*)1)
+
+/** waits for the transfers of a prefetch to finish, and frees it
+		@param link the link of the prefetch
+		@param prefetch the prefetch, which is no longer installed in the link
+		@param apply nonzero if the subregions which have been successfully
+		prefetched and not written since must be marked as actual on device
+		@returns 0 if successful and a negative error code if not
+ */
+static int prefetch_end(link_t *link, prefetch_t *prefetch, int apply) {
+	int err = 0, xfer_err;
+	unsigned ixfer;
+	for(ixfer = 0; ixfer < prefetch->nxfers; ixfer++) {
+		subreg_t *subreg = prefetch->subregs[ixfer];
+		if(xfer_err = xfer_wait(&prefetch->xfers[ixfer]))
+			err = xfer_err;
+		xfer_destroy(&prefetch->xfers[ixfer]);
+		if(apply && !xfer_err && subreg->state & SUBREG_PREFETCH_VALID)
+			subreg_mark_synced_to_device(subreg, link->idev);
+		__sync_fetch_and_and(&subreg->state, ~SUBREG_PREFETCH_VALID);
+	}
+	sfree(prefetch);
+	residency_end(link);
+	return err;
+}  // prefetch_end
+
+int prefetch_start(link_t *link) {
+	// several threads holding the reader lock may start a prefetch of the same
+	// link at once; only the one which claims the link does anything, so that
+	// the others don't touch the marks of its subregions
+	if(link->prefetch || 
+		 !__sync_bool_compare_and_swap(&link->prefetch, 0, PREFETCH_STARTING))
+		return 0;
+	// the link must have device memory for the whole duration of the prefetch
+	int err;
+	if(err = residency_begin(link)) {
+		__sync_lock_release(&link->prefetch);
+		return err;
+	}
+	host_array_t *host_array = link->host_array;
+	unsigned nsubregs = host_array->nsubregs;
+	prefetch_t *prefetch = (prefetch_t*)smalloc
+		(sizeof(prefetch_t) + nsubregs * (sizeof(xfer_t) + sizeof(subreg_t*)));
+	if(!prefetch) {
+		residency_end(link);
+		__sync_lock_release(&link->prefetch);
+		return GPUVM_ESALLOC;
+	}
+	prefetch->nxfers = 0;
+	prefetch->xfers = (xfer_t*)(prefetch + 1);
+	prefetch->subregs = (subreg_t**)(prefetch->xfers + nsubregs);
+
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		region_t *region = subreg->region;
+		if(!(subreg->state & SUBREG_ACTUAL_HOST) || 
+			 subreg_is_actual_on_device(subreg, link->idev) || 
+			 region->prot_status == PROT_NONE)
+			continue;
+		// mark first and protect then, so that a write which happens in between
+		// resets the mark
+		__sync_fetch_and_or(&subreg->state, SUBREG_PREFETCH_VALID);
+		xfer_t *xfer = &prefetch->xfers[prefetch->nxfers];
+		if(region->prot_status == (PROT_READ | PROT_WRITE) && 
+			 (err = region_protect_after(region, GPUVM_READ_ONLY)) ||
+			 (err = xfer_init(xfer))) {
+			// the subregion is not part of the prefetch
+			__sync_fetch_and_and(&subreg->state, ~SUBREG_PREFETCH_VALID);
+			break;
+		}
+		prefetch->subregs[prefetch->nxfers++] = subreg;
+		size_t devoff = link->devoff + 
+			((char*)subreg->range.ptr - (char*)host_array->range.ptr);
+		if(err = xfer_start(xfer, 1, link->idev, link->buf, subreg->range.ptr, 
+												subreg->range.nbytes, devoff))
+			break;
+	}
+	if(err || !prefetch->nxfers) {
+		prefetch_end(link, prefetch, 0);
+		__sync_lock_release(&link->prefetch);
+		return err;
+	}
+	__sync_bool_compare_and_swap(&link->prefetch, PREFETCH_STARTING, prefetch);
+	return 0;
+}  // prefetch_start
+
+int prefetch_finish(link_t *link, int apply) {
+	// take the prefetch out of the link, so that it is finished only once even
+	// if several threads finish it at once; a prefetch still being started is
+	// not yet there to finish
+	prefetch_t *prefetch;
+	do {
+		prefetch = link->prefetch;
+		if(!prefetch || prefetch == PREFETCH_STARTING)
+			return 0;
+	} while(!__sync_bool_compare_and_swap(&link->prefetch, prefetch, 0));
+	return prefetch_end(link, prefetch, apply);
+}  // prefetch_finish
+
+int prefetch_replicate(host_array_t *host_array, unsigned idev) {
+	if(!host_array_same_layout(host_array))
+		return 0;
+	unsigned jdev;
+	int err;
+	for(jdev = 0; jdev < ndevs_g; jdev++) {
+		link_t *link = host_array->links[jdev];
+		// devices which don't hold the array now are not made to evict others
+		if(jdev == idev || !link || !link->buf)
+			continue;
+		if(err = prefetch_start(link))
+			return err;
+	}
+	return 0;
+}  // prefetch_replicate
+
+int prefetch_host_start(host_array_t *host_array) {
+	// write-back copies the data into protected host memory, and needs no other
+	// threads to be stopped; the pagefault path is only a fallback
+	if(wback_prefetch_host(host_array))
+		return 0;
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		// regions of the array are synced together, so a single one is enough
+		if(!(subreg->state & SUBREG_ACTUAL_HOST) && subreg->region->prot_status == PROT_NONE)
+			return wthreads_prefetch_region(subreg->region);
+	}
+	return 0;
+}  // prefetch_host_start
@@ -0,0 +1,67 @@
+#ifndef GPUVM_PREFETCH_H_
+#define GPUVM_PREFETCH_H_
+
+/** @file prefetch.h 
+		interface to prefetching of arrays to device or host ahead of their use.
+		Prefetching to device copies the parts of the array actual on host in the
+		background, with the host pages write-protected; a host write in the
+		meantime invalidates the prefetched copy of the subregion written.
+		Prefetching to host puts the regions of the array for background
+		write-back, or, if they can't be written back, to the worker threads as if
+		they had been accessed on host, without waiting for them
+ */
+
+#include "host-array.h"
+#include "xfer.h"
+
+struct link_struct;
+struct subreg_struct;
+
+/** an array prefetch to device in progress */
+typedef struct prefetch_struct {
+	/** number of transfers in progress */
+	unsigned nxfers;
+	/** subregions being transferred, allocated together with the prefetch */
+	struct subreg_struct **subregs;
+	/** transfers, one per subregion, allocated together with the prefetch */
+	xfer_t *xfers;
+} prefetch_t;
+
+/** starts prefetching the array of the link to its device; does nothing if a
+		prefetch for the link is already in progress. Must be called with the global
+		reader lock held
+		@param link the link whose array to prefetch
+		@returns 0 if successful and a negative error code if not
+ */
+int prefetch_start(struct link_struct *link);
+
+/** waits for the prefetch of the link, if any, to finish, and frees it. Must
+		be called with the global reader lock held
+		@param link the link whose prefetch to finish
+		@param apply nonzero if the subregions which have been successfully
+		prefetched and not written since must be marked as actual on device, and 0
+		if the prefetch is to be discarded
+		@returns 0 if successful and a negative error code if not
+ */
+int prefetch_finish(struct link_struct *link, int apply);
+
+/** starts prefetching the array to all devices it is linked on, except the
+		one given, which already have memory allocated for it; used to keep
+		read-mostly arrays replicated after a kernel writes them. Arrays whose
+		device layout differs from host are not replicated. Must be called with the
+		global reader lock held, and with the data actual on host
+		@param host_array the array to replicate
+		@param idev the device which needs no replica
+		@returns 0 if successful and a negative error code if not
+ */
+int prefetch_replicate(host_array_t *host_array, unsigned idev);
+
+/** starts bringing the data of the array which are actual only on device back
+		to host in the background, through background write-back if possible,
+		and through the pagefault handling path otherwise
+		@param host_array the array to prefetch to host
+		@returns 0 if successful and a negative error code if not
+ */
+int prefetch_host_start(host_array_t *host_array);
+
+#endif
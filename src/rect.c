@@ -0,0 +1,182 @@
+/** @file rect.c implementation of strided host arrays */
+
+#include <stddef.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "rect.h"
+#include "util.h"
+
+/** maximum number of blocks copied as a single batch */
+#define RECT_COPY_BATCH 32
+
+/** a batch of blocks being collected for copying */
+typedef struct {
+	/** the tile layout */
+	const rect_t *rect;
+	/** the first byte of the tile */
+	char *hostptr;
+	/** the device */
+	unsigned idev;
+	/** the device buffer */
+	void *buf;
+	/** the offset of the tile in the device buffer */
+	size_t devoff;
+	/** nonzero if copying to device and 0 if to host */
+	int to_device;
+	/** the blocks collected */
+	devrect_t rects[RECT_COPY_BATCH];
+	/** the number of blocks collected */
+	unsigned nrects;
+	/** nonzero if the last block collected ends with a whole slice, and can be
+			extended with the next one */
+	int last_whole;
+} rect_batch_t;
+
+size_t rect_span(const rect_t *rect) {
+	return (rect->depth - 1) * rect->slice_pitch +
+		(rect->height - 1) * rect->row_pitch + rect->width;
+}  // rect_span
+
+size_t rect_nbytes(const rect_t *rect) {
+	return rect->width * rect->height * rect->depth;
+}  // rect_nbytes
+
+/** gets the offset of a tile row from the first byte of the tile
+		@param rect the tile layout
+		@param irow the number of the row, counting across all slices
+		@returns the offset of the row, in bytes
+ */
+static size_t rect_row_offset(const rect_t *rect, size_t irow) {
+	return irow / rect->height * rect->slice_pitch +
+		irow % rect->height * rect->row_pitch;
+}  // rect_row_offset
+
+int rect_next_run
+(const rect_t *rect, void *hostptr, size_t *irow, memrange_t *run) {
+	size_t nrows = rect->height * rect->depth;
+	if(*irow >= nrows)
+		return 0;
+	ptrdiff_t addr = (char*)hostptr - (char*)0;
+	size_t start = rect_row_offset(rect, *irow), end = start + rect->width;
+	for((*irow)++; *irow < nrows; (*irow)++) {
+		size_t next = rect_row_offset(rect, *irow);
+		if((addr + next) / GPUVM_PAGE_SIZE >
+			 (addr + end - 1) / GPUVM_PAGE_SIZE + 1)
+			break;
+		end = next + rect->width;
+	}
+	run->ptr = (char*)hostptr + start;
+	run->nbytes = end - start;
+	return 1;
+}  // rect_next_run
+
+/** copies the blocks collected so far
+		@param batch the batch
+		@returns 0 if successful and a negative error code if not
+ */
+static int rect_batch_flush(rect_batch_t *batch) {
+	int err = 0;
+	if(batch->nrects)
+		err = batch->to_device ?
+			memcpy_h2d_rect(devapi_g, batch->idev, batch->buf, batch->rects,
+											batch->nrects) :
+			memcpy_d2h_rect(devapi_g, batch->idev, batch->buf, batch->rects,
+											batch->nrects);
+	batch->nrects = 0;
+	batch->last_whole = 0;
+	return err;
+}  // rect_batch_flush
+
+/** adds a block to the batch, copying the batch if it is full
+		@param batch the batch
+		@param z the first slice of the block
+		@param y the first row of the block in the slice
+		@param x the first byte of the block in the row
+		@param width the width of the block in bytes
+		@param height the height of the block in rows
+		@returns 0 if successful and a negative error code if not
+ */
+static int rect_batch_add
+(rect_batch_t *batch, size_t z, size_t y, size_t x, size_t width,
+ size_t height) {
+	const rect_t *rect = batch->rect;
+	int whole = width == rect->width && height == rect->height;
+	if(whole && batch->last_whole) {
+		// whole slices following each other form a 3D block
+		batch->rects[batch->nrects - 1].depth++;
+		return 0;
+	}
+	int err;
+	if(batch->nrects == RECT_COPY_BATCH && (err = rect_batch_flush(batch)))
+		return err;
+	devrect_t *block = &batch->rects[batch->nrects++];
+	block->hostptr = batch->hostptr + z * rect->slice_pitch + 
+		y * rect->row_pitch + x;
+	block->devoff = batch->devoff + (z * rect->height + y) * rect->width + x;
+	block->width = width;
+	block->height = height;
+	block->depth = 1;
+	block->host_row_pitch = rect->row_pitch;
+	block->host_slice_pitch = rect->slice_pitch;
+	block->dev_row_pitch = rect->width;
+	block->dev_slice_pitch = rect->width * rect->height;
+	batch->last_whole = whole;
+	return 0;
+}  // rect_batch_add
+
+int rect_copy
+(const rect_t *rect, void *hostptr, unsigned idev, void *buf, size_t devoff,
+ const memrange_t *range, int to_device) {
+	rect_batch_t batch;
+	batch.rect = rect;
+	batch.hostptr = (char*)hostptr;
+	batch.idev = idev;
+	batch.buf = buf;
+	batch.devoff = devoff;
+	batch.to_device = to_device;
+	batch.nrects = 0;
+	batch.last_whole = 0;
+
+	size_t w = rect->width, h = rect->height, rp = rect->row_pitch;
+	size_t lo = (char*)range->ptr - (char*)hostptr, hi = lo + range->nbytes;
+	size_t slice_span = (h - 1) * rp + w;
+	size_t z;
+	int err = 0;
+	for(z = lo / rect->slice_pitch; z < rect->depth && !err; z++) {
+		size_t base = z * rect->slice_pitch;
+		if(base >= hi)
+			break;
+		// the part of the range in this slice, from byte x0 of row y0 up to byte
+		// x1 of row y1, exclusive
+		size_t slo = lo > base ? lo - base : 0;
+		size_t shi = hi - base < slice_span ? hi - base : slice_span;
+		if(slo >= shi)
+			continue;
+		size_t y0 = slo / rp, x0 = slo % rp;
+		size_t y1 = (shi - 1) / rp, x1 = shi - y1 * rp;
+		if(x0 >= w) {
+			y0++;
+			x0 = 0;
+		}
+		if(x1 > w)
+			x1 = w;
+		if(y0 > y1)
+			continue;
+		if(y0 == y1) {
+			if(x0 < x1)
+				err = rect_batch_add(&batch, z, y0, x0, x1 - x0, 1);
+			continue;
+		}
+		// partial first and last rows, and whole rows in between
+		if(x0 && !(err = rect_batch_add(&batch, z, y0, x0, w - x0, 1)))
+			y0++;
+		if(!err && x1 < w && !(err = rect_batch_add(&batch, z, y1, 0, x1, 1)))
+			y1--;
+		if(!err && y0 <= y1)
+			err = rect_batch_add(&batch, z, y0, 0, w, y1 - y0 + 1);
+	}
+	if(err)
+		return err;
+	return rect_batch_flush(&batch);
+}  // rect_copy
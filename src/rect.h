@@ -0,0 +1,73 @@
+#ifndef GPUVM_RECT_H_
+#define GPUVM_RECT_H_
+
+/** @file rect.h
+		this file contains definition of rect_t, which describes the layout of a
+		strided host array, i.e. a 2D or 3D tile of a larger host matrix. The array
+		starts at the first byte of the tile, and spans up to its last byte; only
+		the bytes of the tile rows are its data. On device, the tile is stored
+		densely, row after row and slice after slice. The host range of the array
+		is covered with runs of rows which do not leave a whole page untouched
+		between them, so that pages holding no data of the tile are never
+		protected. The bytes between the rows of a run lie on pages of the tile
+		anyway, but are tracked as part of the run, so host writes to them make
+		the run stale on devices, and other arrays may not have data there
+ */
+
+#include "util.h"
+
+typedef struct rect_struct {
+	/** width of a row of the tile, in bytes */
+	size_t width;
+	/** number of rows in a slice of the tile */
+	size_t height;
+	/** number of slices in the tile */
+	size_t depth;
+	/** distance between consecutive rows on host, in bytes */
+	size_t row_pitch;
+	/** distance between consecutive slices on host, in bytes */
+	size_t slice_pitch;
+} rect_t;
+
+/** gets the size of the host range spanned by the tile, from its first to its
+		last byte
+		@param rect the tile layout
+		@returns the size of the range in bytes
+ */
+size_t rect_span(const rect_t *rect);
+
+/** gets the size of the tile data, which is also its size on device
+		@param rect the tile layout
+		@returns the size of the data in bytes
+ */
+size_t rect_nbytes(const rect_t *rect);
+
+/** gets the next run of the tile rows, which starts with a row and is
+		extended with the following rows while no whole page lies between them
+		@param rect the tile layout
+		@param hostptr the first byte of the tile
+		@param irow [in,out] the number of the row with which to start, counting
+		across all slices; set to the first row of the next run
+		@param run [out] the host range of the run
+		@returns 1 if a run has been produced and 0 if there are no more rows
+ */
+int rect_next_run
+(const rect_t *rect, void *hostptr, size_t *irow, memrange_t *run);
+
+/** copies the part of the tile data lying in the host range between host and
+		device, as a batch of rectangular blocks; bytes of the range outside the
+		tile rows are not copied
+		@param rect the tile layout
+		@param hostptr the first byte of the tile
+		@param idev the device
+		@param buf the device buffer
+		@param devoff the offset of the tile in the device buffer
+		@param range the host range, inside the host range spanned by the tile
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+int rect_copy
+(const rect_t *rect, void *hostptr, unsigned idev, void *buf, size_t devoff,
+ const memrange_t *range, int to_device);
+
+#endif
@@ -1,38 +1,33 @@
 #ifndef GPUVM_REGION_H_
 #define GPUVM_REGION_H_
 
-#include <pthread.h>
-
 #include "semaph.h"
 #include "util.h"
 
 struct subreg_struct;
 
-/** structure for the list of subregions */
-typedef struct subreg_list_struct {
-	struct subreg_struct *subreg;
-	struct subreg_list_struct *next;
-} subreg_list_t;
-
 typedef struct region_struct {	
 	/** memory range corresponding to this region; its start is aligned to page size, and
 	its size is a multiple of page size */
 	memrange_t range;
+	/** the first of the subregions associated with this region, which are
+			sorted by address and linked through their region_next fields */
+	struct subreg_struct *subregs;
+	/** semaphore to signal removal of protection; most regions are never
+			waited for, so it is created on first use, and is 0 until then */
+	semaph_t *volatile unprot_sem;
 	/** current protection status of this memory region */
 	int prot_status;
 	/** total number of subregions */
 	unsigned nsubregs;
-	/** sorted list of subregions associated with this region */
-	subreg_list_t *subreg_list;
-	/** semaphore to signal removal of protection */
-	semaph_t unprot_sem;
 } region_t;
 
 /** allocates a new region which consists solely of the specified subregion. Also, assigns
-		subregion to the region. Each newly allocated region is added to the region tree
+		subregion to the region. Each newly allocated region is added to the region index
 		@param p [out] *p points to allocated region if successful and is 0 if not. p itself
 		may be zero, in which case we'll get the pointer through subreg
-		@param subreg the subregion of the region
+		@param subreg the subregion of the region; it is owned by the caller, and
+		is not freed if the allocation fails
 		@returns 0 if successful and a negative error code if not
  */
 int region_alloc(region_t **p, struct subreg_struct *subreg);
@@ -40,6 +35,13 @@ int region_alloc(region_t **p, struct subreg_struct *subreg);
 /** frees a region; all subregions must have been removed from the region prior to that */
 void region_free(region_t *region);
 
+/** shrinks the region to its first nbytes bytes; the part cut off must hold no
+		subregions
+		@param region the region to shrink
+		@param nbytes the new size of the region, a multiple of page size
+ */
+void region_shrink(region_t *region, size_t nbytes);
+
 /** turns on memory protection on the region 
 		@param region memory region to protect. When global lock is reader, region lock must
 		be acquired prior to that
@@ -56,6 +58,14 @@ int region_protect(region_t *region);
  */
 int region_protect_after(region_t *region, int flags);
 
+/** sets the protection of a fully protected region whose data have been
+		brought back to host: read-only if some of its subregions are still shared
+		with devices, and none otherwise
+		@param region the region, whose subregions must all be actual on host
+		@returns 0 if successful and a negative error code if not
+ */
+int region_protect_shared(region_t *region);
+
 /** checks whether the region is protected 
 		@param region region to check
 		@returns nonzero if it is and 0 if it is not
@@ -118,7 +128,7 @@ struct subreg_struct *region_find_subreg(const region_t *region, const void
 struct subreg_struct *region_find_subreg_in_range
 (const region_t *region, void *ptr, size_t nbytes);
 
-/** finds the region containing specific host address in the region tree 
+/** finds the region containing specific host address in the region index 
 		@param ptr the address to find
 		@returns the region containing the pointer in question and 0 if none
  */
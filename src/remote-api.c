@@ -0,0 +1,479 @@
+/** @file remote-api.c implementation of remote devices, which are served by
+		a separate process over a socket, see remote-proto.h. Each device has its
+		own connection, used by one copy at a time; a copy is split into pieces,
+		which are sent as pipelined batches of requests. On a Unix socket, the
+		payloads go through a shared memory segment */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "hcopy.h"
+#include "remote-api.h"
+#include "remote-proto.h"
+#include "stat.h"
+#include "util.h"
+
+/** maximum size of a single piece of a copy */
+#define REMOTE_PIECE_SIZE (1024 * 1024)
+
+/** size of the shared memory segment of a connection */
+#define REMOTE_SHM_SIZE (16 * 1024 * 1024)
+
+#ifdef MSG_NOSIGNAL
+#define REMOTE_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define REMOTE_SEND_FLAGS 0
+#endif
+
+/** a remote device */
+typedef struct {
+	/** the socket, or -1 if the connection has failed */
+	int fd;
+	/** the shared memory segment, or 0 if payloads go over the socket */
+	char *shm;
+	/** mutex serializing the use of the connection */
+	pthread_mutex_t mutex;
+} remote_dev_t;
+
+/** a piece of a copy whose response has not yet been read */
+typedef struct {
+	/** host pointer of the piece */
+	char *hostptr;
+	/** the size of the piece */
+	size_t nbytes;
+	/** the offset of the piece in the shared memory segment */
+	size_t shmoff;
+} remote_piece_t;
+
+/** remote devapi structure */
+devapi_t remote_devapi_g;
+
+/** remote devices, one for each GPUVM device */
+remote_dev_t *remote_devs_g = 0;
+
+static int remote_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+static int remote_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+static int remote_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies);
+static int remote_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies);
+static int remote_mem_alloc(unsigned idev, size_t nbytes, void **pbuf);
+static int remote_mem_free(unsigned idev, void *buf);
+
+/** sends data over the socket, retrying on interruptions
+		@param fd the socket
+		@param data the data to send
+		@param nbytes the number of bytes to send
+		@returns 0 if successful and ::GPUVM_EAPI if not
+ */
+static int remote_send(int fd, const void *data, size_t nbytes) {
+	const char *p = (const char*)data;
+	while(nbytes) {
+		ssize_t n = send(fd, p, nbytes, REMOTE_SEND_FLAGS);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return GPUVM_EAPI;
+		p += n;
+		nbytes -= n;
+	}
+	return 0;
+}  // remote_send
+
+/** receives data from the socket, retrying on interruptions
+		@param fd the socket
+		@param data the buffer for the data
+		@param nbytes the number of bytes to receive
+		@returns 0 if successful and ::GPUVM_EAPI if not
+ */
+static int remote_recv(int fd, void *data, size_t nbytes) {
+	char *p = (char*)data;
+	while(nbytes) {
+		ssize_t n = recv(fd, p, nbytes, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return GPUVM_EAPI;
+		p += n;
+		nbytes -= n;
+	}
+	return 0;
+}  // remote_recv
+
+/** connects to a device server
+		@param address the server address, "unix:<path>" or "tcp:<host>:<port>"
+		@param unix_socket [out] nonzero if connected over a Unix socket
+		@returns the socket if successful and -1 if not
+ */
+static int remote_connect(const char *address, int *unix_socket) {
+	int fd = -1;
+	*unix_socket = 0;
+	if(!strncmp(address, "unix:", 5)) {
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(strlen(address + 5) >= sizeof(addr.sun_path))
+			return -1;
+		strcpy(addr.sun_path, address + 5);
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr))) {
+			close(fd);
+			return -1;
+		}
+		*unix_socket = 1;
+		return fd;
+	}
+	if(strncmp(address, "tcp:", 4))
+		return -1;
+	// split host and port at the last colon
+	char host[256];
+	const char *port = strrchr(address + 4, ':');
+	if(!port || port - (address + 4) >= sizeof(host))
+		return -1;
+	memcpy(host, address + 4, port - (address + 4));
+	host[port - (address + 4)] = 0;
+	struct addrinfo hints, *res, *ai;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	if(getaddrinfo(host, port + 1, &hints, &res))
+		return -1;
+	for(ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd < 0)
+			continue;
+		if(!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	if(fd >= 0) {
+		// requests are small, and must not wait for each other
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	return fd;
+}  // remote_connect
+
+/** creates a shared memory segment for payloads
+		@param pshm [out] *pshm is the segment mapped if successful
+		@returns the descriptor of the segment if successful and -1 if not
+ */
+static int remote_shm_create(char **pshm) {
+	char name[64];
+	snprintf(name, sizeof(name), "/gpuvm-remote-%d-%p", (int)getpid(),
+					 (void*)pshm);
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if(fd < 0)
+		return -1;
+	// the segment is only reachable through the descriptor
+	shm_unlink(name);
+	void *shm = MAP_FAILED;
+	if(!ftruncate(fd, REMOTE_SHM_SIZE))
+		shm = mmap(0, REMOTE_SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(shm == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	*pshm = (char*)shm;
+	return fd;
+}  // remote_shm_create
+
+/** sends the hello request, passing the shared memory segment if any, and
+		reads the response
+		@param dev the device
+		@param idev the number of the device on the server
+		@param shm_fd the descriptor of the shared memory segment, or -1 if none
+		@returns 0 if successful and a negative error code if not
+ */
+static int remote_hello(remote_dev_t *dev, unsigned idev, int shm_fd) {
+	remote_req_t req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_HELLO;
+	req.buf = REMOTE_VERSION;
+	req.devoff = idev;
+	req.nbytes = shm_fd >= 0 ? REMOTE_SHM_SIZE : 0;
+	struct iovec iov;
+	iov.iov_base = &req;
+	iov.iov_len = sizeof(req);
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	char control[CMSG_SPACE(sizeof(int))];
+	if(shm_fd >= 0) {
+		memset(control, 0, sizeof(control));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+		memcpy(CMSG_DATA(cmsg), &shm_fd, sizeof(int));
+	}
+	if(sendmsg(dev->fd, &msg, REMOTE_SEND_FLAGS) != sizeof(req))
+		return GPUVM_EAPI;
+	remote_resp_t resp;
+	if(remote_recv(dev->fd, &resp, sizeof(resp)))
+		return GPUVM_EAPI;
+	if(resp.status)
+		return resp.status;
+	if(!resp.value && dev->shm) {
+		// the server can't use the segment
+		munmap(dev->shm, REMOTE_SHM_SIZE);
+		dev->shm = 0;
+	}
+	return 0;
+}  // remote_hello
+
+int remote_devapi_init(void) {
+	// fill in devapi_g structure
+	devapi_g = &remote_devapi_g;
+	memset(devapi_g, 0, sizeof(devapi_t));
+	devapi_g->memcpy_d2h = remote_memcpy_d2h;
+	devapi_g->memcpy_h2d = remote_memcpy_h2d;
+	devapi_g->memcpy_d2h_n = remote_memcpy_d2h_n;
+	devapi_g->memcpy_h2d_n = remote_memcpy_h2d_n;
+	devapi_g->mem_alloc = remote_mem_alloc;
+	devapi_g->mem_free = remote_mem_free;
+
+	// connect to device servers
+	remote_devs_g = (remote_dev_t*)smalloc(ndevs_g * sizeof(remote_dev_t));
+	if(!remote_devs_g)
+		return GPUVM_ESALLOC;
+	unsigned idev;
+	int err;
+	for(idev = 0; idev < ndevs_g; idev++) {
+		remote_dev_t *dev = &remote_devs_g[idev];
+		const gpuvm_remote_params_t *params =
+			(const gpuvm_remote_params_t*)devs_g[idev];
+		dev->shm = 0;
+		if(!params || !params->address) {
+			fprintf(stderr, "remote_devapi_init: no address for device %d\n", idev);
+			return GPUVM_ENULL;
+		}
+		int unix_socket, shm_fd = -1;
+		dev->fd = remote_connect(params->address, &unix_socket);
+		if(dev->fd < 0) {
+			fprintf(stderr, "remote_devapi_init: can\'t connect to %s\n",
+							params->address);
+			return GPUVM_EAPI;
+		}
+		if(unix_socket)
+			shm_fd = remote_shm_create(&dev->shm);
+		err = remote_hello(dev, params->idev, shm_fd);
+		if(shm_fd >= 0)
+			close(shm_fd);
+		if(err) {
+			fprintf(stderr, "remote_devapi_init: device %d refused by %s\n", idev,
+							params->address);
+			return err;
+		}
+		if(pthread_mutex_init(&dev->mutex, 0)) {
+			fprintf(stderr, "remote_devapi_init: can\'t init mutex\n");
+			return GPUVM_ERROR;
+		}
+	}
+	return 0;
+}  // remote_devapi_init
+
+/** closes the connection after a failure, as its state is unknown; must be
+		called with the device mutex held
+		@param dev the device
+		@returns ::GPUVM_EAPI
+ */
+static int remote_fail(remote_dev_t *dev) {
+	if(dev->fd >= 0) {
+		fprintf(stderr, "remote_fail: connection to device server lost\n");
+		close(dev->fd);
+		dev->fd = -1;
+	}
+	return GPUVM_EAPI;
+}  // remote_fail
+
+/** reads the responses to a batch of copy requests; for reads, also receives
+		the data into host memory. Must be called with the device mutex held
+		@param dev the device
+		@param pieces the pieces of the batch
+		@param npieces the number of pieces
+		@param to_device nonzero if the requests are writes and 0 if reads
+		@returns 0 if successful and a negative error code if not
+ */
+static int remote_finish_batch
+(remote_dev_t *dev, const remote_piece_t *pieces, unsigned npieces,
+ int to_device) {
+	int err = 0;
+	unsigned ipiece;
+	for(ipiece = 0; ipiece < npieces; ipiece++) {
+		const remote_piece_t *piece = &pieces[ipiece];
+		remote_resp_t resp;
+		if(remote_recv(dev->fd, &resp, sizeof(resp)))
+			return remote_fail(dev);
+		if(resp.status) {
+			// keep reading, so that the connection stays in sync
+			err = resp.status;
+			continue;
+		}
+		if(to_device)
+			continue;
+		if(dev->shm)
+			hcopy(piece->hostptr, dev->shm + piece->shmoff, piece->nbytes);
+		else if(remote_recv(dev->fd, piece->hostptr, piece->nbytes))
+			return remote_fail(dev);
+	}
+	return err;
+}  // remote_finish_batch
+
+/** copies several ranges between host and a remote buffer
+		@param dev the device
+		@param buf the remote buffer
+		@param copies the ranges to copy
+		@param ncopies the number of ranges
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int remote_copy
+(remote_dev_t *dev, void *buf, const devcopy_t *copies, unsigned ncopies,
+ int to_device) {
+	rtime_t start_time, end_time;
+	if(stat_enabled())
+		start_time = rtime_get();
+	pthread_mutex_lock(&dev->mutex);
+	remote_piece_t pieces[REMOTE_MAX_BATCH];
+	unsigned npieces = 0, icopy;
+	size_t shm_used = 0;
+	int err = dev->fd < 0 ? GPUVM_EAPI : 0, batch_err;
+	for(icopy = 0; icopy < ncopies && dev->fd >= 0; icopy++) {
+		const devcopy_t *copy = &copies[icopy];
+		size_t off;
+		for(off = 0; off < copy->nbytes && dev->fd >= 0; 
+				off += REMOTE_PIECE_SIZE) {
+			size_t nbytes = copy->nbytes - off;
+			if(nbytes > REMOTE_PIECE_SIZE)
+				nbytes = REMOTE_PIECE_SIZE;
+			if(npieces == REMOTE_MAX_BATCH ||
+				 (dev->shm && shm_used + nbytes > REMOTE_SHM_SIZE)) {
+				// wait for the batch, so that its slots can be reused
+				if(batch_err = remote_finish_batch(dev, pieces, npieces, to_device))
+					err = batch_err;
+				npieces = 0;
+				shm_used = 0;
+				if(dev->fd < 0)
+					break;
+			}
+			remote_piece_t *piece = &pieces[npieces++];
+			piece->hostptr = (char*)copy->hostptr + off;
+			piece->nbytes = nbytes;
+			piece->shmoff = shm_used;
+			remote_req_t req;
+			req.op = to_device ? REMOTE_OP_WRITE : REMOTE_OP_READ;
+			req.flags = dev->shm ? REMOTE_FLAG_SHM : 0;
+			req.buf = (uintptr_t)buf;
+			req.devoff = copy->devoff + off;
+			req.nbytes = nbytes;
+			req.shmoff = shm_used;
+			if(dev->shm) {
+				if(to_device)
+					hcopy(dev->shm + shm_used, piece->hostptr, nbytes);
+				shm_used += nbytes;
+			}
+			if(remote_send(dev->fd, &req, sizeof(req)) ||
+				 (to_device && !dev->shm && 
+					remote_send(dev->fd, piece->hostptr, nbytes)))
+				err = remote_fail(dev);
+		}
+	}
+	if(dev->fd >= 0 &&
+		 (batch_err = remote_finish_batch(dev, pieces, npieces, to_device)))
+		err = batch_err;
+	pthread_mutex_unlock(&dev->mutex);
+
+	// do statistics collection
+	if(stat_enabled()) {
+		end_time = rtime_get();
+		stat_acc_double(GPUVM_STAT_COPY_TIME, rtime_diff(&start_time, &end_time));
+	}
+	return err;
+}  // remote_copy
+
+/** performs a single request without payload
+		@param dev the device
+		@param req the request
+		@param value [out] the value of the response, may be 0
+		@returns 0 if successful and a negative error code if not
+ */
+static int remote_request
+(remote_dev_t *dev, const remote_req_t *req, uint64_t *value) {
+	remote_resp_t resp;
+	int err;
+	pthread_mutex_lock(&dev->mutex);
+	if(dev->fd < 0 || remote_send(dev->fd, req, sizeof(*req)) ||
+		 remote_recv(dev->fd, &resp, sizeof(resp)))
+		err = remote_fail(dev);
+	else
+		err = resp.status;
+	pthread_mutex_unlock(&dev->mutex);
+	if(!err && value)
+		*value = resp.value;
+	return err;
+}  // remote_request
+
+static int remote_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {tgt, nbytes, devoff};
+	return remote_copy(&remote_devs_g[idev], src, &copy, 1, 0);
+}
+
+static int remote_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {src, nbytes, devoff};
+	return remote_copy(&remote_devs_g[idev], tgt, &copy, 1, 1);
+}
+
+static int remote_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies) {
+	return remote_copy(&remote_devs_g[idev], src, copies, ncopies, 0);
+}
+
+static int remote_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies) {
+	return remote_copy(&remote_devs_g[idev], tgt, copies, ncopies, 1);
+}
+
+static int remote_mem_alloc(unsigned idev, size_t nbytes, void **pbuf) {
+	remote_req_t req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_ALLOC;
+	req.nbytes = nbytes;
+	uint64_t buf;
+	int err = remote_request(&remote_devs_g[idev], &req, &buf);
+	if(err)
+		return err == GPUVM_EAPI ? err : GPUVM_EDEVALLOC;
+	// remote buffers are only handles, never dereferenced on this side
+	*pbuf = (void*)(uintptr_t)buf;
+	return 0;
+}
+
+static int remote_mem_free(unsigned idev, void *buf) {
+	remote_req_t req;
+	memset(&req, 0, sizeof(req));
+	req.op = REMOTE_OP_FREE;
+	req.buf = (uintptr_t)buf;
+	return remote_request(&remote_devs_g[idev], &req, 0);
+}
@@ -0,0 +1,14 @@
+#ifndef GPUVM_REMOTE_API_H_
+#define GPUVM_REMOTE_API_H_
+
+/** @file remote-api.h 
+		functions used by GPUVM to interact with remote devices, which are served
+		by a separate process over a Unix or TCP socket
+ */
+
+/** initializes remote device API, connecting to the device servers
+		@returns 0 if successful and a negative error code if not
+ */
+int remote_devapi_init(void);
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef GPUVM_REMOTE_PROTO_H_
+#define GPUVM_REMOTE_PROTO_H_
+
+/** @file remote-proto.h
+		the binary protocol spoken between GPUVM and a remote device server over
+		a socket. The client sends requests, each possibly followed by its
+		payload, and the server answers each of them with a response, possibly
+		followed by its payload, strictly in order. Requests are pipelined: the
+		client sends a batch of them before reading any response. On a Unix
+		socket, the client may pass a shared memory segment with its hello
+		request; payloads of requests with ::REMOTE_FLAG_SHM are then placed in
+		the segment instead of being sent over the socket. All fields are in the
+		byte order of the host, so client and server must share it. This header is
+		also used by the stand-in server in samples/remote-server
+ */
+
+#include <stdint.h>
+
+/** the protocol version, sent with the hello request */
+#define REMOTE_VERSION 1
+
+/** maximum number of requests sent before their responses are read */
+#define REMOTE_MAX_BATCH 64
+
+/** the request operations */
+enum {
+	/** first request on a connection; buf is ::REMOTE_VERSION, devoff is the
+			number of the device on the server, and nbytes is the size of the shared
+			memory segment whose descriptor is passed with the request, or 0 if none
+			is. The response value is nonzero if the server uses the segment */
+	REMOTE_OP_HELLO = 1,
+	/** allocates a buffer of nbytes; the response value is the buffer, never 0 */
+	REMOTE_OP_ALLOC = 2,
+	/** frees the buffer buf */
+	REMOTE_OP_FREE = 3,
+	/** writes nbytes at devoff into buf; the payload follows the request */
+	REMOTE_OP_WRITE = 4,
+	/** reads nbytes at devoff from buf; the payload follows a successful
+			response */
+	REMOTE_OP_READ = 5
+};
+
+/** request flags */
+enum {
+	/** the payload is in the shared memory segment at shmoff, rather than on
+			the socket */
+	REMOTE_FLAG_SHM = 0x1
+};
+
+/** a request */
+typedef struct {
+	/** the operation, one of REMOTE_OP_* */
+	uint32_t op;
+	/** request flags, a combination of REMOTE_FLAG_* */
+	uint32_t flags;
+	/** the buffer */
+	uint64_t buf;
+	/** the offset in the buffer */
+	uint64_t devoff;
+	/** the number of bytes */
+	uint64_t nbytes;
+	/** the offset of the payload in the shared memory segment */
+	uint64_t shmoff;
+} remote_req_t;
+
+/** a response */
+typedef struct {
+	/** 0 if the request has succeeded, and a negative GPUVM error code if not */
+	int32_t status;
+	/** reserved, 0 */
+	uint32_t reserved;
+	/** the result of the request */
+	uint64_t value;
+} remote_resp_t;
+
+#endif
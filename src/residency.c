@@ -0,0 +1,222 @@
+/** @file residency.c implementation of the residency manager */
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "devmem.h"
+#include "gpuvm.h"
+#include "host-array.h"
+#include "link.h"
+#include "residency.h"
+#include "stat.h"
+#include "util.h"
+
+/** per-device residency data */
+typedef struct {
+	/** the most and the least recently used links */
+	link_t *lru_head, *lru_tail;
+	/** mutex protecting the list and the links' usage counts */
+	pthread_mutex_t mutex;
+} residency_dev_t;
+
+/** residency data, one for each device */
+static residency_dev_t *residency_devs_g = 0;
+
+int residency_init(void) {
+	residency_devs_g = (residency_dev_t*)smalloc(ndevs_g * sizeof(residency_dev_t));
+	if(!residency_devs_g)
+		return GPUVM_ESALLOC;
+	unsigned idev;
+	for(idev = 0; idev < ndevs_g; idev++) {
+		residency_dev_t *dev = &residency_devs_g[idev];
+		dev->lru_head = dev->lru_tail = 0;
+		if(pthread_mutex_init(&dev->mutex, 0)) {
+			fprintf(stderr, "residency_init: can\'t init mutex\n");
+			return GPUVM_ERROR;
+		}
+	}
+	return 0;
+}  // residency_init
+
+/** removes the link from the LRU list; the device must be locked
+		@param dev the device of the link
+		@param link the link to remove
+ */
+static void lru_remove(residency_dev_t *dev, link_t *link) {
+	if(link->lru_prev)
+		link->lru_prev->lru_next = link->lru_next;
+	else
+		dev->lru_head = link->lru_next;
+	if(link->lru_next)
+		link->lru_next->lru_prev = link->lru_prev;
+	else
+		dev->lru_tail = link->lru_prev;
+	link->lru_prev = link->lru_next = 0;
+}  // lru_remove
+
+/** inserts the link at the head of the LRU list; the device must be locked
+		@param dev the device of the link
+		@param link the link to insert
+ */
+static void lru_push(residency_dev_t *dev, link_t *link) {
+	link->lru_prev = 0;
+	link->lru_next = dev->lru_head;
+	if(dev->lru_head)
+		dev->lru_head->lru_prev = link;
+	else
+		dev->lru_tail = link;
+	dev->lru_head = link;
+}  // lru_push
+
+void residency_add(link_t *link) {
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	pthread_mutex_lock(&dev->mutex);
+	lru_push(dev, link);
+	pthread_mutex_unlock(&dev->mutex);
+}  // residency_add
+
+void residency_remove(link_t *link) {
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	pthread_mutex_lock(&dev->mutex);
+	lru_remove(dev, link);
+	pthread_mutex_unlock(&dev->mutex);
+}  // residency_remove
+
+int residency_begin(link_t *link) {
+	if(!link->allocated)
+		return 0;
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	// mark the link as used first, so that it is not evicted to make room for
+	// itself
+	pthread_mutex_lock(&dev->mutex);
+	link->nkernels++;
+	lru_remove(dev, link);
+	lru_push(dev, link);
+	pthread_mutex_unlock(&dev->mutex);
+
+	// re-materialize an evicted link; the buffer is allocated privately and
+	// published under the device mutex, as another thread (a kernel or a
+	// prefetch) may be re-materializing the same link concurrently
+	int err = 0;
+	size_t nbytes = link->host_array->range.nbytes;
+	while(!link->buf) {
+		void *buf;
+		size_t devoff;
+		err = devmem_alloc(link->idev, nbytes, &buf, &devoff);
+		if(!err) {
+			pthread_mutex_lock(&dev->mutex);
+			int won = !link->buf;
+			if(won) {
+				// gpuvm_xlate_offset() reads devoff after buf without the mutex
+				link->devoff = devoff;
+				__sync_synchronize();
+				link->buf = buf;
+			}
+			pthread_mutex_unlock(&dev->mutex);
+			if(!won)
+				devmem_free(link->idev, nbytes, buf, devoff);
+		} else if(err != GPUVM_EDEVALLOC || (err = residency_evict(link->idev))) {
+			residency_end(link);
+			return err;
+		}
+	}
+	return 0;
+}  // residency_begin
+
+void residency_end(link_t *link) {
+	if(!link->allocated)
+		return;
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	pthread_mutex_lock(&dev->mutex);
+	if(link->nkernels)
+		link->nkernels--;
+	lru_remove(dev, link);
+	lru_push(dev, link);
+	pthread_mutex_unlock(&dev->mutex);
+}  // residency_end
+
+int residency_pin(link_t *link) {
+	if(!link->allocated)
+		return link->buf != 0;
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	pthread_mutex_lock(&dev->mutex);
+	int pinned = link->buf != 0;
+	if(pinned)
+		link->nkernels++;
+	pthread_mutex_unlock(&dev->mutex);
+	return pinned;
+}  // residency_pin
+
+void residency_unpin(link_t *link) {
+	if(!link->allocated)
+		return;
+	residency_dev_t *dev = &residency_devs_g[link->idev];
+	pthread_mutex_lock(&dev->mutex);
+	if(link->nkernels)
+		link->nkernels--;
+	pthread_mutex_unlock(&dev->mutex);
+}  // residency_unpin
+
+/** gets the eviction rank of the link, based on the preferred location of its
+		array; links with lower rank are evicted first
+		@param link the link
+		@returns 0 if the array prefers host, 2 if it prefers the device of the
+		link, and 1 otherwise
+ */
+static int evict_rank(const link_t *link) {
+	int location = link->host_array->preferred_location;
+	if(location == GPUVM_LOCATION_HOST)
+		return 0;
+	else if(location == (int)link->idev)
+		return 2;
+	else
+		return 1;
+}  // evict_rank
+
+int residency_evict(unsigned idev) {
+	residency_dev_t *dev = &residency_devs_g[idev];
+
+	// find the least recently used idle link which has device memory, among
+	// those with the lowest eviction rank
+	pthread_mutex_lock(&dev->mutex);
+	link_t *link, *victim = 0;
+	int rank, victim_rank = 0;
+	for(link = dev->lru_tail; link; link = link->lru_prev) {
+		if(link->nkernels || !link->buf)
+			continue;
+		rank = evict_rank(link);
+		if(!victim || rank < victim_rank) {
+			victim = link;
+			victim_rank = rank;
+		}
+		if(!victim_rank)
+			break;
+	}
+	if(!victim) {
+		pthread_mutex_unlock(&dev->mutex);
+		return GPUVM_EDEVALLOC;
+	}
+	// pin the victim, so that no other thread evicts it meanwhile
+	victim->nkernels++;
+	pthread_mutex_unlock(&dev->mutex);
+
+	// bring the data back to host, with the device unlocked, as it involves
+	// pagefault handling
+	int err = host_array_evict(victim->host_array, idev);
+
+	pthread_mutex_lock(&dev->mutex);
+	victim->nkernels--;
+	if(err || victim->nkernels) {
+		// failed, or the victim has been taken into use in the meantime; the
+		// caller will retry with another one
+		pthread_mutex_unlock(&dev->mutex);
+		return err;
+	}
+	void *buf = victim->buf;
+	size_t devoff = victim->devoff;
+	victim->buf = 0;
+	victim->devoff = 0;
+	stat_inc(GPUVM_STAT_EVICTIONS);
+	pthread_mutex_unlock(&dev->mutex);
+	return devmem_free(idev, victim->host_array->range.nbytes, buf, devoff);
+}  // residency_evict
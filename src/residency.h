@@ -0,0 +1,71 @@
+#ifndef GPUVM_RESIDENCY_H_
+#define GPUVM_RESIDENCY_H_
+
+/** @file residency.h 
+		interface to the residency manager, which lets arrays linked with device
+		memory allocated by GPUVM oversubscribe the device memory. Such links are
+		kept in a per-device list, ordered by the time of last use in a kernel. When
+		device memory is exhausted, the least recently used idle link is evicted,
+		i.e. its data are brought back to host and its device memory is freed. An
+		evicted link has a null device buffer, and is re-materialized on the next
+		gpuvm_kernel_begin(). Links with device buffers supplied by the application
+		are never evicted
+ */
+
+struct link_struct;
+
+/** initializes the residency manager
+		@returns 0 if successful and a negative error code if not
+ */
+int residency_init(void);
+
+/** adds a link whose device memory is allocated by GPUVM to the residency
+		manager, as the most recently used one
+		@param link the link to add
+ */
+void residency_add(struct link_struct *link);
+
+/** removes a link from the residency manager; must be called before freeing
+		the link
+		@param link the link to remove
+ */
+void residency_remove(struct link_struct *link);
+
+/** makes sure that the link has device memory, allocating it and evicting
+		other links if necessary, and marks the link as used by a kernel. Must be
+		called with the global reader lock held
+		@param link the link about to be used in a kernel
+		@returns 0 if successful and a negative error code if not
+ */
+int residency_begin(struct link_struct *link);
+
+/** marks the end of link's use by a kernel, and updates its last-use time
+		@param link the link which has been used in a kernel
+ */
+void residency_end(struct link_struct *link);
+
+/** pins the link, so that it is not evicted, if it has device memory; unlike
+		residency_begin(), neither allocates memory nor counts as a use of the link
+		@param link the link to pin
+		@returns nonzero if the link has device memory and has been pinned, and 0
+		if it has no device memory
+ */
+int residency_pin(struct link_struct *link);
+
+/** unpins a link pinned with residency_pin()
+		@param link the link to unpin
+ */
+void residency_unpin(struct link_struct *link);
+
+/** evicts the least recently used idle link on the device; links of arrays
+		preferring host are evicted before others, and links of arrays preferring
+		the device after others. Must be called with
+		the global reader lock held, as data may be brought back to host through
+		the pagefault mechanism
+		@param idev the device on which to evict a link
+		@returns 0 if a link has been evicted, ::GPUVM_EDEVALLOC if there is no link
+		to evict, and another negative error code in case of an error
+ */
+int residency_evict(unsigned idev);
+
+#endif
@@ -47,6 +47,12 @@ int rqueue_init(rqueue_t *queue, rqueue_elem_t *data, unsigned buffer_size) {
 		pthread_mutex_destroy(&queue->mutex);
 		return -1;
 	}
+	if(pthread_cond_init(&queue->non_full_cond, 0)) {
+		fprintf(stderr, "rqueue_init: can\'t init condition variable\n");
+		pthread_cond_destroy(&queue->non_empty_cond);
+		pthread_mutex_destroy(&queue->mutex);
+		return -1;
+	}
 	return 0;
 } // rqueue_init
 
@@ -68,8 +74,45 @@ int rqueue_put(rqueue_t *queue, const rqueue_elem_t *elem) {
 		return -1;
 	}
 	rqueue_unlock(queue);
+	return 0;
 }  // rqueue_put
 
+int rqueue_put_wait(rqueue_t *queue, const rqueue_elem_t *elem) {
+	if(rqueue_lock(queue))
+		return -1;
+	while((queue->tail + 1) % queue->buffer_size == queue->head) {
+		// queue is full, wait for the consumer to take an element
+		if(pthread_cond_wait(&queue->non_full_cond, &queue->mutex)) {
+			fprintf(stderr, "rqueue_put_wait: can\'t wait for free space\n");
+			rqueue_unlock(queue);
+			return -1;
+		}
+	}
+	int was_empty = queue->head == queue->tail;
+	queue->data[queue->tail] = *elem;
+	queue->tail = (queue->tail + 1) % queue->buffer_size;
+	if(was_empty && pthread_cond_signal(&queue->non_empty_cond)) {
+		fprintf(stderr, "rqueue_put_wait: can\'t signal non-empty condition\n");
+		rqueue_unlock(queue);
+		return -1;
+	}
+	rqueue_unlock(queue);
+	return 0;
+}  // rqueue_put_wait
+
+/** takes the element at the head of a non-empty queue, and wakes up a producer
+		waiting for free space if the queue has been full; the queue must be locked
+		@param queue the queue
+		@param elem [out] the element taken
+ */
+static void rqueue_take(rqueue_t *queue, rqueue_elem_t *elem) {
+	int was_full = (queue->tail + 1) % queue->buffer_size == queue->head;
+	*elem = queue->data[queue->head];
+	queue->head = (queue->head + 1) % queue->buffer_size;
+	if(was_full)
+		pthread_cond_broadcast(&queue->non_full_cond);
+}  // rqueue_take
+
 int rqueue_get(rqueue_t *queue, rqueue_elem_t *elem) {
 	if(rqueue_lock(queue))
 		return -1;
@@ -82,7 +125,19 @@ int rqueue_get(rqueue_t *queue, rqueue_elem_t *elem) {
 		}
 	}  // if(queue is empty)
 
-	*elem = queue->data[queue->head];
-	queue->head = (queue->head + 1) % queue->buffer_size;
+	rqueue_take(queue, elem);
 	rqueue_unlock(queue);
+	return 0;
 }  // rqueue_get
+
+int rqueue_try_get(rqueue_t *queue, rqueue_elem_t *elem) {
+	if(rqueue_lock(queue))
+		return -1;
+	if(queue->tail == queue->head) {
+		rqueue_unlock(queue);
+		return 0;
+	}
+	rqueue_take(queue, elem);
+	rqueue_unlock(queue);
+	return 1;
+}  // rqueue_try_get
@@ -6,6 +6,8 @@
 #include <pthread.h>
 
 struct region_struct;
+struct xfer_struct;
+struct wback_struct;
 
 /** specifies either operation to be performed on region or response */
 typedef enum {
@@ -18,7 +20,15 @@ typedef enum {
 	/** synchronizes region to host */
 	REGION_OP_SYNC_TO_HOST = 3,
 	/**  response to region synchronization to host */
-	REGION_OP_SYNCED_TO_HOST = 4
+	REGION_OP_SYNCED_TO_HOST = 4,
+	/** performs an asynchronous transfer; region is unused */
+	REGION_OP_XFER = 5,
+	/** unprotects and synchronizes region to host like ::REGION_OP_UNPROTECT,
+			but with no thread waiting for it */
+	REGION_OP_PREFETCH = 6,
+	/** writes back to host a part of a region, or finishes the write-back of
+			the region, without removing its protection first */
+	REGION_OP_WRITE_BACK = 7
 } region_op_t;
 
 /** region queue element */
@@ -27,6 +37,10 @@ typedef struct {
 	struct region_struct *region;
 	/** region operation to perform */
 	region_op_t op;	
+	/** the transfer to perform, for ::REGION_OP_XFER only */
+	struct xfer_struct *xfer;
+	/** the write-back step to perform, for ::REGION_OP_WRITE_BACK only */
+	struct wback_struct *wback;
 } rqueue_elem_t;
 
 /** region queue with one consumer (dequeuer) and several producers (enqueuers) */
@@ -45,6 +59,8 @@ typedef struct {
 	pthread_mutex_t mutex;
 	/** condition indicating availability of elements in the queue */
 	pthread_cond_t non_empty_cond;
+	/** condition indicating availability of free space in the queue */
+	pthread_cond_t non_full_cond;
 } rqueue_t;
 
 /** 
@@ -66,6 +82,15 @@ int rqueue_init(rqueue_t *queue, rqueue_elem_t *data, unsigned buffer_size);
  */
 int rqueue_put(rqueue_t *queue, const rqueue_elem_t *elem);
 
+/** puts an element into the queue, waiting for free space if the queue is full
+		@param queue the queue into which to put the element
+		@param elem the element to put
+		@returns 0 if successful and a negative error code if not
+		@remarks this is a blocking operation; it must not be called by the thread
+		which gets elements from the queue, or with the queue locked
+ */
+int rqueue_put_wait(rqueue_t *queue, const rqueue_elem_t *elem);
+
 /** gets an element from the queue 
 		@param queue the queue from which to get the element
 		@param elem the element to get
@@ -75,6 +100,15 @@ int rqueue_put(rqueue_t *queue, const rqueue_elem_t *elem);
  */
 int rqueue_get(rqueue_t *queue, rqueue_elem_t *elem);
 
+/** gets an element from the queue if there is one 
+		@param queue the queue from which to get the element
+		@param elem the element to get
+		@returns 1 if an element has been got, 0 if the queue is empty and a
+		negative error code in case of an error
+		@remarks this is a non-blocking operation
+ */
+int rqueue_try_get(rqueue_t *queue, rqueue_elem_t *elem);
+
 /** locks the queue 
 		@param queue the queue to lock
 		@returns 0 if successful and a negative error code if not
@@ -1,39 +1,75 @@
-/** @file salloc.c 
-		implementation of special separate allocator. Current allocator implementation is
-		simple and working, yet it can take a long time for either allocation or
-		deallocation. Memory is requested from OS in page-aligned regions of fixed size; all
-		regions form a linked list, with a pointer to the initial region stored in a global
-		variable. Each region maintains the count of allocated bytes and pointer to the next
-		region. Regions are subdivided into blocks. For each request, a single block
-		satisfying the request is found and then split into the portion allocated and the
-		remaining free portion. Each free memory block maintains its size and pointer to the
-		next block; each allocated block contains size only in prefix to its header. When an
-		allocated block is freed, it is inserted into free memory list of the region, which is
-		maintained in sorted order, and coalesced with its neighbours if it is possible. The
-		allocator can be used by multiple threads simultaneously; however, it is not
-		thread-safe, so only one thread can be inside the methods of the allocator at any
-		given time
+/** @file salloc.c
+		implementation of special separate allocator. Memory is requested from OS
+		in page-aligned blocks of fixed size, which are cut into pages. Each page
+		in use is a slab, which holds objects of a single size class; the slab
+		header is at the start of the page, so that the slab of an object is found
+		by rounding its address down to the page boundary. Each size class keeps
+		a doubly linked list of its slabs which have free objects; allocation
+		takes an object from the first of them, and freeing returns the object to
+		its slab, so that both take constant time. Objects of a slab which have
+		never been allocated are not linked into its free list, but are taken in
+		order, so that a new slab needs no initialization. Empty slabs are
+		returned to a pool of free pages, shared by all size classes, and the
+		memory of pages beyond a limit is returned to OS.
+
+		The allocator is thread-safe and async-signal-safe. In front of the slabs
+		of each size class is a depot, a small lock-free stack of free objects,
+		from which most allocations are served and to which most frees go. Slabs
+		are changed only under a spinlock, which is taken with all signals
+		blocked, so that a signal handler never finds it held by the thread it
+		has interrupted, and a thread is never stopped while holding it; the
+		depot is refilled from slabs a batch at a time, so that the lock is taken
+		rarely. As a depot may read an object just taken by another thread, pages
+		of slabs are never unmapped; their memory is released with madvise()
+		instead.
+
+		Objects larger than a slab can hold are mapped from OS directly, each in
+		its own run of pages, and are returned page-aligned. No slab object is
+		page-aligned, as it follows the slab header, so that sfree() tells the
+		two kinds apart by the address alone. Large objects are recorded in a
+		table sorted by address, which is changed and searched under the same
+		lock, and grows by remapping
 */
 
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <sys/mman.h>
 
 #include "gpuvm.h"
 #include "util.h"
 
-/** block header */
-typedef struct block_header_s {
-	/** the size of the block, _including_ the block itself; maintained even after the block is allocated */
-	size_t size;
-	/** pointer to the next block, or NULL if none */
-	struct block_header_s *next;
-} block_header_t;
-
-/** minimum alignment of allocated memory, bytes */
-#define MIN_ALIGN 8
+/** a slab, i.e. a page holding objects of a single size class; this header
+		is followed by the objects */
+typedef struct slab_s {
+	/** #SLAB_MAGIC, checked on free */
+	unsigned magic;
+	/** the size class of the objects */
+	unsigned iclass;
+	/** the number of objects allocated */
+	unsigned nused;
+	/** the first object which has never been allocated, or 0 if none */
+	char *fresh;
+	/** list of free objects, linked through their first word */
+	void *free_list;
+	/** previous and next slab of the same size class with free objects */
+	struct slab_s *prev, *next;
+} slab_t;
+
+/** size of slab header, rounded up to a multiple of 16 bytes. Slab objects
+		are only guaranteed to be ::SALIGN-aligned, i.e. 8-byte aligned: objects
+		of classes which are multiples of 16 are 16-byte aligned as well, but
+		those of classes such as 24 or 40 are not. No metadata structure needs
+		more than ::SALIGN */
+#define SLAB_HEADER_SIZE ((sizeof(slab_t) + 15) / 16 * 16)
+
+/** value of the magic field of a slab */
+#define SLAB_MAGIC 0x5a110c5a
 
 /** sizes of blocks requested from OS, in pages */
 #define OS_BLOCK_PAGES 16
@@ -42,7 +78,7 @@ typedef struct block_header_s {
 #define OS_BLOCK_SIZE (OS_BLOCK_PAGES * GPUVM_PAGE_SIZE)
 
 /** maximum allocation size allowed */
-#define MAX_ALLOC_SIZE (GPUVM_PAGE_SIZE - sizeof(block_header_t))
+#define MAX_ALLOC_SIZE (GPUVM_PAGE_SIZE - SLAB_HEADER_SIZE)
 
 /** ratio of maximum number of pages "held" without being freed to pages in OS-requested
 		block */
@@ -51,247 +87,479 @@ typedef struct block_header_s {
 /** maximum number of pages "held" without returning them back to OS */
 #define MAX_HOLD_PAGES (MAX_HOLD_RATIO * OS_BLOCK_PAGES)
 
-/** the value written to next field of an allocated block, checked on free */
-#define ALLOC_CANARY 0xabababababababab /* (~(ptrdiff_t)0)*/
-
 #ifndef __APPLE__
 #define ANONYMOUS_MAP_FLAG MAP_ANONYMOUS
 #else
 #define ANONYMOUS_MAP_FLAG MAP_ANON
 #endif
 
+/** maximum number of pages whose memory has been returned to OS, and which
+		are kept for reuse; if there are more, pages are held instead */
+#define MAX_COLD_PAGES 4096
+
+/** maximum number of objects in the depot of a size class */
+#define DEPOT_MAX 64
+
+/** number of objects moved from slabs into a depot at once */
+#define DEPOT_REFILL 16
+
+/** bits of a depot top word holding the pointer; the rest hold the tag */
+#define DEPOT_PTR_BITS 48
+
+/** mask of the pointer in a depot top word */
+#define DEPOT_PTR_MASK ((1ull << DEPOT_PTR_BITS) - 1)
+
+/** initial number of entries in the table of large objects */
+#define LARGE_TABLE_MIN 64
+
+/** granularity of the small size classes, bytes; must be a multiple of
+		::SALIGN, so that every object is aligned */
+#define CLASS_STEP SALIGN
+
+/** object sizes of the size classes; small classes are CLASS_STEP apart, so
+		that fixed-size metadata structures waste little, and large classes fit
+		a whole number of objects into a slab */
+static const size_t class_sizes_g[] = {
+	8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120, 128, 136, 144,
+	152, 160, 168, 176, 184, 192, 200, 208, 216, 224, 232, 240, 248, 256, 320,
+	384, 448, 512, 672, 800, 1008, 1344, 2016, MAX_ALLOC_SIZE
+};
+
+/** number of size classes */
+#define NCLASSES (sizeof(class_sizes_g) / sizeof(class_sizes_g[0]))
+
+/** size class for each allocation size, in CLASS_STEP units rounded up */
+static unsigned char size_class_g[MAX_ALLOC_SIZE / CLASS_STEP + 2];
+
+/** slabs with free objects, for each size class */
+static slab_t *partial_slabs_g[NCLASSES];
+
+/** a depot, i.e. a lock-free stack of free objects of a size class, linked
+		through their first word */
+typedef struct {
+	/** the top object in the low bits, and a tag incremented on each change in
+			the high bits, so that a stale top never compares equal */
+	volatile unsigned long long top;
+	/** the number of objects, approximate */
+	volatile int count;
+} depot_t;
+
+/** depots of size classes */
+static depot_t depots_g[NCLASSES];
+
+/** the lock of slabs and pages */
+static volatile int salloc_lock_g = 0;
+
+/** free pages, linked through their first word */
+static void *free_pages_g = 0;
+
+/** free pages whose memory has been returned to OS */
+static void *cold_pages_g[MAX_COLD_PAGES];
+
+/** number of free pages whose memory has been returned to OS */
+static size_t ncold_pages_g = 0;
+
 /** number of free pages currently being held */
-size_t npages_held_g = 0;
+static size_t npages_held_g = 0;
 
-/** start of block list */
-block_header_t *block_list_g = 0;
+/** number of pages obtained from OS and not returned */
+static size_t npages_os_g = 0;
 
-/** dumps the list of free blocks; for debug use only */
-static void dump_free_blocks(void) {
-	block_header_t *block;
-	for(block = block_list_g; block = block->next; block) {
-		fprintf(stderr, "{%p, %zd}%s", block, block->size, block->next ? "->" : "\n");
-	}
-}  // dump_free_blocks()
+/** a large object, mapped from OS directly */
+typedef struct {
+	/** the start of the object, page-aligned */
+	void *ptr;
+	/** the number of pages of the object */
+	size_t npages;
+} large_t;
+
+/** large objects, sorted by address */
+static large_t *large_table_g = 0;
 
-/** 
-		gets blocks from OS and inserts them into sorted list of free blocks
-		@returns pointer to first allocated block if successful and NULL if not
+/** number of large objects */
+static size_t nlarge_g = 0;
+
+/** number of entries the table of large objects can hold */
+static size_t large_table_size_g = 0;
+
+/** number of pages in large objects */
+static size_t npages_large_g = 0;
+
+/** number of bytes in allocated objects, counted by size class */
+static volatile size_t nbytes_used_g = 0;
+
+/** gets pages from OS and adds them to free pages
+		@returns 0 if successful and a negative error code if not
  */
-static block_header_t *alloc_os_blocks(void) {
-	// allocate raw memory
-	char *raw = (char*)mmap(0, OS_BLOCK_SIZE, PROT_READ | PROT_WRITE, 
-									 MAP_PRIVATE | ANONYMOUS_MAP_FLAG, -1, 0);
-	if(!raw) {
-		fprintf(stderr, "alloc_os_blocks: can\'t get blocks from OS\n");
-		return 0;
+static int alloc_os_pages(void) {
+	char *raw = (char*)mmap(0, OS_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+													MAP_PRIVATE | ANONYMOUS_MAP_FLAG, -1, 0);
+	if(raw == MAP_FAILED) {
+		fprintf(stderr, "alloc_os_pages: can\'t get pages from OS\n");
+		return GPUVM_ESALLOC;
+	}
+	int ipage;
+	for(ipage = OS_BLOCK_PAGES - 1; ipage >= 0; ipage--) {
+		void **page = (void**)(raw + ipage * GPUVM_PAGE_SIZE);
+		*page = free_pages_g;
+		free_pages_g = page;
 	}
 	npages_held_g += OS_BLOCK_PAGES;
+	npages_os_g += OS_BLOCK_PAGES;
+	return 0;
+}  // alloc_os_pages
 
-	// initialize block data structure
-	int iblock;
-	for(iblock = 0; iblock < OS_BLOCK_PAGES; iblock++) {
-		block_header_t *block = (block_header_t*)(void*)(raw + iblock * GPUVM_PAGE_SIZE);
-		block->size = GPUVM_PAGE_SIZE;
-		block->next = iblock == OS_BLOCK_PAGES - 1 ? 0 : 
-			(block_header_t*)(void*)(raw + (iblock + 1) * GPUVM_PAGE_SIZE);
+/** returns a page to the free pages, and its memory to OS if too many pages
+		are held
+		@param page the page
+ */
+static void free_page(void *page) {
+	if(npages_held_g >= MAX_HOLD_PAGES && ncold_pages_g < MAX_COLD_PAGES &&
+		 !madvise(page, GPUVM_PAGE_SIZE, MADV_DONTNEED)) {
+		cold_pages_g[ncold_pages_g++] = page;
+		return;
 	}
-	block_header_t *first_new_block = (block_header_t*)(void*)raw;
-	block_header_t *last_new_block = (block_header_t*)(void*)(raw + (OS_BLOCK_PAGES - 1) * GPUVM_PAGE_SIZE);
-	
-	// insert into sorted list of free blocks
-	block_header_t **pblock;
-	for(pblock = &block_list_g; *pblock && *pblock < first_new_block; pblock = &(*pblock)->next);
-	last_new_block->next = *pblock;
-	*pblock = first_new_block;
-	return first_new_block;
-}  // alloc_os_block()
+	*(void**)page = free_pages_g;
+	free_pages_g = page;
+	npages_held_g++;
+}  // free_page
 
 int salloc_init(void) {
-	if(!alloc_os_blocks()) 
-		return GPUVM_ESALLOC;
+	// size classes for each size
+	unsigned isize, iclass = 0;
+	for(isize = 0; isize < sizeof(size_class_g); isize++) {
+		while(iclass < NCLASSES - 1 && class_sizes_g[iclass] < isize * CLASS_STEP)
+			iclass++;
+		size_class_g[isize] = iclass;
+	}
+	return alloc_os_pages();
+}  // salloc_init
+
+/** creates a new slab for a size class, and makes it the first slab of the
+		class with free objects
+		@param iclass the size class
+		@returns the slab if successful and 0 if not
+ */
+static slab_t *slab_new(unsigned iclass) {
+	slab_t *slab;
+	if(!free_pages_g && ncold_pages_g) {
+		slab = (slab_t*)cold_pages_g[--ncold_pages_g];
+	} else {
+		if(!free_pages_g && alloc_os_pages())
+			return 0;
+		slab = (slab_t*)free_pages_g;
+		free_pages_g = *(void**)slab;
+		npages_held_g--;
+	}
+	slab->magic = SLAB_MAGIC;
+	slab->iclass = iclass;
+	slab->nused = 0;
+	slab->fresh = (char*)slab + SLAB_HEADER_SIZE;
+	slab->free_list = 0;
+	slab->prev = 0;
+	slab->next = partial_slabs_g[iclass];
+	if(slab->next)
+		slab->next->prev = slab;
+	partial_slabs_g[iclass] = slab;
+	return slab;
+}  // slab_new
+
+/** removes a slab from the list of slabs with free objects of its class
+		@param slab the slab
+ */
+static void slab_unlink(slab_t *slab) {
+	if(slab->prev)
+		slab->prev->next = slab->next;
 	else
+		partial_slabs_g[slab->iclass] = slab->next;
+	if(slab->next)
+		slab->next->prev = slab->prev;
+	slab->prev = slab->next = 0;
+}  // slab_unlink
+
+/** takes the lock of slabs and pages, blocking all signals
+		@param old_mask [out] the signal mask to restore on unlock
+ */
+static void salloc_lock(sigset_t *old_mask) {
+	sigset_t all_mask;
+	sigfillset(&all_mask);
+	pthread_sigmask(SIG_BLOCK, &all_mask, old_mask);
+	while(__sync_lock_test_and_set(&salloc_lock_g, 1))
+		sched_yield();
+}  // salloc_lock
+
+/** releases the lock of slabs and pages, restoring the signal mask
+		@param old_mask the signal mask saved by salloc_lock()
+ */
+static void salloc_unlock(const sigset_t *old_mask) {
+	__sync_lock_release(&salloc_lock_g);
+	pthread_sigmask(SIG_SETMASK, old_mask, 0);
+}  // salloc_unlock
+
+/** pushes an object into a depot, unless it is full
+		@param depot the depot
+		@param ptr the object
+		@returns nonzero if the object has been pushed and 0 if not
+ */
+static int depot_push(depot_t *depot, void *ptr) {
+	if(depot->count >= DEPOT_MAX)
+		return 0;
+	unsigned long long top, new_top;
+	do {
+		top = depot->top;
+		*(void**)ptr = (void*)(uintptr_t)(top & DEPOT_PTR_MASK);
+		new_top = (uintptr_t)ptr | 
+			((top >> DEPOT_PTR_BITS) + 1) << DEPOT_PTR_BITS;
+	} while(!__sync_bool_compare_and_swap(&depot->top, top, new_top));
+	__sync_fetch_and_add(&depot->count, 1);
+	return 1;
+}  // depot_push
+
+/** pops an object from a depot
+		@param depot the depot
+		@returns the object, or 0 if the depot is empty
+ */
+static void *depot_pop(depot_t *depot) {
+	unsigned long long top, new_top;
+	void *ptr;
+	do {
+		top = depot->top;
+		ptr = (void*)(uintptr_t)(top & DEPOT_PTR_MASK);
+		if(!ptr)
+			return 0;
+		// the object may have just been taken by another thread, and its first
+		// word overwritten; the tag then has changed, and the swap fails
+		new_top = (uintptr_t)*(void* volatile*)ptr | 
+			((top >> DEPOT_PTR_BITS) + 1) << DEPOT_PTR_BITS;
+	} while(!__sync_bool_compare_and_swap(&depot->top, top, new_top));
+	__sync_fetch_and_sub(&depot->count, 1);
+	return ptr;
+}  // depot_pop
+
+/** takes an object from the slabs of a size class; must be called with the
+		lock held
+		@param iclass the size class
+		@returns the object if successful and 0 if not
+ */
+static void *slab_alloc(unsigned iclass) {
+	size_t size = class_sizes_g[iclass];
+	slab_t *slab = partial_slabs_g[iclass];
+	if(!slab && !(slab = slab_new(iclass)))
 		return 0;
-}  // salloc_init
 
-void *smalloc(size_t nbytes) {
-	// check size
-	if(nbytes > MAX_ALLOC_SIZE) {
-		fprintf(stderr, "smalloc: %zd bytes requested, greater than maximum "
-						"allowed size %zd bytes\n", nbytes, MAX_ALLOC_SIZE);
+	// take a free object, or a fresh one if there are none
+	void *result;
+	if(slab->free_list) {
+		result = slab->free_list;
+		slab->free_list = *(void**)result;
+	} else {
+		result = slab->fresh;
+		slab->fresh += size;
+		if(slab->fresh + size > (char*)slab + GPUVM_PAGE_SIZE)
+			slab->fresh = 0;
+	}
+	slab->nused++;
+	if(!slab->free_list && !slab->fresh)
+		slab_unlink(slab);
+	return result;
+}  // slab_alloc
+
+/** returns an object to its slab; must be called with the lock held
+		@param slab the slab of the object
+		@param ptr the object
+ */
+static void slab_free(slab_t *slab, void *ptr) {
+	unsigned iclass = slab->iclass;
+	// a full slab gets free objects again
+	int was_full = !slab->free_list && !slab->fresh;
+	*(void**)ptr = slab->free_list;
+	slab->free_list = ptr;
+	slab->nused--;
+	if(was_full) {
+		slab->prev = 0;
+		slab->next = partial_slabs_g[iclass];
+		if(slab->next)
+			slab->next->prev = slab;
+		partial_slabs_g[iclass] = slab;
+	}
+	// keep the last slab of a class, so that a class used by a single object
+	// does not take and release a page each time
+	if(!slab->nused && (slab->prev || slab->next)) {
+		slab_unlink(slab);
+		slab->magic = 0;
+		free_page(slab);
+	}
+}  // slab_free
+
+/** finds the position of a large object in the table; must be called with
+		the lock held
+		@param ptr the start of the object
+		@returns the index of the object if it is in the table, and otherwise
+		the index at which it would be inserted
+ */
+static size_t large_find(void *ptr) {
+	size_t lo = 0, hi = nlarge_g;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if((char*)large_table_g[mid].ptr < (char*)ptr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}  // large_find
+
+/** makes room for one more entry in the table of large objects; must be
+		called with the lock held
+		@returns 0 if successful and a negative error code if not
+ */
+static int large_table_grow(void) {
+	if(nlarge_g < large_table_size_g)
 		return 0;
+	size_t new_size = large_table_size_g ? 2 * large_table_size_g : 
+		LARGE_TABLE_MIN;
+	large_t *new_table = (large_t*)mmap
+		(0, new_size * sizeof(large_t), PROT_READ | PROT_WRITE, 
+		 MAP_PRIVATE | ANONYMOUS_MAP_FLAG, -1, 0);
+	if(new_table == MAP_FAILED) {
+		fprintf(stderr, "large_table_grow: can't get pages from OS\n");
+		return GPUVM_ESALLOC;
+	}
+	if(large_table_g) {
+		memcpy(new_table, large_table_g, nlarge_g * sizeof(large_t));
+		munmap(large_table_g, large_table_size_g * sizeof(large_t));
 	}
+	large_table_g = new_table;
+	large_table_size_g = new_size;
+	return 0;
+}  // large_table_grow
 
-	// find siutable memory block
-	size_t real_nbytes = nbytes + sizeof(block_header_t);
-	int itry;
-	for(itry = 0; itry < 2; itry++) {
-		block_header_t **pblock;
-		for(pblock = &block_list_g; *pblock && (*pblock)->size < real_nbytes; 
-				pblock = &(*pblock)->next);
-		if(*pblock) {
-			// block found
-			block_header_t *block = *pblock;
-			size_t rblocks = real_nbytes / sizeof(block_header_t) + 
-					(real_nbytes % sizeof(block_header_t) ? 1 : 0);
-			size_t rsize = rblocks * sizeof(block_header_t);
-			if(block->size - rsize >= 2 * sizeof(block_header_t)) {
-				// split block
-				block_header_t *new_block = block + rblocks;
-				new_block->next = block->next;
-				new_block->size = block->size - rsize;
-				block->next = new_block;
-				block->size = rsize;
+/** allocates a large object, mapping it from OS directly
+		@param nbytes the size of the object, greater than #MAX_ALLOC_SIZE
+		@returns the object, page-aligned, if successful and 0 if not
+ */
+static void *large_alloc(size_t nbytes) {
+	if(nbytes > (size_t)-1 - GPUVM_PAGE_SIZE) {
+		fprintf(stderr, "smalloc: %zd bytes requested, too many\n", nbytes);
+		return 0;
+	}
+	size_t npages = (nbytes + GPUVM_PAGE_SIZE - 1) / GPUVM_PAGE_SIZE;
+	void *ptr = mmap(0, npages * GPUVM_PAGE_SIZE, PROT_READ | PROT_WRITE, 
+									 MAP_PRIVATE | ANONYMOUS_MAP_FLAG, -1, 0);
+	if(ptr == MAP_FAILED) {
+		fprintf(stderr, "smalloc: can't get %zd pages from OS\n", npages);
+		return 0;
+	}
+	sigset_t old_mask;
+	salloc_lock(&old_mask);
+	if(large_table_grow()) {
+		salloc_unlock(&old_mask);
+		munmap(ptr, npages * GPUVM_PAGE_SIZE);
+		return 0;
+	}
+	size_t ilarge = large_find(ptr);
+	memmove(large_table_g + ilarge + 1, large_table_g + ilarge, 
+					(nlarge_g - ilarge) * sizeof(large_t));
+	large_table_g[ilarge].ptr = ptr;
+	large_table_g[ilarge].npages = npages;
+	nlarge_g++;
+	npages_large_g += npages;
+	salloc_unlock(&old_mask);
+	__sync_fetch_and_add(&nbytes_used_g, npages * GPUVM_PAGE_SIZE);
+	return ptr;
+}  // large_alloc
+
+/** frees a large object, returning its pages to OS
+		@param ptr the object, page-aligned
+ */
+static void large_free(void *ptr) {
+	sigset_t old_mask;
+	salloc_lock(&old_mask);
+	size_t ilarge = large_find(ptr);
+	if(ilarge == nlarge_g || large_table_g[ilarge].ptr != ptr) {
+		salloc_unlock(&old_mask);
+		fprintf(stderr, "sfree: invalid pointer %p passed to free\n", ptr);
+		return;
+	}
+	size_t npages = large_table_g[ilarge].npages;
+	memmove(large_table_g + ilarge, large_table_g + ilarge + 1, 
+					(nlarge_g - ilarge - 1) * sizeof(large_t));
+	nlarge_g--;
+	npages_large_g -= npages;
+	salloc_unlock(&old_mask);
+	__sync_fetch_and_sub(&nbytes_used_g, npages * GPUVM_PAGE_SIZE);
+	munmap(ptr, npages * GPUVM_PAGE_SIZE);
+}  // large_free
+
+void *smalloc(size_t nbytes) {
+	if(nbytes > MAX_ALLOC_SIZE) {
+		void *result = large_alloc(nbytes);
+#ifdef SALLOC_DEBUG
+		if(result)
+			memset(result, 0xcd, nbytes);
+#endif
+		return result;
+	}
+	unsigned iclass = size_class_g[(nbytes + CLASS_STEP - 1) / CLASS_STEP];
+	size_t size = class_sizes_g[iclass];
+	void *result = depot_pop(&depots_g[iclass]);
+	if(!result) {
+		// refill the depot from slabs
+		sigset_t old_mask;
+		salloc_lock(&old_mask);
+		result = slab_alloc(iclass);
+		unsigned irefill;
+		for(irefill = 1; result && irefill < DEPOT_REFILL; irefill++) {
+			void *ptr = slab_alloc(iclass);
+			if(!ptr)
+				break;
+			if(!depot_push(&depots_g[iclass], ptr)) {
+				slab_free((slab_t*)((uintptr_t)ptr / GPUVM_PAGE_SIZE * 
+														GPUVM_PAGE_SIZE), ptr);
+				break;
 			}
-			// bypass block being allocated and return its free memory
-			*pblock = block->next;
-			block->next = (block_header_t*)ALLOC_CANARY;
-			block_header_t *result = block + 1;
-			memset(result, 0xcd, block->size - sizeof(block_header_t));
-			//fprintf(stderr, "allocated %p\n", result);
-			return result;
-		} else if(!itry) { 
-			if(!alloc_os_blocks())
-				return 0;
 		}
-	}  // for(itry)
-	// if here, no block can be allocated, and it's an error
-	fprintf(stderr, "smalloc: can\'t allocate block after getting memory from OS; "
-					"most likely an internal error\n");
-	return 0;
+		salloc_unlock(&old_mask);
+		if(!result)
+			return 0;
+	}
+	__sync_fetch_and_add(&nbytes_used_g, size);
+#ifdef SALLOC_DEBUG
+	memset(result, 0xcd, size);
+#endif
+	return result;
 }  // smalloc
 
-/** frees blocks requested from OS */
-static void free_os_blocks(void) {
-	block_header_t **pblock;
-	for(pblock = &block_list_g; *pblock && npages_held_g > MAX_HOLD_PAGES;) {
-		if((*pblock)->size == GPUVM_PAGE_SIZE) {
-			block_header_t *block = *pblock;
-			*pblock = (*pblock)->next;
-			if(munmap(*pblock, GPUVM_PAGE_SIZE))
-				fprintf(stderr, "free_os_blocks: can\'t free OS page %p\n", block);
-			npages_held_g--;
-		} else
-			pblock = &(*pblock)->next;
-	}  // for(pblock)
-}  // free_os_blocks
-
-/** tries to coalesce two blocks; if coalescing is successful, the second block ceases to
-		exist, and its portion of memory is added to the first block. Coalescing helps to reduce
-		fragmentation. Only blocks belonging to a single page can be coalesced
-		@param block1 the first block
-		@param block2 the second block. Its address must be greater than that of the first block
-*/
-static void coalesce(block_header_t *block1, block_header_t *block2) {
-	if(!block1 || !block2)
-		return;
-	if(block2 <= block1)
-		return;
-	if((block2 - block1) * sizeof(block_header_t) != block1->size)
-		return;
-	if((ptrdiff_t)block1 / GPUVM_PAGE_SIZE != (ptrdiff_t)block2 / GPUVM_PAGE_SIZE)
-		return;
-	//fprintf(stderr, "coalescing blocks {%p, %zd} and {%p, %zd}\n", block1, 
-	//				block1->size, block2, block2->size);
-	block1->size += block2->size;
-	block1->next = block2->next;
-	if(block1->size == GPUVM_PAGE_SIZE)
-		npages_held_g++;
-}  // coalesce
-
 void sfree(void *ptr) {
 	if(!ptr)
 		return;
-
-	//fprintf(stderr, "blocks before free:\n");
-	//dump_free_blocks();
-	
-	// check canary
-	block_header_t *block = (block_header_t*)ptr - 1;
-	if((ptrdiff_t)block->next != ALLOC_CANARY) {
+	// slab objects are never page-aligned
+	if(!((uintptr_t)ptr % GPUVM_PAGE_SIZE)) {
+		large_free(ptr);
+		return;
+	}
+	slab_t *slab = (slab_t*)((uintptr_t)ptr / GPUVM_PAGE_SIZE * GPUVM_PAGE_SIZE);
+	if(slab->magic != SLAB_MAGIC ||
+		 ((char*)ptr - (char*)slab - SLAB_HEADER_SIZE) %
+		 class_sizes_g[slab->iclass]) {
 		fprintf(stderr, "sfree: invalid pointer %p passed to free\n", ptr);
 		return;
 	}
-	if(block->size == GPUVM_PAGE_SIZE)
-		npages_held_g++;
-
-	// add to sorted free list
-	/*block_header_t **pblock;
-	for(pblock = &block_list_g; *pblock && *pblock < block; 
-			pblock = &(*pblock)->next);
-	block->next = *pblock;
-	*pblock = block;*/
-	// destroy block info
-	//fprintf(stderr, "ptr = %p, block = %p, block size = %zd\n", ptr, block, block->size);
-	memset(block + 1, 0xef, block->size - sizeof(block_header_t));
-	//fprintf(stderr, "memory set");
-	block_header_t *prev_block = 0, *next_block;
-	for(next_block = block_list_g; next_block && next_block < block;
-			prev_block = next_block, next_block = next_block->next);
-	if(prev_block) 
-		prev_block->next = block;
-	else
-		block_list_g = block;
-	block->next = next_block;
-
-	// coalesce
-	//if(next_block)
-	coalesce(block, next_block);
-		 //if(prev_block)
-	coalesce(prev_block, block);
-
-	// free OS-allocated pages if necessary
-	free_os_blocks();
-
-	//fprintf(stderr, "blocks after free:\n");
-	//dump_free_blocks();
-	
-	//fprintf(stderr, "freed %p\n", ptr);	
+	unsigned iclass = slab->iclass;
+	size_t size = class_sizes_g[iclass];
+#ifdef SALLOC_DEBUG
+	memset(ptr, 0xef, size);
+#endif
+	__sync_fetch_and_sub(&nbytes_used_g, size);
+	if(depot_push(&depots_g[iclass], ptr))
+		return;
+	sigset_t old_mask;
+	salloc_lock(&old_mask);
+	slab_free(slab, ptr);
+	salloc_unlock(&old_mask);
 }  // sfree
 
-// old allocation procedures
-
-/** maximum allocation size, 4 MB */
-//const size_t MAX_BYTES = 4 * 1024 * 1024;
-
-/** base pointer to blob from which data is allocated */
-//char *baseptr_g = 0;
-
-/** number of bytes already allocated */
-//size_t allocd_g = 0;
-
-/*int salloc_init() {
-	if(posix_memalign((void**)&baseptr_g, GPUVM_PAGE_SIZE, MAX_BYTES)) {
-		fprintf(stderr, "init: can\'t allocate memory from system");
-		baseptr_g = 0;
-	}
-	return baseptr_g ? 0 : GPUVM_ESALLOC;
-	}
-
-void *smalloc(size_t nbytes) {
-
-	// maintain alignment
-	if(nbytes % SALIGN)
-		nbytes += SALIGN - nbytes % SALIGN;
-
-	// check if out of memory
-	if(allocd_g + nbytes > MAX_BYTES) {
-		fprintf(stderr, "smalloc: can\'t allocate memory\n");
-		return 0;
-	}	
-
-	// do allocation
-	void *resptr = baseptr_g + allocd_g;
-	allocd_g += nbytes;
-	return resptr;	
-}
-
-void sfree(void *ptr) {
-	if(!ptr)
-		return;
-	char *cptr = (char*)ptr;
-	if(cptr - baseptr_g < 0 || cptr - baseptr_g > allocd_g)
-		fprintf(stderr, "sfree: invalid pointer");
-	return;
-}
-*/
+void salloc_usage(size_t *pused, size_t *pheld) {
+	*pused = nbytes_used_g;
+	*pheld = (npages_os_g - ncold_pages_g + npages_large_g) * GPUVM_PAGE_SIZE;
+}  // salloc_usage
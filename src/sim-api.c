@@ -0,0 +1,377 @@
+/** @file sim-api.c implementation of simulated devices. Device buffers are
+		ordinary host memory, and copies are host copies followed by a delay, so that
+		the total copy time is latency + nbytes / bandwidth, as specified by device
+		parameters for each direction. The number of copies in progress in each
+		direction may be limited, to model a limited number of DMA engines */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "hcopy.h"
+#include "sim-api.h"
+#include "stat.h"
+#include "util.h"
+
+/** default copy latency, in seconds */
+#define SIM_DEFAULT_LATENCY 10e-6
+
+/** default copy bandwidth, in bytes per second */
+#define SIM_DEFAULT_BANDWIDTH 6e9
+
+/** default maximum number of simultaneous copies in each direction */
+#define SIM_DEFAULT_MAX_COPIES 1
+
+/** size of the header preceding each allocated buffer, which keeps its size;
+		also keeps the buffer aligned */
+#define SIM_MEM_HEADER 64
+
+/** a single copy direction of a simulated device */
+typedef struct {
+	/** copy latency, in seconds */
+	double latency;
+	/** copy bandwidth, in bytes per second, or 0 if unlimited */
+	double bandwidth;
+	/** maximum number of copies in progress, or 0 if unlimited */
+	unsigned max_copies;
+	/** number of copies in progress */
+	unsigned ncopies;
+	/** mutex protecting the number of copies in progress */
+	pthread_mutex_t mutex;
+	/** condition signalled when a copy finishes */
+	pthread_cond_t copy_done_cond;
+} sim_channel_t;
+
+/** a simulated device */
+typedef struct {
+	/** host-to-device direction */
+	sim_channel_t h2d;
+	/** device-to-host direction */
+	sim_channel_t d2h;
+	/** amount of memory available for allocation, or 0 if unlimited */
+	size_t mem_size;
+	/** amount of memory allocated */
+	size_t mem_used;
+	/** mutex protecting the amount of memory allocated */
+	pthread_mutex_t mem_mutex;
+	/** nonzero if the device shares memory with host */
+	int unified_memory;
+} sim_dev_t;
+
+/** simulated devapi structure */
+devapi_t sim_devapi_g;
+
+/** simulated devices, one for each GPUVM device */
+sim_dev_t *sim_devs_g = 0;
+
+static int sim_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+static int sim_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+static int sim_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies);
+static int sim_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies);
+static int sim_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects);
+static int sim_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects);
+static int sim_mem_alloc(unsigned idev, size_t nbytes, void **pbuf);
+static int sim_mem_free(unsigned idev, void *buf);
+static int sim_host_unified(unsigned idev);
+static int sim_mem_wrap
+(unsigned idev, void *hostptr, size_t nbytes, void **pbuf);
+static int sim_mem_unwrap(unsigned idev, void *buf);
+static int sim_mem_map(unsigned idev, void *buf, void *hostptr, size_t nbytes);
+static int sim_mem_unmap(unsigned idev, void *buf, void *hostptr);
+static int sim_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes);
+static int sim_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value);
+
+/** initializes a single direction of a simulated device
+		@param channel the direction to initialize
+		@param latency copy latency
+		@param bandwidth copy bandwidth
+		@param max_copies maximum number of copies in progress
+		@returns 0 if successful and a negative error code if not
+ */
+static int sim_channel_init
+(sim_channel_t *channel, double latency, double bandwidth, unsigned max_copies) {
+	channel->latency = latency;
+	channel->bandwidth = bandwidth;
+	channel->max_copies = max_copies;
+	channel->ncopies = 0;
+	if(pthread_mutex_init(&channel->mutex, 0) || 
+		 pthread_cond_init(&channel->copy_done_cond, 0)) {
+		fprintf(stderr, "sim_channel_init: can\'t init synchronization\n");
+		return GPUVM_ERROR;
+	}
+	return 0;
+}  // sim_channel_init
+
+int sim_devapi_init(void) {
+	// fill in devapi_g structure
+	devapi_g = &sim_devapi_g;
+	devapi_g->memcpy_d2h = sim_memcpy_d2h;
+	devapi_g->memcpy_h2d = sim_memcpy_h2d;
+	devapi_g->memcpy_d2h_n = sim_memcpy_d2h_n;
+	devapi_g->memcpy_h2d_n = sim_memcpy_h2d_n;
+	devapi_g->memcpy_d2h_rect = sim_memcpy_d2h_rect;
+	devapi_g->memcpy_h2d_rect = sim_memcpy_h2d_rect;
+	devapi_g->mem_alloc = sim_mem_alloc;
+	devapi_g->mem_free = sim_mem_free;
+	devapi_g->host_unified = sim_host_unified;
+	devapi_g->mem_wrap = sim_mem_wrap;
+	devapi_g->mem_unwrap = sim_mem_unwrap;
+	devapi_g->mem_map = sim_mem_map;
+	devapi_g->mem_unmap = sim_mem_unmap;
+	devapi_g->memcpy_peer = sim_memcpy_peer;
+	devapi_g->mem_fill = sim_mem_fill;
+
+	// initialize devices
+	sim_devs_g = (sim_dev_t*)smalloc(ndevs_g * sizeof(sim_dev_t));
+	if(!sim_devs_g)
+		return GPUVM_ESALLOC;
+	unsigned idev;
+	int err;
+	for(idev = 0; idev < ndevs_g; idev++) {
+		gpuvm_sim_params_t params = {
+			SIM_DEFAULT_LATENCY, SIM_DEFAULT_BANDWIDTH, 
+			SIM_DEFAULT_LATENCY, SIM_DEFAULT_BANDWIDTH,
+			SIM_DEFAULT_MAX_COPIES, SIM_DEFAULT_MAX_COPIES, 0, 0
+		};
+		if(devs_g[idev])
+			params = *(gpuvm_sim_params_t*)devs_g[idev];
+		if(params.h2d_latency < 0 || params.h2d_bandwidth < 0 || 
+			 params.d2h_latency < 0 || params.d2h_bandwidth < 0) {
+			fprintf(stderr, "sim_devapi_init: invalid parameters for device %d\n", idev);
+			return GPUVM_EARG;
+		}
+		if((err = sim_channel_init(&sim_devs_g[idev].h2d, params.h2d_latency,
+															 params.h2d_bandwidth, params.max_h2d_copies)) ||
+			 (err = sim_channel_init(&sim_devs_g[idev].d2h, params.d2h_latency, 
+															 params.d2h_bandwidth, params.max_d2h_copies)))
+			return err;
+		sim_devs_g[idev].mem_size = params.mem_size;
+		sim_devs_g[idev].mem_used = 0;
+		sim_devs_g[idev].unified_memory = params.unified_memory;
+		if(pthread_mutex_init(&sim_devs_g[idev].mem_mutex, 0)) {
+			fprintf(stderr, "sim_devapi_init: can\'t init mutex\n");
+			return GPUVM_ERROR;
+		}
+	}
+	return 0;
+}  // sim_devapi_init
+
+/** waits until the time passed since the start reaches the specified value
+		@param start the starting time
+		@param time the time to wait since start, in seconds
+ */
+static void sim_wait_until(const struct timespec *start, double time) {
+	struct timespec end = *start;
+	long long nsec = (long long)(time * 1e9);
+	end.tv_sec += nsec / 1000000000ll;
+	end.tv_nsec += nsec % 1000000000ll;
+	if(end.tv_nsec >= 1000000000l) {
+		end.tv_sec++;
+		end.tv_nsec -= 1000000000l;
+	}
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &end, 0) == EINTR);
+}  // sim_wait_until
+
+/** copies a rectangular block between strided host memory and a simulated
+		device buffer
+		@param devbuf the device buffer
+		@param rect the block to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns the number of bytes copied
+ */
+static size_t sim_copy_rect(void *devbuf, const devrect_t *rect, int to_device) {
+	size_t z, y;
+	for(z = 0; z < rect->depth; z++)
+		for(y = 0; y < rect->height; y++) {
+			char *hostptr = (char*)rect->hostptr + z * rect->host_slice_pitch + 
+				y * rect->host_row_pitch;
+			char *devptr = (char*)devbuf + rect->devoff + z * rect->dev_slice_pitch + 
+				y * rect->dev_row_pitch;
+			if(to_device)
+				hcopy(devptr, hostptr, rect->width);
+			else
+				hcopy(hostptr, devptr, rect->width);
+		}
+	return rect->width * rect->height * rect->depth;
+}  // sim_copy_rect
+
+/** performs a simulated copy of several ranges or rectangular blocks in a
+		single direction; the latency is paid once for all of them, and only the
+		bytes actually copied count against the bandwidth
+		@param channel the direction in which to copy
+		@param devbuf the device buffer
+		@param copies the ranges to copy, or 0 if copying blocks
+		@param ncopies the number of ranges to copy
+		@param rects the blocks to copy, or 0 if copying ranges
+		@param nrects the number of blocks to copy
+		@param to_device nonzero if copying to device and 0 if to host
+		@returns 0 if successful and a negative error code if not
+ */
+static int sim_copy
+(sim_channel_t *channel, void *devbuf, const devcopy_t *copies, unsigned ncopies, 
+ const devrect_t *rects, unsigned nrects, int to_device) {
+	// wait for a free copy slot
+	pthread_mutex_lock(&channel->mutex);
+	while(channel->max_copies && channel->ncopies >= channel->max_copies)
+		pthread_cond_wait(&channel->copy_done_cond, &channel->mutex);
+	channel->ncopies++;
+	pthread_mutex_unlock(&channel->mutex);
+
+	// copy and wait for the modelled copy time
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	size_t nbytes = 0;
+	unsigned icopy;
+	for(icopy = 0; icopy < ncopies; icopy++) {
+		const devcopy_t *copy = &copies[icopy];
+		if(to_device)
+			hcopy((char*)devbuf + copy->devoff, copy->hostptr, copy->nbytes);
+		else
+			hcopy(copy->hostptr, (char*)devbuf + copy->devoff, copy->nbytes);
+		nbytes += copy->nbytes;
+	}
+	unsigned irect;
+	for(irect = 0; irect < nrects; irect++)
+		nbytes += sim_copy_rect(devbuf, &rects[irect], to_device);
+	double time = channel->latency;
+	if(channel->bandwidth)
+		time += nbytes / channel->bandwidth;
+	sim_wait_until(&start, time);
+
+	// release the copy slot
+	pthread_mutex_lock(&channel->mutex);
+	channel->ncopies--;
+	pthread_cond_signal(&channel->copy_done_cond);
+	pthread_mutex_unlock(&channel->mutex);
+
+	// do statistics collection
+	if(stat_enabled())
+		return stat_acc_double(GPUVM_STAT_COPY_TIME, time);
+	return 0;
+}  // sim_copy
+
+static int sim_memcpy_d2h
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {tgt, nbytes, devoff};
+	return sim_copy(&sim_devs_g[idev].d2h, src, &copy, 1, 0, 0, 0);
+}
+
+static int sim_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	devcopy_t copy = {src, nbytes, devoff};
+	return sim_copy(&sim_devs_g[idev].h2d, tgt, &copy, 1, 0, 0, 1);
+}
+
+static int sim_memcpy_d2h_n
+(unsigned idev, void *src, const devcopy_t *copies, unsigned ncopies) {
+	return sim_copy(&sim_devs_g[idev].d2h, src, copies, ncopies, 0, 0, 0);
+}
+
+static int sim_memcpy_h2d_n
+(unsigned idev, void *tgt, const devcopy_t *copies, unsigned ncopies) {
+	return sim_copy(&sim_devs_g[idev].h2d, tgt, copies, ncopies, 0, 0, 1);
+}
+
+static int sim_memcpy_d2h_rect
+(unsigned idev, void *src, const devrect_t *rects, unsigned nrects) {
+	return sim_copy(&sim_devs_g[idev].d2h, src, 0, 0, rects, nrects, 0);
+}
+
+static int sim_memcpy_h2d_rect
+(unsigned idev, void *tgt, const devrect_t *rects, unsigned nrects) {
+	return sim_copy(&sim_devs_g[idev].h2d, tgt, 0, 0, rects, nrects, 1);
+}
+
+static int sim_mem_alloc(unsigned idev, size_t nbytes, void **pbuf) {
+	sim_dev_t *dev = &sim_devs_g[idev];
+	pthread_mutex_lock(&dev->mem_mutex);
+	if(dev->mem_size && dev->mem_used + nbytes > dev->mem_size) {
+		pthread_mutex_unlock(&dev->mem_mutex);
+		return GPUVM_EDEVALLOC;
+	}
+	dev->mem_used += nbytes;
+	pthread_mutex_unlock(&dev->mem_mutex);
+	// simulated device memory is ordinary host memory
+	char *raw = (char*)malloc(SIM_MEM_HEADER + nbytes);
+	if(!raw) {
+		pthread_mutex_lock(&dev->mem_mutex);
+		dev->mem_used -= nbytes;
+		pthread_mutex_unlock(&dev->mem_mutex);
+		return GPUVM_EDEVALLOC;
+	}
+	*(size_t*)raw = nbytes;
+	*pbuf = raw + SIM_MEM_HEADER;
+	return 0;
+}
+
+static int sim_mem_free(unsigned idev, void *buf) {
+	sim_dev_t *dev = &sim_devs_g[idev];
+	char *raw = (char*)buf - SIM_MEM_HEADER;
+	pthread_mutex_lock(&dev->mem_mutex);
+	dev->mem_used -= *(size_t*)raw;
+	pthread_mutex_unlock(&dev->mem_mutex);
+	free(raw);
+	return 0;
+}
+
+static int sim_host_unified(unsigned idev) {
+	return sim_devs_g[idev].unified_memory;
+}  // sim_host_unified
+
+static int sim_mem_wrap
+(unsigned idev, void *hostptr, size_t nbytes, void **pbuf) {
+	if(!sim_devs_g[idev].unified_memory) {
+		fprintf(stderr, "sim_mem_wrap: device %d does not share memory with host\n",
+						idev);
+		return GPUVM_EAPI;
+	}
+	// a unified device uses host memory directly
+	*pbuf = hostptr;
+	return 0;
+}  // sim_mem_wrap
+
+static int sim_mem_unwrap(unsigned idev, void *buf) {
+	return 0;
+}  // sim_mem_unwrap
+
+static int sim_mem_map(unsigned idev, void *buf, void *hostptr, size_t nbytes) {
+	return 0;
+}  // sim_mem_map
+
+static int sim_mem_unmap(unsigned idev, void *buf, void *hostptr) {
+	return 0;
+}  // sim_mem_unmap
+
+static int sim_memcpy_peer
+(unsigned tgt_idev, void *tgt, size_t tgtoff, unsigned src_idev, void *src,
+ size_t srcoff, size_t nbytes) {
+	// modelled as a copy into the target device, with the source buffer in
+	// place of host memory
+	devcopy_t copy = {(char*)src + srcoff, nbytes, tgtoff};
+	return sim_copy(&sim_devs_g[tgt_idev].h2d, tgt, &copy, 1, 0, 0, 1);
+}  // sim_memcpy_peer
+
+static int sim_mem_fill
+(unsigned idev, void *buf, size_t devoff, size_t nbytes, int value) {
+	// a fill is done by the device itself, and costs only the latency of a
+	// command
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	memset((char*)buf + devoff, value, nbytes);
+	sim_wait_until(&start, sim_devs_g[idev].h2d.latency);
+	return 0;
+}  // sim_mem_fill
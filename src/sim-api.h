@@ -0,0 +1,15 @@
+#ifndef GPUVM_SIM_API_H_
+#define GPUVM_SIM_API_H_
+
+/** @file sim-api.h 
+		functions used by GPUVM to interact with simulated devices, whose buffers
+		reside in host memory and whose copies are delayed according to a
+		latency/bandwidth model
+ */
+
+/** initializes simulated device API 
+		@returns 0 if successful and a negative error code if not
+ */
+int sim_devapi_init(void);
+
+#endif
@@ -4,7 +4,9 @@
 #include <stdio.h>
 
 #include "gpuvm.h"
+#include "host-array.h"
 #include "stat.h"
+#include "util.h"
 
 extern unsigned ndevs_g;
 
@@ -24,9 +26,24 @@ volatile double host_copy_time_g = 0.0;
 /** total time spent in pagefault handling, without data copying */
 double pagefault_time_g = 0.0;
 
+/** total time copies have waited for copies of higher priority */
+double xfer_wait_time_g = 0.0;
+
 /** total number of page faults */
 unsigned long long n_pagefaults_g = 0;
 
+/** total number of evictions from device memory */
+unsigned long long n_evictions_g = 0;
+
+/** total number of bytes not copied due to write-only usage */
+unsigned long long write_only_bytes_g = 0;
+
+/** total number of bytes written back to host in the background */
+unsigned long long write_back_bytes_g = 0;
+
+/** total number of bytes sent to devices as zero fills */
+unsigned long long zero_fill_bytes_g = 0;
+
 int stat_init(int flags) {
 	if(pthread_mutex_init(&copy_time_mutex_g, 0)) {
 		fprintf(stderr, "init_stat: can\'t initialize mutex");
@@ -38,6 +55,8 @@ int stat_init(int flags) {
 		flags_ctl_g |= CTL_WRITER_SIG_BLOCK;
 	if(!(flags & GPUVM_UNLINK_NO_SYNC_BACK))
 		flags_ctl_g |= CTL_UNLINK_SYNC_BACK;
+	if(flags & GPUVM_WRITE_BACK)
+		flags_ctl_g |= CTL_WRITE_BACK;
 	return 0;
 }  // init_stat
 
@@ -46,6 +65,7 @@ int gpuvm_stat(int parameter, void *value) {
 		fprintf(stderr, "gpuvm_stat: pointer to value is NULL\n");
 		return GPUVM_ENULL;
 	}
+	size_t used, held;
 	switch(parameter) {
 	case GPUVM_STAT_ENABLED:
 		*(int*)value = CTL_STAT_ENABLED;
@@ -65,6 +85,35 @@ int gpuvm_stat(int parameter, void *value) {
 	case GPUVM_STAT_PAGEFAULT_TIME:
 		*(double*)value = pagefault_time_g;
 		return 0;
+	case GPUVM_STAT_XFER_WAIT_TIME:
+		*(double*)value = xfer_wait_time_g;
+		return 0;
+	case GPUVM_STAT_EVICTIONS:
+		*(unsigned long long*)value = n_evictions_g;
+		return 0;
+	case GPUVM_STAT_WRITE_ONLY_BYTES:
+		*(unsigned long long*)value = write_only_bytes_g;
+		return 0;
+	case GPUVM_STAT_WRITE_BACK_BYTES:
+		*(unsigned long long*)value = write_back_bytes_g;
+		return 0;
+	case GPUVM_STAT_ZERO_FILL_BYTES:
+		*(unsigned long long*)value = zero_fill_bytes_g;
+		return 0;
+	case GPUVM_STAT_META_USED_BYTES:
+	case GPUVM_STAT_META_HELD_BYTES:
+		salloc_usage(&used, &held);
+		*(unsigned long long*)value = 
+			parameter == GPUVM_STAT_META_USED_BYTES ? used : held;
+		return 0;
+	case GPUVM_STAT_ARRAYS:
+		*(unsigned long long*)value = host_array_count();
+		return 0;
+	case GPUVM_STAT_META_BYTES_PER_ARRAY:
+		salloc_usage(&used, &held);
+		*(double*)value = host_array_count() ? 
+			(double)used / host_array_count() : 0;
+		return 0;
 	default:
 		fprintf(stderr, "gpuvm_stat: parameter value is invalid\n");
 		return GPUVM_EARG;
@@ -77,6 +126,8 @@ int stat_writer_sig_block(void) {	return flags_ctl_g & CTL_WRITER_SIG_BLOCK; }
 
 int stat_unlink_sync_back(void) {return flags_ctl_g & CTL_UNLINK_SYNC_BACK; }
 
+int stat_write_back(void) { return flags_ctl_g & CTL_WRITE_BACK; }
+
 void stat_acc_unblocked_double(int parameter, double value) {
 	switch(parameter) {
 	case GPUVM_STAT_COPY_TIME:
@@ -88,6 +139,9 @@ void stat_acc_unblocked_double(int parameter, double value) {
 	case GPUVM_STAT_PAGEFAULT_TIME:
 		pagefault_time_g += value;
 		break;
+	case GPUVM_STAT_XFER_WAIT_TIME:
+		xfer_wait_time_g += value;
+		break;
 	default:
 		fprintf(stderr, "stat_acc_double: invalid parameter");
 	}
@@ -107,7 +161,35 @@ int stat_acc_double(int parameter, double value) {
 	return 0;
 }  // stat_acc_double
 
+int stat_acc_ull(int parameter, unsigned long long value) {
+	switch(parameter) {
+	case GPUVM_STAT_WRITE_ONLY_BYTES:
+		__sync_fetch_and_add(&write_only_bytes_g, value);
+		break;
+	case GPUVM_STAT_WRITE_BACK_BYTES:
+		__sync_fetch_and_add(&write_back_bytes_g, value);
+		break;
+	case GPUVM_STAT_ZERO_FILL_BYTES:
+		__sync_fetch_and_add(&zero_fill_bytes_g, value);
+		break;
+	default:
+		fprintf(stderr, "stat_acc_ull: invalid parameter\n");
+		return GPUVM_EARG;
+	}
+	return 0;
+}  // stat_acc_ull
+
 int stat_inc(int parameter) {
-	// currently, only GPUVM_STAT_PAGEFAULTS
-	n_pagefaults_g++;
+	switch(parameter) {
+	case GPUVM_STAT_PAGEFAULTS:
+		n_pagefaults_g++;
+		break;
+	case GPUVM_STAT_EVICTIONS:
+		n_evictions_g++;
+		break;
+	default:
+		fprintf(stderr, "stat_inc: invalid parameter\n");
+		return GPUVM_EARG;
+	}
+	return 0;
 }
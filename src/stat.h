@@ -12,7 +12,10 @@ typedef enum {
 			enabled */
 	CTL_WRITER_SIG_BLOCK = 0x2,
 	/** indicates whether the data must be sync'ed back on unlinking */
-	CTL_UNLINK_SYNC_BACK = 0x4
+	CTL_UNLINK_SYNC_BACK = 0x4,
+	/** indicates whether data written by kernels are written back to host in
+			the background */
+	CTL_WRITE_BACK = 0x8
 } flags_ctl_t;
 
 /** control flags */
@@ -45,10 +48,19 @@ int stat_acc_double(int parameter, double value);
  */
 void stat_acc_unblocked_double(int parameter, double value);
 
+/** atomically accumulates value into an unsigned long long counter
+		@param parameter the parameter into which to accumulate, one of
+		::GPUVM_STAT_WRITE_ONLY_BYTES, ::GPUVM_STAT_WRITE_BACK_BYTES and
+		::GPUVM_STAT_ZERO_FILL_BYTES
+		@param value the value which to add
+		@returns 0 if successful and a negative error code if not
+ */
+int stat_acc_ull(int parameter, unsigned long long value);
+
 /** increments a parameter 
-		@param parameter to increment, currently only GPUVM_STAT_PAGEFAULTS
-		@returns 0 if successful and a negative error code if not (currently, always
-		successful) 
+		@param parameter to increment, ::GPUVM_STAT_PAGEFAULTS or
+		::GPUVM_STAT_EVICTIONS
+		@returns 0 if successful and a negative error code if not
  */
 int stat_inc(int parameter);
 
@@ -67,4 +79,10 @@ int stat_unlink_sync_back(void);
  */
 int stat_writer_sig_block(void);
 
+/** gets whether background write-back is enabled
+		@returns non-zero if data written by kernels are written back to host in
+		the background and 0 if not
+ */
+int stat_write_back(void);
+
 #endif
@@ -0,0 +1,179 @@
+/** @file stream.c implementation of stream_t */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gpuvm.h"
+#include "stream.h"
+#include "util.h"
+
+/** list of all streams */
+stream_t *stream_list_g = 0;
+
+int stream_alloc(stream_t **p, void *hostptr, size_t nbytes, unsigned idev, 
+								 void *devbuf, size_t tile_nbytes, unsigned ntiles, int flags) {
+	*p = 0;
+	stream_t *stream = (stream_t*)smalloc(sizeof(stream_t));
+	if(!stream)
+		return GPUVM_ESALLOC;
+	memset(stream, 0, sizeof(stream_t));
+	stream->range.ptr = hostptr;
+	stream->range.nbytes = nbytes;
+	stream->idev = idev;
+	stream->devbuf = devbuf;
+	stream->tile_nbytes = tile_nbytes;
+	stream->ntiles = ntiles;
+	stream->flags = flags & GPUVM_READ_WRITE;
+	stream->cur_tile = -1;
+	unsigned islot;
+	for(islot = 0; islot < ntiles; islot++) {
+		stream_slot_t *slot = &stream->slots[islot];
+		if(xfer_init(&slot->upload))
+			break;
+		if(xfer_init(&slot->readback)) {
+			xfer_destroy(&slot->upload);
+			break;
+		}
+	}
+	if(islot < ntiles) {
+		// destroy the slots which have been set up
+		while(islot--) {
+			xfer_destroy(&stream->slots[islot].upload);
+			xfer_destroy(&stream->slots[islot].readback);
+		}
+		sfree(stream);
+		return GPUVM_ERROR;
+	}
+	stream->next = stream_list_g;
+	stream_list_g = stream;
+	*p = stream;
+	return 0;
+}  // stream_alloc
+
+int stream_free(stream_t *stream) {
+	int err = 0, xfer_err;
+	unsigned islot;
+	for(islot = 0; islot < stream->ntiles; islot++) {
+		stream_slot_t *slot = &stream->slots[islot];
+		if(xfer_err = xfer_wait(&slot->upload))
+			err = xfer_err;
+		if(xfer_err = xfer_wait(&slot->readback))
+			err = xfer_err;
+		xfer_destroy(&slot->upload);
+		xfer_destroy(&slot->readback);
+	}
+	stream_t **pstream;
+	for(pstream = &stream_list_g; *pstream; pstream = &(*pstream)->next)
+		if(*pstream == stream) {
+			*pstream = stream->next;
+			break;
+		}
+	sfree(stream);
+	return err;
+}  // stream_free
+
+stream_t *stream_find(void *hostptr, size_t nbytes) {
+	memrange_t range = {hostptr, nbytes};
+	stream_t *stream;
+	for(stream = stream_list_g; stream; stream = stream->next) {
+		memrange_cmp_t cmp = nbytes ? memrange_cmp(&range, &stream->range) : 
+			memrange_pos_ptr(&stream->range, hostptr);
+		if(cmp == MR_CMP_EQ || cmp == MR_CMP_INT)
+			return stream;
+	}
+	return 0;
+}  // stream_find
+
+/** gets the total number of tiles in the stream 
+		@param stream the stream
+		@returns the number of tiles
+ */
+static long long stream_ntiles_total(const stream_t *stream) {
+	return (stream->range.nbytes + stream->tile_nbytes - 1) / stream->tile_nbytes;
+}
+
+/** gets the host range of the tile 
+		@param stream the stream
+		@param itile the tile number
+		@param [out] offset offset of the tile in the host array
+		@returns the size of the tile
+ */
+static size_t stream_tile_range(const stream_t *stream, long long itile, 
+																size_t *offset) {
+	*offset = itile * stream->tile_nbytes;
+	size_t nbytes = stream->range.nbytes - *offset;
+	return nbytes < stream->tile_nbytes ? nbytes : stream->tile_nbytes;
+}
+
+/** starts uploading the next tile which has not been uploaded yet; for
+		write-only streams, nothing is copied
+		@param stream the stream
+		@returns 0 if successful and a negative error code if not
+ */
+static int stream_start_upload(stream_t *stream) {
+	long long itile = stream->nuploaded++;
+	if(!(stream->flags & GPUVM_READ_ONLY))
+		return 0;
+	unsigned islot = itile % stream->ntiles;
+	size_t offset, nbytes = stream_tile_range(stream, itile, &offset);
+	// the readback of the tile previously in this slot has been started before,
+	// and the worker performs transfers in order, so the slot will be free by the
+	// time the upload starts
+	return xfer_start(&stream->slots[islot].upload, 1, stream->idev, stream->devbuf,
+										(char*)stream->range.ptr + offset, nbytes, 
+										islot * stream->tile_nbytes);
+}  // stream_start_upload
+
+int stream_next(stream_t *stream, size_t *offset, size_t *nbytes, size_t *devoff) {
+	int err;
+	long long ntiles_total = stream_ntiles_total(stream);
+
+	// read back the tile which the kernel has finished with
+	if(stream->cur_tile >= 0 && (stream->flags & GPUVM_WRITE_ONLY)) {
+		long long itile = stream->cur_tile;
+		unsigned islot = itile % stream->ntiles;
+		size_t tile_offset, tile_nbytes = stream_tile_range(stream, itile, &tile_offset);
+		stream_slot_t *slot = &stream->slots[islot];
+		if((err = xfer_wait(&slot->readback)) || 
+			 (err = xfer_start(&slot->readback, 0, stream->idev, stream->devbuf, 
+												 (char*)stream->range.ptr + tile_offset, tile_nbytes, 
+												 islot * stream->tile_nbytes)))
+			return err;
+	}
+
+	long long itile = ++stream->cur_tile;
+	if(itile == ntiles_total) {
+		// pass finished, wait until everything is back on host
+		unsigned islot;
+		int xfer_err;
+		err = 0;
+		for(islot = 0; islot < stream->ntiles; islot++) {
+			if(xfer_err = xfer_wait(&stream->slots[islot].upload))
+				err = xfer_err;
+			if(xfer_err = xfer_wait(&stream->slots[islot].readback))
+				err = xfer_err;
+		}
+		stream->cur_tile = -1;
+		stream->nuploaded = 0;
+		return err;
+	}
+
+	// make sure the current tile and, if there is place in the window, the next
+	// one are being uploaded
+	while(stream->nuploaded <= itile || 
+				stream->nuploaded < ntiles_total && 
+				stream->nuploaded < itile + stream->ntiles && 
+				stream->nuploaded <= itile + 1) {
+		if(err = stream_start_upload(stream))
+			return err;
+	}
+
+	// wait for the tile to become available on device
+	unsigned islot = itile % stream->ntiles;
+	stream_slot_t *slot = &stream->slots[islot];
+	if((err = xfer_wait(&slot->readback)) || (err = xfer_wait(&slot->upload)))
+		return err;
+	*nbytes = stream_tile_range(stream, itile, offset);
+	*devoff = islot * stream->tile_nbytes;
+	return 1;
+}  // stream_next
@@ -0,0 +1,93 @@
+#ifndef GPUVM_STREAM_H_
+#define GPUVM_STREAM_H_
+
+/** @file stream.h 
+		this file contains definition of stream_t, which pairs a host array,
+		possibly larger than device memory, with a smaller device window buffer
+		holding one or more tiles of the array. Tiles are processed in order, and
+		while the kernel works on one tile, the next one is uploaded and the
+		previous one is read back by a worker thread
+ */
+
+#include "util.h"
+#include "xfer.h"
+
+/** maximum number of tiles in a device window */
+#define MAX_STREAM_TILES 8
+
+/** a single tile slot of the device window */
+typedef struct {
+	/** upload of the tile into the slot */
+	xfer_t upload;
+	/** readback of the tile from the slot */
+	xfer_t readback;
+} stream_slot_t;
+
+typedef struct stream_struct {
+	/** host memory range of the stream */
+	memrange_t range;
+	/** the device of the stream */
+	unsigned idev;
+	/** device window buffer, ntiles * tile_nbytes in size */
+	void *devbuf;
+	/** size of a single tile; the last tile of the array may be smaller */
+	size_t tile_nbytes;
+	/** number of tiles in the device window */
+	unsigned ntiles;
+	/** usage flags, ::GPUVM_READ_ONLY, ::GPUVM_WRITE_ONLY or ::GPUVM_READ_WRITE */
+	int flags;
+	/** the tile currently used by the kernel, or -1 if none */
+	long long cur_tile;
+	/** the number of tiles whose upload has been started during this pass */
+	long long nuploaded;
+	/** tile slots of the device window */
+	stream_slot_t slots[MAX_STREAM_TILES];
+	/** next stream in the list of all streams */
+	struct stream_struct *next;
+} stream_t;
+
+/** allocates a new stream and adds it to the list of streams
+		@param p [out] *p points to the allocated stream if successful and is 0 if
+		not
+		@param hostptr start of the host array
+		@param nbytes size of the host array
+		@param idev the device of the stream
+		@param devbuf the device window buffer
+		@param tile_nbytes the size of a single tile
+		@param ntiles the number of tiles in the window
+		@param flags usage flags
+		@returns 0 if successful and a negative error code if not
+ */
+int stream_alloc(stream_t **p, void *hostptr, size_t nbytes, unsigned idev, 
+								 void *devbuf, size_t tile_nbytes, unsigned ntiles, int flags);
+
+/** waits for all transfers of the stream, removes it from the list of streams
+		and frees it
+		@param stream the stream to free
+		@returns 0 if successful and a negative error code if any of the pending
+		transfers has failed
+ */
+int stream_free(stream_t *stream);
+
+/** finds a stream which intersects the specified range 
+		@param hostptr start of the range
+		@param nbytes size of the range; may be 0 if searching for pointer only
+		@returns the stream found or 0 if none
+ */
+stream_t *stream_find(void *hostptr, size_t nbytes);
+
+/** advances the stream to the next tile. The kernel must have finished using
+		the current tile, if there is one. The current tile is read back if it is
+		written, the next tile is made available on device, and the upload of the tile
+		after it is started
+		@param stream the stream to advance
+		@param [out] offset offset of the tile in the host array
+		@param [out] nbytes size of the tile
+		@param [out] devoff offset of the tile in the device window buffer
+		@returns 1 if the next tile is available, 0 if all tiles have been processed
+		and all of them are back on host, and a negative error code in case of an
+		error. After 0 is returned, the next call starts a new pass
+ */
+int stream_next(stream_t *stream, size_t *offset, size_t *nbytes, size_t *devoff);
+
+#endif
@@ -1,6 +1,5 @@
 /** @file subreg.c implementation of subreg_t */
 
-#include <pthread.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <string.h>
@@ -10,67 +9,45 @@
 #include "host-array.h"
 #include "link.h"
 #include "region.h"
+#include "residency.h"
 #include "subreg.h"
 #include "util.h"
 
-int subreg_alloc(subreg_t **p, void *hostptr, size_t nbytes, int idev) {
-	// allocate memory
-	*p = 0;
-	subreg_t *new_subreg = (subreg_t*)smalloc(sizeof(subreg_t));
-	//fprintf(stderr, "memory for subregion allocated\n");
-	if(!new_subreg)
-		return GPUVM_ESALLOC;
-	memset(new_subreg, 0, sizeof(subreg_t));
-	new_subreg->range.ptr = hostptr;
-	new_subreg->range.nbytes = nbytes;
+int subreg_init(subreg_t *subreg, void *hostptr, size_t nbytes, int idev) {
+	memset(subreg, 0, sizeof(subreg_t));
+	subreg->range.ptr = hostptr;
+	subreg->range.nbytes = nbytes;
 	// initialize members
 	if(idev >= 0) {
-		new_subreg->actual_device = idev;
-		new_subreg->actual_host = 0;
-		new_subreg->actual_mask = 1ul << idev;
+		subreg->actual_mask = 1ull << idev;
 	} else {
-		new_subreg->actual_device = NO_ACTUAL_DEVICE;
-		new_subreg->actual_host = 1;
-		new_subreg->actual_mask = 0;
-	}
-	if(pthread_mutex_init(&new_subreg->mutex, 0)) {
-		fprintf(stderr, "subreg_alloc: can\'t init mutex");
-	 	sfree(new_subreg);
-		return GPUVM_ERROR;
+		subreg->state = SUBREG_ACTUAL_HOST;
+		subreg->actual_mask = 0;
 	}
 
 	// allocate or find region for this subregion
 	int err;
 	region_t *region = region_find_region(hostptr);
-	//fprintf(stderr, "region search finished, region=%x\n", region);
 	if(region) {
 		// add to existing region
-		err = region_add_subreg(region, new_subreg);
-		//fprintf(stderr, "added to existing region\n");
+		err = region_add_subreg(region, subreg);
 	} else {
 		// create new region
-		err = region_alloc(0, new_subreg);
-		//fprintf(stderr, "region allocated\n");
+		err = region_alloc(0, subreg);
 	}
-	if(err) {
-		//pthread_mutex_destroy(&new_subreg->mutex);
-		sfree(new_subreg);
+	if(err)
 		return err;
-	}
 	// protect region if the subregion is initially on device
-	region = new_subreg->region;
+	region = subreg->region;
 	if(idev >= 0) {
 		err = region_protect_after(region, GPUVM_READ_WRITE);
 		if(err) {
-			subreg_free(new_subreg);
+			subreg_free(subreg);
 			return err;
 		}
 	}  // if(on device)
-
-	// return
-	*p = new_subreg;
 	return 0;
-}  // subreg_alloc()
+}  // subreg_init()
 
 void subreg_free(subreg_t *subreg) {
 	// detach subregion from region
@@ -84,37 +61,45 @@ void subreg_free(subreg_t *subreg) {
 		region_free(region);
 	}
 
-	pthread_mutex_destroy(&subreg->mutex);
-	sfree(subreg);
+	// subregions allocated with their host array are freed with it
+	if(subreg->state & SUBREG_SEPARATE)
+		sfree(subreg);
 	//fprintf(stderr, "subreg freed\n");
 }
 
-static int subreg_lock(subreg_t *subreg) {
-	if(pthread_mutex_lock(&subreg->mutex)) {
-		fprintf(stderr, "subreg_lock: can\'t lock mutex");
-		return GPUVM_ERROR;
+int subreg_split(subreg_t *subreg, void *ptr, subreg_t **p) {
+	*p = 0;
+	region_t *region = subreg->region;
+	char *start = (char*)subreg->range.ptr, *end = start + subreg->range.nbytes;
+	if(region->nsubregs != 1 || (ptrdiff_t)ptr % GPUVM_PAGE_SIZE || 
+		 (char*)ptr <= start || (char*)ptr >= end) {
+		fprintf(stderr, "subreg_split: can't split subregion at %p\n", ptr);
+		return GPUVM_EARG;
 	}
-	return 0;
-}
+	subreg_t *new_subreg = (subreg_t*)smalloc(sizeof(subreg_t));
+	if(!new_subreg)
+		return GPUVM_ESALLOC;
+	*new_subreg = *subreg;
+	new_subreg->range.ptr = ptr;
+	new_subreg->range.nbytes = end - (char*)ptr;
+	new_subreg->state |= SUBREG_SEPARATE;
 
-static int subreg_unlock(subreg_t *subreg) {
-	if(pthread_mutex_unlock(&subreg->mutex)) {
-		fprintf(stderr, "subreg_unlock: can\'t unlock mutex");
-		return GPUVM_ERROR;
+	// cut the region, and give the rest to a new region; its pages already have
+	// the protection of the original region
+	size_t region_nbytes = region->range.nbytes;
+	region_shrink(region, (char*)ptr - (char*)region->range.ptr);
+	int err;
+	if(err = region_alloc(0, new_subreg)) {
+		// region_alloc() leaves the subregion to its caller
+		region_shrink(region, region_nbytes);
+		sfree(new_subreg);
+		return err;
 	}
+	new_subreg->region->prot_status = region->prot_status;
+	subreg->range.nbytes = (char*)ptr - start;
+	*p = new_subreg;
 	return 0;
-}
-
-/** a simple wrapper for copying data to device 
-		@param subreg specifies host subregion to copy
-		@param link specifies device buffer to copy
- */
-static int subreg_link_sync_to_device
-(const subreg_t *subreg, const link_t *link) {
-	return memcpy_h2d
-		(devapi_g, link->idev, link->buf, subreg->range.ptr, subreg->range.nbytes, 
-		 subreg->range.ptr - subreg->host_array->range.ptr);
-}
+}  // subreg_split
 
 /** a simple wrapper for copying data to host 
 		@param subreg specifies host subregion to copy
@@ -122,56 +107,95 @@ static int subreg_link_sync_to_device
  */
 static int subreg_link_sync_to_host
 (const subreg_t *subreg, const link_t* link) {
-	return memcpy_d2h
-		(devapi_g, link->idev, subreg->range.ptr, link->buf, subreg->range.nbytes,
-		 subreg->range.ptr - subreg->host_array->range.ptr);
+	return host_array_link_copy(subreg->host_array, link, &subreg->range, 0);
 }
 
-int subreg_sync_to_device(subreg_t *subreg, unsigned idev, int flags) {
+/** copies the subregion to the device directly from another device on which
+		it is actual, if it is not actual on host and the devices can copy directly
+		@param subreg the subregion to copy
+		@param idev the device to which to copy
+		@returns 0 if the subregion has been copied, and a negative error code if
+		not, in which case it must be copied through host
+ */
+static int subreg_peer_sync_to_device(subreg_t *subreg, unsigned idev) {
+	host_array_t *host_array = subreg->host_array;
+	if(!(devapi_g->caps & GPUVM_CAP_PEER) || 
+		 subreg->state & SUBREG_ACTUAL_HOST || !host_array_same_layout(host_array))
+		return GPUVM_EAPI;
+	unsigned src_idev = subreg_actual_device(subreg);
+	if(src_idev == NO_ACTUAL_DEVICE)
+		return GPUVM_EAPI;
+	link_t *tgt = host_array->links[idev], *src = host_array->links[src_idev];
+	// the source link must not be evicted while the data are copied
+	if(!tgt || !tgt->buf || !src || !residency_pin(src))
+		return GPUVM_EAPI;
+	size_t offset = (char*)subreg->range.ptr - (char*)host_array->range.ptr;
+	int err = memcpy_peer(devapi_g, idev, tgt->buf, tgt->devoff + offset, 
+												src_idev, src->buf, src->devoff + offset, 
+												subreg->range.nbytes);
+	residency_unpin(src);
+	if(!err)
+		subreg_mark_synced_to_device(subreg, idev);
+	return err;
+}  // subreg_peer_sync_to_device
+
+int subreg_pre_sync_to_device(subreg_t *subreg, unsigned idev, int flags) {
 	flags &= GPUVM_READ_WRITE;
-	int err;
+	// immutable arrays are only read
+	if(subreg->host_array->advice & ADVICE_IMMUTABLE)
+		flags = GPUVM_READ_ONLY;
 
 	// check usage info
 	// TODO: optionally, detect invalid sharing
-	if(err = subreg_lock(subreg))
-		return err;
-	subreg->device_usage_count++;
-	if(subreg->device_usage != flags && 
-		 !(flags == GPUVM_READ_ONLY && subreg->device_usage == GPUVM_READ_WRITE))
-		subreg->device_usage = flags;
-	if(err = subreg_unlock(subreg))
-		return err;
-
-	if(!((subreg->actual_mask >> idev) & 1ul)) {
-		// need to copy to device
-		// lock region and remove protection if it is in place
-		region_t *region = subreg->region;
-		host_array_t* host_array = subreg->host_array;
+	unsigned state, new_state;
+	do {
+		state = subreg->state;
+		// concurrent kernels reading and writing the subregion make it
+		// read-write; the device data may change, so a background write-back
+		// must not finish
+		new_state = ((state | flags) & ~SUBREG_WBACK_VALID) + 
+			SUBREG_USAGE_COUNT_ONE;
+	} while(!__sync_bool_compare_and_swap(&subreg->state, state, new_state));
 
+	// write-only data needn't be brought to host for copying to device; data
+	// actual only on other devices are copied from one of them directly, if
+	// possible
+	if(flags != GPUVM_WRITE_ONLY && !subreg_is_actual_on_device(subreg, idev) &&
+		 subreg_peer_sync_to_device(subreg, idev)) {
 		// "remove" protection by causing segmentation fault if region is protected
-		err += *(char*)subreg->range.ptr;
-		
-		// need to copy from host to this device
-		link_t *link = host_array->links[idev];
-		//fprintf(stderr, "host -> device, subreg = %p, link = %p\n", subreg, link);
-		if(err = subreg_link_sync_to_device(subreg, link)) {
-			return err;
-		}
-		// TODO: check these things for atomicity
-		subreg->actual_device = idev;
-		subreg->actual_mask |= 1ul << idev;
-
-	}  // if already on device
+		*(volatile char*)subreg->range.ptr;
+	}
 	return 0;
-}  // subreg_sync_to_device
+}  // subreg_pre_sync_to_device
+
+int subreg_is_actual_on_device(const subreg_t *subreg, unsigned idev) {
+	return (subreg->actual_mask >> idev) & 1ull;
+}
+
+unsigned subreg_actual_device(const subreg_t *subreg) {
+	devmask_t mask = subreg->actual_mask;
+	return mask ? (unsigned)__builtin_ctzll(mask) : NO_ACTUAL_DEVICE;
+}  // subreg_actual_device
+
+unsigned subreg_usage_count(const subreg_t *subreg) {
+	return subreg->state >> SUBREG_USAGE_COUNT_SHIFT;
+}  // subreg_usage_count
+
+void subreg_mark_synced_to_device(subreg_t *subreg, unsigned idev) {
+	__sync_fetch_and_or(&subreg->actual_mask, 1ull << idev);
+}  // subreg_mark_synced_to_device
+
+void subreg_drop_device(subreg_t *subreg, unsigned idev) {
+	__sync_fetch_and_and(&subreg->actual_mask, ~(1ull << idev));
+}  // subreg_drop_device
 
 int subreg_sync_to_host(subreg_t *subreg) {
 	int err;
 
 	// check if already on host
-	if(!subreg->actual_host) {
+	if(!(subreg->state & SUBREG_ACTUAL_HOST)) {
 		// have to copy from actual device
-		unsigned idev = subreg->actual_device;
+		unsigned idev = subreg_actual_device(subreg);
 		host_array_t *host_array = subreg->host_array;
 
 		// do actualy copying
@@ -182,23 +206,111 @@ int subreg_sync_to_host(subreg_t *subreg) {
 		}		
 	}  // if(!actual_on_host)	
 	// device ALWAYS uses actuality when subregion is synced to host
-	subreg->actual_host = 1;
-	subreg->actual_device = NO_ACTUAL_DEVICE;
-	subreg->actual_mask = 0ul;
+	__sync_fetch_and_and(&subreg->state, ~SUBREG_PREFETCH_VALID);
+	__sync_fetch_and_or(&subreg->state, SUBREG_ACTUAL_HOST);
+	subreg->actual_mask = 0;
 
 	return 0;
 }  // subreg_sync_to_host
 
-int subreg_after_kernel(subreg_t *subreg, unsigned idev) {
+void subreg_mark_synced_to_host(subreg_t *subreg) {
+	__sync_fetch_and_and(&subreg->state, ~SUBREG_PREFETCH_VALID);
+	__sync_fetch_and_or(&subreg->state, SUBREG_ACTUAL_HOST);
+}  // subreg_mark_synced_to_host
+
+int subreg_sync_to_host_n(subreg_t **subregs, unsigned nsubregs) {
+	devcopy_t copies[MAX_SYNC_BATCH];
+	unsigned isubreg, jsubreg, ncopies = 0;
+	int err = 0, copy_err;
+	if(nsubregs > MAX_SYNC_BATCH) {
+		fprintf(stderr, "subreg_sync_to_host_n: too many subregions\n");
+		return GPUVM_EARG;
+	}
+
+	// sort subregions by address, so that subregions of the same array follow
+	// each other; the number of subregions is small, so insertion sort is fine
+	for(isubreg = 1; isubreg < nsubregs; isubreg++) {
+		subreg_t *subreg = subregs[isubreg];
+		for(jsubreg = isubreg; jsubreg > 0 && 
+					(char*)subregs[jsubreg - 1]->range.ptr > (char*)subreg->range.ptr; 
+				jsubreg--)
+			subregs[jsubreg] = subregs[jsubreg - 1];
+		subregs[jsubreg] = subreg;
+	}
+
+	// merge runs of adjacent subregions into single copies, and issue all copies
+	// from the same link as a single batch
+	link_t *batch_link = 0;
+	unsigned batch_start = 0;
+	for(isubreg = 0; isubreg <= nsubregs; isubreg++) {
+		subreg_t *subreg = isubreg < nsubregs ? subregs[isubreg] : 0;
+		link_t *link = 0;
+		if(subreg && !(subreg->state & SUBREG_ACTUAL_HOST))
+			link = subreg->host_array->links[subreg_actual_device(subreg)];
+		if(batch_link && link != batch_link) {
+			// flush the batch collected so far
+			if(copy_err = memcpy_d2h_n
+				 (devapi_g, batch_link->idev, batch_link->buf, copies, ncopies)) {
+				err = copy_err;
+			} else {
+				for(jsubreg = batch_start; jsubreg < isubreg; jsubreg++)
+					subreg_mark_synced_to_host(subregs[jsubreg]);
+			}
+			batch_link = 0;
+			ncopies = 0;
+		}
+		if(!subreg) 
+			break;
+		if(!link) {
+			// already on host
+			subreg_mark_synced_to_host(subreg);
+			continue;
+		}
+		if(!host_array_same_layout(subreg->host_array)) {
+			// strided and converted arrays are copied in their own way
+			if(copy_err = subreg_link_sync_to_host(subreg, link))
+				err = copy_err;
+			else
+				subreg_mark_synced_to_host(subreg);
+			continue;
+		}
+		size_t devoff = link->devoff + 
+			((char*)subreg->range.ptr - (char*)subreg->host_array->range.ptr);
+		if(batch_link && (char*)copies[ncopies - 1].hostptr + 
+			 copies[ncopies - 1].nbytes == (char*)subreg->range.ptr) {
+			// extend the previous copy
+			copies[ncopies - 1].nbytes += subreg->range.nbytes;
+		} else {
+			if(!batch_link) {
+				batch_link = link;
+				batch_start = isubreg;
+			}
+			copies[ncopies].hostptr = subreg->range.ptr;
+			copies[ncopies].nbytes = subreg->range.nbytes;
+			copies[ncopies].devoff = devoff;
+			ncopies++;
+		}
+	}  // for(isubreg)
+	return err;
+}  // subreg_sync_to_host_n
+
+int subreg_after_kernel(subreg_t *subreg, unsigned idev, int written) {
 
 	int err;
 
+	// a kernel which has read the data and written none of them leaves them
+	// valid everywhere; a write-only kernel must write all of them, though
+	unsigned state = subreg->state, new_state;
+	int usage = state & SUBREG_USAGE;
+	if(!written && usage == GPUVM_READ_WRITE && 
+		 state >> SUBREG_USAGE_COUNT_SHIFT == 1)
+		usage = GPUVM_READ_ONLY;
+
 	// update subregion actuality
-	if(subreg->device_usage == GPUVM_READ_WRITE) {
-		subreg->actual_host = 0;
-		subreg->actual_device = idev;
-		subreg->actual_mask = 1ul << idev;
-	} else if(subreg->device_usage == GPUVM_READ_ONLY) {
+	if(usage & GPUVM_WRITE_ONLY) {
+		__sync_fetch_and_and(&subreg->state, ~SUBREG_ACTUAL_HOST);
+		subreg->actual_mask = 1ull << idev;
+	} else if(usage == GPUVM_READ_ONLY) {
 		// do nothing here
 	} else {
 		// this is an error
@@ -208,14 +320,19 @@ int subreg_after_kernel(subreg_t *subreg, unsigned idev) {
 
 	region_t *region = subreg->region;
 
-	// turn on region memory protection
-	if(err = region_protect_after(region, subreg->device_usage))
+	// turn on region memory protection; immutable arrays are never written on
+	// host, so there is nothing to track
+	if(!(subreg->host_array->advice & ADVICE_IMMUTABLE) && 
+		 (err = region_protect_after(region, usage)))
 		return err;
 
-	// update usage info; locking is unnecessary due to global lock
-	subreg->device_usage_count--;
-	if(!subreg->device_usage_count) 
-		subreg->device_usage = 0;
+	// update usage info; the usage flags are dropped with the last usage
+	do {
+		state = subreg->state;
+		new_state = state - SUBREG_USAGE_COUNT_ONE;
+		if(!(new_state >> SUBREG_USAGE_COUNT_SHIFT))
+			new_state &= ~SUBREG_USAGE;
+	} while(!__sync_bool_compare_and_swap(&subreg->state, state, new_state));
 
 	return 0;
 }  // subreg_after_kernel
@@ -5,7 +5,7 @@
 		this file contains the definition of the subregion structure
  */
 
-#include <pthread.h>
+#include "gpuvm.h"
 #include "util.h"
 
 struct host_array_struct;
@@ -17,7 +17,38 @@ typedef unsigned long long devmask_t;
 /** constant meaning no actual device */
 #define NO_ACTUAL_DEVICE (~0)
 
-/** a subregion is an intersection of a region and a host array */
+/** subregion state flag: the data are actual on host */
+#define SUBREG_ACTUAL_HOST 0x1
+/** subregion state flag: the subregion is being or has been prefetched to
+		device, and has not been written on host since the prefetch started */
+#define SUBREG_PREFETCH_VALID 0x2
+/** subregion state flag: the subregion is being written back to host in the
+		background, and no kernel has used it since the write-back started */
+#define SUBREG_WBACK_VALID 0x4
+/** subregion state flag: the subregion has been allocated on its own by
+		subreg_split(), rather than together with its host array */
+#define SUBREG_SEPARATE 0x8
+/** device usage flags, ::GPUVM_READ_ONLY and ::GPUVM_WRITE_ONLY, are kept in
+		the state word as they are */
+#define SUBREG_USAGE GPUVM_READ_WRITE
+/** the shift of the device usage count in the state word */
+#define SUBREG_USAGE_COUNT_SHIFT 8
+/** a single device usage in the state word */
+#define SUBREG_USAGE_COUNT_ONE (1u << SUBREG_USAGE_COUNT_SHIFT)
+
+/** maximum number of subregions synchronized to host with a single call to
+		subreg_sync_to_host_n() */
+#define MAX_SYNC_BATCH 64
+
+/** a subregion is an intersection of a region and a host array. Its data follow
+		an MSI-like protocol: they are either modified, i.e. actual on a single device
+		only, with the region protected from any host access, or shared, i.e.
+		actual on host and on any number of devices, with the region write-protected
+		if there is any device copy. A host read of modified data brings them back
+		to host and makes them shared; only a host write or a kernel writing the
+		subregion invalidates the other copies. Subregions are normally allocated
+		inline with their host array, and kept small, as there is one for each
+		page-aligned part of each array */
 typedef struct subreg_struct {
 	/** memory range of the subregion */
 	memrange_t range;
@@ -25,61 +56,130 @@ typedef struct subreg_struct {
 	struct host_array_struct *host_array;
 	/** region to which this subregion belongs */
 	struct region_struct *region;
-	/** indicates the device where host_array is actual, or, in case of multiple devices,
-			the first such deivce; if there is none, must be #NO_ACTUAL_DEVICE */
-	unsigned actual_device;
-	/** 1 if actual on host and 0 if not */
-	unsigned actual_host;
+	/** the next subregion of the same region, by address, or 0 if none */
+	struct subreg_struct *region_next;
 	/** the mask indicating on which devices the subregion is actual; bit 0 is for device 0,
 			bit 1 for device 1 etc */
-	devmask_t actual_mask;
-	/** device usage flags, either ::GPUVM_READ_ONLY or ::GPUVM_READ_WRITE */
-	int device_usage;
-	/** device usage count, incremented by a call to gpuvm_kernel_begin(), and
-			decremented by a call to gpuvm_kernel_end() */
-	unsigned device_usage_count;
-	/** the mutex to lock and unlock the region in a multithreaded environment;
-			note that subregion must be locked only for short periods of time to
-			maintain actual information; e.g., it must not be locked for OpenCL copy
-			or similar commands */
-	pthread_mutex_t mutex;
+	volatile devmask_t actual_mask;
+	/** the state of the subregion: a combination of SUBREG_* flags, the device
+			usage flags, either ::GPUVM_READ_ONLY or ::GPUVM_READ_WRITE, and, from
+			#SUBREG_USAGE_COUNT_SHIFT up, the device usage count, incremented by a
+			call to gpuvm_kernel_begin(), and decremented by a call to
+			gpuvm_kernel_end(). It is changed with atomic operations only, so that
+			threads changing different parts of it need no lock */
+	volatile unsigned state;
 } subreg_t;
 
-/** allocates a new subregion. The subregion is initially assumed to be actual on host 
-		@param p *p contains pointer to allocated subregion if successful and 0 if not
+/** initializes a new subregion, and adds it to the region containing it,
+		which is allocated if necessary
+		@param subreg the subregion, allocated by the caller
 		@param hostptr the start address of the subregion
 		@param nbytes the size of the subregion
-		@param flags the device where the subreg is actual, or a negative value if
-		it is actual on host
+		@param idev the device where the subregion is actual, or a negative value
+		if it is actual on host
 		@returns 0 if successful and a negative error code if not
  */
-int subreg_alloc(subreg_t **p, void *hostptr, size_t nbytes, int idev);
+int subreg_init(subreg_t *subreg, void *hostptr, size_t nbytes, int idev);
 
-/** removes the subregion from the region it belongs to and frees the subregion. Note that
-		if the subregion is the last one in the region, then the region is removed as well */
+/** removes the subregion from the region it belongs to, and frees the
+		subregion if it has been allocated by subreg_split(). Note that if the
+		subregion is the last one in the region, then the region is removed as well */
 void subreg_free(subreg_t *subreg);
 
-/** synchronizes subregion to device 
-		@param subreg the subregion to synchronize to device
+/** splits the subregion in two at a page boundary. The subregion must be the
+		only one in its region. The second part becomes a new subregion with a new
+		region, and inherits the actuality, usage and protection of the original one
+		@param subreg the subregion to split; its range is cut at ptr
+		@param ptr the address at which to split, page-aligned and strictly inside
+		the subregion
+		@param p [out] *p points to the new subregion if successful and is 0 if not
+		@returns 0 if successful and a negative error code if not
+ */
+int subreg_split(subreg_t *subreg, void *ptr, subreg_t **p);
+
+/** prepares subregion for synchronization to device. This updates usage info,
+		and makes the data actual on host if they are not, so that they can be copied
+		to device; data actual only on other devices are instead copied to the
+		device directly, if the devices can copy between themselves. Actual copying
+		is done by the caller, possibly for several adjacent subregions at once,
+		after which subreg_mark_synced_to_device() must be called
+		@param subreg the subregion to prepare for synchronization to device
 		@param idev the device to which to synchronize
-		@param flags usage flags, either ::GPUVM_READ_WRITE or ::GPUVM_READ_ONLY
+		@param flags usage flags, one of ::GPUVM_READ_WRITE, ::GPUVM_READ_ONLY or
+		::GPUVM_WRITE_ONLY; with ::GPUVM_WRITE_ONLY, the data are not brought to
+		the device
 		@returns 0 if successful and a negative error code if not
  */
-int subreg_sync_to_device(subreg_t *subreg, unsigned idev, int flags);
+int subreg_pre_sync_to_device(subreg_t *subreg, unsigned idev, int flags);
+
+/** checks whether the subregion is actual on the device 
+		@param subreg the subregion to check
+		@param idev the device to check
+		@returns nonzero if the subregion is actual on device and 0 if not
+ */
+int subreg_is_actual_on_device(const subreg_t *subreg, unsigned idev);
+
+/** gets the first device on which the subregion is actual
+		@param subreg the subregion
+		@returns the device, or #NO_ACTUAL_DEVICE if there is none
+ */
+unsigned subreg_actual_device(const subreg_t *subreg);
+
+/** gets the number of kernels using the subregion
+		@param subreg the subregion
+		@returns the device usage count
+ */
+unsigned subreg_usage_count(const subreg_t *subreg);
+
+/** marks the subregion as actual on the device, after its data have been
+		copied there
+		@param subreg the subregion copied to device
+		@param idev the device to which the subregion has been copied
+ */
+void subreg_mark_synced_to_device(subreg_t *subreg, unsigned idev);
+
+/** marks the subregion as no longer actual on the device, e.g. because its
+		device memory is about to be freed. The subregion must be actual somewhere
+		else, normally on host
+		@param subreg the subregion
+		@param idev the device
+ */
+void subreg_drop_device(subreg_t *subreg, unsigned idev);
 
-/** synchronizes subregion to host
+/** synchronizes subregion to host and makes it actual on host only, as
+		required before a host write
 		@param subreg the subregion to synchronize to host
 		@returns 0 if successful and a negative error code if not
  */
 int subreg_sync_to_host(subreg_t *subreg);
 
+/** marks the subregion as actual on host, after its data have been copied to
+		host; device copies stay valid until the host writes the subregion
+		@param subreg the subregion copied to host
+ */
+void subreg_mark_synced_to_host(subreg_t *subreg);
+
+/** synchronizes several subregions to host. Adjacent subregions of the same host
+		array are copied with a single command, and all ranges copied from the same
+		device buffer are copied as a single batch. The subregions remain actual on
+		the devices, i.e. become shared
+		@param subregs the subregions to synchronize to host; the array is reordered
+		by the call
+		@param nsubregs the number of subregions, no more than #MAX_SYNC_BATCH
+		@returns 0 if successful and a negative error code if not
+ */
+int subreg_sync_to_host_n(subreg_t **subregs, unsigned nsubregs);
+
 /** performs actions necessary after the subregion has been used in device kernel. This
 		includes setting up memory protection and marking the subregion as valid only on the
 		device it was used at 
 		@param subreg the subregion which has been used on device
 		@param idev the device on which the kernel has been executed
+		@param written nonzero if the kernel may have written the subregion, and 0
+		if it has not; a subregion not written is handled as if only read, unless
+		another kernel is still using it
 		@returns 0 if successful and a negative error code if not
 */
-int subreg_after_kernel(subreg_t *subreg, unsigned idev);
+int subreg_after_kernel(subreg_t *subreg, unsigned idev, int written);
 
 #endif
@@ -9,6 +9,7 @@
 #include "gpuvm.h"
 #include "stat.h"
 #include "util.h"
+#include "wback.h"
 
 /** a helper signal mask to (un)block during writer lock */
 sigset_t writer_block_sig_g;
@@ -16,6 +17,9 @@ sigset_t writer_block_sig_g;
 /** global mutex lock */
 pthread_rwlock_t mutex_g;
 
+/** number of threads waiting for or holding the writer lock */
+volatile int nwriters_g = 0;
+
 int sync_init(void) {
 	if(pthread_rwlock_init(&mutex_g, 0)) {
 		fprintf(stderr, "sync_init: can\'t init rwlock\n");
@@ -42,7 +46,10 @@ int lock_writer(void) {
 	//fprintf(stderr, "locking writer\n");
 	if(stat_writer_sig_block())
 		sigprocmask(SIG_BLOCK, &writer_block_sig_g, 0);
+	__sync_fetch_and_add(&nwriters_g, 1);
 	if(pthread_rwlock_wrlock(&mutex_g)) {
+		if(!__sync_sub_and_fetch(&nwriters_g, 1))
+			wback_resume();
 		fprintf(stderr, "lock_writer: writer can\'t lock\n");
 		return GPUVM_ERROR;
 	}
@@ -64,7 +71,14 @@ int unlock_writer(void) {
 		fprintf(stderr, "unlock_writer: reader unlock\n");
 		return GPUVM_ERROR;
 	}
+	// background write-back waits for writers to finish
+	if(!__sync_sub_and_fetch(&nwriters_g, 1))
+		wback_resume();
 	if(stat_writer_sig_block())
 		sigprocmask(SIG_UNBLOCK, &writer_block_sig_g, 0);
 	return 0;
 }
+
+int writer_pending(void) {
+	return nwriters_g;
+}
@@ -33,18 +33,29 @@ int salloc_init(void);
 		allocates specific number of bytes
 		@param nbytes number of bytes to allocate
 		@returns pointer to allocated memory if successful and 0 if not
-		@remarks the returned pointer is guaranteed to be aligned to 8 bytes. The function is
-		not thread-safe.
+		@remarks the returned pointer is guaranteed to be aligned to 8 bytes; memory
+		of more than about a page is mapped from OS directly, and is page-aligned. The
+		function is thread-safe and async-signal-safe.
  */
 void *smalloc(size_t nbytes);
 
 /** 
 		frees memory allocated by salloc()
 		@param ptr pointer to memory to be freed. Must be either a pointer previously
-		allocated by salloc() and not freed after that, or 0. The function is not thread-safe.
+		allocated by salloc() and not freed after that, or 0. The function is thread-safe and
+		async-signal-safe.
  */
 void sfree(void *ptr);
 
+/**
+		gets the memory usage of the separate allocator; the fraction of memory
+		held but not used measures its fragmentation
+		@param pused [out] the number of bytes in allocated objects, rounded up to
+		their size classes
+		@param pheld [out] the number of bytes obtained from OS and not returned
+ */
+void salloc_usage(size_t *pused, size_t *pheld);
+
 /** @} */
 
 /** @{ 
@@ -92,6 +103,12 @@ int unlock_reader(void);
  */
 int unlock_writer(void);
 
+/** checks whether some thread is waiting for or holding the global writer
+		lock; used by background activities to give way to it
+		@returns nonzero if there is such a thread and 0 if not
+ */
+int writer_pending(void);
+
 /** @} */
 
 /** @{ */
@@ -216,6 +233,44 @@ void stop_other_threads(void);
  */
 void cont_other_threads(void);
 
+/** 
+		writes data into host memory of this process regardless of its protection,
+		so that a protected range can be filled before its protection is removed,
+		and no thread ever sees partially written data. Supported only on Linux,
+		through /proc/self/mem
+		@param dst the destination address
+		@param src the data to write
+		@param nbytes the number of bytes to write
+		@returns 0 if successful and a negative error code if not
+ */
+int write_protected(void *dst, const void *src, size_t nbytes);
+
+/**
+		finds the pages of a range which the process has never touched, and which
+		therefore read as zeros. Only pages of private anonymous mappings, such as
+		those returned by malloc(), may be reported untouched, as pages of other
+		mappings which are not in memory may hold data; the caller must check this
+		with range_is_private_anon() first, once for all the windows of a larger
+		range. Supported only on Linux, through /proc/self/pagemap
+		@param untouched [out] one byte per page, set to nonzero if the page has
+		never been touched and to 0 if it may have been
+		@param ptr the start of the range, page-aligned
+		@param npages the number of pages in the range
+		@returns 0 if successful and a negative error code if the information is
+		not available, in which case all pages must be assumed touched
+ */
+int untouched_pages(unsigned char *untouched, void *ptr, size_t npages);
+
+/** 
+		checks whether the range lies entirely in private anonymous mappings, whose
+		untouched pages read as zeros. This parses /proc/self/maps on Linux, and is
+		not supported elsewhere
+		@param ptr the start of the range
+		@param nbytes the size of the range
+		@returns 1 if it does, and 0 if it does not or this can't be determined
+ */
+int range_is_private_anon(void *ptr, size_t nbytes);
+
 /** thread suspension signal number - for non-Darwin only*/
 #ifndef __APPLE__
 #define SIG_SUSP (SIGRTMIN + 4)
@@ -0,0 +1,277 @@
+/** @file wback.c implementation of background write-back */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/mman.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "host-array.h"
+#include "link.h"
+#include "region.h"
+#include "residency.h"
+#include "stat.h"
+#include "subreg.h"
+#include "util.h"
+#include "wback.h"
+#include "wthreads.h"
+
+/** size of a single chunk copied from device by the write-back thread */
+#define WBACK_CHUNK_SIZE (4 * 1024 * 1024)
+
+/** the write-back in progress; there is a single write-back thread */
+static wback_t wback_g;
+
+/** bounce buffer into which chunks are copied from device, mapped separately
+		from all host arrays */
+static char *wback_buf_g = 0;
+
+/** number of copies to device in progress */
+static volatile int nuploads_g = 0;
+
+/** nonzero if the write-back thread waits for uploads and writers to finish */
+static volatile int wback_waiting_g = 0;
+
+/** semaphore posted when the write-back thread may resume */
+static semaph_t wback_resume_sem_g;
+
+/** nonzero if background write-back has failed and has been turned off */
+static volatile int wback_disabled_g = 0;
+
+/** puts the regions of the array which are not used by kernels and hold data
+		actual only on device for background write-back
+		@param host_array the array whose regions to write back
+ */
+static void wback_put_array(host_array_t *host_array) {
+	unsigned isubreg;
+	region_t *prev_region = 0;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+		subreg_t *subreg = host_array_subreg(host_array, isubreg);
+		region_t *region = subreg->region;
+		if(region == prev_region || region->prot_status != PROT_NONE ||
+			 subreg->state & SUBREG_ACTUAL_HOST || subreg_usage_count(subreg))
+			continue;
+		// if the queue is full, the region will be brought back on access
+		wthreads_write_back_region(region);
+		prev_region = region;
+	}
+}  // wback_put_array
+
+void wback_array(host_array_t *host_array) {
+	if(!stat_write_back() || wback_disabled_g)
+		return;
+	wback_put_array(host_array);
+}  // wback_array
+
+int wback_prefetch_host(host_array_t *host_array) {
+	if(wback_disabled_g || !host_array_same_layout(host_array))
+		return 0;
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++)
+		if(host_array_subreg(host_array, isubreg)->region->nsubregs > 
+			 WBACK_MAX_SUBREGS)
+			return 0;
+	wback_put_array(host_array);
+	return 1;
+}  // wback_prefetch_host
+
+/** checks whether the write-back must give way to other activities
+		@returns nonzero if it must and 0 if not
+ */
+static int wback_must_yield(void) {
+	return nuploads_g || writer_pending();
+}  // wback_must_yield
+
+/** waits while the write-back must give way to other activities. The
+		threads which finish them only post a semaphore, as they may hold locks or
+		run in a signal handler */
+static void wback_wait_turn(void) {
+	while(wback_must_yield()) {
+		// announce the wait before checking again, so that an activity finishing
+		// in between posts the semaphore; a stale post only causes another check
+		__sync_fetch_and_or(&wback_waiting_g, 1);
+		if(wback_must_yield())
+			semaph_wait(&wback_resume_sem_g);
+	}
+	__sync_fetch_and_and(&wback_waiting_g, 0);
+}  // wback_wait_turn
+
+void wback_resume(void) {
+	if(__sync_bool_compare_and_swap(&wback_waiting_g, 1, 0))
+		semaph_post(&wback_resume_sem_g);
+}  // wback_resume
+
+/** collects the subregions of the region to write back and pins their links;
+		must be called with the reader lock held
+		@param wback the write-back
+		@param region the region
+		@returns 1 if there is something to write back, 0 if there is not, e.g.
+		because the region is in use by a kernel
+ */
+static int wback_collect(wback_t *wback, region_t *region) {
+	wback->region = region;
+	wback->nsubregs = 0;
+	if(region->prot_status != PROT_NONE || region->nsubregs > WBACK_MAX_SUBREGS)
+		return 0;
+	subreg_t *subreg;
+	for(subreg = region->subregs; subreg; subreg = subreg->region_next) {
+		if(subreg_usage_count(subreg))
+			break;
+		if(subreg->state & SUBREG_ACTUAL_HOST)
+			continue;
+		// strided and converted arrays are not laid out on device as on host, and
+		// are left to pagefault handling
+		if(!host_array_same_layout(subreg->host_array))
+			break;
+		link_t *link = subreg->host_array->links[subreg_actual_device(subreg)];
+		if(!link || !residency_pin(link))
+			break;
+		__sync_fetch_and_or(&subreg->state, SUBREG_WBACK_VALID);
+		wback->subregs[wback->nsubregs] = subreg;
+		wback->links[wback->nsubregs] = link;
+		wback->nsubregs++;
+	}
+	if(subreg || !wback->nsubregs) {
+		// can't write back the whole region
+		unsigned isubreg;
+		for(isubreg = 0; isubreg < wback->nsubregs; isubreg++)
+			residency_unpin(wback->links[isubreg]);
+		wback->nsubregs = 0;
+		return 0;
+	}
+	return 1;
+}  // wback_collect
+
+/** has the unprot thread perform the current step of the write-back, and waits
+		for it
+		@param wback the write-back
+		@returns the result of the step
+ */
+static int wback_do_step(wback_t *wback) {
+	int err;
+	if(err = wthreads_put_wback_step(wback))
+		return err;
+	if(semaph_wait(&wback->done_sem))
+		return GPUVM_ERROR;
+	return wback->err;
+}  // wback_do_step
+
+int wback_region(region_t *region) {
+	wback_t *wback = &wback_g;
+	if(!wback_buf_g) {
+		void *buf = mmap(0, WBACK_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+										 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(buf == MAP_FAILED || semaph_init(&wback->done_sem, 0) ||
+			 semaph_init(&wback_resume_sem_g, 0)) {
+			fprintf(stderr, "wback_region: can\'t allocate bounce buffer\n");
+			wback_disabled_g = 1;
+			return GPUVM_ERROR;
+		}
+		wback_buf_g = (char*)buf;
+	}
+
+	// uploads and writers go first
+	wback_wait_turn();
+	if(lock_reader())
+		return GPUVM_ERROR;
+	if(!wback_collect(wback, region)) {
+		unlock_reader();
+		return 0;
+	}
+
+	// copy the data chunk by chunk, and have each chunk written into protected
+	// host memory; give up if anything else needs the region or the bandwidth
+	int err = 0;
+	size_t nbytes = 0;
+	unsigned isubreg;
+	for(isubreg = 0; isubreg < wback->nsubregs && !err; isubreg++) {
+		subreg_t *subreg = wback->subregs[isubreg];
+		link_t *link = wback->links[isubreg];
+		size_t offset, devoff = link->devoff +
+			((char*)subreg->range.ptr - (char*)subreg->host_array->range.ptr);
+		for(offset = 0; offset < subreg->range.nbytes && !err;
+				offset += WBACK_CHUNK_SIZE) {
+			if(wback_must_yield() || !(subreg->state & SUBREG_WBACK_VALID)) {
+				err = GPUVM_ERROR;
+				break;
+			}
+			size_t chunk_nbytes = subreg->range.nbytes - offset;
+			if(chunk_nbytes > WBACK_CHUNK_SIZE)
+				chunk_nbytes = WBACK_CHUNK_SIZE;
+			if(err = memcpy_d2h(devapi_g, link->idev, wback_buf_g, link->buf,
+													chunk_nbytes, devoff + offset))
+				break;
+			wback->subreg = subreg;
+			wback->hostptr = (char*)subreg->range.ptr + offset;
+			wback->nbytes = chunk_nbytes;
+			wback->data = wback_buf_g;
+			err = wback_do_step(wback);
+		}
+		nbytes += subreg->range.nbytes;
+	}
+	if(!err) {
+		wback->subreg = 0;
+		err = wback_do_step(wback);
+	}
+	if(!err)
+		stat_acc_ull(GPUVM_STAT_WRITE_BACK_BYTES, nbytes);
+
+	for(isubreg = 0; isubreg < wback->nsubregs; isubreg++)
+		residency_unpin(wback->links[isubreg]);
+	wback->nsubregs = 0;
+	if(unlock_reader())
+		return GPUVM_ERROR;
+	// an unfinished write-back is not an error; the data will be brought back
+	// on access
+	return 0;
+}  // wback_region
+
+/** checks whether a subregion being written back has not been touched since
+		the write-back started; must be called from the unprot thread
+		@param subreg the subregion
+		@returns nonzero if it has not and 0 if it has
+ */
+static int wback_subreg_valid(subreg_t *subreg) {
+	// a single read, as the flags and the usage count change together
+	unsigned state = subreg->state;
+	return state & SUBREG_WBACK_VALID && !(state & SUBREG_ACTUAL_HOST) &&
+		state < SUBREG_USAGE_COUNT_ONE;
+}  // wback_subreg_valid
+
+void wback_step(wback_t *wback) {
+	// a region whose protection has changed has been accessed on host, and
+	// synchronized through the usual pagefault handling
+	wback->err = GPUVM_ERROR;
+	if(wback->region->prot_status != PROT_NONE)
+		return;
+	if(wback->subreg) {
+		// write a chunk; no thread can see it, as the region is still protected
+		if(!wback_subreg_valid(wback->subreg))
+			return;
+		if(write_protected(wback->hostptr, wback->data, wback->nbytes)) {
+			fprintf(stderr, "wback_step: turning background write-back off\n");
+			wback_disabled_g = 1;
+			return;
+		}
+	} else {
+		// all the data are on host; make them shared with devices
+		unsigned isubreg;
+		for(isubreg = 0; isubreg < wback->nsubregs; isubreg++)
+			if(!wback_subreg_valid(wback->subregs[isubreg]))
+				return;
+		for(isubreg = 0; isubreg < wback->nsubregs; isubreg++)
+			subreg_mark_synced_to_host(wback->subregs[isubreg]);
+		if(region_protect_shared(wback->region))
+			return;
+	}
+	wback->err = 0;
+}  // wback_step
+
+void wback_upload_begin(void) {
+	__sync_fetch_and_add(&nuploads_g, 1);
+}  // wback_upload_begin
+
+void wback_upload_end(void) {
+	if(!__sync_sub_and_fetch(&nuploads_g, 1))
+		wback_resume();
+}  // wback_upload_end
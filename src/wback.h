@@ -0,0 +1,97 @@
+#ifndef GPUVM_WBACK_H_
+#define GPUVM_WBACK_H_
+
+/** @file wback.h
+		interface to background write-back of data written by kernels. After
+		gpuvm_kernel_end(), the regions holding data actual only on device are put
+		to the write-back worker thread. It copies their data from device in chunks
+		into a bounce buffer, and the unprot thread writes each chunk into the
+		still protected host pages. Once the whole region is on host, its
+		protection is lowered, so the data become shared with devices without ever
+		stopping other threads. Write-back gives way to uploads and to threads
+		waiting for the writer lock, and gives up on a region if a kernel or a host
+		access touches it in the meantime
+ */
+
+#include "host-array.h"
+#include "semaph.h"
+
+struct region_struct;
+struct subreg_struct;
+struct link_struct;
+
+/** maximum number of subregions in a region written back in the background;
+		regions with more subregions are left to pagefault handling */
+#define WBACK_MAX_SUBREGS 64
+
+/** a write-back of a single region in progress */
+typedef struct wback_struct {
+	/** the region being written back */
+	struct region_struct *region;
+	/** subregions of the region actual only on device */
+	struct subreg_struct *subregs[WBACK_MAX_SUBREGS];
+	/** pinned links from which the subregions are copied */
+	struct link_struct *links[WBACK_MAX_SUBREGS];
+	/** number of subregions being written back */
+	unsigned nsubregs;
+	/** the subregion a part of which to write into host memory at the current
+			step, or 0 if the write-back is to be finished */
+	struct subreg_struct *subreg;
+	/** host address at which to write at the current step */
+	void *hostptr;
+	/** the number of bytes to write at the current step */
+	size_t nbytes;
+	/** the data to write at the current step */
+	const void *data;
+	/** the result of the current step */
+	int err;
+	/** semaphore posted when the current step is done */
+	semaph_t done_sem;
+} wback_t;
+
+/** puts the regions of the array which are no longer used by kernels and hold
+		data actual only on device for background write-back. Does nothing if
+		background write-back is not enabled. Must be called with the global lock
+		held
+		@param host_array the array whose regions to write back
+ */
+void wback_array(host_array_t *host_array);
+
+/** puts the regions of the array holding data actual only on device for
+		background write-back, whether or not write-back after kernels is enabled;
+		used to prefetch the array to host without stopping other threads. Must be
+		called with the global lock held
+		@param host_array the array to prefetch to host
+		@returns 1 if the regions have been put, and 0 if background write-back
+		can't handle the array, e.g. because it has been turned off or the array
+		is laid out differently on device
+ */
+int wback_prefetch_host(host_array_t *host_array);
+
+/** writes the region back to host; called by the write-back thread with no
+		locks held
+		@param region the region to write back
+		@returns 0 if successful or if the region needs no write-back, and a
+		negative error code if not
+ */
+int wback_region(struct region_struct *region);
+
+/** performs a single step of the region write-back, i.e. writes a chunk of
+		data into protected host memory or finishes the write-back; called by the
+		unprot thread. The result is stored in wback->err
+		@param wback the write-back in progress
+ */
+void wback_step(wback_t *wback);
+
+/** marks the start of copying data to device, so that background write-back
+		gives way to it */
+void wback_upload_begin(void);
+
+/** marks the end of copying data to device */
+void wback_upload_end(void);
+
+/** wakes up the write-back thread if it waits for uploads and writers to
+		finish; called when the last of them finishes */
+void wback_resume(void);
+
+#endif
@@ -7,26 +7,57 @@
 #include <sys/time.h>
 
 #include "gpuvm.h"
+#include "host-array.h"
 #include "region.h"
 #include "rqueue.h"
 #include "semaph.h"
 #include "stat.h"
 #include "subreg.h"
 #include "util.h"
+#include "wback.h"
 #include "wthreads.h"
+#include "xfer.h"
+#include "xsched.h"
 
 /** maximum queue buffer size, in terms of numbers of elements */
 #define MAX_QUEUE_SIZE 128
 
+/** maximum number of regions synchronized to host together by sync thread */
+#define MAX_SYNC_REGIONS 32
+
 /** buffers for queues */
 rqueue_elem_t unprot_queue_data_g[MAX_QUEUE_SIZE], 
-	sync_queue_data_g[MAX_QUEUE_SIZE];
+	sync_queue_data_g[MAX_QUEUE_SIZE], xfer_queue_data_g[MAX_QUEUE_SIZE],
+	wback_queue_data_g[MAX_QUEUE_SIZE];
+
+/** region queues for unprotecting and syncing regions, for asynchronous
+		transfers and for background write-back, respectively */
+rqueue_t unprot_queue_g, sync_queue_g, xfer_queue_g, wback_queue_g;
+
+/** ids of unprot, sync, xfer and wback thread */
+volatile thread_t unprot_thread_g, sync_thread_g, xfer_thread_g, 
+	wback_thread_g;
+
+/** a number of background requests which have not yet been handled, which
+		threads can wait to drop to zero. The worker handling the requests only
+		posts a semaphore, and never blocks, as it may run with application threads
+		stopped */
+typedef struct {
+	/** number of requests not yet handled */
+	volatile int nrequests;
+	/** number of threads waiting for the number of requests to drop to zero */
+	volatile int nwaiters;
+	/** the semaphore posted for each waiter when the number drops to zero */
+	semaph_t zero_sem;
+} pending_t;
 
-/** region queues for unprotecting and syncing regions, respectively */
-rqueue_t unprot_queue_g, sync_queue_g;
+/** background prefetch requests which have not yet been handled by unprot
+		thread */
+static pending_t prefetches_g;
 
-/** ids of unprot and sync thread */
-volatile thread_t unprot_thread_g, sync_thread_g;
+/** regions put for background write-back which have not yet been handled by
+		wback thread */
+static pending_t wbacks_g;
 
 /** initialization semaphore for GPUVM threads threads*/
 semaph_t init_sem_g;
@@ -34,6 +65,8 @@ semaph_t init_sem_g;
 /** thread routine prototypes */
 static void *unprot_thread(void*);
 static void *sync_thread(void*);
+static void *xfer_thread(void*);
+static void *wback_thread(void*);
 
 /** finishes the thread by sending a quit message */
 static void wthread_quit(rqueue_t *queue) {
@@ -53,6 +86,16 @@ static void sync_quit(void) {
 	wthread_quit(&sync_queue_g);
 }
 
+/** quits xfer thread */
+static void xfer_quit(void) {
+	wthread_quit(&xfer_queue_g);
+}
+
+/** quits wback thread */
+static void wback_quit(void) {
+	wthread_quit(&wback_queue_g);
+}
+
 int wthreads_init() {
 	// create queues for working threads
 	int err;
@@ -60,6 +103,17 @@ int wthreads_init() {
 		return err;
 	if(err = rqueue_init(&sync_queue_g, sync_queue_data_g, MAX_QUEUE_SIZE)) 
 		return err;
+	if(err = rqueue_init(&xfer_queue_g, xfer_queue_data_g, MAX_QUEUE_SIZE)) 
+		return err;
+	if(err = rqueue_init(&wback_queue_g, wback_queue_data_g, MAX_QUEUE_SIZE)) 
+		return err;
+
+	if(semaph_init(&prefetches_g.zero_sem, 0))
+		return -1;
+	if(semaph_init(&wbacks_g.zero_sem, 0)) {
+		semaph_destroy(&prefetches_g.zero_sem);
+		return -1;
+	}
 
 	// start working threads
 	if(semaph_init(&init_sem_g, 0))
@@ -74,21 +128,57 @@ int wthreads_init() {
 		unprot_quit();
 		return -1;
 	}
+	if(pthread_create(&dummy_pthread, 0, xfer_thread, 0)) {
+		fprintf(stderr, "wthread_init: can\'t start xfer thread\n");
+		unprot_quit();
+		sync_quit();
+		return -1;
+	}
+	if(pthread_create(&dummy_pthread, 0, wback_thread, 0)) {
+		fprintf(stderr, "wthread_init: can\'t start wback thread\n");
+		unprot_quit();
+		sync_quit();
+		xfer_quit();
+		return -1;
+	}
 	// set exit handlers
-	if(semaph_wait(&init_sem_g) || semaph_wait(&init_sem_g) ||
-		 atexit(unprot_quit) || atexit(sync_quit)) {
+	if(semaph_wait(&init_sem_g) || semaph_wait(&init_sem_g) || 
+		 semaph_wait(&init_sem_g) || semaph_wait(&init_sem_g) || 
+		 atexit(unprot_quit) || atexit(sync_quit) || atexit(xfer_quit) || 
+		 atexit(wback_quit)) {
 		fprintf(stderr, "wthread_init: can\'t finish initialization\n");
 		unprot_quit();
 		sync_quit();
+		xfer_quit();
+		wback_quit();
 	}
 	// add to immute threads
-	if(immune_nthreads_g + 2 > MAX_NTHREADS) {
+	if(immune_nthreads_g + 4 > MAX_NTHREADS) {
 		fprintf(stderr, "wthread_init: too many immune threads\n");
 		unprot_quit();
 		sync_quit();
+		xfer_quit();
+		wback_quit();
 	}
 	immune_threads_g[immune_nthreads_g++] = unprot_thread_g;
 	immune_threads_g[immune_nthreads_g++] = sync_thread_g;
+	immune_threads_g[immune_nthreads_g++] = xfer_thread_g;
+	immune_threads_g[immune_nthreads_g++] = wback_thread_g;
+
+	// pagefault readbacks are done by the sync thread, and go before anything
+	// else; prefetches and write-backs go after everything else
+	if(xsched_set_thread_class(sync_thread_g, XSCHED_FAULT) ||
+		 xsched_set_thread_class(xfer_thread_g, XSCHED_BACKGROUND) ||
+		 xsched_set_thread_class(wback_thread_g, XSCHED_BACKGROUND)) {
+		fprintf(stderr, "wthread_init: can't set transfer classes of threads\n");
+		immune_nthreads_g -= 4;
+		unprot_quit();
+		sync_quit();
+		xfer_quit();
+		wback_quit();
+		semaph_destroy(&init_sem_g);
+		return GPUVM_ERROR;
+	}
 
 	// destroy initialization semaphore
 	semaph_destroy(&init_sem_g);
@@ -103,6 +193,151 @@ void wthreads_put_region(region_t *region) {
 	rqueue_put(&unprot_queue_g, &elem);
 } 
 
+/** marks a request as handled, and wakes up the threads waiting for all
+		requests to be handled if it has been the last one
+		@param pending the pending requests
+ */
+static void pending_done(pending_t *pending) {
+	if(__sync_sub_and_fetch(&pending->nrequests, 1))
+		return;
+	int iwaiter, nwaiters = pending->nwaiters;
+	for(iwaiter = 0; iwaiter < nwaiters; iwaiter++)
+		semaph_post(&pending->zero_sem);
+}  // pending_done
+
+/** waits until all pending requests have been handled
+		@param pending the pending requests
+ */
+static void pending_wait(pending_t *pending) {
+	// register as a waiter before checking, so that the last request handled
+	// in between posts for this thread as well; a post left over from an
+	// earlier wait only causes another check
+	__sync_fetch_and_add(&pending->nwaiters, 1);
+	while(pending->nrequests)
+		semaph_wait(&pending->zero_sem);
+	__sync_fetch_and_sub(&pending->nwaiters, 1);
+}  // pending_wait
+
+int wthreads_prefetch_region(region_t *region) {
+	rqueue_elem_t elem;
+	elem.region = region;
+	elem.op = REGION_OP_PREFETCH;
+	__sync_fetch_and_add(&prefetches_g.nrequests, 1);
+	int err = rqueue_put(&unprot_queue_g, &elem);
+	if(err)
+		pending_done(&prefetches_g);
+	return err;
+}
+
+void wthreads_wait_prefetches(void) {
+	pending_wait(&prefetches_g);
+}
+
+int wthreads_put_xfer(xfer_t *xfer) {
+	rqueue_elem_t elem;
+	elem.region = 0;
+	elem.op = REGION_OP_XFER;
+	elem.xfer = xfer;
+	return rqueue_put_wait(&xfer_queue_g, &elem);
+}
+
+int wthreads_write_back_region(region_t *region) {
+	rqueue_elem_t elem;
+	elem.region = region;
+	elem.op = REGION_OP_WRITE_BACK;
+	__sync_fetch_and_add(&wbacks_g.nrequests, 1);
+	int err = rqueue_put(&wback_queue_g, &elem);
+	if(err)
+		pending_done(&wbacks_g);
+	return err;
+}
+
+void wthreads_wait_write_backs(void) {
+	pending_wait(&wbacks_g);
+}
+
+int wthreads_put_wback_step(wback_t *wback) {
+	rqueue_elem_t elem;
+	elem.region = wback->region;
+	elem.op = REGION_OP_WRITE_BACK;
+	elem.wback = wback;
+	return rqueue_put(&unprot_queue_g, &elem);
+}
+
+/** unprotects other regions of host arrays which have subregions in the
+		region, and puts them for syncing to host, so that the whole array is
+		synchronized at once, rather than with a separate pagefault for each of its
+		subregions. Must be called from unprot thread, with other threads stopped
+		@param region the region whose subregions' siblings to unprotect
+		@returns the number of regions unprotected and put for syncing
+ */
+static unsigned unprot_region_siblings(region_t *region) {
+	unsigned nregions = 0;
+	subreg_t *subreg;
+	rqueue_elem_t elem;
+	elem.op = REGION_OP_SYNC_TO_HOST;
+	for(subreg = region->subregs; subreg; subreg = subreg->region_next) {
+		host_array_t *host_array = subreg->host_array;
+		unsigned isubreg;
+		for(isubreg = 0; isubreg < host_array->nsubregs; isubreg++) {
+			region_t *sibling = host_array_subreg(host_array, isubreg)->region;
+			if(sibling == region || sibling->prot_status != PROT_NONE)
+				continue;
+			region_unprotect(sibling);
+			elem.region = sibling;
+			if(rqueue_put(&sync_queue_g, &elem)) {
+				// can't sync it now, keep it protected
+				region_protect(sibling);
+				continue;
+			}
+			nregions++;
+		}
+	}
+	return nregions;
+}  // unprot_region_siblings
+
+/** synchronizes subregions of regions to host, coalescing the copies where
+		possible
+		@param regions the regions to synchronize
+		@param nregions the number of regions
+ */
+static void sync_regions_to_host(region_t **regions, unsigned nregions) {
+	subreg_t *subregs[MAX_SYNC_BATCH];
+	unsigned iregion, nsubregs = 0;
+	subreg_t *subreg;
+	for(iregion = 0; iregion < nregions; iregion++) {
+		for(subreg = regions[iregion]->subregs; subreg; 
+				subreg = subreg->region_next) {
+			if(nsubregs == MAX_SYNC_BATCH) {
+				subreg_sync_to_host_n(subregs, nsubregs);
+				nsubregs = 0;
+			}
+			subregs[nsubregs++] = subreg;
+		}
+	}
+	if(nsubregs)
+		subreg_sync_to_host_n(subregs, nsubregs);
+}  // sync_regions_to_host
+
+/** write-protects the regions synchronized to host whose data are still
+		shared with devices, so that a host write invalidates the device copies.
+		Must be called with other threads stopped
+		@param regions the regions synchronized to host
+		@param nregions the number of regions
+ */
+static void protect_shared_regions(region_t **regions, unsigned nregions) {
+	unsigned iregion;
+	subreg_t *subreg;
+	for(iregion = 0; iregion < nregions; iregion++) {
+		for(subreg = regions[iregion]->subregs; subreg; 
+				subreg = subreg->region_next)
+			if(subreg->actual_mask)
+				break;
+		if(subreg)
+			region_protect_after(regions[iregion], GPUVM_READ_ONLY);
+	}
+}  // protect_shared_regions
+
 /** thread routine for the thread which does unprotection of regions */
 static void *unprot_thread(void *dummy_param) {
 	unprot_thread_g = self_thread();
@@ -116,6 +351,7 @@ static void *unprot_thread(void *dummy_param) {
 	unsigned pending_regions = 0;
 	// starting and ending time for this time period
 	rtime_t start_time, end_time;
+	int prefetch;
 	while(1) {
 		rqueue_get(&unprot_queue_g, &elem);
 		region_t *region = elem.region;
@@ -126,8 +362,11 @@ static void *unprot_thread(void *dummy_param) {
 			return 0;
 
 		case REGION_OP_UNPROTECT:
+		case REGION_OP_PREFETCH:
 			//fprintf(stderr, "unprotect request received\n");
-			stat_inc(GPUVM_STAT_PAGEFAULTS);
+			prefetch = elem.op == REGION_OP_PREFETCH;
+			if(!prefetch)
+				stat_inc(GPUVM_STAT_PAGEFAULTS);
 			if(region->prot_status == PROT_NONE) {
 				// fully unprotect region
 				// remove protection, stop threads if necessary
@@ -140,27 +379,46 @@ static void *unprot_thread(void *dummy_param) {
 				}				
 				region_unprotect(region);
 				//fprintf(stderr, "unprotect request satisfied - BLOCK\n");
-				region_post_unprotect(region);
+				if(!prefetch)
+					region_post_unprotect(region);
 			
 				pending_regions++;
 				elem.op = REGION_OP_SYNC_TO_HOST;
+				// hold the queue, so that the sync thread gets the region together
+				// with its siblings
+				rqueue_lock(&sync_queue_g);
 				rqueue_put(&sync_queue_g, &elem);
-			} else if(region->prot_status == PROT_READ) {
-				// mark all data as actual on host only, no need to stop threads				
-				subreg_list_t *list;
+				pending_regions += unprot_region_siblings(region);
+				rqueue_unlock(&sync_queue_g);
+			} else if(region->prot_status == PROT_READ && 
+								!prefetch) {
+				// host write to shared data: invalidate device copies and mark all
+				// data as actual on host only, no need to stop threads
+				subreg_t *subreg;
 				region_unprotect(region);
-				for(list = region->subreg_list; list; list = list->next)
-					subreg_sync_to_host(list->subreg);
+				for(subreg = region->subregs; subreg; subreg = subreg->region_next)
+					subreg_sync_to_host(subreg);
 				//fprintf(stderr, "unprotect request satisfied - RO\n");
-				region_post_unprotect(region);
+				if(!prefetch)
+					region_post_unprotect(region);
 			} else {
 				// do nothing
 				//fprintf(stderr, "unprotect request satisfied - NONE\n");
-				region_post_unprotect(region);
+				if(!prefetch)
+					region_post_unprotect(region);
 			}
+			if(prefetch)
+				pending_done(&prefetches_g);
 			//fprintf(stderr, "unprotect message posted\n");
 			break;
 
+		case REGION_OP_WRITE_BACK:
+			// protection changes are serialized by this thread, so the region
+			// can't be unprotected while the step is in progress
+			wback_step(elem.wback);
+			semaph_post(&elem.wback->done_sem);
+			break;
+
 		case REGION_OP_SYNCED_TO_HOST:
 			pending_regions--;
 			if(!pending_regions) {			 
@@ -191,10 +449,11 @@ static void *sync_thread(void *dummy_param) {
 	}
 
 	rqueue_elem_t elem;
-	subreg_list_t *list;
+	region_t *regions[MAX_SYNC_REGIONS];
+	unsigned iregion, nregions;
+	int quit;
 	while(1) {
 		rqueue_get(&sync_queue_g, &elem);
-		region_t *region = elem.region;
 		switch(elem.op) {
 
 		case REGION_OP_QUIT:
@@ -203,13 +462,35 @@ static void *sync_thread(void *dummy_param) {
 
 		case REGION_OP_SYNC_TO_HOST:
 			//fprintf(stderr, "syncing region to host\n");
-			// sync region to host
-			for(list = region->subreg_list; list; list = list->next)
-				subreg_sync_to_host(list->subreg);
+			// get other regions already waiting to be synced, so that their copies
+			// can be coalesced
+			nregions = 0;
+			quit = 0;
+			regions[nregions++] = elem.region;
+			while(nregions < MAX_SYNC_REGIONS && 
+						rqueue_try_get(&sync_queue_g, &elem) > 0) {
+				if(elem.op == REGION_OP_SYNC_TO_HOST) {
+					regions[nregions++] = elem.region;
+				} else if(elem.op == REGION_OP_QUIT) {
+					quit = 1;
+					break;
+				} else {
+					fprintf(stderr, "sync_thread: invalid region operation %d\n", elem.op);
+				}
+			}
+
+			// sync regions to host
+			sync_regions_to_host(regions, nregions);
+			protect_shared_regions(regions, nregions);
 			
 			elem.op = REGION_OP_SYNCED_TO_HOST;
-			rqueue_put(&unprot_queue_g, &elem);
+			for(iregion = 0; iregion < nregions; iregion++) {
+				elem.region = regions[iregion];
+				rqueue_put(&unprot_queue_g, &elem);
+			}
 			//fprintf(stderr, "synced region to host\n");
+			if(quit)
+				return 0;
 			break;
 
 		default:
@@ -219,3 +500,63 @@ static void *sync_thread(void *dummy_param) {
 
 	}  // while()
 }  // unprot_thread()
+
+/** thread routine for the thread which writes regions back to host in the
+		background */
+static void *wback_thread(void *dummy_param) {
+	wback_thread_g = self_thread();
+	if(semaph_post(&init_sem_g)) {
+		fprintf(stderr, "wback_thread: can\'t post init semaphore\n");
+		return 0;
+	}
+
+	rqueue_elem_t elem;
+	while(1) {
+		rqueue_get(&wback_queue_g, &elem);
+		switch(elem.op) {
+
+		case REGION_OP_QUIT:
+			// quit the thread
+			return 0;
+
+		case REGION_OP_WRITE_BACK:
+			wback_region(elem.region);
+			pending_done(&wbacks_g);
+			break;
+
+		default:
+			fprintf(stderr, "wback_thread: invalid region operation %d\n", elem.op);
+			break;
+		}  // switch(elem->op)
+
+	}  // while()
+}  // wback_thread()
+
+/** thread routine for the thread which performs asynchronous transfers */
+static void *xfer_thread(void *dummy_param) {
+	xfer_thread_g = self_thread();
+	if(semaph_post(&init_sem_g)) {
+		fprintf(stderr, "xfer_thread: can\'t post init semaphore\n");
+		return 0;
+	}
+
+	rqueue_elem_t elem;
+	while(1) {
+		rqueue_get(&xfer_queue_g, &elem);
+		switch(elem.op) {
+
+		case REGION_OP_QUIT:
+			// quit the thread
+			return 0;
+
+		case REGION_OP_XFER:
+			xfer_do(elem.xfer);
+			break;
+
+		default:
+			fprintf(stderr, "xfer_thread: invalid region operation %d\n", elem.op);
+			break;
+		}  // switch(elem->op)
+
+	}  // while()
+}  // xfer_thread()
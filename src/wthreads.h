@@ -3,6 +3,8 @@
 /** @file wthreads.h interface to GPUVM worker threads */
 
 struct region_struct;
+struct xfer_struct;
+struct wback_struct;
 
 /** initializes GPUVM worker threads 
 		@returns 0 if successful and a negative error code if not
@@ -15,4 +17,43 @@ int wthreads_init();
 */
 void wthreads_put_region(struct region_struct *region);
 
+/** puts a region for unprotection and synchronization to host in the
+		background, without waiting for it
+		@param region the region to prefetch to host
+		@returns 0 if successful and a negative error code if not
+ */
+int wthreads_prefetch_region(struct region_struct *region);
+
+/** waits until all regions put for background prefetching have been handled,
+		so that the regions can be safely freed
+ */
+void wthreads_wait_prefetches(void);
+
+/** puts an asynchronous transfer for wthread handling; if too many transfers
+		are already waiting, waits until the worker takes one, so that transfers
+		are always performed in the order they are put
+		@param xfer the transfer to perform
+		@returns 0 if successful and a negative error code if not
+ */
+int wthreads_put_xfer(struct xfer_struct *xfer);
+
+/** puts a region for writing back to host in the background
+		@param region the region to write back
+		@returns 0 if successful and a negative error code if not, e.g. if there
+		are too many regions already waiting
+ */
+int wthreads_write_back_region(struct region_struct *region);
+
+/** waits until all regions put for background write-back have been handled,
+		so that the regions can be safely freed
+ */
+void wthreads_wait_write_backs(void);
+
+/** puts a step of a background write-back for handling by unprot thread,
+		which serializes it with changes of region protection
+		@param wback the write-back whose current step to perform
+		@returns 0 if successful and a negative error code if not
+ */
+int wthreads_put_wback_step(struct wback_struct *wback);
+
 #endif
@@ -0,0 +1,65 @@
+/** @file xfer.c implementation of asynchronous transfers */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "util.h"
+#include "wthreads.h"
+#include "xfer.h"
+#include "zfill.h"
+
+int xfer_init(xfer_t *xfer) {
+	memset(xfer, 0, sizeof(xfer_t));
+	if(semaph_init(&xfer->done_sem, 0))
+		return GPUVM_ERROR;
+	return 0;
+}  // xfer_init
+
+void xfer_destroy(xfer_t *xfer) {
+	semaph_destroy(&xfer->done_sem);
+}
+
+int xfer_start
+(xfer_t *xfer, int to_device, unsigned idev, void *devbuf, void *hostptr, 
+ size_t nbytes, size_t devoff) {
+	if(xfer->pending) {
+		fprintf(stderr, "xfer_start: transfer is already pending\n");
+		return GPUVM_ESTATE;
+	}
+	xfer->to_device = to_device;
+	xfer->idev = idev;
+	xfer->devbuf = devbuf;
+	xfer->hostptr = hostptr;
+	xfer->nbytes = nbytes;
+	xfer->devoff = devoff;
+	xfer->err = 0;
+	// performing the transfer here if the queue is full would overtake the
+	// transfers already queued, so wait for room instead
+	if(wthreads_put_xfer(xfer)) {
+		fprintf(stderr, "xfer_start: can\'t queue transfer\n");
+		return GPUVM_ERROR;
+	}
+	xfer->pending = 1;
+	return 0;
+}  // xfer_start
+
+void xfer_do(xfer_t *xfer) {
+	if(xfer->to_device)
+		xfer->err = zfill_memcpy_h2d(xfer->idev, xfer->devbuf, xfer->hostptr, 
+																 xfer->nbytes, xfer->devoff);
+	else
+		xfer->err = memcpy_d2h(devapi_g, xfer->idev, xfer->hostptr, xfer->devbuf,
+													 xfer->nbytes, xfer->devoff);
+	semaph_post(&xfer->done_sem);
+}  // xfer_do
+
+int xfer_wait(xfer_t *xfer) {
+	if(!xfer->pending)
+		return 0;
+	if(semaph_wait(&xfer->done_sem))
+		return GPUVM_ERROR;
+	xfer->pending = 0;
+	return xfer->err;
+}  // xfer_wait
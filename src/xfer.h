@@ -0,0 +1,78 @@
+#ifndef GPUVM_XFER_H_
+#define GPUVM_XFER_H_
+
+/** @file xfer.h interface to asynchronous transfers between host and device,
+		which are performed by a GPUVM worker thread while the caller continues
+		running
+ */
+
+#include <stddef.h>
+
+#include "semaph.h"
+
+/** an asynchronous transfer of a single range between host and device */
+typedef struct xfer_struct {
+	/** nonzero if copying from host to device, and 0 if from device to host */
+	int to_device;
+	/** the device to or from which to copy */
+	unsigned idev;
+	/** the device buffer */
+	void *devbuf;
+	/** the host pointer */
+	void *hostptr;
+	/** how many bytes to copy */
+	size_t nbytes;
+	/** offset in device buffer */
+	size_t devoff;
+	/** nonzero if the transfer has been started and not yet waited for */
+	int pending;
+	/** the error code of the transfer, valid after it has finished */
+	volatile int err;
+	/** the semaphore posted when the transfer finishes */
+	semaph_t done_sem;
+} xfer_t;
+
+/** initializes a transfer structure; it can then be used for many transfers,
+		one at a time
+		@param xfer the transfer to initialize
+		@returns 0 if successful and a negative error code if not
+ */
+int xfer_init(xfer_t *xfer);
+
+/** destroys a transfer structure; the transfer must not be pending 
+		@param xfer the transfer to destroy
+ */
+void xfer_destroy(xfer_t *xfer);
+
+/** starts an asynchronous transfer. Transfers are performed one after
+		another in the order they are started; if too many are waiting, this waits
+		for one of them to be taken by the worker. The transfer must be waited for
+		with xfer_wait()
+		@param xfer the transfer, which must not be pending
+		@param to_device nonzero if copying to device, and 0 if copying to host
+		@param idev the device to or from which to copy
+		@param devbuf the device buffer
+		@param hostptr the host pointer
+		@param nbytes how many bytes to copy
+		@param devoff offset in device buffer
+		@returns 0 if successful and a negative error code if not
+ */
+int xfer_start
+(xfer_t *xfer, int to_device, unsigned idev, void *devbuf, void *hostptr, 
+ size_t nbytes, size_t devoff);
+
+/** performs the transfer synchronously, and signals its completion; called by
+		the worker thread
+		@param xfer the transfer to perform
+ */
+void xfer_do(xfer_t *xfer);
+
+/** waits for the transfer to finish; does nothing if the transfer is not
+		pending
+		@param xfer the transfer to wait for
+		@returns 0 if the transfer has been successful and a negative error code if
+		not
+ */
+int xfer_wait(xfer_t *xfer);
+
+#endif
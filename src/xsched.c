@@ -0,0 +1,162 @@
+/** @file xsched.c implementation of the transfer scheduler */
+
+#include <stdio.h>
+
+#include "gpuvm.h"
+#include "stat.h"
+#include "util.h"
+#include "xsched.h"
+
+/** maximum number of threads with a class of their own */
+#define XSCHED_MAX_THREADS 8
+
+/** time slice of the link taken by a single background chunk, in seconds */
+#define XSCHED_SLICE 1e-3
+
+/** minimum, maximum and initial size of a background chunk; the initial size
+		is used until the bandwidth of the link is known */
+#define XSCHED_CHUNK_MIN (256 * 1024)
+#define XSCHED_CHUNK_MAX (16 * 1024 * 1024)
+#define XSCHED_CHUNK_INIT (4 * 1024 * 1024)
+
+/** minimum size of a copy used to learn the bandwidth; smaller copies take
+		mostly latency */
+#define XSCHED_SAMPLE_MIN (256 * 1024)
+
+/** a direction of the link */
+typedef struct {
+	/** the number of copies of each class which wait or are in progress */
+	volatile int npending[XSCHED_NCLASSES];
+	/** the bandwidth learned so far, in bytes per second, or 0 if unknown */
+	volatile unsigned long long bandwidth;
+	/** the number of copies waiting for copies of higher classes */
+	volatile int nwaiters;
+	/** the semaphore posted for each waiting copy when no copies of a class
+			other copies may wait for are left */
+	semaph_t resume_sem;
+} xsched_dir_t;
+
+/** a thread with a class of its own */
+typedef struct {
+	/** the thread */
+	thread_t thread;
+	/** the class of its copies */
+	int xclass;
+} xsched_thread_t;
+
+/** directions of the link, to host and to device */
+static xsched_dir_t xsched_dirs_g[2];
+
+/** threads with a class of their own */
+static xsched_thread_t xsched_threads_g[XSCHED_MAX_THREADS];
+
+/** the number of threads with a class of their own */
+static unsigned xsched_nthreads_g = 0;
+
+int xsched_init(void) {
+	unsigned idir;
+	for(idir = 0; idir < 2; idir++)
+		if(semaph_init(&xsched_dirs_g[idir].resume_sem, 0)) {
+			if(idir)
+				semaph_destroy(&xsched_dirs_g[0].resume_sem);
+			fprintf(stderr, "xsched_init: can\'t init semaphore\n");
+			return GPUVM_ERROR;
+		}
+	return 0;
+}  // xsched_init
+
+int xsched_set_thread_class(thread_t thread, int xclass) {
+	if(xsched_nthreads_g == XSCHED_MAX_THREADS) {
+		fprintf(stderr, "xsched_set_thread_class: too many threads\n");
+		return GPUVM_ERROR;
+	}
+	xsched_threads_g[xsched_nthreads_g].thread = thread;
+	xsched_threads_g[xsched_nthreads_g].xclass = xclass;
+	xsched_nthreads_g++;
+	return 0;
+}  // xsched_set_thread_class
+
+int xsched_class(int to_device) {
+	if(xsched_nthreads_g) {
+		thread_t self = self_thread();
+		unsigned ithread;
+		for(ithread = 0; ithread < xsched_nthreads_g; ithread++)
+			if(xsched_threads_g[ithread].thread == self)
+				return xsched_threads_g[ithread].xclass;
+	}
+	return to_device ? XSCHED_UPLOAD : XSCHED_FAULT;
+}  // xsched_class
+
+size_t xsched_chunk(int xclass, int to_device) {
+	if(xclass != XSCHED_BACKGROUND)
+		return (size_t)-1;
+	unsigned long long bandwidth = xsched_dirs_g[!!to_device].bandwidth;
+	if(!bandwidth)
+		return XSCHED_CHUNK_INIT;
+	size_t chunk = (size_t)(bandwidth * XSCHED_SLICE);
+	if(chunk < XSCHED_CHUNK_MIN)
+		chunk = XSCHED_CHUNK_MIN;
+	if(chunk > XSCHED_CHUNK_MAX)
+		chunk = XSCHED_CHUNK_MAX;
+	return chunk / GPUVM_PAGE_SIZE * GPUVM_PAGE_SIZE;
+}  // xsched_chunk
+
+/** checks whether a copy must wait for copies of higher classes
+		@param dir the direction of the copy
+		@param xclass the class of the copy
+		@returns nonzero if it must and 0 if not
+ */
+static int xsched_must_wait(const xsched_dir_t *dir, int xclass) {
+	int iclass;
+	for(iclass = 0; iclass < xclass; iclass++)
+		if(dir->npending[iclass])
+			return 1;
+	return 0;
+}  // xsched_must_wait
+
+void xsched_begin(xsched_ticket_t *ticket, int xclass, int to_device) {
+	xsched_dir_t *dir = &xsched_dirs_g[!!to_device];
+	ticket->xclass = xclass;
+	ticket->to_device = to_device;
+	__sync_fetch_and_add(&dir->npending[xclass], 1);
+	ticket->start = rtime_get();
+	if(!xsched_must_wait(dir, xclass))
+		return;
+	// register as a waiter before checking again, so that a copy ending in
+	// between posts for this one as well; a stale post only causes another check
+	__sync_fetch_and_add(&dir->nwaiters, 1);
+	while(xsched_must_wait(dir, xclass))
+		semaph_wait(&dir->resume_sem);
+	__sync_fetch_and_sub(&dir->nwaiters, 1);
+	rtime_t now = rtime_get();
+	if(stat_enabled())
+		stat_acc_double(GPUVM_STAT_XFER_WAIT_TIME, 
+										rtime_diff(&ticket->start, &now));
+	ticket->start = now;
+}  // xsched_begin
+
+double xsched_end(const xsched_ticket_t *ticket, size_t nbytes) {
+	xsched_dir_t *dir = &xsched_dirs_g[!!ticket->to_device];
+	rtime_t now = rtime_get();
+	double time = rtime_diff(&ticket->start, &now);
+	// the last copy of a class lets the waiting copies check whether they can
+	// start; the lowest class is waited for by none
+	if(!__sync_sub_and_fetch(&dir->npending[ticket->xclass], 1) && 
+		 ticket->xclass < XSCHED_NCLASSES - 1) {
+		int iwaiter, nwaiters = dir->nwaiters;
+		for(iwaiter = 0; iwaiter < nwaiters; iwaiter++)
+			semaph_post(&dir->resume_sem);
+	}
+	if(nbytes >= XSCHED_SAMPLE_MIN && time > 0) {
+		// moving average over about 8 copies
+		unsigned long long sample = (unsigned long long)(nbytes / time), 
+			old_bandwidth, new_bandwidth;
+		do {
+			old_bandwidth = dir->bandwidth;
+			new_bandwidth = old_bandwidth ? 
+				old_bandwidth - old_bandwidth / 8 + sample / 8 : sample;
+		} while(!__sync_bool_compare_and_swap
+						(&dir->bandwidth, old_bandwidth, new_bandwidth));
+	}
+	return time;
+}  // xsched_end
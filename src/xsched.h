@@ -0,0 +1,87 @@
+#ifndef GPUVM_XSCHED_H_
+#define GPUVM_XSCHED_H_
+
+/** @file xsched.h
+		interface to the transfer scheduler, through which all copies between
+		host and devices go. Devices are assumed to share a single link to host,
+		e.g. a PCIe switch, with independent directions. Each copy belongs to a
+		class, and copies of a class wait while copies of higher classes in the
+		same direction are waiting or in progress; background copies are cut
+		into chunks, each taking a short slice of the link at its bandwidth
+		measured so far, so that a fault readback waits for at most one chunk
+ */
+
+#include <stddef.h>
+
+#include "semaph.h"
+#include "util.h"
+
+/** classes of copies, by decreasing priority */
+enum {
+	/** data brought back to host for a pagefault, or for another host access
+			which can't proceed until they arrive */
+	XSCHED_FAULT = 0,
+	/** data copied to device for a kernel about to start */
+	XSCHED_UPLOAD = 1,
+	/** prefetch and write-back, which nothing waits for */
+	XSCHED_BACKGROUND = 2,
+	/** the number of classes */
+	XSCHED_NCLASSES = 3
+};
+
+/** a copy admitted by the scheduler */
+typedef struct {
+	/** the class of the copy */
+	int xclass;
+	/** nonzero if the copy is to device and 0 if to host */
+	int to_device;
+	/** when the copy has started */
+	rtime_t start;
+} xsched_ticket_t;
+
+/** initializes the scheduler; must be called before any copies are done
+		@returns 0 if successful and a negative error code if not
+ */
+int xsched_init(void);
+
+/** sets the class of all copies done by a thread; by default, copies to
+		device are ::XSCHED_UPLOAD and copies to host are ::XSCHED_FAULT. Must be
+		called during initialization, before any copies are done
+		@param thread the thread
+		@param xclass the class of its copies
+		@returns 0 if successful and a negative error code if not
+ */
+int xsched_set_thread_class(thread_t thread, int xclass);
+
+/** gets the class of a copy done by the calling thread
+		@param to_device nonzero if the copy is to device and 0 if to host
+		@returns the class of the copy
+ */
+int xsched_class(int to_device);
+
+/** gets the maximum size of a single copy of a class; longer copies must be
+		split, and each part admitted separately
+		@param xclass the class of the copy
+		@param to_device nonzero if the copy is to device and 0 if to host
+		@returns the maximum size, in bytes
+ */
+size_t xsched_chunk(int xclass, int to_device);
+
+/** waits until a copy can start; must be called with signals unblocked, so
+		that the waiting thread can be stopped, and followed by xsched_end()
+		@param ticket [out] the admitted copy
+		@param xclass the class of the copy
+		@param to_device nonzero if the copy is to device and 0 if to host
+ */
+void xsched_begin(xsched_ticket_t *ticket, int xclass, int to_device);
+
+/** marks the copy as done; safe to call with signals blocked
+		@param ticket the copy, as admitted by xsched_begin()
+		@param nbytes the number of bytes copied by a single contiguous copy, from
+		which the bandwidth of the link is learned, or 0 if the copy must not be
+		used for that, e.g. because it is a batch of small copies
+		@returns the time the copy has taken, in seconds
+ */
+double xsched_end(const xsched_ticket_t *ticket, size_t nbytes);
+
+#endif
@@ -0,0 +1,102 @@
+/** @file zcopy.c implementation of zcopy_t */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "util.h"
+#include "zcopy.h"
+
+/** list of all zero-copy arrays */
+zcopy_t *zcopy_list_g = 0;
+
+int zcopy_alloc(zcopy_t **p, void *hostptr, size_t nbytes, unsigned idev) {
+	*p = 0;
+	zcopy_t *zcopy = (zcopy_t*)smalloc(sizeof(zcopy_t));
+	if(!zcopy)
+		return GPUVM_ESALLOC;
+	memset(zcopy, 0, sizeof(zcopy_t));
+	zcopy->range.ptr = hostptr;
+	zcopy->range.nbytes = nbytes;
+	zcopy->idev = idev;
+	if(pthread_mutex_init(&zcopy->mutex, 0)) {
+		fprintf(stderr, "zcopy_alloc: can\'t init mutex\n");
+		sfree(zcopy);
+		return GPUVM_ERROR;
+	}
+	int err;
+	if(err = mem_wrap(devapi_g, idev, hostptr, nbytes, &zcopy->buf)) {
+		pthread_mutex_destroy(&zcopy->mutex);
+		sfree(zcopy);
+		return err;
+	}
+	// the host keeps access to the array until a kernel uses it
+	if(err = mem_map(devapi_g, idev, zcopy->buf, hostptr, nbytes)) {
+		mem_unwrap(devapi_g, idev, zcopy->buf);
+		pthread_mutex_destroy(&zcopy->mutex);
+		sfree(zcopy);
+		return err;
+	}
+	zcopy->next = zcopy_list_g;
+	zcopy_list_g = zcopy;
+	*p = zcopy;
+	return 0;
+}  // zcopy_alloc
+
+int zcopy_free(zcopy_t *zcopy) {
+	int err = 0, api_err;
+	// a buffer must not be mapped when released
+	if(!zcopy->nkernels)
+		err = mem_unmap(devapi_g, zcopy->idev, zcopy->buf, zcopy->range.ptr);
+	if(api_err = mem_unwrap(devapi_g, zcopy->idev, zcopy->buf))
+		err = api_err;
+	zcopy_t **pzcopy;
+	for(pzcopy = &zcopy_list_g; *pzcopy; pzcopy = &(*pzcopy)->next)
+		if(*pzcopy == zcopy) {
+			*pzcopy = zcopy->next;
+			break;
+		}
+	pthread_mutex_destroy(&zcopy->mutex);
+	sfree(zcopy);
+	return err;
+}  // zcopy_free
+
+zcopy_t *zcopy_find(void *hostptr, size_t nbytes) {
+	memrange_t range = {hostptr, nbytes};
+	zcopy_t *zcopy;
+	for(zcopy = zcopy_list_g; zcopy; zcopy = zcopy->next) {
+		memrange_cmp_t cmp = nbytes ? memrange_cmp(&range, &zcopy->range) :
+			memrange_pos_ptr(&zcopy->range, hostptr);
+		if(cmp == MR_CMP_EQ || cmp == MR_CMP_INT)
+			return zcopy;
+	}
+	return 0;
+}  // zcopy_find
+
+int zcopy_kernel_begin(zcopy_t *zcopy) {
+	int err = 0;
+	pthread_mutex_lock(&zcopy->mutex);
+	if(!zcopy->nkernels)
+		err = mem_unmap(devapi_g, zcopy->idev, zcopy->buf, zcopy->range.ptr);
+	if(!err)
+		zcopy->nkernels++;
+	pthread_mutex_unlock(&zcopy->mutex);
+	return err;
+}  // zcopy_kernel_begin
+
+int zcopy_kernel_end(zcopy_t *zcopy) {
+	int err = 0;
+	pthread_mutex_lock(&zcopy->mutex);
+	if(!zcopy->nkernels) {
+		pthread_mutex_unlock(&zcopy->mutex);
+		return GPUVM_ERROR;
+	}
+	if(zcopy->nkernels == 1)
+		err = mem_map(devapi_g, zcopy->idev, zcopy->buf, zcopy->range.ptr,
+									zcopy->range.nbytes);
+	if(!err)
+		zcopy->nkernels--;
+	pthread_mutex_unlock(&zcopy->mutex);
+	return err;
+}  // zcopy_kernel_end
@@ -0,0 +1,73 @@
+#ifndef GPUVM_ZCOPY_H_
+#define GPUVM_ZCOPY_H_
+
+/** @file zcopy.h
+		this file contains definition of zcopy_t, which links a host array with a
+		device that shares memory with host, e.g. a CPU or an integrated GPU. The
+		device buffer uses the host memory of the array as its storage, so no data
+		are ever copied, and the array is not protected. Instead, the buffer is
+		unmapped from host while kernels use it, and mapped back afterwards
+ */
+
+#include <pthread.h>
+
+#include "util.h"
+
+typedef struct zcopy_struct {
+	/** host memory range of the array */
+	memrange_t range;
+	/** the device of the array */
+	unsigned idev;
+	/** device buffer created over the host memory */
+	void *buf;
+	/** number of kernels currently using the buffer; the buffer is mapped for
+			host when there are none */
+	unsigned nkernels;
+	/** mutex protecting the number of kernels and mapping state */
+	pthread_mutex_t mutex;
+	/** next zero-copy array in the list of all such arrays */
+	struct zcopy_struct *next;
+} zcopy_t;
+
+/** creates a device buffer over the host array, maps it for host and adds the
+		array to the list of zero-copy arrays. Must be called with the writer lock
+		held
+		@param p [out] *p points to the allocated zero-copy array if successful and
+		is 0 if not
+		@param hostptr start of the host array
+		@param nbytes size of the host array
+		@param idev the device of the array
+		@returns 0 if successful and a negative error code if not
+ */
+int zcopy_alloc(zcopy_t **p, void *hostptr, size_t nbytes, unsigned idev);
+
+/** removes the array from the list of zero-copy arrays, releases its device
+		buffer and frees it. No kernels may be using the array. Must be called with
+		the writer lock held
+		@param zcopy the zero-copy array to free
+		@returns 0 if successful and a negative error code if not
+ */
+int zcopy_free(zcopy_t *zcopy);
+
+/** finds a zero-copy array which intersects the specified range
+		@param hostptr start of the range
+		@param nbytes size of the range; may be 0 if searching for pointer only
+		@returns the zero-copy array found or 0 if none
+ */
+zcopy_t *zcopy_find(void *hostptr, size_t nbytes);
+
+/** makes the array available to a kernel, unmapping it from host if this is
+		the first kernel using it
+		@param zcopy the zero-copy array
+		@returns 0 if successful and a negative error code if not
+ */
+int zcopy_kernel_begin(zcopy_t *zcopy);
+
+/** marks the end of a kernel using the array, mapping it back for host if this
+		is the last kernel using it
+		@param zcopy the zero-copy array
+		@returns 0 if successful and a negative error code if not
+ */
+int zcopy_kernel_end(zcopy_t *zcopy);
+
+#endif
@@ -0,0 +1,161 @@
+/** @file zfill.c implementation of zero detection in uploads */
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "devapi.h"
+#include "gpuvm.h"
+#include "stat.h"
+#include "util.h"
+#include "zfill.h"
+
+/** granularity of zero detection, in bytes; a multiple of the page size */
+#define ZFILL_BLOCK (64 * 1024)
+
+/** minimum size of a run of zeros sent as a fill; shorter runs are copied
+		together with the data around them, as each command has its own
+		latency */
+#define ZFILL_MIN (256 * 1024)
+
+/** number of pages whose state is queried at once */
+#define ZFILL_WINDOW_PAGES 512
+
+/** checks whether memory is all zeros
+		@param ptr the memory to check
+		@param nbytes its size
+		@returns nonzero if all bytes are 0, and 0 if not
+ */
+static int zfill_is_zero(const void *ptr, size_t nbytes) {
+	const char *p = (const char*)ptr, *end = p + nbytes;
+	// head, up to 16-byte alignment
+	for(; p < end && (uintptr_t)p % 16; p++)
+		if(*p)
+			return 0;
+#ifdef __SSE2__
+	// 64 bytes at a time, checking the accumulated bits once per 256 bytes
+	__m128i zero = _mm_setzero_si128();
+	while(end - p >= 256) {
+		__m128i acc = zero;
+		const char *stop = p + 256;
+		for(; p < stop; p += 64) {
+			__m128i x = _mm_or_si128
+				(_mm_or_si128(_mm_load_si128((const __m128i*)p), 
+											_mm_load_si128((const __m128i*)(p + 16))),
+				 _mm_or_si128(_mm_load_si128((const __m128i*)(p + 32)), 
+											_mm_load_si128((const __m128i*)(p + 48))));
+			acc = _mm_or_si128(acc, x);
+		}
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(acc, zero)) != 0xffff)
+			return 0;
+	}
+#else
+	while(end - p >= 64) {
+		const uint64_t *w = (const uint64_t*)p;
+		if(w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7])
+			return 0;
+		p += 64;
+	}
+#endif
+	for(; p < end; p++)
+		if(*p)
+			return 0;
+	return 1;
+}  // zfill_is_zero
+
+/** checks whether a block is all zeros
+		@param ptr the start of the block
+		@param nbytes the size of the block
+		@param untouched the untouched flags of the pages of the block, starting
+		with the one containing ptr, or 0 if unknown
+		@returns nonzero if all bytes are 0, and 0 if not
+ */
+static int zfill_block_is_zero
+(const char *ptr, size_t nbytes, const unsigned char *untouched) {
+	const char *end = ptr + nbytes;
+	while(ptr < end) {
+		const char *page_end = 
+			(const char*)(((uintptr_t)ptr / GPUVM_PAGE_SIZE + 1) * GPUVM_PAGE_SIZE);
+		if(page_end > end)
+			page_end = end;
+		if(!(untouched && *untouched++) && !zfill_is_zero(ptr, page_end - ptr))
+			return 0;
+		ptr = page_end;
+	}
+	return 1;
+}  // zfill_block_is_zero
+
+int zfill_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff) {
+	if(!(devapi_g->caps & GPUVM_CAP_FILL) || nbytes < ZFILL_MIN)
+		return memcpy_h2d(devapi_g, idev, tgt, src, nbytes, devoff);
+	char *start = (char*)src, *end = start + nbytes;
+	// the pending copy starts at copy_start, and the current run of zero
+	// blocks, if any, at zero_start
+	char *copy_start = start, *zero_start = 0, *block = start;
+	unsigned char untouched[ZFILL_WINDOW_PAGES];
+	char *window = 0, *window_end = 0;
+	// the mappings are checked once for the whole range, as parsing them is
+	// far slower than querying the pages of a window
+	int anon = -1, have_untouched = 0, err;
+	size_t filled = 0;
+	while(1) {
+		char *block_end = (char*)
+			(((uintptr_t)block / ZFILL_BLOCK + 1) * ZFILL_BLOCK);
+		if(block_end > end)
+			block_end = end;
+		int is_zero = 0;
+		if(block < end) {
+			// query the state of pages a window at a time
+			if(block >= window_end) {
+				window = (char*)((uintptr_t)block / GPUVM_PAGE_SIZE * GPUVM_PAGE_SIZE);
+				// whole blocks only, so that no block crosses the window end
+				window_end = (char*)
+					(((uintptr_t)window + ZFILL_WINDOW_PAGES * GPUVM_PAGE_SIZE) / 
+					 ZFILL_BLOCK * ZFILL_BLOCK);
+				size_t npages = ((uintptr_t)end - (uintptr_t)window + 
+												 GPUVM_PAGE_SIZE - 1) / GPUVM_PAGE_SIZE;
+				if(npages > ZFILL_WINDOW_PAGES)
+					npages = ZFILL_WINDOW_PAGES;
+				if(anon < 0)
+					anon = range_is_private_anon(window, end - window);
+				have_untouched = anon && !untouched_pages(untouched, window, npages);
+			}
+			is_zero = zfill_block_is_zero
+				(block, block_end - block, have_untouched ? 
+				 untouched + (block - window) / GPUVM_PAGE_SIZE : 0);
+		}
+		if(is_zero) {
+			if(!zero_start)
+				zero_start = block;
+		} else {
+			// the run of zeros, if any, has ended; fill it if it is long enough
+			if(zero_start && block - zero_start >= ZFILL_MIN) {
+				if(zero_start > copy_start && 
+					 (err = memcpy_h2d(devapi_g, idev, tgt, copy_start, 
+														 zero_start - copy_start, 
+														 devoff + (copy_start - start))))
+					return err;
+				if(err = mem_fill(devapi_g, idev, tgt, devoff + (zero_start - start), 
+													block - zero_start, 0))
+					return err;
+				filled += block - zero_start;
+				copy_start = block;
+			}
+			zero_start = 0;
+			if(block >= end)
+				break;
+		}
+		block = block_end;
+	}
+	if(end > copy_start && 
+		 (err = memcpy_h2d(devapi_g, idev, tgt, copy_start, end - copy_start, 
+											 devoff + (copy_start - start))))
+		return err;
+	if(filled && stat_enabled())
+		stat_acc_ull(GPUVM_STAT_ZERO_FILL_BYTES, filled);
+	return 0;
+}  // zfill_memcpy_h2d
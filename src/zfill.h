@@ -0,0 +1,22 @@
+#ifndef GPUVM_ZFILL_H_
+#define GPUVM_ZFILL_H_
+
+/** @file zfill.h
+		interface to zero detection in uploads. Freshly allocated or zeroed
+		arrays are mostly zeros, and large all-zero blocks of them are sent to
+		devices which support ::GPUVM_CAP_FILL as fills, which transfer nothing,
+		rather than as copies. Pages never touched by the process are known to be
+		zero without reading them; other pages are scanned
+ */
+
+#include <stddef.h>
+
+/** copies data from host to device, sending large all-zero blocks as fills;
+		a drop-in replacement for memcpy_h2d(). Arguments are the same as for
+		devapi->memcpy_h2d
+		@returns 0 if successful and a negative error code if not
+ */
+int zfill_memcpy_h2d
+(unsigned idev, void *tgt, void *src, size_t nbytes, size_t devoff);
+
+#endif